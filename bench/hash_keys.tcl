@@ -0,0 +1,74 @@
+#
+# Hash quality and throughput of the lhash engine with the DJB and MIX64
+# hash functions on a few key sets. For each run the number of distinct
+# hash values and of bucket collisions (cells beyond the first of their
+# bucket) are taken from analyze, next to the store and fetch times.
+#
+# Usage: tclsh hash_keys.tcl ?records?
+#
+
+package require unqlite
+
+set nRecord [expr {$argc > 0 ? [lindex $argv 0] : 50000}]
+
+# Composite keys sharing a long prefix
+proc key_composite {i} {
+    return [format "tenant:0042:region:eu-west:user:%08d:session" $i]
+}
+
+# URL like keys
+proc key_url {i} {
+    return "https://example.com/catalog/items/category/[expr {$i % 37}]/item/$i?ref=bench"
+}
+
+# Long keys that only differ after the first 2KB
+set prefix [string repeat p 2100]
+proc key_long {i} {
+    return "$::prefix$i"
+}
+
+proc run {hash keyset nRecord} {
+    set dbfile [file join [pwd] hash_keys.db]
+    file delete -force $dbfile
+    unqlite db $dbfile -hash $hash
+    set keys {}
+    for {set i 0} {$i < $nRecord} {incr i} {
+        lappend keys [key_$keyset $i]
+    }
+    set t0 [clock microseconds]
+    foreach key $keys {
+        db kv_store $key v
+    }
+    db commit
+    set tStore [expr {[clock microseconds] - $t0}]
+    set t0 [clock microseconds]
+    foreach key $keys {
+        db kv_fetch $key
+    }
+    set tFetch [expr {[clock microseconds] - $t0}]
+    set info [db analyze]
+    db close
+    set size [file size $dbfile]
+    file delete -force $dbfile
+    set nCell [dict get $info cells]
+    set nEmpty 0
+    if {[dict exists $info cells_per_bucket 0]} {
+        set nEmpty [dict get $info cells_per_bucket 0]
+    }
+    set nDistinct [expr {$nCell - [dict get $info hash_collisions]}]
+    set nBucketCol [expr {$nCell - ([dict get $info sampled_buckets] - $nEmpty)}]
+    puts [format "%-10s %-6s hashes %8d  bucket collisions %8d  store %8.2f us/op  fetch %8.2f us/op  file %10d bytes" \
+        $keyset $hash $nDistinct $nBucketCol [expr {double($tStore) / $nRecord}] \
+        [expr {double($tFetch) / $nRecord}] $size]
+}
+
+foreach keyset {composite url long} {
+    set n $nRecord
+    if {$keyset eq "long"} {
+        # Every DJB hash is the same, keep the run short
+        set n [expr {min($nRecord, 2000)}]
+    }
+    foreach hash {djb mix64} {
+        run $hash $keyset $n
+    }
+}
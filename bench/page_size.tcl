@@ -0,0 +1,77 @@
+#
+# Store and fetch throughput, file size and overflow pages of the lhash
+# engine for several value size distributions at each page size. Values
+# larger than about half a page go to overflow chains, so the page size
+# that fits the values shows up as fewer overflow pages and faster
+# fetches.
+#
+# Usage: tclsh page_size.tcl ?records? ?pagesizes?
+#
+
+package require unqlite
+
+set nRecord [expr {$argc > 0 ? [lindex $argv 0] : 20000}]
+set lPageSize [expr {$argc > 1 ? [lindex $argv 1] : {4096 8192 16384 32768 65536}}]
+
+# Value size distributions: the size of the value of record i
+proc size_small {i} {
+    return [expr {64 + $i % 192}]
+}
+
+proc size_kb {i} {
+    return [expr {1024 + ($i * 7919) % 3072}]
+}
+
+# 10 to 50 KB JSON documents
+proc size_json {i} {
+    return [expr {10240 + ($i * 7919) % 40960}]
+}
+
+# Mostly small values with a few large ones
+proc size_mixed {i} {
+    if {$i % 20 == 0} {
+        return [expr {65536 + ($i * 7919) % 196608}]
+    }
+    return [expr {128 + ($i * 7919) % 1920}]
+}
+
+proc run {dist pagesize nRecord} {
+    set dbfile [file join [pwd] page_size.db]
+    file delete -force $dbfile
+    unqlite db $dbfile -pagesize $pagesize
+    set chunk [string repeat {{"field":"value","n":12345},} 10000]
+    set t0 [clock microseconds]
+    set nByte 0
+    for {set i 0} {$i < $nRecord} {incr i} {
+        set n [size_$dist $i]
+        db kv_store key$i [string range $chunk 0 [expr {$n - 1}]] -binary 1
+        incr nByte $n
+    }
+    db commit
+    set store [expr {[clock microseconds] - $t0}]
+    db close
+    unqlite db $dbfile
+    set t0 [clock microseconds]
+    for {set i 0} {$i < $nRecord} {incr i} {
+        db kv_fetch key[expr {($i * 7919) % $nRecord}] -binary 1
+    }
+    set fetch [expr {[clock microseconds] - $t0}]
+    set info [db analyze]
+    db close
+    puts [format "%-6s %6d %10.0f %10.0f %8.1f %8d %8d %7.1f%%" \
+        $dist $pagesize \
+        [expr {$nRecord * 1e6 / $store}] [expr {$nRecord * 1e6 / $fetch}] \
+        [expr {[file size $dbfile] / 1048576.0}] \
+        [dict get $info pages] [dict get $info overflow_pages] \
+        [expr {100.0 * $nByte / [file size $dbfile]}]]
+    file delete -force $dbfile
+}
+
+puts "$nRecord records"
+puts [format "%-6s %6s %10s %10s %8s %8s %8s %8s" \
+    dist page store/s fetch/s MB pages overflow payload]
+foreach dist {small kb json mixed} {
+    foreach pagesize $lPageSize {
+        run $dist $pagesize $nRecord
+    }
+}
@@ -0,0 +1,81 @@
+#
+# Write latency histogram of kv_store with inline and deferred bucket
+# splits.
+#
+# Usage: tclsh split_latency.tcl ?records? ?batch?
+#
+# Each mode inserts the records in transactions of batch records. In
+# deferred mode "maintain" runs after each commit and its time is reported
+# apart from the kv_store latencies.
+#
+
+package require unqlite
+
+set nRecord [expr {$argc > 0 ? [lindex $argv 0] : 200000}]
+set nBatch  [expr {$argc > 1 ? [lindex $argv 1] : 1000}]
+
+proc percentile {sorted p} {
+    set n [llength $sorted]
+    set i [expr {int(ceil($p * $n / 100.0)) - 1}]
+    if {$i < 0} {
+        set i 0
+    }
+    return [lindex $sorted $i]
+}
+
+proc histogram {sorted} {
+    set hist [dict create]
+    foreach us $sorted {
+        set bucket 1
+        while {$bucket < $us} {
+            set bucket [expr {$bucket * 2}]
+        }
+        dict incr hist $bucket
+    }
+    dict for {bucket count} $hist {
+        puts [format "  <= %8d us %10d" $bucket $count]
+    }
+}
+
+proc run {mode nRecord nBatch} {
+    set dbfile [file join [pwd] split_latency.db]
+    file delete -force $dbfile
+    unqlite db $dbfile
+    if {$mode eq "deferred"} {
+        db config -deferSplit 1
+    }
+    set value [string repeat v 100]
+    set times {}
+    set maintain 0
+    for {set i 0} {$i < $nRecord} {incr i} {
+        set t0 [clock microseconds]
+        db kv_store key$i $value
+        lappend times [expr {[clock microseconds] - $t0}]
+        if {($i + 1) % $nBatch == 0} {
+            db commit
+            set t0 [clock microseconds]
+            if {$mode eq "deferred"} {
+                db maintain
+                db commit
+            }
+            incr maintain [expr {[clock microseconds] - $t0}]
+        }
+    }
+    db commit
+    db close
+    file delete -force $dbfile
+
+    set sorted [lsort -integer $times]
+    puts "$mode splits, $nRecord records"
+    foreach p {50 90 99 99.9} {
+        puts [format "  p%-5s %8d us" $p [percentile $sorted $p]]
+    }
+    puts [format "  max    %8d us" [lindex $sorted end]]
+    if {$mode eq "deferred"} {
+        puts [format "  maintain total %d us" $maintain]
+    }
+    histogram $sorted
+}
+
+run inline $nRecord $nBatch
+run deferred $nRecord $nBatch
@@ -28,6 +28,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 #include "unqlite.h"
 
 
@@ -42,6 +48,8 @@
 
 
 typedef struct UnqliteDb UnqliteDb;
+typedef struct UnqliteBlob UnqliteBlob;
+typedef struct UnqliteLatency UnqliteLatency;
 
 
 struct UnqliteDb {
@@ -51,6 +59,154 @@ struct UnqliteDb {
   char *cursor_command;
   unqlite_vm *vm;             /* A compiled Jx9 program represented */
   char *collection_name;      /* Collection name, for document store used */
+  UnqliteBlob *pBlob;         /* Open blob channels */
+  UnqliteLatency *aLatency;   /* Per subcommand histograms, NULL unless timing is on */
+  Tcl_Obj *pSlowlog;          /* Slowlog callback, NULL when off */
+  Tcl_WideUInt iSlowlog;      /* Slowlog threshold in nanoseconds */
+  int bDeleted;               /* Command deleted, kept alive by Tcl_Preserve() */
+};
+
+
+/*
+** A channel opened by blob_open on the value of a key.
+*/
+struct UnqliteBlob {
+  UnqliteDb *pDb;             /* Database, NULL once it is closed */
+  unqlite_kv_cursor *cursor;  /* Cursor used to read the value */
+  char *zKey;                 /* The key */
+  int nKey;
+  unqlite_int64 iOffset;      /* Read position */
+  Tcl_Channel channel;
+  UnqliteBlob *pNext;         /* Next blob of the same database */
+};
+
+
+/*
+** The database is closed, the channel stays open but any further
+** read or write fails.
+*/
+static void BlobDetach(UnqliteBlob *p) {
+  if(p->cursor) {
+    unqlite_kv_cursor_release(p->pDb->db, p->cursor);
+    p->cursor = 0;
+  }
+  p->pDb = 0;
+}
+
+
+static int BlobClose2Proc(void *instanceData, Tcl_Interp *interp, int flags) {
+  UnqliteBlob *p = (UnqliteBlob *)instanceData;
+  UnqliteBlob **pp;
+
+  (void)interp;
+  if( (flags & (TCL_CLOSE_READ|TCL_CLOSE_WRITE))!=0 ){
+    return EINVAL;
+  }
+
+  if(p->pDb) {
+    for(pp = &p->pDb->pBlob; *pp; pp = &(*pp)->pNext) {
+      if(*pp == p) {
+        *pp = p->pNext;
+        break;
+      }
+    }
+    BlobDetach(p);
+  }
+
+  Tcl_Free(p->zKey);
+  Tcl_Free((char *)p);
+  return 0;
+}
+
+
+/*
+** Read the value from the current position. Each call seek the key again
+** (the value may have been changed in between), the engine resume the
+** read from the overflow page where the previous one stopped.
+*/
+static int BlobInputProc(void *instanceData, char *buf, int toRead, int *errorCodePtr) {
+  UnqliteBlob *p = (UnqliteBlob *)instanceData;
+  unqlite_int64 nByte = toRead;
+  int rc;
+
+  if( p->pDb==0 || p->cursor==0 ){
+    *errorCodePtr = EIO;
+    return -1;
+  }
+
+  rc = unqlite_kv_cursor_seek(p->cursor, p->zKey, p->nKey, UNQLITE_CURSOR_MATCH_EXACT);
+  if( rc==UNQLITE_OK ){
+    rc = unqlite_kv_cursor_data_read(p->cursor, p->iOffset, buf, &nByte);
+  }
+  if( rc!=UNQLITE_OK ){
+    *errorCodePtr = EIO;
+    return -1;
+  }
+
+  p->iOffset += nByte;
+  return (int)nByte;
+}
+
+
+/*
+** Append to the value. The engine remember where the value ends, so each
+** write only touches the last overflow page of the value.
+*/
+static int BlobOutputProc(void *instanceData, const char *buf, int toWrite, int *errorCodePtr) {
+  UnqliteBlob *p = (UnqliteBlob *)instanceData;
+  int rc;
+
+  if( p->pDb==0 ){
+    *errorCodePtr = EIO;
+    return -1;
+  }
+
+  rc = unqlite_kv_append(p->pDb->db, p->zKey, p->nKey, buf, (unqlite_int64)toWrite);
+  if( rc!=UNQLITE_OK ){
+    *errorCodePtr = EIO;
+    return -1;
+  }
+
+  return toWrite;
+}
+
+
+static void BlobWatchProc(void *instanceData, int mask) {
+  (void)instanceData;
+  (void)mask;
+}
+
+
+static int BlobGetHandleProc(void *instanceData, int direction, void **handlePtr) {
+  (void)instanceData;
+  (void)direction;
+  (void)handlePtr;
+  return TCL_ERROR;
+}
+
+
+static const Tcl_ChannelType BlobChannelType = {
+  "unqlite_blob",             /* typeName */
+  TCL_CHANNEL_VERSION_5,      /* version */
+#if TCL_MAJOR_VERSION > 8
+  NULL,                       /* closeProc, unused */
+#else
+  TCL_CLOSE2PROC,             /* closeProc */
+#endif
+  BlobInputProc,              /* inputProc */
+  BlobOutputProc,             /* outputProc */
+  NULL,                       /* seekProc */
+  NULL,                       /* setOptionProc */
+  NULL,                       /* getOptionProc */
+  BlobWatchProc,              /* watchProc */
+  BlobGetHandleProc,          /* getHandleProc */
+  BlobClose2Proc,             /* close2Proc */
+  NULL,                       /* blockModeProc */
+  NULL,                       /* flushProc */
+  NULL,                       /* handlerProc */
+  NULL,                       /* wideSeekProc */
+  NULL,                       /* threadActionProc */
+  NULL                        /* truncateProc */
 };
 
 
@@ -71,6 +227,20 @@ static void CursorDeleteCmd(void *db) {
 }
 
 
+/*
+** Close the database and free the structure, once no subcommand uses
+** it (See Tcl_Preserve()).
+*/
+static void DbFree(void *db) {
+  UnqliteDb *pDb = (UnqliteDb*)db;
+
+  unqlite_close(pDb->db);
+  pDb->db = 0;
+
+  Tcl_Free((char*)pDb);
+}
+
+
 /*
 ** TCL calls this procedure when a unqlite database command is
 ** deleted.
@@ -97,16 +267,52 @@ static void DbDeleteCmd(void *db) {
   //  pDb->cursor = 0;
   //}
 
-  pDb->vm = 0;
+  if(pDb->aLatency) {
+    Tcl_Free((char*)pDb->aLatency);
+    pDb->aLatency = 0;
+  }
 
-  unqlite_close(pDb->db);
-  pDb->db = 0;
+  if(pDb->pSlowlog) {
+    Tcl_DecrRefCount(pDb->pSlowlog);
+    pDb->pSlowlog = 0;
+  }
 
-  Tcl_Free((char*)pDb);
-  pDb = 0;
+  while(pDb->pBlob) {
+    UnqliteBlob *pBlob = pDb->pBlob;
+
+    /* Write the buffered output first */
+    Tcl_Flush(pBlob->channel);
+    pDb->pBlob = pBlob->pNext;
+    BlobDetach(pBlob);
+  }
+
+  pDb->vm = 0;
+  pDb->bDeleted = 1;
+
+  /* A callback may close the database while a subcommand still uses it */
+  Tcl_EventuallyFree((ClientData)pDb, (Tcl_FreeProc *)DbFree);
 }
 
 
+/*
+** Subcommands of a cursor command.
+*/
+static const char *CURSOR_strs[] = {
+  "seek",
+  "first",
+  "last",
+  "next",
+  "prev",
+  "isvalid",
+  "getkey",
+  "getdata",
+  "delete",
+  "reset",
+  "release",
+  0
+};
+
+
 /*
 ** Creates a new Tcl command for unqlite cursors.
 */
@@ -116,21 +322,6 @@ static int CursorObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*ob
   int result;
   int rc = TCL_OK;
 
-  static const char *CURSOR_strs[] = {
-    "seek",
-    "first",
-    "last",
-    "next",
-    "prev",
-    "isvalid",
-    "getkey",
-    "getdata",
-    "delete",
-    "reset",
-    "release",
-    0
-  };
-
   enum CURSOR_enum {
     CURSOR_SEEK,
     CURSOR_FIRST,
@@ -441,6 +632,441 @@ static int CursorObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*ob
 }
 
 
+/*
+** Callback for the integrity_check method. Each problem is appended
+** to the result list as a {page reason} pair.
+*/
+static int IntegrityReportCallback(pgno iPage, const char *zReason, void *pUserData){
+  Tcl_Obj *pList = (Tcl_Obj *)pUserData;
+  Tcl_Obj *pEntry;
+
+  pEntry = Tcl_NewListObj(0, NULL);
+  Tcl_ListObjAppendElement(NULL, pEntry, Tcl_NewWideIntObj((Tcl_WideInt)iPage));
+  Tcl_ListObjAppendElement(NULL, pEntry, Tcl_NewStringObj(zReason, -1));
+  Tcl_ListObjAppendElement(NULL, pList, pEntry);
+
+  return UNQLITE_OK;
+}
+
+
+/*
+** A growable array of page numbers.
+*/
+typedef struct PageList PageList;
+struct PageList {
+  pgno *aPage;
+  int nPage;
+  int nAlloc;
+};
+
+static int CachePageCallback(pgno iPage, void *pUserData){
+  PageList *p = (PageList *)pUserData;
+
+  if( p->nPage >= p->nAlloc ){
+    p->nAlloc = p->nAlloc ? p->nAlloc * 2 : 256;
+    p->aPage = (pgno *)Tcl_Realloc((char *)p->aPage, p->nAlloc * sizeof(pgno));
+  }
+  p->aPage[p->nPage++] = iPage;
+
+  return UNQLITE_OK;
+}
+
+static int PageCompare(const void *pA, const void *pB){
+  pgno a = *(const pgno *)pA;
+  pgno b = *(const pgno *)pB;
+
+  return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+/*
+** Load the pages listed in a file written by "$db cache_save" into the
+** page cache, in sorted order so that they are read with a few large
+** reads. A missing file is not an error, nothing was saved yet.
+*/
+static int CacheLoadFile(Tcl_Interp *interp, unqlite *db, Tcl_Obj *pPath){
+  Tcl_Channel chan;
+  Tcl_Obj *pData;
+  Tcl_Obj **apElem;
+  Tcl_Size nElem;
+  Tcl_Size i;
+  PageList sList;
+  int result;
+
+  chan = Tcl_FSOpenFileChannel(interp, pPath, "r", 0);
+  if( chan == NULL ){
+    if( Tcl_GetErrno() == ENOENT ){
+      Tcl_ResetResult(interp);
+      return TCL_OK;
+    }
+    return TCL_ERROR;
+  }
+
+  pData = Tcl_NewObj();
+  Tcl_IncrRefCount(pData);
+  if( Tcl_ReadChars(chan, pData, -1, 0) < 0 ){
+    Tcl_DecrRefCount(pData);
+    Tcl_Close(NULL, chan);
+    Tcl_SetResult(interp, "Read warmup file fail", NULL);
+    return TCL_ERROR;
+  }
+  Tcl_Close(NULL, chan);
+
+  if( Tcl_ListObjGetElements(NULL, pData, &nElem, &apElem) != TCL_OK ){
+    Tcl_DecrRefCount(pData);
+    Tcl_SetResult(interp, "Malformed warmup file", NULL);
+    return TCL_ERROR;
+  }
+
+  memset(&sList, 0, sizeof(sList));
+  for(i = 0; i < nElem; i++){
+    Tcl_WideInt iPage;
+
+    if( Tcl_GetWideIntFromObj(NULL, apElem[i], &iPage) != TCL_OK || iPage < 0 ){
+      Tcl_Free((char *)sList.aPage);
+      Tcl_DecrRefCount(pData);
+      Tcl_SetResult(interp, "Malformed warmup file", NULL);
+      return TCL_ERROR;
+    }
+    CachePageCallback((pgno)iPage, &sList);
+  }
+  Tcl_DecrRefCount(pData);
+
+  result = UNQLITE_OK;
+  if( sList.nPage > 0 ){
+    qsort(sList.aPage, sList.nPage, sizeof(pgno), PageCompare);
+    result = unqlite_config(db, UNQLITE_CONFIG_CACHE_LOAD, sList.aPage, sList.nPage);
+  }
+  Tcl_Free((char *)sList.aPage);
+  if( result != UNQLITE_OK ){
+    Tcl_SetResult(interp, "Cache warmup fail", NULL);
+    return TCL_ERROR;
+  }
+
+  return TCL_OK;
+}
+
+
+/*
+** Histogram of the analyze method as a dict of class to count, empty
+** classes left out. With bLog, entry i counts the values in
+** [2^(i-1), 2^i) and is keyed by its lower bound, otherwise it is keyed
+** by iScale times its index.
+*/
+static Tcl_Obj *AnalyzeHistogram(Tcl_Interp *interp, const unqlite_int64 *aCount,
+                                 int nCount, int bLog, int iScale){
+  Tcl_Obj *pDict = Tcl_NewDictObj();
+  Tcl_WideInt iKey;
+  int i;
+
+  for(i = 0; i < nCount; i++){
+    if( aCount[i] == 0 ) continue;
+    if( bLog ){
+      iKey = i == 0 ? 0 : ((Tcl_WideInt)1 << (i - 1));
+    }else{
+      iKey = (Tcl_WideInt)i * iScale;
+    }
+    Tcl_DictObjPut(interp, pDict, Tcl_NewWideIntObj(iKey),
+                   Tcl_NewWideIntObj((Tcl_WideInt)aCount[i]));
+  }
+  return pDict;
+}
+
+
+/*
+** Subcommands of a database command.
+*/
+static const char *DB_strs[] = {
+  "kv_store",          // Saves entry
+  "kv_append",         // Append entry data specified by key
+  "kv_fetch",          // Fetch data specified by key
+  "kv_delete",         // Delete entry specified by key
+  "begin",             // Manual Transaction Manager
+  "commit",            // Manual Transaction Manager
+  "rollback",          // Manual Transaction Manager
+  "config",
+  "close",             // Close database
+  "cursor_init",       // Create a cursor command
+  "random_string",     // Generate a random string
+  "version",
+  "doc_create",        // Store (JSON via Jx9) Interfaces
+  "doc_fetch",
+  "doc_fetchall",
+  "doc_fetch_id",
+  "doc_store",
+  "doc_update_record",
+  "doc_delete",
+  "doc_reset_cursor",
+  "doc_count",
+	"doc_current_id",
+	"doc_last_id",
+  "doc_begin",
+  "doc_commit",
+  "doc_rollback",
+  "doc_drop",
+  "doc_close",
+  "jx9_eval",          // Execute a JX9 script string
+  "jx9_eval_file",     // Execute a JX9 script from file
+  "integrity_check",   // Check the database image
+  "backup",            // Online backup to a file
+  "vacuum",            // Compact the database file
+  "freelist_count",    // Pages available for reuse
+  "maintain",          // Perform the deferred bucket splits
+  "bloom_rebuild",     // Build the Bloom filter of the keys
+  "vlog_gc",           // Reclaim the value log segments
+  "blob_open",         // Open a channel on the value of a key
+  "cache_save",        // Save the list of cached pages
+  "warmup",            // Load the hot pages into the cache
+  "stats",             // Pager and storage engine counters
+  "latency",           // Latency histograms of the subcommands
+  "analyze",           // Report the layout of the database file
+  0
+};
+
+
+/*
+** Latency histograms kept by "config -timing 1", one per subcommand of the
+** database command followed by one per subcommand of the cursor command.
+** Samples are nanoseconds of the monotonic clock. Each power of two is cut
+** in LATENCY_SUB linear buckets, so a percentile is off by 12.5% at most.
+*/
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB      (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_EXP  40   /* About 18 minutes, longer samples share the last bucket */
+#define LATENCY_BUCKETS  ((LATENCY_MAX_EXP - LATENCY_SUB_BITS + 2) * LATENCY_SUB)
+#define LATENCY_NDB      ((int)(sizeof(DB_strs) / sizeof(DB_strs[0])) - 1)
+#define LATENCY_NCURSOR  ((int)(sizeof(CURSOR_strs) / sizeof(CURSOR_strs[0])) - 1)
+#define LATENCY_SLOTS    (LATENCY_NDB + LATENCY_NCURSOR)
+
+struct UnqliteLatency {
+  Tcl_WideUInt nCount;        /* Number of samples */
+  Tcl_WideUInt nTotal;        /* Sum of the samples */
+  Tcl_WideUInt nMax;          /* Largest sample */
+  Tcl_WideUInt aBucket[LATENCY_BUCKETS];
+};
+
+
+/*
+** Current time of the monotonic clock in nanoseconds.
+*/
+static Tcl_WideUInt LatencyNow(void) {
+#ifdef _WIN32
+  static LARGE_INTEGER sFreq;
+  LARGE_INTEGER sCount;
+
+  if( sFreq.QuadPart == 0 ){
+    QueryPerformanceFrequency(&sFreq);
+  }
+  QueryPerformanceCounter(&sCount);
+  return (Tcl_WideUInt)((double)sCount.QuadPart * 1e9 / (double)sFreq.QuadPart);
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (Tcl_WideUInt)ts.tv_sec * 1000000000 + (Tcl_WideUInt)ts.tv_nsec;
+#endif
+}
+
+
+/*
+** Index of the bucket holding a sample.
+*/
+static int LatencyBucket(Tcl_WideUInt iValue) {
+  int iExp;
+
+  if( iValue < LATENCY_SUB ){
+    return (int)iValue;
+  }
+#if defined(__GNUC__)
+  iExp = 63 - __builtin_clzll((unsigned long long)iValue);
+#else
+  for(iExp = LATENCY_SUB_BITS; (iValue >> (iExp + 1)) != 0; iExp++);
+#endif
+  if( iExp > LATENCY_MAX_EXP ){
+    return LATENCY_BUCKETS - 1;
+  }
+  return (iExp - LATENCY_SUB_BITS + 1) * LATENCY_SUB
+         + (int)((iValue >> (iExp - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+}
+
+
+/*
+** Largest sample that falls in a bucket.
+*/
+static Tcl_WideUInt LatencyBucketTop(int iBucket) {
+  int iShift;
+
+  if( iBucket < LATENCY_SUB ){
+    return (Tcl_WideUInt)iBucket;
+  }
+  iShift = iBucket / LATENCY_SUB - 1;
+  return (((Tcl_WideUInt)(LATENCY_SUB + iBucket % LATENCY_SUB) + 1) << iShift) - 1;
+}
+
+
+static void LatencyRecord(UnqliteLatency *p, Tcl_WideUInt iElapsed) {
+  p->nCount++;
+  p->nTotal += iElapsed;
+  if( iElapsed > p->nMax ){
+    p->nMax = iElapsed;
+  }
+  p->aBucket[LatencyBucket(iElapsed)]++;
+}
+
+
+/*
+** Smallest sample at or above the fraction rQuantile of the samples.
+*/
+static Tcl_WideUInt LatencyQuantile(UnqliteLatency *p, double rQuantile) {
+  Tcl_WideUInt nTarget, nSeen = 0, iTop;
+  int i;
+
+  nTarget = (Tcl_WideUInt)(rQuantile * (double)p->nCount);
+  if( (double)nTarget < rQuantile * (double)p->nCount || nTarget == 0 ){
+    nTarget++;
+  }
+  for(i = 0; i < LATENCY_BUCKETS; i++){
+    nSeen += p->aBucket[i];
+    if( nSeen >= nTarget ){
+      iTop = LatencyBucketTop(i);
+      return iTop < p->nMax ? iTop : p->nMax;
+    }
+  }
+  return p->nMax;
+}
+
+
+/*
+** Summary of one histogram: sample count, then the mean, the 50th, 99th
+** and 99.9th percentiles and the largest sample in microseconds.
+*/
+static Tcl_Obj *LatencySummary(Tcl_Interp *interp, UnqliteLatency *p) {
+  Tcl_Obj *pDict = Tcl_NewDictObj();
+
+  Tcl_DictObjPut(interp, pDict, Tcl_NewStringObj("count", -1),
+                 Tcl_NewWideIntObj((Tcl_WideInt)p->nCount));
+  Tcl_DictObjPut(interp, pDict, Tcl_NewStringObj("mean", -1),
+                 Tcl_NewDoubleObj(p->nCount ? (double)p->nTotal / p->nCount / 1000.0 : 0.0));
+  Tcl_DictObjPut(interp, pDict, Tcl_NewStringObj("p50", -1),
+                 Tcl_NewDoubleObj(LatencyQuantile(p, 0.5) / 1000.0));
+  Tcl_DictObjPut(interp, pDict, Tcl_NewStringObj("p99", -1),
+                 Tcl_NewDoubleObj(LatencyQuantile(p, 0.99) / 1000.0));
+  Tcl_DictObjPut(interp, pDict, Tcl_NewStringObj("p999", -1),
+                 Tcl_NewDoubleObj(LatencyQuantile(p, 0.999) / 1000.0));
+  Tcl_DictObjPut(interp, pDict, Tcl_NewStringObj("max", -1),
+                 Tcl_NewDoubleObj(p->nMax / 1000.0));
+  return pDict;
+}
+
+
+/*
+** Name under which a histogram is reported: the subcommand name, with a
+** "cursor_" prefix for the cursor subcommands.
+*/
+static Tcl_Obj *LatencyName(int iSlot) {
+  Tcl_Obj *pName;
+
+  if( iSlot < LATENCY_NDB ){
+    return Tcl_NewStringObj(DB_strs[iSlot], -1);
+  }
+  pName = Tcl_NewStringObj("cursor_", -1);
+  Tcl_AppendToObj(pName, CURSOR_strs[iSlot - LATENCY_NDB], -1);
+  return pName;
+}
+
+
+/*
+** Run a subcommand, add its duration to the histogram of iSlot when timing
+** is on and report it to the slowlog callback when it took longer than the
+** threshold. The callback is invoked as
+**
+**       CALLBACK command subject elapsed_us pages_read pages_written
+**
+** where subject is the key, or the first 64 characters of the script, and
+** the page counts are the pager deltas of the call. Errors raised by the
+** callback are reported in the background, the result of the subcommand
+** is kept.
+*/
+static int TimedCall(
+  int (*xProc)(void *, Tcl_Interp *, int, Tcl_Obj *const*),
+  int iSlot,
+  void *cd, Tcl_Interp *interp, int objc, Tcl_Obj *const*objv
+){
+  UnqliteDb *pDb = (UnqliteDb *) cd;
+  unqlite_pager_stats sBefore, sAfter;
+  Tcl_WideUInt iStart, iElapsed;
+  Tcl_InterpState sState;
+  Tcl_Obj *pScript;
+  int bSlow = pDb->pSlowlog != 0;
+  int rc;
+
+  if( bSlow ){
+    unqlite_config(pDb->db, UNQLITE_CONFIG_PAGER_STATS, &sBefore, 0);
+  }
+  Tcl_Preserve((ClientData)pDb);
+  iStart = LatencyNow();
+  rc = xProc(cd, interp, objc, objv);
+  iElapsed = LatencyNow() - iStart;
+
+  /* The subcommand may have turned timing or the slowlog off or closed the database */
+  if( pDb->aLatency ){
+    LatencyRecord(&pDb->aLatency[iSlot], iElapsed);
+  }
+  if( !bSlow || pDb->pSlowlog == 0 || iElapsed < pDb->iSlowlog ){
+    Tcl_Release((ClientData)pDb);
+    return rc;
+  }
+
+  unqlite_config(pDb->db, UNQLITE_CONFIG_PAGER_STATS, &sAfter, 0);
+  pScript = Tcl_DuplicateObj(pDb->pSlowlog);
+  Tcl_IncrRefCount(pScript);
+  Tcl_ListObjAppendElement(NULL, pScript, LatencyName(iSlot));
+  if( objc > 2 ){
+    Tcl_ListObjAppendElement(NULL, pScript,
+                             Tcl_GetCharLength(objv[2]) > 64 ?
+                             Tcl_GetRange(objv[2], 0, 63) : objv[2]);
+  }else{
+    Tcl_ListObjAppendElement(NULL, pScript, Tcl_NewObj());
+  }
+  Tcl_ListObjAppendElement(NULL, pScript, Tcl_NewDoubleObj(iElapsed / 1000.0));
+  /* Counters zeroed by the call (stats -reset) only count since the reset */
+  if( sAfter.nRead < sBefore.nRead || sAfter.nWrite < sBefore.nWrite ){
+    sBefore.nRead = sBefore.nWrite = 0;
+  }
+  Tcl_ListObjAppendElement(NULL, pScript,
+                           Tcl_NewWideIntObj((Tcl_WideInt)(sAfter.nRead - sBefore.nRead)));
+  Tcl_ListObjAppendElement(NULL, pScript,
+                           Tcl_NewWideIntObj((Tcl_WideInt)(sAfter.nWrite - sBefore.nWrite)));
+  Tcl_Release((ClientData)pDb);
+
+  /* The callback may close the database, pDb must not be used below */
+  sState = Tcl_SaveInterpState(interp, rc);
+  if( Tcl_EvalObjEx(interp, pScript, TCL_EVAL_GLOBAL) != TCL_OK ){
+    Tcl_BackgroundException(interp, TCL_ERROR);
+  }
+  Tcl_DecrRefCount(pScript);
+
+  return Tcl_RestoreInterpState(interp, sState);
+}
+
+
+/*
+** The cursor command. When timing or the slowlog is on, the subcommand
+** is looked up here (the lookup is cached in the Tcl_Obj and reused by
+** CursorObjCmd) and the call goes through TimedCall().
+*/
+static int CursorTimedObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  UnqliteDb *pDb = (UnqliteDb *) cd;
+  int choice;
+
+  if( (pDb->aLatency == 0 && pDb->pSlowlog == 0) || objc < 2 ||
+      Tcl_GetIndexFromObj(NULL, objv[1], CURSOR_strs, "option", 0, &choice) != TCL_OK ){
+    return CursorObjCmd(cd, interp, objc, objv);
+  }
+
+  return TimedCall(CursorObjCmd, LATENCY_NDB + choice, cd, interp, objc, objv);
+}
+
+
 /*
 ** The "unqlite" command below creates a new Tcl command for each
 ** connection it opens to an UnQLite database.  This routine is invoked
@@ -460,40 +1086,6 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
   int result;
   int rc = TCL_OK;
 
-  static const char *DB_strs[] = {
-    "kv_store",          // Saves entry
-    "kv_append",         // Append entry data specified by key
-    "kv_fetch",          // Fetch data specified by key
-    "kv_delete",         // Delete entry specified by key
-    "begin",             // Manual Transaction Manager
-    "commit",            // Manual Transaction Manager
-    "rollback",          // Manual Transaction Manager
-    "config",
-    "close",             // Close database
-    "cursor_init",       // Create a cursor command
-    "random_string",     // Generate a random string
-    "version",
-    "doc_create",        // Store (JSON via Jx9) Interfaces
-    "doc_fetch",
-    "doc_fetchall",
-    "doc_fetch_id",
-    "doc_store",
-    "doc_update_record",
-    "doc_delete",
-    "doc_reset_cursor",
-    "doc_count",
-	"doc_current_id",
-	"doc_last_id",
-    "doc_begin",
-    "doc_commit",
-    "doc_rollback",
-    "doc_drop",
-    "doc_close",
-    "jx9_eval",          // Execute a JX9 script string
-    "jx9_eval_file",     // Execute a JX9 script from file
-    0
-  };
-
   enum DB_enum {
     DB_KV_STORE,
     DB_KV_APPEND,
@@ -525,6 +1117,19 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     DB_DOC_CLOSE,
     DB_JX9_EVAL,
     DB_JX9_EVAL_FILE,
+    DB_INTEGRITY_CHECK,
+    DB_BACKUP,
+    DB_VACUUM,
+    DB_FREELIST_COUNT,
+    DB_MAINTAIN,
+    DB_BLOOM_REBUILD,
+    DB_VLOG_GC,
+    DB_BLOB_OPEN,
+    DB_CACHE_SAVE,
+    DB_WARMUP,
+    DB_STATS,
+    DB_LATENCY,
+    DB_ANALYZE,
   };
 
   if( objc < 2 ){
@@ -815,7 +1420,9 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
 
       if( objc < 4 || (objc&1)!=0 ){
         Tcl_WrongNumArgs(interp, 2, objv,
-                         "?-disableautocommit BOOLEAN? ");
+                         "?-disableautocommit BOOLEAN? ?-deferSplit BOOLEAN? "
+                         "?-valueLog BYTES? ?-valueLogSegment BYTES? "
+                         "?-timing BOOLEAN? ?-slowlog {threshold_us callback}? ");
         return TCL_ERROR;
       }
 
@@ -828,6 +1435,73 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
           if( b ){
             unqlite_config(pDb->db, UNQLITE_CONFIG_DISABLE_AUTO_COMMIT);
           }
+        }else if( strcmp(zArg, "-deferSplit")==0 ){
+          int b;
+          if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+          result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_DEFER_SPLIT, b);
+          if( result != UNQLITE_OK ){
+            Tcl_SetResult (interp, "Config fail", NULL);
+            return TCL_ERROR;
+          }
+        }else if( strcmp(zArg, "-valueLog")==0 ){
+          Tcl_WideInt n;
+          if( Tcl_GetWideIntFromObj(interp, objv[i+1], &n) ) return TCL_ERROR;
+          if( n < 0 ){
+            Tcl_SetResult(interp, "valueLog must not be negative", NULL);
+            return TCL_ERROR;
+          }
+          /* Values of at least n bytes go to the value log, 0 turns it off */
+          result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_VALUE_LOG,
+                                     (unqlite_int64)n, (unqlite_int64)-1);
+          if( result != UNQLITE_OK ){
+            Tcl_SetResult (interp, "Config fail", NULL);
+            return TCL_ERROR;
+          }
+        }else if( strcmp(zArg, "-valueLogSegment")==0 ){
+          Tcl_WideInt n;
+          if( Tcl_GetWideIntFromObj(interp, objv[i+1], &n) ) return TCL_ERROR;
+          if( n < 1 ){
+            Tcl_SetResult(interp, "valueLogSegment must be positive", NULL);
+            return TCL_ERROR;
+          }
+          result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_VALUE_LOG,
+                                     (unqlite_int64)-1, (unqlite_int64)n);
+          if( result != UNQLITE_OK ){
+            Tcl_SetResult (interp, "Config fail", NULL);
+            return TCL_ERROR;
+          }
+        }else if( strcmp(zArg, "-timing")==0 ){
+          int b;
+          if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
+          /* Allocated once here so that recording a sample never allocates */
+          if( b && pDb->aLatency == 0 ){
+            pDb->aLatency = (UnqliteLatency *)Tcl_Alloc(LATENCY_SLOTS * sizeof(UnqliteLatency));
+            memset(pDb->aLatency, 0, LATENCY_SLOTS * sizeof(UnqliteLatency));
+          }else if( !b && pDb->aLatency ){
+            Tcl_Free((char *)pDb->aLatency);
+            pDb->aLatency = 0;
+          }
+        }else if( strcmp(zArg, "-slowlog")==0 ){
+          Tcl_Obj **apElem;
+          Tcl_Size nElem;
+          Tcl_WideInt n = 0;
+
+          /* An empty list turns the slowlog off */
+          if( Tcl_ListObjGetElements(interp, objv[i+1], &nElem, &apElem) ) return TCL_ERROR;
+          if( nElem != 0 && (nElem != 2 ||
+              Tcl_GetWideIntFromObj(NULL, apElem[0], &n) != TCL_OK || n < 0) ){
+            Tcl_SetResult(interp, "slowlog must be {threshold_us callback}", NULL);
+            return TCL_ERROR;
+          }
+          if( pDb->pSlowlog ){
+            Tcl_DecrRefCount(pDb->pSlowlog);
+            pDb->pSlowlog = 0;
+          }
+          if( nElem == 2 ){
+            pDb->pSlowlog = apElem[1];
+            Tcl_IncrRefCount(pDb->pSlowlog);
+            pDb->iSlowlog = (Tcl_WideUInt)n * 1000;
+          }
         }else{
           Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
           return TCL_ERROR;
@@ -870,7 +1544,7 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
 	  return TCL_ERROR;
       }
 
-      Tcl_CreateObjCommand(interp, zArg, CursorObjCmd, (char *)pDb, CursorDeleteCmd);
+      Tcl_CreateObjCommand(interp, zArg, CursorTimedObjCmd, (char *)pDb, CursorDeleteCmd);
       Tcl_SetObjResult(interp,  Tcl_NewBooleanObj(1));
 
       break;
@@ -1683,16 +2357,774 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
       break;
     }
 
-  } /* End of the SWITCH statement */
+    /*    $db integrity_check ?-threads N?
+    **
+    ** Walk the whole database image and return a list of {page reason}
+    ** pairs, one for each problem found. An empty list means no problem.
+    ** With -threads the buckets are walked by N threads.
+    */
+    case DB_INTEGRITY_CHECK: {
+      Tcl_Obj *pList;
+      char *zArg;
+      int nThread = 1;
+
+      if( objc != 2 && objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-threads N?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 4 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-threads")==0 ){
+          if( Tcl_GetIntFromObj(interp, objv[3], &nThread) != TCL_OK ) return TCL_ERROR;
+          if( nThread < 1 ){
+            Tcl_SetResult(interp, "threads must be at least 1", NULL);
+            return TCL_ERROR;
+          }
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      pList = Tcl_NewListObj(0, NULL);
+      Tcl_IncrRefCount(pList);
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_INTEGRITY_CHECK,
+                                 nThread, IntegrityReportCallback, (void *)pList);
+      if( result != UNQLITE_OK ){
+        Tcl_DecrRefCount(pList);
+        Tcl_SetResult (interp, "Integrity check fail", NULL);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, pList);
+      Tcl_DecrRefCount(pList);
+
+      break;
+    }
+
+    /*    $db backup FILENAME ?-pagesPerStep N? ?-progress SCRIPT?
+    **
+    ** Copy the committed database image to FILENAME, N pages at a time.
+    ** SCRIPT is invoked after each step with the number of remaining and
+    ** total pages appended. Pages committed by SCRIPT are copied again.
+    ** Return the number of pages in the backup.
+    */
+    case DB_BACKUP: {
+      Tcl_Obj *pProgress = NULL;
+      Tcl_DString translatedFilename;
+      const char *zDest;
+      char *zArg;
+      unqlite_int64 nRemaining = 0;
+      unqlite_int64 nTotal = 0;
+      int nPage = 100;
+      int i;
+
+      if( objc < 3 || (objc & 1) == 0 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+                         "filename ?-pagesPerStep N? ?-progress script?");
+        return TCL_ERROR;
+      }
+
+      for(i = 3; i + 1 < objc; i += 2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-pagesPerStep")==0 ){
+          if( Tcl_GetIntFromObj(interp, objv[i+1], &nPage) != TCL_OK ) {
+            return TCL_ERROR;
+          }
+          if( nPage < 1 ){
+            Tcl_SetResult(interp, "pagesPerStep must be positive", NULL);
+            return TCL_ERROR;
+          }
+        }else if( strcmp(zArg, "-progress")==0 ){
+          pProgress = objv[i+1];
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      zDest = Tcl_TranslateFileName(interp, Tcl_GetStringFromObj(objv[2], 0),
+                                    &translatedFilename);
+      if( zDest == NULL ){
+        return TCL_ERROR;
+      }
+      result = unqlite_backup_init(pDb->db, zDest);
+      Tcl_DStringFree(&translatedFilename);
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult(interp, "Backup init fail", NULL);
+        return TCL_ERROR;
+      }
+
+      /* The progress script may close the database */
+      Tcl_Preserve((ClientData)pDb);
+      for(;;){
+        result = unqlite_backup_step(pDb->db, nPage, &nRemaining, &nTotal);
+        if( result != UNQLITE_OK && result != UNQLITE_DONE ){
+          Tcl_SetResult(interp, "Backup step fail", NULL);
+          rc = TCL_ERROR;
+          break;
+        }
+        if( pProgress ){
+          Tcl_Obj *pScript = Tcl_DuplicateObj(pProgress);
+
+          Tcl_IncrRefCount(pScript);
+          Tcl_ListObjAppendElement(NULL, pScript,
+                                   Tcl_NewWideIntObj((Tcl_WideInt)nRemaining));
+          Tcl_ListObjAppendElement(NULL, pScript,
+                                   Tcl_NewWideIntObj((Tcl_WideInt)nTotal));
+          rc = Tcl_EvalObjEx(interp, pScript, 0);
+          Tcl_DecrRefCount(pScript);
+          if( rc != TCL_OK ){
+            break;
+          }
+          if( pDb->bDeleted ){
+            Tcl_SetResult(interp, "Database closed during backup", NULL);
+            rc = TCL_ERROR;
+            break;
+          }
+        }
+        if( result == UNQLITE_DONE ){
+          break;
+        }
+      }
+
+      unqlite_backup_finish(pDb->db);
+      Tcl_Release((ClientData)pDb);
+      if( rc != TCL_OK ){
+        /* Do not leave a partial image behind */
+        Tcl_FSDeleteFile(objv[2]);
+        return rc;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)nTotal));
+
+      break;
+    }
+
+    /*    $db vacuum ?-incremental N?
+    **
+    ** Defragment the bucket pages, reduce the bucket count and move the
+    ** live pages to the start of the file. The file is truncated when the
+    ** transaction commits. With -incremental, do at most N steps and return
+    ** an estimate of the remaining work, 0 when the file is compact.
+    ** An open cursor is reset to the first entry.
+    */
+    case DB_VACUUM: {
+      char *zArg;
+      unqlite_int64 nRemaining = 0;
+      int nStep = 0;
+
+      if( objc != 2 && objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-incremental N?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 4 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-incremental")==0 ){
+          if( Tcl_GetIntFromObj(interp, objv[3], &nStep) != TCL_OK ) {
+            return TCL_ERROR;
+          }
+          if( nStep < 1 ){
+            Tcl_SetResult(interp, "incremental must be positive", NULL);
+            return TCL_ERROR;
+          }
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_VACUUM,
+                                 nStep, &nRemaining);
+      if( pDb->cursor ){
+        unqlite_kv_cursor_reset(pDb->cursor);
+      }
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Vacuum fail", NULL);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)nRemaining));
+
+      break;
+    }
+
+    /*    $db freelist_count
+    **
+    ** Return a {pages N bytes M} list describing the free pages that the
+    ** next writes will reuse before the file grows, or that vacuum can
+    ** reclaim. The in-memory engine has no free list and returns zeros.
+    */
+    case DB_FREELIST_COUNT: {
+      Tcl_Obj *pList;
+      unqlite_int64 nPage = 0;
+      int nPageSize = 0;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_FREE_PAGES,
+                                 &nPage, &nPageSize);
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Freelist count fail", NULL);
+        return TCL_ERROR;
+      }
+
+      pList = Tcl_NewListObj(0, NULL);
+      Tcl_ListObjAppendElement(NULL, pList, Tcl_NewStringObj("pages", -1));
+      Tcl_ListObjAppendElement(NULL, pList, Tcl_NewWideIntObj((Tcl_WideInt)nPage));
+      Tcl_ListObjAppendElement(NULL, pList, Tcl_NewStringObj("bytes", -1));
+      Tcl_ListObjAppendElement(NULL, pList,
+                               Tcl_NewWideIntObj((Tcl_WideInt)nPage * nPageSize));
+      Tcl_SetObjResult(interp, pList);
+
+      break;
+    }
+
+    /*    $db maintain ?-steps N?
+    **
+    ** Perform the bucket splits deferred by "config -deferSplit 1", at
+    ** most N of them with -steps. Return the number of splits still owed.
+    */
+    case DB_MAINTAIN: {
+      char *zArg;
+      unqlite_int64 nRemaining = 0;
+      int nStep = 0;
+
+      if( objc != 2 && objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-steps N?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 4 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-steps")==0 ){
+          if( Tcl_GetIntFromObj(interp, objv[3], &nStep) != TCL_OK ) {
+            return TCL_ERROR;
+          }
+          if( nStep < 1 ){
+            Tcl_SetResult(interp, "steps must be positive", NULL);
+            return TCL_ERROR;
+          }
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_MAINTAIN,
+                                 nStep, &nRemaining);
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Maintain fail", NULL);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)nRemaining));
+
+      break;
+    }
+
+    /*    $db bloom_rebuild ?-bitsPerKey N?
+    **
+    ** Build the Bloom filter consulted before a lookup reads any bucket
+    ** page, N bits per key (10 by default, about 1% false positives).
+    ** The filter is kept up to date by later stores but deleted keys stay
+    ** in it until the next rebuild. -bitsPerKey 0 drops the filter.
+    ** Return the number of keys indexed.
+    */
+    case DB_BLOOM_REBUILD: {
+      char *zArg;
+      unqlite_int64 nKeys = 0;
+      int nBitsPerKey = 10;
+
+      if( objc != 2 && objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-bitsPerKey N?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 4 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-bitsPerKey")==0 ){
+          if( Tcl_GetIntFromObj(interp, objv[3], &nBitsPerKey) != TCL_OK ) {
+            return TCL_ERROR;
+          }
+          if( nBitsPerKey < 0 || nBitsPerKey > 64 ){
+            Tcl_SetResult(interp, "bitsPerKey must be between 0 and 64", NULL);
+            return TCL_ERROR;
+          }
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_BLOOM_REBUILD,
+                                 nBitsPerKey, &nKeys);
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Bloom rebuild fail", NULL);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)nKeys));
+
+      break;
+    }
+
+    /*    $db vlog_gc ?-minDead PERCENT?
+    **
+    ** Delete the value log segments with at least PERCENT (50 by default)
+    ** of dead bytes, their live values are copied to the active segment
+    ** first. The files are deleted when the transaction commits.
+    ** Return the number of bytes reclaimed.
+    */
+    case DB_VLOG_GC: {
+      char *zArg;
+      unqlite_int64 nReclaimed = 0;
+      int nMinDead = 50;
+
+      if( objc != 2 && objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-minDead PERCENT?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 4 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-minDead")==0 ){
+          if( Tcl_GetIntFromObj(interp, objv[3], &nMinDead) != TCL_OK ) {
+            return TCL_ERROR;
+          }
+          if( nMinDead < 0 || nMinDead > 100 ){
+            Tcl_SetResult(interp, "minDead must be between 0 and 100", NULL);
+            return TCL_ERROR;
+          }
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_VALUE_LOG_GC,
+                                 nMinDead, &nReclaimed);
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Value log gc fail", NULL);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)nReclaimed));
+
+      break;
+    }
+
+    /*    $db blob_open key ?-mode r|w?
+    **
+    ** Return a binary channel on the value of key. In r mode (the default)
+    ** the value is read a chunk at a time. In w mode the value is replaced
+    ** by an empty one and everything written to the channel is appended to
+    ** it, so fcopy between a file and the database runs in constant memory.
+    */
+    case DB_BLOB_OPEN: {
+      char *zKey;
+      char *zArg;
+      Tcl_Size len;
+      int isWrite = 0;
+      UnqliteBlob *p;
+      char zChannel[64];
+      static int nBlob = 0;
+
+      if( objc != 3 && objc != 5 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "key ?-mode r|w?");
+        return TCL_ERROR;
+      }
+
+      zKey = Tcl_GetStringFromObj(objv[2], &len);
+      if( !zKey || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      if( objc == 5 ){
+        zArg = Tcl_GetStringFromObj(objv[3], 0);
+
+        if( strcmp(zArg, "-mode")==0 ){
+          zArg = Tcl_GetStringFromObj(objv[4], 0);
+          if( strcmp(zArg, "r")==0 ){
+            isWrite = 0;
+          }else if( strcmp(zArg, "w")==0 ){
+            isWrite = 1;
+          }else{
+            Tcl_AppendResult(interp, "unknown mode: ", zArg, (char*)0);
+            return TCL_ERROR;
+          }
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      p = (UnqliteBlob *)Tcl_Alloc( sizeof(*p) );
+      memset(p, 0, sizeof(*p));
+      p->zKey = Tcl_Alloc( len + 1 );
+      memcpy(p->zKey, zKey, len + 1);
+      p->nKey = (int)len;
+
+      if( isWrite ){
+        result = unqlite_kv_store(pDb->db, zKey, (int)len, "", 0);
+      }else{
+        result = unqlite_kv_cursor_init(pDb->db, &p->cursor);
+        if( result == UNQLITE_OK ){
+          result = unqlite_kv_cursor_seek(p->cursor, zKey, (int)len, UNQLITE_CURSOR_MATCH_EXACT);
+        }
+      }
+      if( result != UNQLITE_OK ){
+        if(p->cursor) {
+          unqlite_kv_cursor_release(pDb->db, p->cursor);
+        }
+        Tcl_Free(p->zKey);
+        Tcl_Free((char *)p);
+        Tcl_SetResult (interp, "Blob open fail", NULL);
+        return TCL_ERROR;
+      }
+
+      snprintf(zChannel, sizeof(zChannel), "unqlite_blob%d", nBlob++);
+      p->channel = Tcl_CreateChannel(&BlobChannelType, zChannel, p,
+                                     isWrite ? TCL_WRITABLE : TCL_READABLE);
+      Tcl_RegisterChannel(interp, p->channel);
+      Tcl_SetChannelOption(interp, p->channel, "-translation", "binary");
+
+      p->pDb = pDb;
+      p->pNext = pDb->pBlob;
+      pDb->pBlob = p;
+
+      Tcl_SetObjResult(interp, Tcl_NewStringObj(zChannel, -1));
+
+      break;
+    }
+
+    /*    $db cache_save FILENAME
+    **
+    ** Write the numbers of the pages held in the page cache to FILENAME,
+    ** one per line in ascending order, so that a later open with
+    ** -warmup FILENAME reloads them. Return the number of pages saved.
+    */
+    case DB_CACHE_SAVE: {
+      Tcl_Channel chan;
+      PageList sList;
+      char zLine[32];
+      int i;
+
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "filename");
+        return TCL_ERROR;
+      }
+
+      memset(&sList, 0, sizeof(sList));
+      result = unqlite_config(pDb->db, UNQLITE_CONFIG_CACHE_PAGES,
+                              CachePageCallback, (void *)&sList);
+      if( result != UNQLITE_OK ){
+        Tcl_Free((char *)sList.aPage);
+        Tcl_SetResult (interp, "Cache save fail", NULL);
+        return TCL_ERROR;
+      }
+
+      chan = Tcl_FSOpenFileChannel(interp, objv[2], "w", 0644);
+      if( chan == NULL ){
+        Tcl_Free((char *)sList.aPage);
+        return TCL_ERROR;
+      }
+
+      if( sList.nPage > 0 ){
+        qsort(sList.aPage, sList.nPage, sizeof(pgno), PageCompare);
+      }
+      for(i = 0; i < sList.nPage; i++){
+        snprintf(zLine, sizeof(zLine), "%llu\n", (unsigned long long)sList.aPage[i]);
+        Tcl_WriteChars(chan, zLine, -1);
+      }
+      Tcl_Free((char *)sList.aPage);
+
+      if( Tcl_Close(interp, chan) != TCL_OK ){
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewIntObj(sList.nPage));
+
+      break;
+    }
+
+    /*    $db warmup ?-all?
+    **
+    ** Load the whole bucket map and the bucket pages into the page cache
+    ** with large sequential reads. With -all every page of the database
+    ** is loaded. Return the number of pages read.
+    */
+    case DB_WARMUP: {
+      char *zArg;
+      unqlite_int64 nPage = 0;
+      int bAll = 0;
+
+      if( objc != 2 && objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-all?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 3 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-all")==0 ){
+          bAll = 1;
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_WARMUP, bAll, &nPage);
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Warmup fail", NULL);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)nPage));
+
+      break;
+    }
+
+    /*    $db stats ?-reset?
+    **
+    ** Return a dict of the pager and storage engine counters, plus the
+    ** number of cached pages and the bytes of memory in use. With -reset
+    ** the counters are zeroed after being read.
+    */
+    case DB_STATS: {
+      char *zArg;
+      unqlite_pager_stats sPager;
+      unqlite_kv_stats sKv;
+      unqlite_int64 nMemUsed = 0;
+      Tcl_Obj *pResultDict;
+      int bReset = 0;
+
+      if( objc != 2 && objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-reset?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 3 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-reset")==0 ){
+          bReset = 1;
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      memset(&sPager, 0, sizeof(sPager));
+      memset(&sKv, 0, sizeof(sKv));
+      result = unqlite_config(pDb->db, UNQLITE_CONFIG_PAGER_STATS, &sPager, bReset);
+      if( result == UNQLITE_OK ){
+        result = unqlite_config(pDb->db, UNQLITE_CONFIG_MEM_USED, &nMemUsed);
+      }
+      if( result == UNQLITE_OK ){
+        result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_STATS, &sKv, bReset);
+      }
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Stats fail", NULL);
+        return TCL_ERROR;
+      }
+
+      pResultDict = Tcl_NewDictObj();
+#define STATS_PUT(zKey, iValue) \
+      Tcl_DictObjPut(interp, pResultDict, Tcl_NewStringObj(zKey, -1), \
+                     Tcl_NewWideIntObj((Tcl_WideInt)(iValue)))
+      STATS_PUT("cache_hits", sPager.nHit);
+      STATS_PUT("cache_misses", sPager.nMiss);
+      STATS_PUT("cache_evictions", sPager.nEvict);
+      STATS_PUT("cached_pages", sPager.nCached);
+      STATS_PUT("pages_read", sPager.nRead);
+      STATS_PUT("pages_prefetched", sPager.nPrefetch);
+      STATS_PUT("pages_written", sPager.nWrite);
+      STATS_PUT("journal_bytes", sPager.nJournal);
+      STATS_PUT("syncs", sPager.nSync);
+      STATS_PUT("commits", sPager.nCommit);
+      STATS_PUT("splits", sKv.nSplit);
+      STATS_PUT("slave_pages", sKv.nSlave);
+      STATS_PUT("overflow_pages", sKv.nOverflow);
+      STATS_PUT("cell_inserts", sKv.nInsert);
+      STATS_PUT("cell_deletes", sKv.nDelete);
+      STATS_PUT("mem_used", nMemUsed + sKv.nMemUsed);
+#undef STATS_PUT
+      Tcl_SetObjResult(interp, pResultDict);
+
+      break;
+    }
+
+    /*    $db latency ?command?
+    **
+    ** Return the latency of the subcommands timed since "config -timing 1"
+    ** as a dict of command name to {count mean p50 p99 p999 max}, times in
+    ** microseconds. Cursor subcommands are named cursor_next and so on.
+    ** With a command name, return the summary of that command only.
+    */
+    case DB_LATENCY: {
+      Tcl_Obj *pResultDict;
+      char *zArg;
+      int iSlot;
+
+      if( objc != 2 && objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?command?");
+        return TCL_ERROR;
+      }
+
+      if( pDb->aLatency == 0 ){
+        Tcl_SetResult (interp, "Timing is off", NULL);
+        return TCL_ERROR;
+      }
+
+      if( objc == 3 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+        for(iSlot = 0; iSlot < LATENCY_SLOTS; iSlot++){
+          if( iSlot < LATENCY_NDB ){
+            if( strcmp(DB_strs[iSlot], zArg)==0 ) break;
+          }else if( strncmp(zArg, "cursor_", 7)==0 &&
+                    strcmp(CURSOR_strs[iSlot - LATENCY_NDB], &zArg[7])==0 ){
+            break;
+          }
+        }
+        if( iSlot >= LATENCY_SLOTS ){
+          Tcl_AppendResult(interp, "unknown command: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, LatencySummary(interp, &pDb->aLatency[iSlot]));
+        break;
+      }
+
+      pResultDict = Tcl_NewDictObj();
+      for(iSlot = 0; iSlot < LATENCY_SLOTS; iSlot++){
+        if( pDb->aLatency[iSlot].nCount > 0 ){
+          Tcl_DictObjPut(interp, pResultDict, LatencyName(iSlot),
+                         LatencySummary(interp, &pDb->aLatency[iSlot]));
+        }
+      }
+      Tcl_SetObjResult(interp, pResultDict);
+
+      break;
+    }
+
+    /*    $db analyze ?-sample PERCENT?
+    **
+    ** Walk the buckets of the database and return a dict describing its
+    ** layout: bucket and page counts, overflow pages and how full they
+    ** are, free bytes on the bucket pages and histograms of the cells per
+    ** bucket, slave chain lengths, page fill and key and value sizes.
+    ** With -sample only about PERCENT of the buckets are walked.
+    */
+    case DB_ANALYZE: {
+      unqlite_kv_analysis sInfo;
+      Tcl_Obj *pResultDict;
+      unqlite_int64 nPages;
+      char *zArg;
+      int nPercent = 100;
+
+      if( objc != 2 && objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-sample PERCENT?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 4 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+
+        if( strcmp(zArg, "-sample")==0 ){
+          if( Tcl_GetIntFromObj(interp, objv[3], &nPercent) != TCL_OK ) return TCL_ERROR;
+          if( nPercent < 1 || nPercent > 100 ){
+            Tcl_SetResult(interp, "sample must be between 1 and 100", NULL);
+            return TCL_ERROR;
+          }
+        }else{
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      result = unqlite_kv_config(pDb->db, UNQLITE_KV_CONFIG_ANALYZE, nPercent, &sInfo);
+      if( result != UNQLITE_OK ){
+        Tcl_SetResult (interp, "Analyze fail", NULL);
+        return TCL_ERROR;
+      }
+
+      pResultDict = Tcl_NewDictObj();
+#define ANALYZE_PUT(zKey, pValue) \
+      Tcl_DictObjPut(interp, pResultDict, Tcl_NewStringObj(zKey, -1), pValue)
+      nPages = sInfo.nSampled + sInfo.nSlave;
+      ANALYZE_PUT("page_size", Tcl_NewIntObj(sInfo.iPageSize));
+      ANALYZE_PUT("pages", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nPage));
+      ANALYZE_PUT("logical_buckets", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nLogic));
+      ANALYZE_PUT("real_buckets", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nReal));
+      ANALYZE_PUT("sampled_buckets", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nSampled));
+      ANALYZE_PUT("cells", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nCell));
+      ANALYZE_PUT("slave_pages", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nSlave));
+      ANALYZE_PUT("overflow_pages", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nOverflow));
+      ANALYZE_PUT("overflow_fill", Tcl_NewDoubleObj(sInfo.nOvflRoom > 0 ?
+                  100.0 * (double)sInfo.nOvflBytes / (double)sInfo.nOvflRoom : 0.0));
+      ANALYZE_PUT("free_bytes", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nFree));
+      ANALYZE_PUT("avg_free_bytes", Tcl_NewDoubleObj(nPages > 0 ?
+                  (double)sInfo.nFree / (double)nPages : 0.0));
+      ANALYZE_PUT("value_log_cells", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nVlog));
+      ANALYZE_PUT("compressed_cells", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nLz));
+      ANALYZE_PUT("hash_collisions", Tcl_NewWideIntObj((Tcl_WideInt)sInfo.nHashDup));
+      ANALYZE_PUT("cells_per_bucket",
+                  AnalyzeHistogram(interp, sInfo.aCell, UNQLITE_KV_ANALYZE_HIST, 1, 0));
+      ANALYZE_PUT("slave_chains",
+                  AnalyzeHistogram(interp, sInfo.aChain, UNQLITE_KV_ANALYZE_HIST, 0, 1));
+      ANALYZE_PUT("page_fill", AnalyzeHistogram(interp, sInfo.aFill, 10, 0, 10));
+      ANALYZE_PUT("key_sizes",
+                  AnalyzeHistogram(interp, sInfo.aKey, UNQLITE_KV_ANALYZE_HIST, 1, 0));
+      ANALYZE_PUT("value_sizes",
+                  AnalyzeHistogram(interp, sInfo.aData, UNQLITE_KV_ANALYZE_HIST, 1, 0));
+#undef ANALYZE_PUT
+      Tcl_SetObjResult(interp, pResultDict);
+
+      break;
+    }
+
+  } /* End of the SWITCH statement */
 
   return rc;
 }
 
+/*
+** The database command, see CursorTimedObjCmd(). "close" is not timed
+** since the handle, histograms included, is gone when it returns.
+*/
+static int DbTimedObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  UnqliteDb *pDb = (UnqliteDb *) cd;
+  int choice;
+
+  if( (pDb->aLatency == 0 && pDb->pSlowlog == 0) || objc < 2 ||
+      Tcl_GetIndexFromObj(NULL, objv[1], DB_strs, "option", 0, &choice) != TCL_OK ||
+      strcmp(DB_strs[choice], "close")==0 ){
+    return DbObjCmd(cd, interp, objc, objv);
+  }
+
+  return TimedCall(DbObjCmd, choice, cd, interp, objc, objv);
+}
+
 
 
 /*
 **   unqlite DBNAME FILENAME ?-readonly BOOLEAN? ?-mmap BOOLEAN? ?-create BOOLEAN?
 **                           ?-in-memory BOOLEAN? ?-nomutex BOOLEAN?
+**                           ?-hash djb|mix64? ?-compress lz|none? ?-compressMin BYTES?
+**                           ?-pageCompress BOOLEAN? ?-warmup FILENAME?
+**                           ?-pagesize BYTES?
 **
 ** This is the main Tcl command.  When the "unqlite" Tcl command is
 ** invoked, this routine runs to process that command.
@@ -1712,6 +3144,12 @@ static int DbMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
   const char *zFile;
   int flags;
   Tcl_DString translatedFilename;
+  int iHashId = 0;
+  int iCompress = UNQLITE_KV_COMPRESS_NONE;
+  Tcl_WideInt nCompressMin = 64;
+  int bPageCompress = 0;
+  Tcl_Obj *pWarmup = NULL;
+  int iPageSize = 0;
   int rc;
 
 
@@ -1736,7 +3174,7 @@ static int DbMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
 
   if( objc<3 || (objc&1)!=1 ){
     Tcl_WrongNumArgs(interp, 1, objv,
-      "HANDLE FILENAME ?-readonly BOOLEAN? ?-mmap BOOLEAN? ?-create BOOLEAN? ?-in-memory BOOLEAN? ?-nomutex BOOLEAN? "
+      "HANDLE FILENAME ?-readonly BOOLEAN? ?-mmap BOOLEAN? ?-create BOOLEAN? ?-in-memory BOOLEAN? ?-nomutex BOOLEAN? ?-hash djb|mix64? ?-compress lz|none? ?-compressMin BYTES? ?-pageCompress BOOLEAN? ?-warmup FILENAME? ?-pagesize BYTES? "
     );
     return TCL_ERROR;
   }
@@ -1758,10 +3196,11 @@ static int DbMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
       int b;
 
       /*
-       * UNQLITE_OPEN_MMAP: Obtain a read-only memory view of the whole database.
+       * UNQLITE_OPEN_MMAP: Serve page reads from a memory view of the whole
+       * database. Writes still go through the journal.
        */
       if( Tcl_GetBooleanFromObj(interp, objv[i+1], &b) ) return TCL_ERROR;
-      if( b && (flags & UNQLITE_OPEN_READONLY)==1 ){
+      if( b ){
         flags |= UNQLITE_OPEN_MMAP;
       }else{
         flags &= ~UNQLITE_OPEN_MMAP;
@@ -1795,6 +3234,65 @@ static int DbMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
       }else{
         flags &= ~UNQLITE_OPEN_NOMUTEX;
       }
+    }else if( strcmp(zArg, "-hash")==0 ){
+      const char *zHash = Tcl_GetStringFromObj(objv[i+1], 0);
+
+      /*
+       * Hash function of a new database. An existing database keeps
+       * the one it was created with.
+       */
+      if( strcmp(zHash, "djb")==0 ){
+        iHashId = UNQLITE_KV_HASH_DJB;
+      }else if( strcmp(zHash, "mix64")==0 ){
+        iHashId = UNQLITE_KV_HASH_MIX64;
+      }else{
+        Tcl_AppendResult(interp, "unknown hash: ", zHash, (char*)0);
+        return TCL_ERROR;
+      }
+    }else if( strcmp(zArg, "-compress")==0 ){
+      const char *zCodec = Tcl_GetStringFromObj(objv[i+1], 0);
+
+      /*
+       * Compression of the values stored by this handle. Compressed
+       * values are read back transparently whatever the setting.
+       */
+      if( strcmp(zCodec, "lz")==0 ){
+        iCompress = UNQLITE_KV_COMPRESS_LZ;
+      }else if( strcmp(zCodec, "none")==0 ){
+        iCompress = UNQLITE_KV_COMPRESS_NONE;
+      }else{
+        Tcl_AppendResult(interp, "unknown compression: ", zCodec, (char*)0);
+        return TCL_ERROR;
+      }
+    }else if( strcmp(zArg, "-compressMin")==0 ){
+      if( Tcl_GetWideIntFromObj(interp, objv[i+1], &nCompressMin) ) return TCL_ERROR;
+      if( nCompressMin < 0 ){
+        Tcl_SetResult(interp, "compressMin must be >= 0", NULL);
+        return TCL_ERROR;
+      }
+    }else if( strcmp(zArg, "-pageCompress")==0 ){
+      /*
+       * Compress the pages written by this handle. Compressed pages
+       * are read back transparently whatever the setting.
+       */
+      if( Tcl_GetBooleanFromObj(interp, objv[i+1], &bPageCompress) ) return TCL_ERROR;
+    }else if( strcmp(zArg, "-warmup")==0 ){
+      /*
+       * Reload the pages saved by "$db cache_save" once the database
+       * is open.
+       */
+      pWarmup = objv[i+1];
+    }else if( strcmp(zArg, "-pagesize")==0 ){
+      /*
+       * Page size of a new database. An existing database keeps
+       * the one it was created with.
+       */
+      if( Tcl_GetIntFromObj(interp, objv[i+1], &iPageSize) ) return TCL_ERROR;
+      if( iPageSize < 512 || iPageSize > 65536 || (iPageSize & (iPageSize-1)) ){
+        Tcl_SetResult(interp,
+          "pagesize must be a power of two between 512 and 65536", NULL);
+        return TCL_ERROR;
+      }
     }else{
       Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
       return TCL_ERROR;
@@ -1813,6 +3311,31 @@ static int DbMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
   rc = unqlite_open(&p->db, zFile, flags);
   Tcl_DStringFree(&translatedFilename);
 
+  if( rc == UNQLITE_OK && iPageSize ){
+     /* UNQLITE_LOCKED: in-memory database, the pages never reach the disk */
+     int result = unqlite_config(p->db, UNQLITE_CONFIG_PAGE_SIZE, iPageSize);
+     if( result != UNQLITE_OK && result != UNQLITE_LOCKED ){
+       rc = result;
+     }
+  }
+
+  if( rc == UNQLITE_OK && iHashId ){
+     /* UNQLITE_LOCKED: the database exists, keep its hash function */
+     int result = unqlite_kv_config(p->db, UNQLITE_KV_CONFIG_HASH_ID, iHashId);
+     if( result != UNQLITE_OK && result != UNQLITE_LOCKED ){
+       rc = result;
+     }
+  }
+
+  if( rc == UNQLITE_OK && iCompress != UNQLITE_KV_COMPRESS_NONE ){
+     rc = unqlite_kv_config(p->db, UNQLITE_KV_CONFIG_COMPRESS, iCompress,
+                            (unqlite_int64)nCompressMin);
+  }
+
+  if( rc == UNQLITE_OK && bPageCompress ){
+     rc = unqlite_config(p->db, UNQLITE_CONFIG_PAGE_COMPRESS, 1);
+  }
+
   if( rc != UNQLITE_OK ) {
      unqlite_close(p->db);
      p->db = 0;
@@ -1824,14 +3347,235 @@ static int DbMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
     return TCL_ERROR;
   }
 
+  if( pWarmup && CacheLoadFile(interp, p->db, pWarmup) != TCL_OK ){
+    unqlite_close(p->db);
+    Tcl_Free((char*)p);
+    return TCL_ERROR;
+  }
+
   p->interp = interp;
   zArg = Tcl_GetStringFromObj(objv[1], 0);
-  Tcl_CreateObjCommand(interp, zArg, DbObjCmd, (char*)p, DbDeleteCmd);
+  Tcl_CreateObjCommand(interp, zArg, DbTimedObjCmd, (char*)p, DbDeleteCmd);
 
   return TCL_OK;
 }
 
 
+/*
+** Growable buffer filled by the cursor consumers of DbRebuild().
+*/
+typedef struct RebuildBuf RebuildBuf;
+struct RebuildBuf {
+  char *z;               /* Buffer, NULL until the first record */
+  unsigned int n;        /* Bytes used */
+  unsigned int nAlloc;   /* Bytes allocated */
+};
+
+static int RebuildConsumer(const void *pData, unsigned int nData, void *pUserData){
+  RebuildBuf *p = (RebuildBuf *)pUserData;
+
+  if( p->n + nData > p->nAlloc ){
+    unsigned int nNew = p->nAlloc ? p->nAlloc : 4096;
+
+    while( nNew < p->n + nData ) nNew <<= 1;
+    p->z = Tcl_Realloc(p->z, nNew);
+    p->nAlloc = nNew;
+  }
+  memcpy(&p->z[p->n], pData, nData);
+  p->n += nData;
+
+  return UNQLITE_OK;
+}
+
+/*
+**   unqlite_rebuild SRC DST ?-pagesize N? ?-engine NAME? ?-compress?
+**
+** Copy every record of the database file SRC into the new database file
+** DST, the way to change the page size or the storage engine which are
+** fixed once a file is created. The records are streamed by a C cursor
+** into DST opened without a journal, with its buckets sized up front
+** from a first pass over SRC, and written with a single commit. DST must
+** not hold any record and is left incomplete on error. -compress stores
+** the values with the LZ codec. Return the number of records copied.
+*/
+static int DbRebuild(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  unqlite *pSrc = 0;
+  unqlite *pDst = 0;
+  unqlite_kv_cursor *pCur = 0;
+  RebuildBuf sKey, sData;
+  Tcl_DString translatedFilename;
+  const char *zArg;
+  const char *zFile;
+  const char *zEngine = 0;
+  int iPageSize = 0;
+  int bCompress = 0;
+  unqlite_int64 nRecord = 0;
+  unqlite_int64 nPayload = 0;
+  unqlite_int64 nData;
+  int nKey;
+  int i, result;
+
+  if( objc<3 ){
+    Tcl_WrongNumArgs(interp, 1, objv,
+      "SRC DST ?-pagesize N? ?-engine NAME? ?-compress?");
+    return TCL_ERROR;
+  }
+
+  for(i=3; i<objc; i++){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-compress")==0 ){
+      bCompress = 1;
+    }else if( strcmp(zArg, "-pagesize")!=0 && strcmp(zArg, "-engine")!=0 ){
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }else if( i+1>=objc ){
+      Tcl_WrongNumArgs(interp, 1, objv,
+        "SRC DST ?-pagesize N? ?-engine NAME? ?-compress?");
+      return TCL_ERROR;
+    }else if( strcmp(zArg, "-pagesize")==0 ){
+      if( Tcl_GetIntFromObj(interp, objv[++i], &iPageSize) != TCL_OK ) {
+        return TCL_ERROR;
+      }
+      if( iPageSize < 512 || iPageSize > 65536 || (iPageSize & (iPageSize-1)) ){
+        Tcl_SetResult(interp,
+          "pagesize must be a power of two between 512 and 65536", NULL);
+        return TCL_ERROR;
+      }
+    }else{
+      zEngine = Tcl_GetStringFromObj(objv[++i], 0);
+    }
+  }
+
+  zFile = Tcl_TranslateFileName(interp, Tcl_GetStringFromObj(objv[1], 0),
+                                &translatedFilename);
+  if( zFile == NULL ){
+    return TCL_ERROR;
+  }
+  result = unqlite_open(&pSrc, zFile, UNQLITE_OPEN_READONLY|UNQLITE_OPEN_MMAP);
+  Tcl_DStringFree(&translatedFilename);
+  if( result != UNQLITE_OK ){
+    Tcl_SetResult(interp, "Open source database fail", NULL);
+    return TCL_ERROR;
+  }
+
+  zFile = Tcl_TranslateFileName(interp, Tcl_GetStringFromObj(objv[2], 0),
+                                &translatedFilename);
+  if( zFile == NULL ){
+    unqlite_close(pSrc);
+    return TCL_ERROR;
+  }
+  result = unqlite_open(&pDst, zFile,
+             UNQLITE_OPEN_CREATE|UNQLITE_OPEN_READWRITE|UNQLITE_OPEN_OMIT_JOURNALING);
+  Tcl_DStringFree(&translatedFilename);
+  if( result != UNQLITE_OK ){
+    unqlite_close(pSrc);
+    Tcl_SetResult(interp, "Open destination database fail", NULL);
+    return TCL_ERROR;
+  }
+
+  /* Fixed by the first access to DST */
+  if( zEngine ){
+    result = unqlite_config(pDst, UNQLITE_CONFIG_KV_ENGINE, zEngine);
+    if( result != UNQLITE_OK ){
+      unqlite_close(pSrc);
+      unqlite_close(pDst);
+      Tcl_AppendResult(interp, result == UNQLITE_NOTIMPLEMENTED ?
+        "unknown engine: " : "engine cannot back a file: ", zEngine, (char*)0);
+      return TCL_ERROR;
+    }
+  }
+  if( iPageSize ){
+    result = unqlite_config(pDst, UNQLITE_CONFIG_PAGE_SIZE, iPageSize);
+  }
+  if( result == UNQLITE_OK && bCompress ){
+    result = unqlite_kv_config(pDst, UNQLITE_KV_CONFIG_COMPRESS,
+                               UNQLITE_KV_COMPRESS_LZ, (unqlite_int64)64);
+  }
+  if( result == UNQLITE_OK ){
+    result = unqlite_kv_cursor_init(pSrc, &pCur);
+  }
+  if( result != UNQLITE_OK ){
+    unqlite_close(pSrc);
+    unqlite_close(pDst);
+    Tcl_SetResult(interp, "Rebuild fail", NULL);
+    return TCL_ERROR;
+  }
+
+  /* First pass: count the records to size the buckets of DST */
+  result = unqlite_kv_cursor_first_entry(pCur);
+  while( result == UNQLITE_OK && unqlite_kv_cursor_valid_entry(pCur) ){
+    result = unqlite_kv_cursor_key(pCur, NULL, &nKey);
+    if( result == UNQLITE_OK ){
+      result = unqlite_kv_cursor_data(pCur, NULL, &nData);
+    }
+    if( result != UNQLITE_OK ){
+      break;
+    }
+    nRecord++;
+    nPayload += nKey + nData;
+    result = unqlite_kv_cursor_next_entry(pCur);
+  }
+  if( result == UNQLITE_DONE ){
+    result = unqlite_kv_config(pDst, UNQLITE_KV_CONFIG_PRESIZE,
+                               nRecord, nPayload);
+    if( result == UNQLITE_LOCKED ){
+      unqlite_kv_cursor_release(pSrc, pCur);
+      unqlite_close(pSrc);
+      unqlite_close(pDst);
+      Tcl_SetResult(interp, "destination database is not empty", NULL);
+      return TCL_ERROR;
+    }
+  }
+
+  /* Second pass: copy */
+  memset(&sKey, 0, sizeof(sKey));
+  memset(&sData, 0, sizeof(sData));
+  nRecord = 0;
+  if( result == UNQLITE_OK ){
+    result = unqlite_kv_cursor_first_entry(pCur);
+  }
+  while( result == UNQLITE_OK && unqlite_kv_cursor_valid_entry(pCur) ){
+    sKey.n = sData.n = 0;
+    result = unqlite_kv_cursor_key_callback(pCur, RebuildConsumer, &sKey);
+    if( result == UNQLITE_OK ){
+      result = unqlite_kv_cursor_data_callback(pCur, RebuildConsumer, &sData);
+    }
+    if( result == UNQLITE_OK ){
+      result = unqlite_kv_store(pDst, sKey.z, (int)sKey.n,
+                                sData.z ? sData.z : "", sData.n);
+    }
+    if( result != UNQLITE_OK ){
+      break;
+    }
+    nRecord++;
+    result = unqlite_kv_cursor_next_entry(pCur);
+  }
+  if( result == UNQLITE_DONE ){
+    /* The only sync of DST */
+    result = unqlite_commit(pDst);
+  }
+
+  if( sKey.z ) Tcl_Free(sKey.z);
+  if( sData.z ) Tcl_Free(sData.z);
+  unqlite_kv_cursor_release(pSrc, pCur);
+  unqlite_close(pSrc);
+  if( result != UNQLITE_OK ){
+    unqlite_rollback(pDst);
+    unqlite_close(pDst);
+    Tcl_SetResult(interp, "Rebuild fail", NULL);
+    return TCL_ERROR;
+  }
+  if( unqlite_close(pDst) != UNQLITE_OK ){
+    Tcl_SetResult(interp, "Rebuild fail", NULL);
+    return TCL_ERROR;
+  }
+
+  Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)nRecord));
+
+  return TCL_OK;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1844,7 +3588,8 @@ static int DbMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
  *
  * Side effects:
  *	The Unqlite package is created.
- *	One new command "unqlite" is added to the Tcl interpreter.
+ *	Two new commands "unqlite" and "unqlite_rebuild" are added to
+ *	the Tcl interpreter.
  *
  *----------------------------------------------------------------------
  */
@@ -1860,6 +3605,8 @@ EXTERN int Unqlite_Init(Tcl_Interp *interp)
 
     Tcl_CreateObjCommand(interp, "unqlite", (Tcl_ObjCmdProc *) DbMain,
     	    (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+    Tcl_CreateObjCommand(interp, "unqlite_rebuild", (Tcl_ObjCmdProc *) DbRebuild,
+    	    (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
 
 #ifdef UNQLITE_ENABLE_THREADS
   // Try to enable unqlite multi-thread support
@@ -10,6 +10,10 @@
  * or visit:
  *      http://unqlite.org/licensing.html
  */
+/* fallocate() and the FALLOC_FL_* flags used by the Unix VFS to punch holes */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
 /*
  * Copyright (C) 2012, 2022 Symisc Systems, S.U.A.R.L [M.I.A.G Mrad Chems Eddine <chm@symisc.net>].
  * All rights reserved.
@@ -461,6 +465,13 @@ typedef sxi64 unqlite_int64;
 #define UNQLITE_CONFIG_KV_ENGINE           4  /* ONE ARGUMENT: const char *zKvName */
 #define UNQLITE_CONFIG_DISABLE_AUTO_COMMIT 5  /* NO ARGUMENTS */
 #define UNQLITE_CONFIG_GET_KV_NAME         6  /* ONE ARGUMENT: const char **pzPtr */
+#define UNQLITE_CONFIG_PAGE_CODEC          7  /* ONE ARGUMENT: const unqlite_page_codec *pCodec */
+#define UNQLITE_CONFIG_PAGE_COMPRESS       8  /* ONE ARGUMENT: int bEnable */
+#define UNQLITE_CONFIG_CACHE_PAGES         9  /* TWO ARGUMENTS: int (*xPage)(pgno iPage,void *pUserData), void *pUserData */
+#define UNQLITE_CONFIG_CACHE_LOAD         10  /* TWO ARGUMENTS: const pgno *aPage, int nPage */
+#define UNQLITE_CONFIG_PAGER_STATS        11  /* TWO ARGUMENTS: unqlite_pager_stats *pStats, int bReset */
+#define UNQLITE_CONFIG_MEM_USED           12  /* ONE ARGUMENT: unqlite_int64 *pBytes */
+#define UNQLITE_CONFIG_PAGE_SIZE          13  /* ONE ARGUMENT: int iPageSize */
 /*
  * UnQLite/Jx9 Virtual Machine Configuration Commands.
  *
@@ -506,6 +517,35 @@ typedef sxi64 unqlite_int64;
  */
 #define UNQLITE_KV_CONFIG_HASH_FUNC  1 /* ONE ARGUMENT: unsigned int (*xHash)(const void *,unsigned int) */
 #define UNQLITE_KV_CONFIG_CMP_FUNC   2 /* ONE ARGUMENT: int (*xCmp)(const void *,const void *,unsigned int) */
+#define UNQLITE_KV_CONFIG_INTEGRITY_CHECK 3 /* THREE ARGUMENTS: int nThread, int (*xReport)(pgno iPage,const char *zReason,void *pUserData), void *pUserData */
+#define UNQLITE_KV_CONFIG_VACUUM          4 /* TWO ARGUMENTS: int nStep, unqlite_int64 *pRemaining */
+#define UNQLITE_KV_CONFIG_FREE_PAGES      5 /* TWO ARGUMENTS: unqlite_int64 *pCount, int *pPageSize */
+#define UNQLITE_KV_CONFIG_DEFER_SPLIT     6 /* ONE ARGUMENT: int bDefer */
+#define UNQLITE_KV_CONFIG_MAINTAIN        7 /* TWO ARGUMENTS: int nStep, unqlite_int64 *pRemaining */
+#define UNQLITE_KV_CONFIG_HASH_ID         8 /* ONE ARGUMENT: int iHashId (UNQLITE_KV_HASH_*) */
+#define UNQLITE_KV_CONFIG_BLOOM_REBUILD   9 /* TWO ARGUMENTS: int nBitsPerKey, unqlite_int64 *pKeys */
+#define UNQLITE_KV_CONFIG_VALUE_LOG      10 /* TWO ARGUMENTS: unqlite_int64 nThreshold, unqlite_int64 nSegmentSize */
+#define UNQLITE_KV_CONFIG_VALUE_LOG_GC   11 /* TWO ARGUMENTS: int nMinDeadPercent, unqlite_int64 *pReclaimed */
+#define UNQLITE_KV_CONFIG_COMPRESS      12 /* TWO ARGUMENTS: int iCodec (UNQLITE_KV_COMPRESS_*), unqlite_int64 nMinSize */
+#define UNQLITE_KV_CONFIG_WARMUP        13 /* TWO ARGUMENTS: int bAll, unqlite_int64 *pPages */
+#define UNQLITE_KV_CONFIG_STATS         14 /* TWO ARGUMENTS: unqlite_kv_stats *pStats, int bReset */
+#define UNQLITE_KV_CONFIG_ANALYZE       15 /* TWO ARGUMENTS: int nPercent, unqlite_kv_analysis *pInfo */
+#define UNQLITE_KV_CONFIG_PRESIZE       16 /* TWO ARGUMENTS: unqlite_int64 nRecord, unqlite_int64 nPayload */
+#define UNQLITE_KV_CONFIG_SIDE_FILES    17 /* TWO ARGUMENTS: int (*xFile)(void *,const char *zSuffix,unqlite_int64 nSize), void *pUserData */
+/*
+ * Built-in hash functions of the linear hash engine. The function a database
+ * was created with is recorded in its header and is used from then on.
+ * UNQLITE_KV_CONFIG_HASH_ID select the one used for a new database.
+ * Stock UnQLite only knows DJB and rejects a database created with MIX64.
+ */
+#define UNQLITE_KV_HASH_DJB   1 /* Byte-at-a-time DJB over the first 2KB of the key (Default) */
+#define UNQLITE_KV_HASH_MIX64 2 /* Word-at-a-time 64-bit mix over the whole key (Opt-in) */
+/*
+ * Value compression codecs (UNQLITE_KV_CONFIG_COMPRESS). The setting only
+ * affect the values stored afterward, compressed values are always readable.
+ */
+#define UNQLITE_KV_COMPRESS_NONE 0 /* Store the values as is (Default) */
+#define UNQLITE_KV_COMPRESS_LZ   1 /* Built-in LZ77 codec */
 /*
  * Global Library Configuration Commands.
  *
@@ -631,9 +671,26 @@ struct unqlite_file {
  * the file. The sector size is the minimum write that can be performed without
  * disturbing other bytes in the file.
  *
+ * The xAdvise() method (Version 2) tells the OS that the given range of the file
+ * is about to be read so that it can be brought into the OS cache ahead of time.
+ * It is only a hint, may be NULL and its return value is ignored.
+ *
+ * The xPunchHole() method (Version 3) releases the disk blocks backing the given
+ * range of the file, which then reads back as zeros. The file size is unchanged.
+ * It may be NULL and is used to free the unused tail of compressed page slots.
+ *
+ * The xMmap() method (Version 4) returns a read-only memory view of the first
+ * iSize bytes of the file and xUnmap() releases it. The view is obtained from
+ * the open file so that the locks held on it are kept. Both may be NULL, the
+ * pages are then read with xRead().
+ *
+ * The xReadAt() method (Version 5) reads like xRead() but may be called from
+ * several threads at once on the same file, the file offset is not used. It
+ * may be NULL, the integrity check then reads the pages from a single thread.
+ *
  */
 struct unqlite_io_methods {
-  int iVersion;                 /* Structure version number (currently 1) */
+  int iVersion;                 /* Structure version number (currently 5) */
   int (*xClose)(unqlite_file*);
   int (*xRead)(unqlite_file*, void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
   int (*xWrite)(unqlite_file*, const void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
@@ -644,6 +701,15 @@ struct unqlite_io_methods {
   int (*xUnlock)(unqlite_file*, int);
   int (*xCheckReservedLock)(unqlite_file*, int *pResOut);
   int (*xSectorSize)(unqlite_file*);
+  /* Methods above are valid for version 1 */
+  int (*xAdvise)(unqlite_file*, unqlite_int64 iOfst, unqlite_int64 iAmt); /* Read ahead hint (May be NULL) */
+  /* Methods above are valid for version 2 */
+  int (*xPunchHole)(unqlite_file*, unqlite_int64 iOfst, unqlite_int64 iAmt); /* Release the disk blocks of a range (May be NULL) */
+  /* Methods above are valid for version 3 */
+  int (*xMmap)(unqlite_file*, unqlite_int64 iSize, void **ppMap); /* Read-only memory view of the file (May be NULL) */
+  void (*xUnmap)(unqlite_file*, void *pMap, unqlite_int64 iSize); /* Release a memory view (May be NULL) */
+  /* Methods above are valid for version 4 */
+  int (*xReadAt)(unqlite_file*, void*, unqlite_int64 iAmt, unqlite_int64 iOfst); /* Thread safe xRead() (May be NULL) */
 };
 /*
  * CAPIREF: OS Interface Object
@@ -732,6 +798,107 @@ struct unqlite_page
   void *pUserData;            /* Extra content */
   pgno iPage;                 /* Page number for this page */
 };
+/*
+ * Page codec.
+ *
+ * An instance of the following structure can be installed on a database handle via
+ * [unqlite_config()] using the UNQLITE_CONFIG_PAGE_CODEC verb (The structure is copied,
+ * a NULL pointer remove the codec). Every page image the pager write to the database
+ * or journal file, except the database header (page 0), is passed through xEncode()
+ * and every page image read back is passed through xDecode().
+ * xEncode() store at most nPageSize bytes in zOut[] and set *pnOut to the number of
+ * bytes that must reach the disk. Only these bytes are written to the database file,
+ * the rest of the page slot is left as is.
+ * xDecode() is given the whole page slot and must rebuild exactly nPageSize bytes in zOut[].
+ * Pages read before the codec was installed (The storage engine header is read by
+ * [unqlite_open()]) or written without it are handed to xDecode() as well, so a codec
+ * must recognize its own images and copy any other page as is.
+ * Both methods must return UNQLITE_OK on success, any other return value is reported
+ * as an IO error.
+ * The built-in compressing codec is installed by the UNQLITE_CONFIG_PAGE_COMPRESS verb.
+ * Its pages are recognized on read whether the codec is installed or not.
+ */
+typedef struct unqlite_page_codec unqlite_page_codec;
+struct unqlite_page_codec
+{
+	const char *zName; /* Codec name */
+	int (*xEncode)(void *pCodecArg,pgno iPage,const unsigned char *zIn,unsigned char *zOut,int nPageSize,int *pnOut);
+	int (*xDecode)(void *pCodecArg,pgno iPage,const unsigned char *zIn,unsigned char *zOut,int nPageSize);
+	void *pCodecArg;   /* First argument to xEncode() and xDecode() */
+};
+/*
+ * Pager statistics.
+ *
+ * Filled by [unqlite_config()] using the UNQLITE_CONFIG_PAGER_STATS verb. The counters
+ * are plain increments on the handle and are zeroed when bReset is set, nCached
+ * reports the current state and is never reset. Taking a snapshot is cheap, the
+ * memory held by the handle is reported by UNQLITE_CONFIG_MEM_USED instead.
+ */
+typedef struct unqlite_pager_stats unqlite_pager_stats;
+struct unqlite_pager_stats
+{
+	unqlite_int64 nHit;       /* Page requests served by the page cache */
+	unqlite_int64 nMiss;      /* Page requests that had to load the page */
+	unqlite_int64 nEvict;     /* Pages dropped from the page cache */
+	unqlite_int64 nRead;      /* Pages read from the database file (Read ahead included) */
+	unqlite_int64 nPrefetch;  /* Pages loaded by read ahead */
+	unqlite_int64 nWrite;     /* Pages written to the database file */
+	unqlite_int64 nJournal;   /* Bytes written to the rollback journal */
+	unqlite_int64 nSync;      /* Sync requests on the database and journal files */
+	unqlite_int64 nCommit;    /* Transactions committed to the database file */
+	unqlite_int64 nCached;    /* Pages currently in the page cache */
+};
+/*
+ * Key/Value storage engine statistics.
+ *
+ * Filled by [unqlite_kv_config()] using the UNQLITE_KV_CONFIG_STATS verb. Counters are
+ * zeroed when bReset is set, nMemUsed is never reset. Engines that do not keep a
+ * counter leave it to zero.
+ */
+typedef struct unqlite_kv_stats unqlite_kv_stats;
+struct unqlite_kv_stats
+{
+	unqlite_int64 nSplit;     /* Bucket splits */
+	unqlite_int64 nSlave;     /* Slave (Overflowing bucket) pages created */
+	unqlite_int64 nOverflow;  /* Overflow pages created for large keys and values */
+	unqlite_int64 nInsert;    /* Cells (Records) created */
+	unqlite_int64 nDelete;    /* Cells (Records) removed */
+	unqlite_int64 nMemUsed;   /* Bytes currently held by the engine memory backend */
+};
+/*
+ * Layout of a Key/Value storage engine database.
+ *
+ * Filled by [unqlite_kv_config()] using the UNQLITE_KV_CONFIG_ANALYZE verb. Only a
+ * sample of the buckets may be walked (nSampled out of nReal), the counters then
+ * cover that sample only. Histograms use power of two classes: entry 0 counts
+ * the zero values and entry i (i > 0) the values in [2^(i-1), 2^i), except
+ * aChain[] which is indexed by the exact slave chain length (The last entry
+ * counts the longer chains) and aFill[] which is indexed by tenth of page used.
+ */
+#define UNQLITE_KV_ANALYZE_HIST 32
+typedef struct unqlite_kv_analysis unqlite_kv_analysis;
+struct unqlite_kv_analysis
+{
+	int iPageSize;            /* Database page size */
+	unqlite_int64 nPage;      /* Total number of pages in the database */
+	unqlite_int64 nLogic;     /* Logical buckets */
+	unqlite_int64 nReal;      /* Buckets with a master page */
+	unqlite_int64 nSampled;   /* Buckets walked */
+	unqlite_int64 nSlave;     /* Slave pages of the walked buckets */
+	unqlite_int64 nOverflow;  /* Overflow pages of the walked buckets */
+	unqlite_int64 nOvflBytes; /* Payload bytes stored on those overflow pages */
+	unqlite_int64 nOvflRoom;  /* Payload capacity of those overflow pages */
+	unqlite_int64 nCell;      /* Cells (Records) of the walked buckets */
+	unqlite_int64 nVlog;      /* Cells whose value is stored in the value log */
+	unqlite_int64 nLz;        /* Cells whose value is compressed */
+	unqlite_int64 nHashDup;   /* Cells whose hash value is shared with an earlier cell */
+	unqlite_int64 nFree;      /* Free bytes on the master and slave pages walked */
+	unqlite_int64 aCell[UNQLITE_KV_ANALYZE_HIST];  /* Buckets by number of cells */
+	unqlite_int64 aChain[UNQLITE_KV_ANALYZE_HIST]; /* Buckets by slave chain length */
+	unqlite_int64 aKey[UNQLITE_KV_ANALYZE_HIST];   /* Keys by size in bytes */
+	unqlite_int64 aData[UNQLITE_KV_ANALYZE_HIST];  /* Values by stored size in bytes */
+	unqlite_int64 aFill[10];  /* Master and slave pages by fill factor */
+};
 /*
  * UnQLite handle to the underlying Key/Value Storage Engine (See below).
  */
@@ -765,6 +932,18 @@ struct unqlite_kv_io
 	void (*xSetUnpin)(unqlite_kv_handle,void (*xPageUnpin)(void *)); 
 	void (*xSetReload)(unqlite_kv_handle,void (*xPageReload)(void *));
 	void (*xErr)(unqlite_kv_handle,const char *);
+	pgno (*xDbSize)(unqlite_kv_handle);
+	int (*xTruncate)(unqlite_kv_handle,pgno);
+	void (*xUnpinAll)(unqlite_kv_handle);
+	/* Side files: the database path followed by a suffix */
+	int (*xOpenFile)(unqlite_kv_handle,const char *zSuffix,int bCreate,unqlite_file **);
+	void (*xCloseFile)(unqlite_kv_handle,unqlite_file *);
+	int (*xDropFile)(unqlite_kv_handle,const char *zSuffix); /* Deleted once the transaction commits */
+	void (*xSetCommit)(unqlite_kv_handle,int (*xCommit)(unqlite_kv_engine *)); /* Called before the dirty pages are written */
+	int (*xPrefetch)(unqlite_kv_handle,const pgno *aPage,int nPage,int bLoad); /* Read ahead hint, bLoad to pull the pages into the cache */
+	int (*xRead)(unqlite_kv_handle,pgno,unsigned char *zBuf); /* Copy of a page, uncached pages do not enter the cache */
+	int (*xReadShared)(unqlite_kv_handle,pgno,unsigned char *zBuf,unsigned char *zScratch); /* xRead() for several threads while the handle is idle */
+	void (*xSetKeep)(unqlite_kv_handle,void *pKeep,unsigned int nByte); /* Engine fields kept when the pager resets the engine */
 };
 /*
  * Key/Value Storage Engine Cursor Object
@@ -847,6 +1026,7 @@ struct unqlite_kv_methods
   int (*xData)(unqlite_kv_cursor *,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
   void (*xReset)(unqlite_kv_cursor *);
   void (*xCursorRelease)(unqlite_kv_cursor *);
+  int (*xDataRange)(unqlite_kv_cursor *,unqlite_int64 iOfft,unqlite_int64 nByte,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData); /* Optional */
 };
 /*
  * UnQLite journal file suffix.
@@ -854,6 +1034,12 @@ struct unqlite_kv_methods
 #ifndef UNQLITE_JOURNAL_FILE_SUFFIX
 #define UNQLITE_JOURNAL_FILE_SUFFIX "_unqlite_journal"
 #endif
+/*
+ * Value log segment file suffix (Followed by the segment number).
+ */
+#ifndef UNQLITE_VLOG_FILE_SUFFIX
+#define UNQLITE_VLOG_FILE_SUFFIX "_unqlite_vlog"
+#endif
 /*
  * Call Context - Error Message Serverity Level.
  *
@@ -908,6 +1094,7 @@ UNQLITE_APIEXPORT int unqlite_kv_cursor_prev_entry(unqlite_kv_cursor *pCursor);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_key(unqlite_kv_cursor *pCursor,void *pBuf,int *pnByte);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_key_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_data(unqlite_kv_cursor *pCursor,void *pBuf,unqlite_int64 *pnData);
+UNQLITE_APIEXPORT int unqlite_kv_cursor_data_read(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,void *pBuf,unqlite_int64 *pnData);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_data_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_delete_entry(unqlite_kv_cursor *pCursor);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_reset(unqlite_kv_cursor *pCursor);
@@ -923,6 +1110,11 @@ UNQLITE_APIEXPORT int unqlite_util_release_mmaped_file(void *pMap,unqlite_int64
 UNQLITE_APIEXPORT int unqlite_util_random_string(unqlite *pDb,char *zBuf,unsigned int buf_size);
 UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb);
 
+/* Online backup interfaces */
+UNQLITE_APIEXPORT int unqlite_backup_init(unqlite *pDb,const char *zDest);
+UNQLITE_APIEXPORT int unqlite_backup_step(unqlite *pDb,int nPage,unqlite_int64 *pRemaining,unqlite_int64 *pTotal);
+UNQLITE_APIEXPORT int unqlite_backup_finish(unqlite *pDb);
+
 /* In-process extending interfaces */
 UNQLITE_APIEXPORT int unqlite_create_function(unqlite_vm *pVm,const char *zName,int (*xFunc)(unqlite_context *,int,unqlite_value **),void *pUserData);
 UNQLITE_APIEXPORT int unqlite_delete_function(unqlite_vm *pVm, const char *zName);
@@ -3173,6 +3365,7 @@ JX9_PRIVATE void *SyMemBackendPoolRealloc(SyMemBackend *pBackend, void *pOld, sx
 JX9_PRIVATE sxi32 SyMemBackendPoolFree(SyMemBackend *pBackend, void *pChunk);
 JX9_PRIVATE void *SyMemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte);
 JX9_PRIVATE sxi32 SyMemBackendFree(SyMemBackend *pBackend, void *pChunk);
+JX9_PRIVATE sxu64 SyMemBackendUsage(SyMemBackend *pBackend);
 JX9_PRIVATE void *SyMemBackendRealloc(SyMemBackend *pBackend, void *pOld, sxu32 nByte);
 JX9_PRIVATE void *SyMemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte);
 JX9_PRIVATE sxu32 SyMemcpy(const void *pSrc, void *pDest, sxu32 nLen);
@@ -3489,6 +3682,8 @@ UNQLITE_PRIVATE const unqlite_vfs * unqliteExportBuiltinVfs(void);
 UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportMemKvStorage(void);
 /* lhash_kv.c */
 UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void);
+UNQLITE_PRIVATE int unqliteLzCompress(const unsigned char *zIn,sxu32 nIn,unsigned char *zOut,sxu32 nMax,sxu32 *aHash,sxu32 *pnOut);
+UNQLITE_PRIVATE int unqliteLzDecompress(const unsigned char *zIn,sxu32 nIn,unsigned char *zOut,sxu32 nOut);
 /* os.c */
 UNQLITE_PRIVATE int unqliteOsRead(unqlite_file *id, void *pBuf, unqlite_int64 amt, unqlite_int64 offset);
 UNQLITE_PRIVATE int unqliteOsWrite(unqlite_file *id, const void *pBuf, unqlite_int64 amt, unqlite_int64 offset);
@@ -3499,6 +3694,11 @@ UNQLITE_PRIVATE int unqliteOsLock(unqlite_file *id, int lockType);
 UNQLITE_PRIVATE int unqliteOsUnlock(unqlite_file *id, int lockType);
 UNQLITE_PRIVATE int unqliteOsCheckReservedLock(unqlite_file *id, int *pResOut);
 UNQLITE_PRIVATE int unqliteOsSectorSize(unqlite_file *id);
+UNQLITE_PRIVATE int unqliteOsAdvise(unqlite_file *id, unqlite_int64 iOfst, unqlite_int64 iAmt);
+UNQLITE_PRIVATE int unqliteOsPunchHole(unqlite_file *id, unqlite_int64 iOfst, unqlite_int64 iAmt);
+UNQLITE_PRIVATE int unqliteOsMmap(unqlite_file *id, unqlite_int64 iSize, void **ppMap);
+UNQLITE_PRIVATE void unqliteOsUnmap(unqlite_file *id, void *pMap, unqlite_int64 iSize);
+UNQLITE_PRIVATE int unqliteOsReadAt(unqlite_file *id, void *pBuf, unqlite_int64 amt, unqlite_int64 offset);
 UNQLITE_PRIVATE int unqliteOsOpen(
   unqlite_vfs *pVfs,
   SyMemBackend *pAlloc,
@@ -3518,6 +3718,13 @@ UNQLITE_PRIVATE void unqliteBitvecDestroy(Bitvec *p);
 UNQLITE_PRIVATE int unqliteInitCursor(unqlite *pDb,unqlite_kv_cursor **ppOut);
 UNQLITE_PRIVATE int unqliteReleaseCursor(unqlite *pDb,unqlite_kv_cursor *pCur);
 UNQLITE_PRIVATE int unqlitePagerSetCachesize(Pager *pPager,int mxPage);
+UNQLITE_PRIVATE int unqlitePagerSetPageSize(Pager *pPager,int iPageSize);
+UNQLITE_PRIVATE int unqlitePagerSetKvEngine(Pager *pPager,const char *zName);
+UNQLITE_PRIVATE int unqlitePagerSetCodec(Pager *pPager,const unqlite_page_codec *pCodec);
+UNQLITE_PRIVATE int unqlitePagerSetCompress(Pager *pPager,int bEnable);
+UNQLITE_PRIVATE int unqlitePagerCachePages(Pager *pPager,int (*xPage)(pgno,void *),void *pUserData);
+UNQLITE_PRIVATE int unqlitePagerCacheLoad(Pager *pPager,const pgno *aPage,int nPage);
+UNQLITE_PRIVATE int unqlitePagerStats(Pager *pPager,unqlite_pager_stats *pStats,int bReset);
 UNQLITE_PRIVATE int unqlitePagerClose(Pager *pPager);
 UNQLITE_PRIVATE int unqlitePagerOpen(
   unqlite_vfs *pVfs,       /* The virtual file system to use */
@@ -3532,6 +3739,9 @@ UNQLITE_PRIVATE int unqlitePagerCommit(Pager *pPager);
 UNQLITE_PRIVATE int unqlitePagerRollback(Pager *pPager,int bResetKvEngine);
 UNQLITE_PRIVATE void unqlitePagerRandomString(Pager *pPager,char *zBuf,sxu32 nLen);
 UNQLITE_PRIVATE sxu32 unqlitePagerRandomNum(Pager *pPager);
+UNQLITE_PRIVATE int unqlitePagerBackupInit(Pager *pPager,const char *zDest);
+UNQLITE_PRIVATE int unqlitePagerBackupStep(Pager *pPager,int nPage,pgno *pRemaining,pgno *pTotal);
+UNQLITE_PRIVATE int unqlitePagerBackupFinish(Pager *pPager);
 #endif /* __UNQLITEINT_H__ */
 /*
  * ----------------------------------------------------------
@@ -4086,14 +4296,12 @@ static unsigned int unqliteSanityzeFlag(unsigned int iFlags)
 		iFlags |= UNQLITE_OPEN_READWRITE;
 	}
 	if( iFlags & UNQLITE_OPEN_CREATE ){
-		iFlags &= ~(UNQLITE_OPEN_MMAP|UNQLITE_OPEN_READONLY);
+		iFlags &= ~UNQLITE_OPEN_READONLY;
 		/* Auto-append the R+W flag */
 		iFlags |= UNQLITE_OPEN_READWRITE;
 	}else{
 		if( iFlags & UNQLITE_OPEN_READONLY ){
 			iFlags &= ~UNQLITE_OPEN_READWRITE;
-		}else if( iFlags & UNQLITE_OPEN_READWRITE ){
-			iFlags &= ~UNQLITE_OPEN_MMAP;
 		}
 	}
 	return iFlags;
@@ -4283,6 +4491,69 @@ static int unqliteConfigure(unqlite *pDb,int nOp,va_list ap)
 		pDb->iFlags |= UNQLITE_FL_DISABLE_AUTO_COMMIT;
 		break;
 											}
+	case UNQLITE_CONFIG_PAGE_CODEC: {
+		/* Install or remove a page codec */
+		const unqlite_page_codec *pCodec = va_arg(ap,const unqlite_page_codec *);
+		rc = unqlitePagerSetCodec(pDb->sDB.pPager,pCodec);
+		break;
+									}
+	case UNQLITE_CONFIG_PAGE_COMPRESS: {
+		/* Built-in compressing page codec */
+		int bEnable = va_arg(ap,int);
+		rc = unqlitePagerSetCompress(pDb->sDB.pPager,bEnable);
+		break;
+									   }
+	case UNQLITE_CONFIG_CACHE_PAGES: {
+		/* Walk the page cache */
+		int (*xPage)(pgno,void *) = va_arg(ap,int (*)(pgno,void *));
+		void *pUserData = va_arg(ap,void *);
+		rc = unqlitePagerCachePages(pDb->sDB.pPager,xPage,pUserData);
+		break;
+									 }
+	case UNQLITE_CONFIG_CACHE_LOAD: {
+		/* Load a list of pages into the page cache */
+		const pgno *aPage = va_arg(ap,const pgno *);
+		int nPage = va_arg(ap,int);
+		if( aPage == 0 || nPage < 0 ){
+			rc = UNQLITE_INVALID;
+			break;
+		}
+		rc = unqlitePagerCacheLoad(pDb->sDB.pPager,aPage,nPage);
+		break;
+									}
+	case UNQLITE_CONFIG_PAGER_STATS: {
+		/* Pager counters */
+		unqlite_pager_stats *pStats = va_arg(ap,unqlite_pager_stats *);
+		int bReset = va_arg(ap,int);
+		rc = unqlitePagerStats(pDb->sDB.pPager,pStats,bReset);
+		break;
+									 }
+	case UNQLITE_CONFIG_PAGE_SIZE: {
+		/* Page size of a new database */
+		int iPageSize = va_arg(ap,int);
+		rc = unqlitePagerSetPageSize(pDb->sDB.pPager,iPageSize);
+		break;
+								   }
+	case UNQLITE_CONFIG_KV_ENGINE: {
+		/* Storage engine of a new database */
+		const char *zName = va_arg(ap,const char *);
+		if( zName == 0 ){
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		rc = unqlitePagerSetKvEngine(pDb->sDB.pPager,zName);
+		break;
+								   }
+	case UNQLITE_CONFIG_MEM_USED: {
+		/* Bytes held by the memory backend of the handle */
+		unqlite_int64 *pBytes = va_arg(ap,unqlite_int64 *);
+		if( pBytes == 0 ){
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		*pBytes = (unqlite_int64)SyMemBackendUsage(&pDb->sMem);
+		break;
+								  }
 	case UNQLITE_CONFIG_GET_KV_NAME: {
 		/* Name of the underlying KV storage engine */
 		const char **pzPtr = va_arg(ap,const char **);
@@ -6146,6 +6417,83 @@ int unqlite_kv_cursor_data(unqlite_kv_cursor *pCursor,void *pBuf,unqlite_int64 *
 	}
 	return rc;
 }
+/*
+ * Data consumer used when the storage engine cannot consume a range of the data.
+ * The first nSkip bytes are discarded and the consumption stop once the buffer is full.
+ */
+struct unqlite_range_consumer
+{
+	SyBlob *pBlob;  /* Output buffer */
+	sxu64 nSkip;    /* Bytes to be skipped */
+	sxu32 nMax;     /* Buffer size */
+};
+static int unqliteRangeConsumer(const void *pOut,unsigned int nLen,void *pUserData)
+{
+	struct unqlite_range_consumer *pRange = (struct unqlite_range_consumer *)pUserData;
+	const char *zOut = (const char *)pOut;
+	sxu32 nAvail;
+	if( pRange->nSkip >= (sxu64)nLen ){
+		pRange->nSkip -= nLen;
+		return UNQLITE_OK;
+	}
+	zOut += pRange->nSkip;
+	nLen -= (unsigned int)pRange->nSkip;
+	pRange->nSkip = 0;
+	nAvail = pRange->nMax - SyBlobLength(pRange->pBlob);
+	if( nLen > nAvail ){
+		nLen = nAvail;
+	}
+	SyBlobAppend(pRange->pBlob,(const void *)zOut,nLen);
+	/* Stop once the buffer is full */
+	return SyBlobLength(pRange->pBlob) >= pRange->nMax ? UNQLITE_ABORT : UNQLITE_OK;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_data_read()]
+ * Copy up to *pnByte bytes of the data the cursor point to, starting at offset iOfft,
+ * into pBuf. On return *pnByte hold the number of bytes copied (zero past the end).
+ * Sequential reads of a large record resume where the previous read stopped.
+ */
+int unqlite_kv_cursor_data_read(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,void *pBuf,unqlite_int64 *pnByte)
+{
+	const unqlite_kv_methods *pMethods;
+	SyBlob sBlob;
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 || pBuf == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	if( iOfft < 0 || (*pnByte) < 0 ){
+		return UNQLITE_INVALID;
+	}
+	if( (*pnByte) > SXU32_HIGH ){
+		*pnByte = SXU32_HIGH;
+	}
+	pMethods = pCursor->pStore->pIo->pMethods;
+	/* Initialize the data consumer */
+	SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)(*pnByte));
+	if( *pnByte == 0 ){
+		rc = UNQLITE_OK;
+	}else if( pMethods->xDataRange ){
+		/* Consume the requested range only */
+		rc = pMethods->xDataRange(pCursor,iOfft,*pnByte,unqliteDataConsumer,&sBlob);
+	}else{
+		struct unqlite_range_consumer sRange;
+		sRange.pBlob = &sBlob;
+		sRange.nSkip = (sxu64)iOfft;
+		sRange.nMax = (sxu32)(*pnByte);
+		rc = pMethods->xData(pCursor,unqliteRangeConsumer,&sRange);
+		if( rc == UNQLITE_ABORT ){
+			/* Buffer full */
+			rc = UNQLITE_OK;
+		}
+	}
+	/* Data length */
+	*pnByte = SyBlobLength(&sBlob);
+	/* Cleanup */
+	SyBlobRelease(&sBlob);
+	return rc;
+}
 /*
  * [CAPIREF: unqlite_begin()]
  * Please refer to the official documentation for function purpose and expected parameters.
@@ -6326,6 +6674,91 @@ UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb)
 #endif
 	 return iNum;
 }
+/*
+ * [CAPIREF: unqlite_backup_init()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+UNQLITE_APIEXPORT int unqlite_backup_init(unqlite *pDb,const char *zDest)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || SX_EMPTY_STR(zDest) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Open the destination file */
+	 rc = unqlitePagerBackupInit(pDb->sDB.pPager,zDest);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_backup_step()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+UNQLITE_APIEXPORT int unqlite_backup_step(unqlite *pDb,int nPage,unqlite_int64 *pRemaining,unqlite_int64 *pTotal)
+{
+	pgno nRemaining = 0,nTotal = 0;
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Copy the next pages */
+	 rc = unqlitePagerBackupStep(pDb->sDB.pPager,nPage,&nRemaining,&nTotal);
+	 if( pRemaining ){
+		 *pRemaining = (unqlite_int64)nRemaining;
+	 }
+	 if( pTotal ){
+		 *pTotal = (unqlite_int64)nTotal;
+	 }
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_backup_finish()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+UNQLITE_APIEXPORT int unqlite_backup_finish(unqlite *pDb)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Close the destination file */
+	 rc = unqlitePagerBackupFinish(pDb->sDB.pPager);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
 /*
  * ----------------------------------------------------------
  * File: bitvec.c
@@ -27655,6 +28088,31 @@ JX9_PRIVATE sxi32 SyMemBackendRelease(SyMemBackend *pBackend)
 	}
 	return rc;
 }
+/*
+ * Total number of bytes held by a memory backend (Pool buckets included).
+ * Zero if the underlying allocator cannot report chunk sizes.
+ */
+JX9_PRIVATE sxu64 SyMemBackendUsage(SyMemBackend *pBackend)
+{
+	SyMemBlock *pBlock;
+	sxu64 nByte = 0;
+	sxu32 n;
+	if( pBackend->pMethods == 0 || pBackend->pMethods->xChunkSize == 0 ){
+		return 0;
+	}
+	if( pBackend->pMutexMethods ){
+		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+	pBlock = pBackend->pBlocks;
+	for( n = 0 ; n < pBackend->nBlock && pBlock ; ++n ){
+		nByte += pBackend->pMethods->xChunkSize(pBlock);
+		pBlock = pBlock->pNext;
+	}
+	if( pBackend->pMutexMethods ){
+		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+	return nByte;
+}
 JX9_PRIVATE void * SyMemBackendDup(SyMemBackend *pBackend, const void *pSrc, sxu32 nSize)
 {
 	void *pNew;
@@ -40574,7 +41032,7 @@ static int UnixVfs_Mmap(const char *zPath, void **ppMap, jx9_int64 *pSize)
 	/* stat the handle */
 	fstat(fd, &st);
 	/* Obtain a memory view of the whole file */
-	pMap = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE|MAP_FILE, fd, 0);
+	pMap = mmap(0, st.st_size, PROT_READ, MAP_SHARED|MAP_FILE, fd, 0);
 	rc = JX9_OK;
 	if( pMap == MAP_FAILED ){
 		rc = -1;
@@ -48727,18 +49185,101 @@ static sxi32 VmGetNextLine(SyString *pCursor, SyString *pCurrent)
  * The maximum amount of payload (in bytes) that can be stored locally for
  * a database entry.  If the entry contains more data than this, the
  * extra goes onto overflow pages.
+ * Page offsets are 16-bit: with 64KB pages the page size itself does not
+ * fit, but any offset inside the page and these amounts do.
 */
-#define L_HASH_MX_PAYLOAD(PageSize)  (PageSize-(L_HASH_PAGE_HDR_SZ+L_HASH_CELL_SZ))
+#define L_HASH_MX_PAYLOAD(PageSize)  ((PageSize)-(L_HASH_PAGE_HDR_SZ+L_HASH_CELL_SZ))
+/*
+ * Smallest payload moved to overflow pages when its cell does not fit in
+ * a bucket page. Smaller payloads go to a slave page instead of using a
+ * whole overflow page for a few hundred bytes, the bigger the page the
+ * bigger the waste.
+ */
+#define L_HASH_MIN_OVFL_PAYLOAD(PageSize) ((sxu64)L_HASH_MX_PAYLOAD(PageSize) / 4)
 /*
  * Maxium free space on a single page.
  */
-#define L_HASH_MX_FREE_SPACE(PageSize) (PageSize - (L_HASH_PAGE_HDR_SZ))
+#define L_HASH_MX_FREE_SPACE(PageSize) ((PageSize) - (L_HASH_PAGE_HDR_SZ))
 /*
 ** The maximum number of bytes of payload allowed on a single overflow page.
 */
-#define L_HASH_OVERFLOW_SIZE(PageSize) (PageSize-8)
+#define L_HASH_OVERFLOW_SIZE(PageSize) ((PageSize)-8)
+/*
+** Offset of the free page count in the database header. Bucket map records
+** start at offset 44 and are 16 bytes long so the last 4 bytes of the
+** header page are never used by the map. The count is stored plus one so
+** that zero identify an older image where the count is unknown.
+** The two high bits of the same word are persistent engine flags.
+*/
+#define L_HASH_FREE_COUNT_OFFT(PageSize) (PageSize-4)
+#define L_HASH_FREE_COUNT_MASK 0x3FFFFFFF
+#define L_HASH_DEFER_SPLIT     0x80000000 /* Bucket splits are performed by lhMaintain() only */
+#define L_HASH_PRESIZED        0x40000000 /* lhPresize() left buckets without a map record */
+/*
+** Optional Bloom filter of the stored keys. It is registered in the bucket
+** map under the L_HASH_BLOOM_LOGIC logical bucket number, in the first slot
+** of page one so that it is known as soon as the header is read. The filter
+** is made of 512-bit blocks and all the bits of a key fall in a single block
+** so that a lookup reads at most one filter page.
+** The root page begins like an empty bucket page (12 zero bytes) so that a
+** reader walking the bucket map sees no cell there. It is followed by the
+** next directory page (8 bytes), the number of entries on this page (4),
+** the number of blocks (8), the number of keys indexed (8) and the data page
+** numbers (8 bytes each). Other directory pages hold the next directory page,
+** the number of entries and the data page numbers.
+*/
+#define L_HASH_BLOOM_LOGIC    ((pgno)0xFFFFFFFFFFFFFFFFULL)
+#define L_HASH_BLOOM_ROOT_HDR (L_HASH_PAGE_HDR_SZ+8/*Next*/+4/*Entries*/+8/*Blocks*/+8/*Keys*/)
+#define L_HASH_BLOOM_DIR_HDR  (8/*Next*/+4/*Entries*/)
+#define L_HASH_BLOOM_BLOCK    64 /* Bytes per block */
+#define L_HASH_BLOOM_PROBE    7  /* Bits set per key */
+#define L_HASH_BLOOM_SEED     0xC2B2AE3D27D4EB4FULL /* MIX64 seed of the filter hash */
+/*
+** Optional value log. Values of at least the configured threshold are
+** appended to segment files next to the database (See UNQLITE_VLOG_FILE_SUFFIX)
+** and the cell keeps a pointer to them instead of the data: the segment
+** number (4 bytes), the offset of the log record (8) and the value length (8).
+** Such a cell have the high bit of its data length set.
+** Each log record is made of a magic number (4 bytes), the key length (4),
+** the value length (8), the key and the value. Segments are never rewritten,
+** a segment whose records are all dead is deleted by the garbage collector
+** and the live records of a mostly dead segment are copied to the active one
+** first.
+** The root page is registered in the bucket map under the L_HASH_VLOG_LOGIC
+** logical bucket number, next to the Bloom filter record at the start of
+** page one. It begins like an empty bucket page (12 zero bytes) followed by
+** the threshold (8 bytes), the segment size (8), the next segment number (4),
+** the number of segments (4) and the segments: number (4), size (8) and
+** dead bytes (8). The last segment is the one being appended to.
+*/
+#define L_HASH_VLOG_LOGIC     ((pgno)0xFFFFFFFFFFFFFFFEULL)
+#define L_HASH_VLOG_FLAG      0x8000000000000000ULL /* Cell data length flag */
+#define L_HASH_VLOG_PTR_SZ    (4/*Segment*/+8/*Offset*/+8/*Value length*/)
+#define L_HASH_VLOG_REC_HDR   (4/*Magic*/+4/*Key length*/+8/*Value length*/)
+#define L_HASH_VLOG_ROOT_HDR  (L_HASH_PAGE_HDR_SZ+8/*Threshold*/+8/*Segment size*/+4/*Next segment*/+4/*Segments*/)
+#define L_HASH_VLOG_ENTRY_SZ  (4/*Segment*/+8/*Size*/+8/*Dead bytes*/)
+#define L_HASH_VLOG_MAGIC     0x564C4F47 /* Log record magic number */
+#define L_HASH_VLOG_SEGMENT   (64 * 1024 * 1024) /* Default segment size */
+#define L_HASH_VLOG_CHUNK     65536 /* Value log IO buffer size */
+/*
+** Optional value compression (UNQLITE_KV_CONFIG_COMPRESS). A compressed value
+** is made of the codec (1 byte, UNQLITE_KV_COMPRESS_*), the length of the
+** original value (8 bytes) and the compressed stream. Such a cell have the
+** second highest bit of its data length set, whether the value is stored in
+** the cell or in the value log.
+** The LZ stream is a sequence of tokens: the literal length (high nibble)
+** and the match length minus 4 (low nibble) of a token byte, extended by
+** 255 valued bytes when the nibble is 15, the literals, then the 2 bytes
+** little-endian offset of the match. The last token have no match.
+*/
+#define L_HASH_LZ_FLAG        0x4000000000000000ULL /* Cell data length flag */
+#define L_HASH_LZ_HDR         (1/*Codec*/+8/*Value length*/)
+#define L_HASH_LZ_HASH_BITS   14 /* Match finder table size (log2) */
+#define L_HASH_LZ_MIN_MATCH   4
+#define L_HASH_LZ_MAX_OFFSET  65535
 /* Forward declaration */
 typedef struct lhash_kv_engine lhash_kv_engine;
+typedef struct lhash_vacuum lhash_vacuum;
 typedef struct lhpage lhpage;
 /*
  * Each record in the database is identified either in-memory or in
@@ -48751,14 +49292,20 @@ struct lhcell
 	sxu32 nHash;   /* Hash of the key: 4 bytes */
 	sxu32 nKey;    /* Key length: 4 bytes */
 	sxu64 nData;   /* Data length: 8 bytes */
-	sxu16 iNext;   /* Offset of the next cell: 2 bytes */
 	pgno iOvfl;    /* Overflow page number if any: 8 bytes */
+	sxu16 iNext;   /* Offset of the next cell: 2 bytes */
 	/* In-memory data only */
-	lhpage *pPage;     /* Page this cell belongs */
 	sxu16 iStart;      /* Offset of this cell */
-	pgno iDataPage;    /* Data page number when overflow */
 	sxu16 iDataOfft;   /* Offset of the data in iDataPage */
-	SyBlob sKey;       /* Record key for fast lookup (Kept in-memory if < 256KB ) */
+	sxu8 bVlog;        /* The data is a value log pointer (L_HASH_VLOG_FLAG) */
+	sxu8 bLz;          /* The value is compressed (L_HASH_LZ_FLAG) */
+	pgno iDataPage;    /* Data page number when overflow */
+	pgno iTailPage;    /* Last overflow page of the data, zero when unknown */
+	sxu32 iTailOfft;   /* End of the data in iTailPage */
+	pgno iHintPage;    /* Overflow page last read, zero when unknown */
+	sxu64 iHintPos;    /* Data offset of the first byte of iHintPage */
+	lhpage *pPage;     /* Page this cell belongs */
+	SyBlob sKey;       /* Copy of an overflow key (< 256KB), loaded on first use. Local keys are read from the raw page (See lhCellKey()) */
 	lhcell *pNext,*pPrev;         /* Linked list of the loaded memory cells */
 	lhcell *pNextCol,*pPrevCol;   /* Collison chain  */
 };
@@ -48795,15 +49342,17 @@ struct lhpage
 /*
  * A Bucket map record which is used to map logical bucket number to real
  * bucket number is represented by an instance of the following structure.
+ * Records are kept in a dense array indexed by logical bucket number, split
+ * in chunks of L_HASH_MAP_CHUNK records so that a record never moves once
+ * installed.
  */
 typedef struct lhash_bmap_rec lhash_bmap_rec;
 struct lhash_bmap_rec
 {
 	pgno iLogic;                   /* Logical bucket number */
-	pgno iReal;                    /* Real bucket number */
-	lhash_bmap_rec *pNext,*pPrev;  /* Link to other bucket map */     
-	lhash_bmap_rec *pNextCol,*pPrevCol; /* Collision links */
+	pgno iReal;                    /* Real bucket number, zero for an unused slot */
 };
+#define L_HASH_MAP_CHUNK 1024 /* Bucket map records per in-memory chunk */
 typedef struct lhash_bmap_page lhash_bmap_page;
 struct lhash_bmap_page
 {
@@ -48812,6 +49361,27 @@ struct lhash_bmap_page
 	sxu32 nRec;  /* Total number of records in this page */
 	pgno iNext;  /* Next map page */
 };
+/*
+ * An open value log segment.
+ */
+typedef struct lhash_vlog_file lhash_vlog_file;
+struct lhash_vlog_file
+{
+	sxu32 iSeg;          /* Segment number */
+	unqlite_file *pFd;   /* Segment file */
+	int bDirty;          /* Written since the last sync */
+};
+/*
+ * Handle settings and counters of the engine. They are kept when the pager
+ * resets the engine on rollback and when vacuum reloads it (See xSetKeep()).
+ */
+typedef struct lhash_kv_keep lhash_kv_keep;
+struct lhash_kv_keep
+{
+	int iLzCodec;                 /* Compression of the stored values, UNQLITE_KV_COMPRESS_* */
+	sxu64 nLzMin;                 /* Values shorter than this are stored as is */
+	unqlite_kv_stats sStats;      /* Engine counters (See UNQLITE_KV_CONFIG_STATS) */
+};
 /*
  * An in memory linear hash implemenation is represented by in an isntance
  * of the following structure.
@@ -48824,42 +49394,79 @@ struct lhash_kv_engine
 	ProcHash xHash;               /* Default hash function */
 	ProcCmp xCmp;                 /* Default comparison function */
 	unqlite_page *pHeader;        /* Page one to identify a valid implementation */
-	lhash_bmap_rec **apMap;       /* Buckets map records */
-	sxu32 nBuckRec;               /* Total number of bucket map records */
-	sxu32 nBuckSize;              /* apMap[] size  */
-	lhash_bmap_rec *pList;        /* List of bucket map records */
-	lhash_bmap_rec *pFirst;       /* First record*/
-	lhash_bmap_page sPageMap;     /* Primary bucket map */
+	lhash_bmap_rec **apMap;       /* Buckets map records (Chunks of L_HASH_MAP_CHUNK records) */
+	sxu32 nBuckRec;               /* Total number of loaded bucket map records */
+	sxu32 nBuckSize;              /* apMap[] size (Number of chunks) */
+	lhash_bmap_page sPageMap;     /* Last loaded bucket map page */
+	pgno nMapPage;                /* Bucket map pages loaded after page one (In-memory only) */
 	int iPageSize;                /* Page size */
 	pgno nFreeList;               /* List of free pages */
+	pgno nFreePage;               /* Total number of pages on the free list */
 	pgno split_bucket;            /* Current split bucket: MUST BE A POWER OF TWO */
 	pgno max_split_bucket;        /* Maximum split bucket: MUST BE A POWER OF TWO */
 	pgno nmax_split_nucket;       /* Next maximum split bucket (1 << nMsb): In-memory only */
 	sxu32 nMagic;                 /* Magic number to identify a valid linear hash disk database */
+	sxu32 iVacuum;                /* Current vacuum phase (In-memory only) */
+	pgno iVacuumBucket;           /* Next logical bucket to defragment (In-memory only) */
+	lhash_vacuum *pVacuum;        /* Page walk of the relocation phase, NULL when stale (In-memory only) */
+	int bDeferSplit;              /* True to defer bucket splits to lhMaintain() */
+	int bPresized;                /* True if the table was presized by lhPresize() */
+	int bSplitDebt;               /* True if nSplitDebt is known (In-memory only) */
+	pgno nSplitDebt;              /* Number of deferred bucket splits (In-memory only) */
+	int bBloomRec;                /* True if the bucket map holds the Bloom filter record */
+	pgno iBloom;                  /* Bloom filter root page, zero when there is no filter */
+	pgno nBloomBlock;             /* Total number of filter blocks */
+	pgno nBloomKey;               /* Number of keys indexed when the filter was built */
+	pgno *aBloomPage;             /* Filter data pages (Loaded on first use) */
+	pgno nBloomPage;              /* aBloomPage[] length */
+	int bVlogRec;                 /* True if the bucket map holds the value log record */
+	pgno iVlog;                   /* Value log root page, zero when there is no value log */
+	SySet aVlogFile;              /* Open value log segments (lhash_vlog_file) */
+	unsigned char *zVlogBuf;      /* Value log IO buffer (Allocated on first use) */
+	int bVlogTx;                  /* True if the log was written since the last commit (In-memory only) */
+	sxu32 iVlogTxSeg;             /* Segment and offset of the first record written since */
+	sxu64 iVlogTxOfft;            /* the last commit (In-memory only) */
+	lhash_kv_keep sKeep;          /* Handle settings and counters (In-memory only) */
+	sxu32 *aLzHash;               /* Match finder table (Allocated on first use) */
+	unsigned char *zLzBuf;        /* Compression output buffer */
+	sxu32 nLzBuf;                 /* zLzBuf[] size */
+	lhcell *pLzCell;              /* Cell whose value is in zLzCache[], NULL if none */
+	unsigned char *zLzCache;      /* Last decompressed value */
+	sxu32 nLzCache;               /* zLzCache[] size */
+	sxu64 nLzCacheLen;            /* Length of the value in zLzCache[] */
 };
+/*
+ * On-disk data length of a cell.
+ */
+#define L_HASH_CELL_DATA_LEN(CELL) ((CELL)->nData | ((CELL)->bVlog ? L_HASH_VLOG_FLAG : 0) | ((CELL)->bLz ? L_HASH_LZ_FLAG : 0))
+/*
+ * The decompressed value of a cell is no longer valid.
+ */
+#define L_HASH_LZ_DROP(ENGINE,CELL) if( (ENGINE)->pLzCell == (CELL) ){ (ENGINE)->pLzCell = 0; }
+/*
+ * Slot of a cell in the apCell[] table of its master page (SIZE is a power of two).
+ * The cells of a bucket share the low bits of their hash (They picked the bucket)
+ * so the high bits are folded in, otherwise a skewed bucket would crowd into a few slots.
+ */
+#define L_HASH_CELL_SLOT(HASH,SIZE) (((HASH) ^ ((HASH) >> 16)) & ((SIZE) - 1))
 /*
  * Given a logical bucket number, return the record associated with it.
+ * Only the part of the bucket map loaded so far is consulted.
  */
 static lhash_bmap_rec * lhMapFindBucket(lhash_kv_engine *pEngine,pgno iLogic)
 {
-	lhash_bmap_rec *pRec;
-	if( pEngine->nBuckRec < 1 ){
+	lhash_bmap_rec *pChunk;
+	pgno iChunk = iLogic / L_HASH_MAP_CHUNK;
+	if( iChunk >= (pgno)pEngine->nBuckSize ){
 		/* Don't bother */
 		return 0;
 	}
-	pRec = pEngine->apMap[iLogic & (pEngine->nBuckSize - 1)];
-	for(;;){
-		if( pRec == 0 ){
-			break;
-		}
-		if( pRec->iLogic == iLogic ){
-			return pRec;
-		}
-		/* Point to the next entry */
-		pRec = pRec->pNextCol;
+	pChunk = pEngine->apMap[iChunk];
+	if( pChunk == 0 || pChunk[iLogic % L_HASH_MAP_CHUNK].iReal == 0 ){
+		/* No such record */
+		return 0;
 	}
-	/* No such record */
-	return 0;
+	return &pChunk[iLogic % L_HASH_MAP_CHUNK];
 }
 /*
  * Install a new bucket map record.
@@ -48867,67 +49474,40 @@ static lhash_bmap_rec * lhMapFindBucket(lhash_kv_engine *pEngine,pgno iLogic)
 static int lhMapInstallBucket(lhash_kv_engine *pEngine,pgno iLogic,pgno iReal)
 {
 	lhash_bmap_rec *pRec;
-	sxu32 iBucket;
-	/* Allocate a new instance */
-	pRec = (lhash_bmap_rec *)SyMemBackendPoolAlloc(&pEngine->sAllocator,sizeof(lhash_bmap_rec));
-	if( pRec == 0 ){
-		return UNQLITE_NOMEM;
-	}
-	/* Zero the structure */
-	SyZero(pRec,sizeof(lhash_bmap_rec));
-	/* Fill in the structure */
-	pRec->iLogic = iLogic;
-	pRec->iReal = iReal;
-	iBucket = iLogic & (pEngine->nBuckSize - 1);
-	pRec->pNextCol = pEngine->apMap[iBucket];
-	if( pEngine->apMap[iBucket] ){
-		pEngine->apMap[iBucket]->pPrevCol = pRec;
-	}
-	pEngine->apMap[iBucket] = pRec;
-	/* Link */
-	if( pEngine->pFirst == 0 ){
-		pEngine->pFirst = pEngine->pList = pRec;
-	}else{
-		MACRO_LD_PUSH(pEngine->pList,pRec);
-	}
-	pEngine->nBuckRec++;
-	if( (pEngine->nBuckRec >= pEngine->nBuckSize * 3) && pEngine->nBuckRec < 100000 ){
-		/* Allocate a new larger table */
-		sxu32 nNewSize = pEngine->nBuckSize << 1;
-		lhash_bmap_rec *pEntry;
+	pgno iChunk = iLogic / L_HASH_MAP_CHUNK;
+	if( iChunk >= (pgno)pEngine->nBuckSize ){
+		/* Grow the chunk table */
+		sxu32 nNewSize = pEngine->nBuckSize > 0 ? pEngine->nBuckSize << 1 : 16;
 		lhash_bmap_rec **apNew;
-		sxu32 n;
-		
-		apNew = (lhash_bmap_rec **)SyMemBackendAlloc(&pEngine->sAllocator, nNewSize * sizeof(lhash_bmap_rec *));
-		if( apNew ){
-			/* Zero the new table */
-			SyZero((void *)apNew, nNewSize * sizeof(lhash_bmap_rec *));
-			/* Rehash all entries */
-			n = 0;
-			pEntry = pEngine->pList;
-			for(;;){
-				/* Loop one */
-				if( n >= pEngine->nBuckRec ){
-					break;
-				}
-				pEntry->pNextCol = pEntry->pPrevCol = 0;
-				/* Install in the new bucket */
-				iBucket = pEntry->iLogic & (nNewSize - 1);
-				pEntry->pNextCol = apNew[iBucket];
-				if( apNew[iBucket] ){
-					apNew[iBucket]->pPrevCol = pEntry;
-				}
-				apNew[iBucket] = pEntry;
-				/* Point to the next entry */
-				pEntry = pEntry->pNext;
-				n++;
-			}
-			/* Release the old table and reflect the change */
-			SyMemBackendFree(&pEngine->sAllocator,(void *)pEngine->apMap);
-			pEngine->apMap = apNew;
-			pEngine->nBuckSize  = nNewSize;
+		while( (pgno)nNewSize <= iChunk ){
+			nNewSize <<= 1;
 		}
+		apNew = (lhash_bmap_rec **)SyMemBackendRealloc(&pEngine->sAllocator,(void *)pEngine->apMap,nNewSize * sizeof(lhash_bmap_rec *));
+		if( apNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		/* Zero the new slots */
+		SyZero((void *)&apNew[pEngine->nBuckSize],(nNewSize - pEngine->nBuckSize) * sizeof(lhash_bmap_rec *));
+		pEngine->apMap = apNew;
+		pEngine->nBuckSize = nNewSize;
+	}
+	if( pEngine->apMap[iChunk] == 0 ){
+		/* Allocate a new chunk */
+		pRec = (lhash_bmap_rec *)SyMemBackendAlloc(&pEngine->sAllocator,L_HASH_MAP_CHUNK * sizeof(lhash_bmap_rec));
+		if( pRec == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		/* Zero the chunk */
+		SyZero((void *)pRec,L_HASH_MAP_CHUNK * sizeof(lhash_bmap_rec));
+		pEngine->apMap[iChunk] = pRec;
 	}
+	/* Fill in the record */
+	pRec = &pEngine->apMap[iChunk][iLogic % L_HASH_MAP_CHUNK];
+	if( pRec->iReal == 0 ){
+		pEngine->nBuckRec++;
+	}
+	pRec->iLogic = iLogic;
+	pRec->iReal = iReal;
 	return UNQLITE_OK;
 }
 /*
@@ -48960,6 +49540,22 @@ static int lhMapLoadPage(lhash_kv_engine *pEngine,lhash_bmap_page *pMap,const un
 		zRaw += 8;
 		SyBigEndianUnpack64(zRaw,&iReal);
 		zRaw += 8;
+		if( iLogic == L_HASH_BLOOM_LOGIC ){
+			/* Bloom filter root */
+			pEngine->bBloomRec = 1;
+			pEngine->iBloom = iReal;
+			continue;
+		}
+		if( iLogic == L_HASH_VLOG_LOGIC ){
+			/* Value log root */
+			pEngine->bVlogRec = 1;
+			pEngine->iVlog = iReal;
+			continue;
+		}
+		if( iLogic >= pEngine->nmax_split_nucket || iReal == 0 ){
+			/* Unreachable record (Reported by the integrity check) */
+			continue;
+		}
 		/* Install the record in the map */
 		rc = lhMapInstallBucket(pEngine,iLogic,iReal);
 		if( rc != UNQLITE_OK ){
@@ -48970,6 +49566,70 @@ static int lhMapLoadPage(lhash_kv_engine *pEngine,lhash_bmap_page *pMap,const un
 	/* All done */
 	return UNQLITE_OK;
 }
+/*
+ * Load the next page of the bucket map chain. Only page one is read when
+ * the database is opened, the rest of the map is loaded on demand.
+ */
+static int lhMapLoadNext(lhash_kv_engine *pEngine)
+{
+	lhash_bmap_page *pMap = &pEngine->sPageMap;
+	pgno iNext = pMap->iNext;
+	unqlite_page *pPage;
+	int rc;
+	if( ++pEngine->nMapPage > pEngine->pIo->xDbSize(pEngine->pIo->pHandle) ){
+		/* Bucket map loop */
+		return UNQLITE_CORRUPT;
+	}
+	/* Point to the target page */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNext,&pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Fill in the structure */
+	pMap->iNum = iNext;
+	pMap->iPtr = 0;
+	/* Load the map in memory */
+	rc = lhMapLoadPage(pEngine,pMap,pPage->zData);
+	pEngine->pIo->xPageUnref(pPage);
+	return rc;
+}
+/*
+ * Load the remaining bucket map pages. Required before the map is modified
+ * or walked as a whole.
+ */
+static int lhMapLoadAll(lhash_kv_engine *pEngine)
+{
+	int rc;
+	while( pEngine->sPageMap.iNext > 0 ){
+		rc = lhMapLoadNext(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Given a logical bucket number, return the record associated with it
+ * loading bucket map pages until the record is found or the chain is exhausted.
+ * *ppRec is set to NULL when there is no such bucket.
+ */
+static int lhMapLoadBucket(lhash_kv_engine *pEngine,pgno iLogic,lhash_bmap_rec **ppRec)
+{
+	lhash_bmap_rec *pRec;
+	int rc;
+	for(;;){
+		pRec = lhMapFindBucket(pEngine,iLogic);
+		if( pRec || pEngine->sPageMap.iNext == 0 ){
+			break;
+		}
+		rc = lhMapLoadNext(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	*ppRec = pRec;
+	return UNQLITE_OK;
+}
 /* 
  * Allocate a new cell instance.
  */
@@ -48997,7 +49657,7 @@ static void lhCellDiscard(lhcell *pCell)
 	if( pCell->pPrevCol ){
 		pCell->pPrevCol->pNextCol = pCell->pNextCol;
 	}else{
-		pPage->apCell[pCell->nHash & (pPage->nCellSize - 1)] = pCell->pNextCol;
+		pPage->apCell[L_HASH_CELL_SLOT(pCell->nHash,pPage->nCellSize)] = pCell->pNextCol;
 	}
 	if( pCell->pNextCol ){
 		pCell->pNextCol->pPrevCol = pCell->pPrevCol;
@@ -49007,6 +49667,7 @@ static void lhCellDiscard(lhcell *pCell)
 		pPage->pFirst = pCell->pPrev;
 	}
 	pPage->nCell--;
+	L_HASH_LZ_DROP(pPage->pHash,pCell);
 	/* Release the cell */
 	SyBlobRelease(&pCell->sKey);
 	SyMemBackendPoolFree(&pPage->pHash->sAllocator,pCell);
@@ -49032,7 +49693,7 @@ static int lhInstallCell(lhcell *pCell)
 		pPage->apCell = apTable;
 		pPage->nCellSize = nTableSize;
 	}
-	iBucket = pCell->nHash & (pPage->nCellSize - 1);
+	iBucket = L_HASH_CELL_SLOT(pCell->nHash,pPage->nCellSize);
 	pCell->pNextCol = pPage->apCell[iBucket];
 	if( pPage->apCell[iBucket] ){
 		pPage->apCell[iBucket]->pPrevCol = pCell;
@@ -49044,7 +49705,12 @@ static int lhInstallCell(lhcell *pCell)
 		MACRO_LD_PUSH(pPage->pList,pCell);
 	}
 	pPage->nCell++;
-	if( (pPage->nCell >= pPage->nCellSize * 3) && pPage->nCell < 100000 ){
+	/*
+	 * The table covers the master page and all of its slave pages. Keep
+	 * growing it with the chain so that a lookup in a skewed bucket still
+	 * compare about three hashes before touching any key bytes.
+	 */
+	if( (pPage->nCell >= pPage->nCellSize * 3) && pPage->nCellSize < 0x10000000 ){
 		/* Allocate a new larger table */
 		sxu32 nNewSize = pPage->nCellSize << 1;
 		lhcell *pEntry;
@@ -49065,7 +49731,7 @@ static int lhInstallCell(lhcell *pCell)
 				}
 				pEntry->pNextCol = pEntry->pPrevCol = 0;
 				/* Install in the new bucket */
-				iBucket = pEntry->nHash & (nNewSize - 1);
+				iBucket = L_HASH_CELL_SLOT(pEntry->nHash,nNewSize);
 				pEntry->pNextCol = apNew[iBucket];
 				if( apNew[iBucket]  ){
 					apNew[iBucket]->pPrevCol = pEntry;
@@ -49117,6 +49783,22 @@ static int lhKeyCmp(const void *pData,sxu32 nLen,void *pUserData)
 }
 /* Forward declaration */
 static int lhConsumeCellkey(lhcell *pCell,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData,int offt_only);
+/*
+ * Return a pointer to the key of a cell if it is available in memory,
+ * NULL otherwise. A local key is read in place from the raw page so that
+ * loading a page does not copy its keys. An overflow key is available
+ * once it has been loaded in sKey.
+ */
+static const void * lhCellKey(lhcell *pCell)
+{
+	if( pCell->iOvfl == 0 ){
+		return (const void *)&pCell->pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ];
+	}
+	if( SyBlobLength(&pCell->sKey) > 0 ){
+		return SyBlobData(&pCell->sKey);
+	}
+	return 0;
+}
 /*
  * given a key, return the cell associated with it on success. NULL otherwise.
  */
@@ -49133,13 +49815,23 @@ static lhcell * lhFindCell(
 		return 0;
 	}
 	/* Point to the corresponding bucket */
-	pEntry = pPage->apCell[nHash & (pPage->nCellSize - 1)];
+	pEntry = pPage->apCell[L_HASH_CELL_SLOT(nHash,pPage->nCellSize)];
 	for(;;){
 		if( pEntry == 0 ){
 			break;
 		}
+		/* Key bytes (possibly on overflow pages) are read only when the full hash and length match */
 		if( pEntry->nHash == nHash && pEntry->nKey == nByte ){
-			if( SyBlobLength(&pEntry->sKey) < 1 ){
+			const void *pCellKey = lhCellKey(pEntry);
+			if( pCellKey == 0 && nByte > 0 && nByte < 262144 /* 256 KB */ ){
+				/* Overflow key, keep a copy for the next lookups */
+				if( lhConsumeCellkey(pEntry,unqliteDataConsumer,&pEntry->sKey,0) == UNQLITE_OK ){
+					pCellKey = SyBlobData(&pEntry->sKey);
+				}else{
+					SyBlobRelease(&pEntry->sKey);
+				}
+			}
+			if( pCellKey == 0 ){
 				/* Large key (> 256 KB) are not kept in-memory */
 				struct lhash_key_cmp sCmp;
 				int rc;
@@ -49153,7 +49845,7 @@ static lhcell * lhFindCell(
 					/* Cell found */
 					return pEntry;
 				}
-			}else if ( pPage->pHash->xCmp(pKey,SyBlobData(&pEntry->sKey),nByte) == 0 ){
+			}else if ( pPage->pHash->xCmp(pKey,pCellKey,nByte) == 0 ){
 				/* Cell found */
 				return pEntry;
 			}
@@ -49199,19 +49891,16 @@ static int lhParseOneCell(lhpage *pPage,const unsigned char *zRaw,const unsigned
 	/* Fill in the structure */
 	pCell->iNext = iNext;
 	pCell->nKey  = nKey;
-	pCell->nData = nData;
+	pCell->nData = nData & ~(L_HASH_VLOG_FLAG|L_HASH_LZ_FLAG);
+	pCell->bVlog = (nData & L_HASH_VLOG_FLAG) ? 1 : 0;
+	pCell->bLz = (nData & L_HASH_LZ_FLAG) ? 1 : 0;
 	pCell->nHash = iHash;
 	/* Overflow page if any */
 	SyBigEndianUnpack64(zRaw,&pCell->iOvfl);
 	zRaw += 8;
 	/* Cell offset */
 	pCell->iStart = iOfft;
-	/* Consume the key */
-	rc = lhConsumeCellkey(pCell,unqliteDataConsumer,&pCell->sKey,pCell->nKey > 262144 /* 256 KB */? 1 : 0);
-	if( rc != UNQLITE_OK ){
-		/* TICKET: 14-32-chm@symisc.net: Key too large for memory */
-		SyBlobRelease(&pCell->sKey);
-	}
+	/* The key is not copied: lhCellKey() read local keys in place and overflow keys are loaded on demand */
 	/* Finally install the cell */
 	rc = lhInstallCell(pCell);
 	if( rc != UNQLITE_OK ){
@@ -49280,8 +49969,8 @@ static int lhLoadCells(lhpage *pPage)
 		return UNQLITE_OK;
 	}
 	/* Point to first cell */
-	zRaw += pHdr->iOfft;
 	zEnd = &zRaw[pPage->pHash->iPageSize];
+	zRaw += pHdr->iOfft;
 	for(;;){
 		/* Parse a single cell */
 		rc = lhParseOneCell(pPage,zRaw,zEnd,&pCell);
@@ -49384,12 +50073,27 @@ static int lhLoadPage(lhash_kv_engine *pEngine,pgno pnum,lhpage *pMaster,lhpage
 			pEngine->pIo->xPageUnref(pPage->pRaw); /* pPage will be released inside this call */
 			return rc;
 		}
-		if( pPage->sHdr.iSlave > 0 && iNest < 128 ){
-			if( pMaster == 0 ){
-				pMaster = pPage;
+		if( pMaster == 0 && iNest == 0 ){
+			pgno iSlave = pPage->sHdr.iSlave;
+			/*
+			 * Walk the slave chain iteratively so that a long chain does not
+			 * translate into deep recursion. Every slave cell is indexed in the
+			 * master apCell[] table, so a lookup never visits the slaves again.
+			 * Not a fatal error if something goes wrong here.
+			 */
+			while( iSlave > 0 ){
+				unqlite_page *pSlaveRaw = 0;
+				lhpage *pSlave;
+				if( pEngine->pIo->xLookup(pEngine->pIo->pHandle,iSlave,&pSlaveRaw) == UNQLITE_OK
+					&& pSlaveRaw && pSlaveRaw->pUserData ){
+					/* Already loaded (Corrupt chain), stop here */
+					break;
+				}
+				if( lhLoadPage(pEngine,iSlave,pPage,&pSlave,1) != UNQLITE_OK ){
+					break;
+				}
+				iSlave = pSlave->sHdr.iSlave;
 			}
-			/* Slave page. Not a fatal error if something goes wrong here */
-			lhLoadPage(pEngine,pPage->sHdr.iSlave,pMaster,0,iNest++);
 		}
 	}
 	if( ppOut ){
@@ -49428,8 +50132,6 @@ static int lhConsumeCellkey(
 		pgno iOvfl;
 		/* Overflow page */
 		iOvfl = pCell->iOvfl;
-		/* Total usable bytes in an overflow page */
-		nByte = L_HASH_OVERFLOW_SIZE(pEngine->iPageSize);
 		for(;;){
 			if( iOvfl == 0 || nData < 1 ){
 				/* no more overflow page */
@@ -49455,6 +50157,8 @@ static int lhConsumeCellkey(
 				}
 				data_offset = 1;
 			}
+			/* Usable bytes in this page: the first overflow page also hold the data page and offset */
+			nByte = (sxu32)(&pOvfl->zData[pEngine->iPageSize] - zPayload);
 			/* Consume the key */
 			if( nData <= nByte ){
 				rc = xConsumer((const void *)zPayload,nData,pUserData);
@@ -49509,6 +50213,13 @@ static int lhConsumeCellData(
 		int fix_offset = 0;
 		sxu32 nByte;
 		pgno iOvfl;
+		if( pCell->iDataPage == 0 ){
+			/* The key was never read, grab the data page and offset */
+			rc = lhConsumeCellkey(pCell,unqliteDataConsumer,0,1);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+		}
 		/* Overflow page where data is stored */
 		iOvfl = pCell->iDataPage;
 		for(;;){
@@ -49560,6 +50271,730 @@ static int lhConsumeCellData(
 	}
 	return rc;
 }
+/*
+ * A value log pointer as stored in the data of a cell.
+ */
+typedef struct lhash_vlog_ptr lhash_vlog_ptr;
+struct lhash_vlog_ptr
+{
+	sxu32 iSeg;    /* Segment number */
+	sxu64 iOfft;   /* Offset of the log record in the segment */
+	sxu64 nData;   /* Value length */
+};
+/*
+ * Suffix of the segment file iSeg.
+ */
+static void lhVlogSuffix(sxu32 iSeg,char *zBuf,sxu32 nLen)
+{
+	SyBufferFormat(zBuf,nLen,"%s.%u",UNQLITE_VLOG_FILE_SUFFIX,iSeg);
+}
+/*
+ * Return the segment iSeg, the segment file is opened on first use and
+ * created when bCreate is set. The returned pointer is valid until the
+ * next segment is opened.
+ */
+static int lhVlogFile(lhash_kv_engine *pEngine,sxu32 iSeg,int bCreate,lhash_vlog_file **ppOut)
+{
+	lhash_vlog_file *aFile = (lhash_vlog_file *)SySetBasePtr(&pEngine->aVlogFile);
+	lhash_vlog_file sFile;
+	char zSuffix[64];
+	sxu32 n;
+	int rc;
+	for( n = 0 ; n < SySetUsed(&pEngine->aVlogFile) ; ++n ){
+		if( aFile[n].iSeg == iSeg ){
+			*ppOut = &aFile[n];
+			return UNQLITE_OK;
+		}
+	}
+	lhVlogSuffix(iSeg,zSuffix,sizeof(zSuffix));
+	rc = pEngine->pIo->xOpenFile(pEngine->pIo->pHandle,zSuffix,bCreate,&sFile.pFd);
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Cannot open value log segment");
+		return rc;
+	}
+	sFile.iSeg = iSeg;
+	sFile.bDirty = 0;
+	if( SXRET_OK != SySetPut(&pEngine->aVlogFile,(const void *)&sFile) ){
+		pEngine->pIo->xCloseFile(pEngine->pIo->pHandle,sFile.pFd);
+		return UNQLITE_NOMEM;
+	}
+	*ppOut = (lhash_vlog_file *)SySetPeek(&pEngine->aVlogFile);
+	return UNQLITE_OK;
+}
+/*
+ * Close the segment iSeg if it is open.
+ */
+static void lhVlogCloseFile(lhash_kv_engine *pEngine,sxu32 iSeg)
+{
+	lhash_vlog_file *aFile = (lhash_vlog_file *)SySetBasePtr(&pEngine->aVlogFile);
+	lhash_vlog_file *pLast;
+	sxu32 n;
+	for( n = 0 ; n < SySetUsed(&pEngine->aVlogFile) ; ++n ){
+		if( aFile[n].iSeg == iSeg ){
+			pEngine->pIo->xCloseFile(pEngine->pIo->pHandle,aFile[n].pFd);
+			/* Fill the hole with the last entry */
+			pLast = (lhash_vlog_file *)SySetPop(&pEngine->aVlogFile);
+			if( pLast != &aFile[n] ){
+				aFile[n] = *pLast;
+			}
+			return;
+		}
+	}
+}
+/*
+ * Make the segments written by the transaction durable. Registered as
+ * the pager commit callback so that the log records reach the disk before
+ * the cells pointing to them.
+ */
+static int lhVlogSync(unqlite_kv_engine *pKv)
+{
+	lhash_kv_engine *pEngine = (lhash_kv_engine *)pKv;
+	lhash_vlog_file *aFile = (lhash_vlog_file *)SySetBasePtr(&pEngine->aVlogFile);
+	sxu32 n;
+	int rc;
+	for( n = 0 ; n < SySetUsed(&pEngine->aVlogFile) ; ++n ){
+		if( aFile[n].bDirty ){
+			rc = unqliteOsSync(aFile[n].pFd,UNQLITE_SYNC_NORMAL);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			aFile[n].bDirty = 0;
+		}
+	}
+	pEngine->bVlogTx = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Value log IO buffer.
+ */
+static unsigned char * lhVlogBuffer(lhash_kv_engine *pEngine)
+{
+	if( pEngine->zVlogBuf == 0 ){
+		pEngine->zVlogBuf = (unsigned char *)SyMemBackendAlloc(&pEngine->sAllocator,L_HASH_VLOG_CHUNK);
+	}
+	return pEngine->zVlogBuf;
+}
+/*
+ * Serialize/Unserialize a value log pointer.
+ */
+static void lhVlogPackPtr(const lhash_vlog_ptr *pPtr,unsigned char *zBuf)
+{
+	SyBigEndianPack32(zBuf,pPtr->iSeg);
+	SyBigEndianPack64(&zBuf[4],pPtr->iOfft);
+	SyBigEndianPack64(&zBuf[4+8],pPtr->nData);
+}
+static void lhVlogUnpackPtr(const unsigned char *zBuf,lhash_vlog_ptr *pPtr)
+{
+	SyBigEndianUnpack32(zBuf,&pPtr->iSeg);
+	SyBigEndianUnpack64(&zBuf[4],&pPtr->iOfft);
+	SyBigEndianUnpack64(&zBuf[4+8],&pPtr->nData);
+}
+/*
+ * Extract the value log pointer stored in the data of a cell.
+ */
+static int lhCellVlogPtr(lhcell *pCell,lhash_vlog_ptr *pPtr)
+{
+	lhash_kv_engine *pEngine = pCell->pPage->pHash;
+	SyBlob sWorker;
+	int rc;
+	if( pCell->nData != L_HASH_VLOG_PTR_SZ ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Corrupt value log pointer");
+		return UNQLITE_CORRUPT;
+	}
+	if( pCell->iOvfl == 0 ){
+		/* Local pointer */
+		lhVlogUnpackPtr(&pCell->pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey],pPtr);
+		return UNQLITE_OK;
+	}
+	SyBlobInit(&sWorker,&pEngine->sAllocator);
+	rc = lhConsumeCellData(pCell,unqliteDataConsumer,&sWorker);
+	if( rc == UNQLITE_OK ){
+		if( SyBlobLength(&sWorker) != L_HASH_VLOG_PTR_SZ ){
+			rc = UNQLITE_CORRUPT;
+		}else{
+			lhVlogUnpackPtr((const unsigned char *)SyBlobData(&sWorker),pPtr);
+		}
+	}
+	SyBlobRelease(&sWorker);
+	return rc;
+}
+/*
+ * Read and check the header of the log record a pointer refer to.
+ */
+static int lhVlogReadHeader(lhash_kv_engine *pEngine,unqlite_file *pFd,sxu64 iOfft,sxu32 *pKey,sxu64 *pData)
+{
+	unsigned char zHdr[L_HASH_VLOG_REC_HDR];
+	sxu32 nMagic;
+	int rc;
+	rc = unqliteOsRead(pFd,zHdr,L_HASH_VLOG_REC_HDR,(unqlite_int64)iOfft);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack32(zHdr,&nMagic);
+	SyBigEndianUnpack32(&zHdr[4],pKey);
+	SyBigEndianUnpack64(&zHdr[4+4],pData);
+	if( nMagic != L_HASH_VLOG_MAGIC ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Corrupt value log record");
+		return UNQLITE_CORRUPT;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Consume nLen bytes starting at offset iStart of the value a log pointer
+ * refer to by invoking the given callback for each extracted chunk.
+ */
+static int lhVlogRead(
+	lhash_kv_engine *pEngine,
+	const lhash_vlog_ptr *pPtr, /* Target record */
+	sxu32 nKey,                 /* Key length of the record */
+	sxu64 iStart,sxu64 nLen,    /* Range to be consumed */
+	int (*xConsumer)(const void *,unsigned int,void *), /* Data consumer callback */
+	void *pUserData /* Last argument to xConsumer() */
+	)
+{
+	lhash_vlog_file *pFile;
+	unsigned char *zBuf;
+	sxu64 nData,iOfft,nRead;
+	sxu32 nRecKey;
+	int rc;
+	rc = lhVlogFile(pEngine,pPtr->iSeg,0,&pFile);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = lhVlogReadHeader(pEngine,pFile->pFd,pPtr->iOfft,&nRecKey,&nData);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( nRecKey != nKey || nData != pPtr->nData ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Corrupt value log record");
+		return UNQLITE_CORRUPT;
+	}
+	zBuf = lhVlogBuffer(pEngine);
+	if( zBuf == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	if( iStart >= nData ){
+		return UNQLITE_OK;
+	}
+	if( nLen > nData - iStart ){
+		nLen = nData - iStart;
+	}
+	nData = nLen;
+	iOfft = pPtr->iOfft + L_HASH_VLOG_REC_HDR + nKey + iStart;
+	while( nData > 0 ){
+		nRead = nData > L_HASH_VLOG_CHUNK ? L_HASH_VLOG_CHUNK : nData;
+		rc = unqliteOsRead(pFile->pFd,zBuf,(unqlite_int64)nRead,(unqlite_int64)iOfft);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = xConsumer((const void *)zBuf,(unsigned int)nRead,pUserData);
+		if( rc != UNQLITE_OK ){
+			return UNQLITE_ABORT;
+		}
+		iOfft += nRead;
+		nData -= nRead;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Given a cell, Consume its value (Stored in the cell or in the value log).
+ */
+static int lhConsumeCellValue(
+	lhcell *pCell, /* Target cell */
+	int (*xConsumer)(const void *,unsigned int,void *), /* Data consumer callback */
+	void *pUserData /* Last argument to xConsumer() */
+	)
+{
+	lhash_vlog_ptr sPtr;
+	int rc;
+	if( !pCell->bVlog ){
+		return lhConsumeCellData(pCell,xConsumer,pUserData);
+	}
+	rc = lhCellVlogPtr(pCell,&sPtr);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return lhVlogRead(pCell->pPage->pHash,&sPtr,pCell->nKey,0,sPtr.nData,xConsumer,pUserData);
+}
+/*
+ * Given a cell, Consume nLen bytes of its value starting at offset iStart.
+ * The overflow page where the previous call stopped is remembered so that
+ * sequential reads do not walk the chain from its head each time.
+ */
+static int lhConsumeCellRange(
+	lhcell *pCell, /* Target cell */
+	sxu64 iStart,sxu64 nLen, /* Range to be consumed */
+	int (*xConsumer)(const void *,unsigned int,void *), /* Data consumer callback */
+	void *pUserData /* Last argument to xConsumer() */
+	)
+{
+	lhpage *pPage = pCell->pPage;
+	lhash_kv_engine *pEngine = pPage->pHash;
+	const unsigned char *zPayload;
+	unqlite_page *pOvfl;
+	sxu32 nAvail,nByte;
+	sxu64 iPos;
+	pgno iOvfl;
+	int rc;
+	if( pCell->bVlog ){
+		lhash_vlog_ptr sPtr;
+		rc = lhCellVlogPtr(pCell,&sPtr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		return lhVlogRead(pEngine,&sPtr,pCell->nKey,iStart,nLen,xConsumer,pUserData);
+	}
+	if( iStart >= pCell->nData ){
+		return UNQLITE_OK;
+	}
+	if( nLen > pCell->nData - iStart ){
+		nLen = pCell->nData - iStart;
+	}
+	if( pCell->iOvfl == 0 ){
+		/* Local payload */
+		zPayload = &pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey + iStart];
+		rc = xConsumer((const void *)zPayload,(unsigned int)nLen,pUserData);
+		return rc != UNQLITE_OK ? UNQLITE_ABORT : UNQLITE_OK;
+	}
+	if( pCell->iDataPage == 0 ){
+		/* The key was never read, grab the data page and offset */
+		rc = lhConsumeCellkey(pCell,unqliteDataConsumer,0,1);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( pCell->iHintPage > 0 && pCell->iHintPos <= iStart ){
+		/* Resume where the last read stopped */
+		iOvfl = pCell->iHintPage;
+		iPos = pCell->iHintPos;
+	}else{
+		iOvfl = pCell->iDataPage;
+		iPos = 0;
+	}
+	while( nLen > 0 ){
+		if( iOvfl == 0 ){
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Corrupt overflow page");
+			return UNQLITE_CORRUPT;
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iOvfl,&pOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iOvfl == pCell->iDataPage ){
+			zPayload = &pOvfl->zData[pCell->iDataOfft];
+			nAvail = pEngine->iPageSize - pCell->iDataOfft;
+		}else{
+			zPayload = &pOvfl->zData[8];
+			nAvail = L_HASH_OVERFLOW_SIZE(pEngine->iPageSize);
+		}
+		if( iStart < iPos + nAvail ){
+			nByte = nAvail - (sxu32)(iStart - iPos);
+			if( (sxu64)nByte > nLen ){
+				nByte = (sxu32)nLen;
+			}
+			rc = xConsumer((const void *)&zPayload[iStart - iPos],nByte,pUserData);
+			if( rc != UNQLITE_OK ){
+				pEngine->pIo->xPageUnref(pOvfl);
+				return UNQLITE_ABORT;
+			}
+			pCell->iHintPage = iOvfl;
+			pCell->iHintPos = iPos;
+			iStart += nByte;
+			nLen -= nByte;
+		}
+		/* Next overflow page in the chain */
+		SyBigEndianUnpack64(pOvfl->zData,&iOvfl);
+		pEngine->pIo->xPageUnref(pOvfl);
+		iPos += nAvail;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Grow a buffer of the engine to at least nByte bytes.
+ */
+static int lhLzGrow(lhash_kv_engine *pEngine,unsigned char **pzBuf,sxu32 *pnBuf,sxu32 nByte)
+{
+	unsigned char *zNew;
+	if( *pnBuf >= nByte ){
+		return UNQLITE_OK;
+	}
+	zNew = (unsigned char *)SyMemBackendRealloc(&pEngine->sAllocator,(void *)*pzBuf,nByte);
+	if( zNew == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	*pzBuf = zNew;
+	*pnBuf = nByte;
+	return UNQLITE_OK;
+}
+/*
+ * Write a literal or match length extension.
+ */
+static unsigned char * lhLzPutLength(unsigned char *zOut,unsigned char *zEnd,sxu32 nLen)
+{
+	while( nLen >= 255 ){
+		if( zOut >= zEnd ){
+			return 0;
+		}
+		*zOut++ = 255;
+		nLen -= 255;
+	}
+	if( zOut >= zEnd ){
+		return 0;
+	}
+	*zOut++ = (unsigned char)nLen;
+	return zOut;
+}
+/*
+ * Append a token: nLit literals followed by a match of nMatch bytes
+ * (zero for the last token) at distance iDist.
+ */
+static unsigned char * lhLzPutToken(
+	unsigned char *zOut,unsigned char *zEnd,
+	const unsigned char *zLit,sxu32 nLit,
+	sxu32 iDist,sxu32 nMatch
+	)
+{
+	unsigned char *zToken = zOut++;
+	sxu32 nCode;
+	if( zOut > zEnd ){
+		return 0;
+	}
+	*zToken = (unsigned char)((nLit >= 15 ? 15 : nLit) << 4);
+	if( nLit >= 15 ){
+		zOut = lhLzPutLength(zOut,zEnd,nLit - 15);
+		if( zOut == 0 ){
+			return 0;
+		}
+	}
+	if( (sxu32)(zEnd - zOut) < nLit ){
+		return 0;
+	}
+	SyMemcpy((const void *)zLit,(void *)zOut,nLit);
+	zOut += nLit;
+	if( nMatch < 1 ){
+		return zOut;
+	}
+	if( zEnd - zOut < 2 ){
+		return 0;
+	}
+	zOut[0] = (unsigned char)(iDist & 0xFF);
+	zOut[1] = (unsigned char)(iDist >> 8);
+	zOut += 2;
+	nCode = nMatch - L_HASH_LZ_MIN_MATCH;
+	*zToken |= (unsigned char)(nCode >= 15 ? 15 : nCode);
+	if( nCode >= 15 ){
+		zOut = lhLzPutLength(zOut,zEnd,nCode - 15);
+	}
+	return zOut;
+}
+/*
+ * Compress nIn bytes into zOut[]. Return UNQLITE_FULL when the compressed
+ * stream would not fit in nMax bytes.
+ */
+UNQLITE_PRIVATE int unqliteLzCompress(
+	const unsigned char *zIn,sxu32 nIn,
+	unsigned char *zOut,sxu32 nMax,
+	sxu32 *aHash,    /* Match finder table (1 << L_HASH_LZ_HASH_BITS entries) */
+	sxu32 *pnOut     /* OUT: Compressed length */
+	)
+{
+	unsigned char *zPtr = zOut,*zEnd = &zOut[nMax];
+	sxu32 iAnchor = 0,i = 0;
+	sxu32 nSeq,iCand,nMatch,h;
+	SyZero((void *)aHash,sizeof(sxu32) << L_HASH_LZ_HASH_BITS);
+	while( nIn >= L_HASH_LZ_MIN_MATCH && i <= nIn - L_HASH_LZ_MIN_MATCH ){
+		SyMemcpy((const void *)&zIn[i],(void *)&nSeq,sizeof(sxu32));
+		h = (nSeq * 2654435761U) >> (32 - L_HASH_LZ_HASH_BITS);
+		iCand = aHash[h];
+		aHash[h] = i + 1;
+		if( iCand == 0 || i - (iCand - 1) > L_HASH_LZ_MAX_OFFSET || SyMemcmp((const void *)&zIn[iCand - 1],(const void *)&zIn[i],L_HASH_LZ_MIN_MATCH) != 0 ){
+			i++;
+			continue;
+		}
+		iCand--;
+		nMatch = L_HASH_LZ_MIN_MATCH;
+		while( i + nMatch < nIn && zIn[iCand + nMatch] == zIn[i + nMatch] ){
+			nMatch++;
+		}
+		zPtr = lhLzPutToken(zPtr,zEnd,&zIn[iAnchor],i - iAnchor,i - iCand,nMatch);
+		if( zPtr == 0 ){
+			return UNQLITE_FULL;
+		}
+		i += nMatch;
+		iAnchor = i;
+	}
+	/* Trailing literals */
+	zPtr = lhLzPutToken(zPtr,zEnd,&zIn[iAnchor],nIn - iAnchor,0,0);
+	if( zPtr == 0 ){
+		return UNQLITE_FULL;
+	}
+	*pnOut = (sxu32)(zPtr - zOut);
+	return UNQLITE_OK;
+}
+/*
+ * Read a literal or match length extension.
+ */
+static const unsigned char * lhLzGetLength(const unsigned char *zIn,const unsigned char *zEnd,sxu32 *pLen)
+{
+	sxu32 nLen = *pLen;
+	for(;;){
+		if( zIn >= zEnd ){
+			return 0;
+		}
+		nLen += *zIn;
+		if( *zIn++ != 255 ){
+			break;
+		}
+	}
+	*pLen = nLen;
+	return zIn;
+}
+/*
+ * Decompress a stream into exactly nOut bytes.
+ */
+UNQLITE_PRIVATE int unqliteLzDecompress(const unsigned char *zIn,sxu32 nIn,unsigned char *zOut,sxu32 nOut)
+{
+	const unsigned char *zEnd = &zIn[nIn];
+	sxu32 iOut = 0,nLen,iDist;
+	unsigned char cToken;
+	while( zIn < zEnd ){
+		cToken = *zIn++;
+		/* Literals */
+		nLen = cToken >> 4;
+		if( nLen == 15 ){
+			zIn = lhLzGetLength(zIn,zEnd,&nLen);
+			if( zIn == 0 ){
+				return UNQLITE_CORRUPT;
+			}
+		}
+		if( (sxu32)(zEnd - zIn) < nLen || nOut - iOut < nLen ){
+			return UNQLITE_CORRUPT;
+		}
+		SyMemcpy((const void *)zIn,(void *)&zOut[iOut],nLen);
+		zIn += nLen;
+		iOut += nLen;
+		if( zIn >= zEnd ){
+			/* Last token */
+			break;
+		}
+		/* Match */
+		if( zEnd - zIn < 2 ){
+			return UNQLITE_CORRUPT;
+		}
+		iDist = (sxu32)zIn[0] | ((sxu32)zIn[1] << 8);
+		zIn += 2;
+		nLen = cToken & 0x0F;
+		if( nLen == 15 ){
+			zIn = lhLzGetLength(zIn,zEnd,&nLen);
+			if( zIn == 0 ){
+				return UNQLITE_CORRUPT;
+			}
+		}
+		nLen += L_HASH_LZ_MIN_MATCH;
+		if( iDist == 0 || iDist > iOut || nOut - iOut < nLen ){
+			return UNQLITE_CORRUPT;
+		}
+		/* The match may overlap the bytes it produces */
+		while( nLen-- > 0 ){
+			zOut[iOut] = zOut[iOut - iDist];
+			iOut++;
+		}
+	}
+	return iOut == nOut ? UNQLITE_OK : UNQLITE_CORRUPT;
+}
+/*
+ * Compress a value according to the engine settings. *pzOut is set to
+ * NULL when the value is stored as is (Too short or incompressible).
+ */
+static int lhLzPack(lhash_kv_engine *pEngine,const void *pData,sxu64 nData,const void **pzOut,sxu64 *pnOut)
+{
+	sxu32 nStream;
+	int rc;
+	*pzOut = 0;
+	if( pEngine->sKeep.iLzCodec != UNQLITE_KV_COMPRESS_LZ || nData < pEngine->sKeep.nLzMin
+		|| nData <= L_HASH_LZ_HDR + 1 || nData >= SXU32_HIGH ){
+		return UNQLITE_OK;
+	}
+	if( pEngine->aLzHash == 0 ){
+		pEngine->aLzHash = (sxu32 *)SyMemBackendAlloc(&pEngine->sAllocator,sizeof(sxu32) << L_HASH_LZ_HASH_BITS);
+		if( pEngine->aLzHash == 0 ){
+			return UNQLITE_NOMEM;
+		}
+	}
+	rc = lhLzGrow(pEngine,&pEngine->zLzBuf,&pEngine->nLzBuf,(sxu32)nData);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Keep the compressed form only if it is smaller */
+	rc = unqliteLzCompress((const unsigned char *)pData,(sxu32)nData,&pEngine->zLzBuf[L_HASH_LZ_HDR],
+		(sxu32)nData - L_HASH_LZ_HDR - 1,pEngine->aLzHash,&nStream);
+	if( rc != UNQLITE_OK ){
+		return UNQLITE_OK;
+	}
+	pEngine->zLzBuf[0] = UNQLITE_KV_COMPRESS_LZ;
+	SyBigEndianPack64(&pEngine->zLzBuf[1],nData);
+	*pzOut = (const void *)pEngine->zLzBuf;
+	*pnOut = L_HASH_LZ_HDR + nStream;
+	return UNQLITE_OK;
+}
+/*
+ * Original length of a compressed value.
+ */
+static int lhLzValueLength(lhcell *pCell,sxu64 *pLen)
+{
+	unsigned char zHdr[L_HASH_LZ_HDR];
+	SyBlob sHdr;
+	int rc;
+	SyBlobInitFromBuf(&sHdr,zHdr,sizeof(zHdr));
+	rc = lhConsumeCellRange(pCell,0,L_HASH_LZ_HDR,unqliteDataConsumer,&sHdr);
+	if( rc == UNQLITE_OK && (SyBlobLength(&sHdr) != L_HASH_LZ_HDR || zHdr[0] != UNQLITE_KV_COMPRESS_LZ) ){
+		pCell->pPage->pHash->pIo->xErr(pCell->pPage->pHash->pIo->pHandle,"Corrupt compressed value");
+		rc = UNQLITE_CORRUPT;
+	}
+	if( rc == UNQLITE_OK ){
+		SyBigEndianUnpack64(&zHdr[1],pLen);
+	}
+	SyBlobRelease(&sHdr);
+	return rc;
+}
+/*
+ * Decompress the value of a cell. The result is kept until the cell
+ * is modified or released so that ranges of it can be read in turn.
+ */
+static int lhLzInflate(lhcell *pCell,const unsigned char **pzData,sxu64 *pnData)
+{
+	lhash_kv_engine *pEngine = pCell->pPage->pHash;
+	const unsigned char *zStream;
+	SyBlob sWorker;
+	sxu64 nLen;
+	int rc;
+	if( pEngine->pLzCell != pCell ){
+		pEngine->pLzCell = 0;
+		SyBlobInit(&sWorker,&pEngine->sAllocator);
+		rc = lhConsumeCellRange(pCell,0,SXU64_HIGH,unqliteDataConsumer,&sWorker);
+		if( rc == UNQLITE_OK ){
+			zStream = (const unsigned char *)SyBlobData(&sWorker);
+			if( SyBlobLength(&sWorker) < L_HASH_LZ_HDR || zStream[0] != UNQLITE_KV_COMPRESS_LZ ){
+				rc = UNQLITE_CORRUPT;
+			}else{
+				SyBigEndianUnpack64(&zStream[1],&nLen);
+				rc = nLen >= SXU32_HIGH ? UNQLITE_CORRUPT : lhLzGrow(pEngine,&pEngine->zLzCache,&pEngine->nLzCache,(sxu32)nLen + 1);
+				if( rc == UNQLITE_OK ){
+					rc = unqliteLzDecompress(&zStream[L_HASH_LZ_HDR],SyBlobLength(&sWorker) - L_HASH_LZ_HDR,pEngine->zLzCache,(sxu32)nLen);
+				}
+			}
+		}
+		SyBlobRelease(&sWorker);
+		if( rc != UNQLITE_OK ){
+			if( rc == UNQLITE_CORRUPT ){
+				pEngine->pIo->xErr(pEngine->pIo->pHandle,"Corrupt compressed value");
+			}
+			return rc;
+		}
+		pEngine->pLzCell = pCell;
+		pEngine->nLzCacheLen = nLen;
+	}
+	*pzData = pEngine->zLzCache;
+	*pnData = pEngine->nLzCacheLen;
+	return UNQLITE_OK;
+}
+/*
+ * Segment N of the value log root page.
+ */
+#define L_HASH_VLOG_ENTRY(ROOT,N) (&(ROOT)->zData[L_HASH_VLOG_ROOT_HDR + (N) * L_HASH_VLOG_ENTRY_SZ])
+/*
+ * A log record is no longer referenced, account its bytes as dead so
+ * that the garbage collector can reclaim its segment.
+ */
+static int lhVlogRelease(lhash_kv_engine *pEngine,const lhash_vlog_ptr *pPtr,sxu32 nKey)
+{
+	unqlite_page *pRoot;
+	unsigned char *zEntry;
+	sxu64 nSize,nDead;
+	sxu32 nEntry,iSeg,n;
+	int rc;
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],&nEntry);
+	for( n = 0 ; n < nEntry ; ++n ){
+		zEntry = L_HASH_VLOG_ENTRY(pRoot,n);
+		SyBigEndianUnpack32(zEntry,&iSeg);
+		if( iSeg != pPtr->iSeg ){
+			continue;
+		}
+		rc = pEngine->pIo->xWrite(pRoot);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianUnpack64(&zEntry[4],&nSize);
+			SyBigEndianUnpack64(&zEntry[4+8],&nDead);
+			nDead += L_HASH_VLOG_REC_HDR + nKey + pPtr->nData;
+			SyBigEndianPack64(&zEntry[4+8],nDead > nSize ? nSize : nDead);
+		}
+		break;
+	}
+	pEngine->pIo->xPageUnref(pRoot);
+	return rc;
+}
+/*
+ * Walk the free list and count its pages.
+ */
+static int lhCountFreePages(lhash_kv_engine *pEngine)
+{
+	pgno nPage = pEngine->pIo->xDbSize(pEngine->pIo->pHandle);
+	pgno iNext = pEngine->nFreeList;
+	unqlite_page *pPage;
+	int rc;
+	pEngine->nFreePage = 0;
+	while( iNext > 0 ){
+		if( pEngine->nFreePage > nPage ){
+			/* Free list loop */
+			return UNQLITE_CORRUPT;
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNext,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(pPage->zData,&iNext);
+		pEngine->pIo->xPageUnref(pPage);
+		pEngine->nFreePage++;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Reflect the free list head and its page count in the database header.
+ * pEngine->pIo->xWrite() must have been successfully called on the header.
+ */
+static void lhWriteFreeList(lhash_kv_engine *pEngine)
+{
+	unsigned char *zRaw = pEngine->pHeader->zData;
+	sxu32 nWord = (sxu32)(pEngine->nFreePage + 1) & L_HASH_FREE_COUNT_MASK;
+	if( pEngine->bDeferSplit ){
+		nWord |= L_HASH_DEFER_SPLIT;
+	}
+	if( pEngine->bPresized ){
+		nWord |= L_HASH_PRESIZED;
+	}
+	SyBigEndianPack64(&zRaw[4/*Magic*/+4/*Hash*/],pEngine->nFreeList);
+	SyBigEndianPack32(&zRaw[L_HASH_FREE_COUNT_OFFT(pEngine->iPageSize)],nWord);
+}
+/* Forward declaration */
+static sxu32 lhash_bin_hash(const void *pSrc,sxu32 nLen);
+static sxu32 lhash_mix64_hash(const void *pSrc,sxu32 nLen);
+static sxu64 lhash_mix64(const void *pSrc,sxu32 nLen,sxu64 nSeed);
+/*
+ * Return the built-in hash function identified by iHashId, NULL otherwise.
+ */
+static ProcHash lhBuiltinHash(int iHashId)
+{
+	switch(iHashId){
+	case UNQLITE_KV_HASH_DJB:   return lhash_bin_hash;
+	case UNQLITE_KV_HASH_MIX64: return lhash_mix64_hash;
+	default:
+		break;
+	}
+	return 0;
+}
 /*
  * Read the linear hash header (Page one of the database).
  */
@@ -49567,7 +51002,7 @@ static int lhash_read_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 {
 	const unsigned char *zRaw = pHeader->zData;
 	lhash_bmap_page *pMap;
-	sxu32 nHash;
+	sxu32 nHash,nCount;
 	int rc;
 	pEngine->pHeader = pHeader;
 	/* 4 byte magic number */
@@ -49582,13 +51017,39 @@ static int lhash_read_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	zRaw += 4;
 	/* Sanity check */
 	if( pEngine->xHash(L_HASH_WORD,sizeof(L_HASH_WORD)-1) != nHash ){
-		/* Different hash function */
-		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Invalid hash function");
-		return UNQLITE_INVALID;
+		ProcHash xHash = 0;
+		if( pEngine->xHash == lhash_bin_hash || pEngine->xHash == lhash_mix64_hash ){
+			/* Built-in hash function, switch to the one the image was created with */
+			if( lhash_bin_hash(L_HASH_WORD,sizeof(L_HASH_WORD)-1) == nHash ){
+				xHash = lhash_bin_hash;
+			}else if( lhash_mix64_hash(L_HASH_WORD,sizeof(L_HASH_WORD)-1) == nHash ){
+				xHash = lhash_mix64_hash;
+			}
+		}
+		if( xHash == 0 ){
+			/* Different hash function */
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Invalid hash function");
+			return UNQLITE_INVALID;
+		}
+		pEngine->xHash = xHash;
 	}
 	/* List of free pages */
 	SyBigEndianUnpack64(zRaw,&pEngine->nFreeList);
 	zRaw += 8;
+	/* Free page count */
+	SyBigEndianUnpack32(&pHeader->zData[L_HASH_FREE_COUNT_OFFT(pEngine->iPageSize)],&nCount);
+	pEngine->bDeferSplit = (nCount & L_HASH_DEFER_SPLIT) ? 1 : 0;
+	pEngine->bPresized = (nCount & L_HASH_PRESIZED) ? 1 : 0;
+	nCount &= L_HASH_FREE_COUNT_MASK;
+	if( nCount > 0 ){
+		pEngine->nFreePage = (pgno)(nCount - 1);
+	}else{
+		/* Older image, count the free pages */
+		rc = lhCountFreePages(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
 	/* Current split bucket */
 	SyBigEndianUnpack64(zRaw,&pEngine->split_bucket);
 	zRaw += 8;
@@ -49608,35 +51069,121 @@ static int lhash_read_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	SyBigEndianUnpack32(zRaw,&pMap->nRec);
 	zRaw += 4;
 	pMap->iPtr = (sxu16)(zRaw - pHeader->zData);
-	/* Load the map in memory */
+	/* Load the records of page one, the rest of the chain is loaded on demand */
 	rc = lhMapLoadPage(pEngine,pMap,pHeader->zData);
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
-	/* Load the bucket map chain if any */
-	for(;;){
-		pgno iNext = pMap->iNext;
-		unqlite_page *pPage;
-		if( iNext == 0 ){
-			/* No more map pages */
+	/* All done */
+	return UNQLITE_OK;
+}
+/*
+ * Load the Bloom filter directory in memory.
+ */
+static int lhBloomLoad(lhash_kv_engine *pEngine)
+{
+	pgno iDir = pEngine->iBloom,iNext,nBlock,nKey,nPage,nDir,n = 0;
+	sxu32 nEntry,nBase,i;
+	unqlite_page *pRaw;
+	int rc;
+	/* Root page */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iDir,&pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack64(&pRaw->zData[L_HASH_PAGE_HDR_SZ+8+4],&nBlock);
+	SyBigEndianUnpack64(&pRaw->zData[L_HASH_PAGE_HDR_SZ+8+4+8],&nKey);
+	pEngine->pIo->xPageUnref(pRaw);
+	nPage = (nBlock + (pgno)(pEngine->iPageSize / L_HASH_BLOOM_BLOCK) - 1) / (pgno)(pEngine->iPageSize / L_HASH_BLOOM_BLOCK);
+	if( nBlock < 1 || nPage > pEngine->pIo->xDbSize(pEngine->pIo->pHandle) ){
+		return UNQLITE_CORRUPT;
+	}
+	pEngine->aBloomPage = (pgno *)SyMemBackendAlloc(&pEngine->sAllocator,(sxu32)(nPage * sizeof(pgno)));
+	if( pEngine->aBloomPage == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	nBase = L_HASH_BLOOM_ROOT_HDR;
+	iNext = L_HASH_PAGE_HDR_SZ;
+	for( nDir = 0 ; iDir > 0 && n < nPage ; ++nDir ){
+		if( nDir > nPage ){
+			/* Directory loop */
+			rc = UNQLITE_CORRUPT;
 			break;
 		}
-		/* Point to the target page */
-		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNext,&pPage);
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iDir,&pRaw);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		SyBigEndianUnpack32(&pRaw->zData[iNext + 8],&nEntry);
+		for( i = 0 ; i < nEntry && n < nPage ; ++i ){
+			if( nBase + (i + 1) * 8 > (sxu32)pEngine->iPageSize ){
+				break;
+			}
+			SyBigEndianUnpack64(&pRaw->zData[nBase + i * 8],&pEngine->aBloomPage[n++]);
+		}
+		SyBigEndianUnpack64(&pRaw->zData[iNext],&iDir);
+		pEngine->pIo->xPageUnref(pRaw);
+		nBase = L_HASH_BLOOM_DIR_HDR;
+		iNext = 0;
+	}
+	if( rc == UNQLITE_OK && n < nPage ){
+		rc = UNQLITE_CORRUPT;
+	}
+	if( rc != UNQLITE_OK ){
+		SyMemBackendFree(&pEngine->sAllocator,pEngine->aBloomPage);
+		pEngine->aBloomPage = 0;
+		return rc;
+	}
+	pEngine->nBloomPage = nPage;
+	pEngine->nBloomBlock = nBlock;
+	pEngine->nBloomKey = nKey;
+	return UNQLITE_OK;
+}
+/*
+ * Test or set (bSet) the Bloom filter bits of a key.
+ * Return UNQLITE_NOTFOUND when the key is certainly not stored.
+ */
+static int lhBloomProbe(lhash_kv_engine *pEngine,const void *pKey,sxu32 nByte,int bSet)
+{
+	sxu64 nH = lhash_mix64(pKey,nByte,L_HASH_BLOOM_SEED);
+	sxu32 nPerPage = (sxu32)(pEngine->iPageSize / L_HASH_BLOOM_BLOCK);
+	unsigned char *zBlock;
+	unqlite_page *pRaw;
+	pgno iBlock;
+	sxu64 nBits;
+	int i,rc;
+	if( pEngine->aBloomPage == 0 ){
+		rc = lhBloomLoad(pEngine);
 		if( rc != UNQLITE_OK ){
 			return rc;
 		}
-		/* Fill in the structure */
-		pMap->iNum = iNext;
-		pMap->iPtr = 0;
-		/* Load the map in memory */
-		rc = lhMapLoadPage(pEngine,pMap,pPage->zData);
+	}
+	/* Block of the key, then the bits within the block */
+	iBlock = (pgno)((nH >> 32) % pEngine->nBloomBlock);
+	nBits = (nH ^ (nH >> 31)) * 0x94D049BB133111EBULL;
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->aBloomPage[iBlock / nPerPage],&pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( bSet ){
+		rc = pEngine->pIo->xWrite(pRaw);
 		if( rc != UNQLITE_OK ){
+			pEngine->pIo->xPageUnref(pRaw);
 			return rc;
 		}
 	}
-	/* All done */
-	return UNQLITE_OK;
+	zBlock = &pRaw->zData[(iBlock % nPerPage) * L_HASH_BLOOM_BLOCK];
+	for( i = 0 ; i < L_HASH_BLOOM_PROBE ; ++i ){
+		sxu32 iBit = (sxu32)(nBits >> (i * 9)) & 511;
+		if( bSet ){
+			zBlock[iBit >> 3] |= (unsigned char)(1 << (iBit & 7));
+		}else if( (zBlock[iBit >> 3] & (1 << (iBit & 7))) == 0 ){
+			rc = UNQLITE_NOTFOUND;
+			break;
+		}
+	}
+	pEngine->pIo->xPageUnref(pRaw);
+	return rc;
 }
 /*
  * Perform a record lookup.
@@ -49659,6 +51206,13 @@ static int lhRecordLookup(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	if( pEngine->iBloom > 0 ){
+		/* Consult the Bloom filter before any bucket page */
+		rc = lhBloomProbe(pEngine,pKey,nByte,0);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
 	/* Compute the hash of the key first */
 	nHash = pEngine->xHash(pKey,nByte);
 	/* Extract the logical (i.e. not real) page number */
@@ -49668,7 +51222,10 @@ static int lhRecordLookup(
 		iBucket = nHash & (pEngine->max_split_bucket - 1);
 	}
 	/* Map the logical bucket number to real page number */
-	pRec = lhMapFindBucket(pEngine,iBucket);
+	rc = lhMapLoadBucket(pEngine,iBucket,&pRec);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pRec == 0 ){
 		/* No such entry */
 		return UNQLITE_NOTFOUND;
@@ -49702,16 +51259,21 @@ static int lhAcquirePage(lhash_kv_engine *pEngine,unqlite_page **ppOut)
 		/* Acquire one from the free list */
 		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->nFreeList,&pPage);
 		if( rc == UNQLITE_OK ){
-			/* Point to the next free page */
-			SyBigEndianUnpack64(pPage->zData,&pEngine->nFreeList);
 			/* Update the database header */
 			rc = pEngine->pIo->xWrite(pEngine->pHeader);
 			if( rc != UNQLITE_OK ){
 				return rc;
 			}
-			SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/],pEngine->nFreeList);
-			/* Tell the pager do not journal this page */
-			pEngine->pIo->xDontJournal(pPage);
+			/* Point to the next free page */
+			SyBigEndianUnpack64(pPage->zData,&pEngine->nFreeList);
+			if( pEngine->nFreePage > 0 ){
+				pEngine->nFreePage--;
+			}
+			lhWriteFreeList(pEngine);
+			/*
+			 * The page is journaled by the caller: its first 8 bytes link the
+			 * free list and must be restored if the transaction is rolled back.
+			 */
 			/* Return to the caller */
 			*ppOut = pPage;
 			/* All done */
@@ -49735,6 +51297,11 @@ static int lhMapWriteRecord(lhash_kv_engine *pEngine,pgno iLogic,pgno iReal)
 	lhash_bmap_page *pMap = &pEngine->sPageMap;
 	unqlite_page *pPage = 0;
 	int rc;
+	/* Records are appended to the last map page */
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pMap->iPtr > (pEngine->iPageSize - 16) /* 8 byte logical bucket number + 8 byte real bucket number */ ){
 		unqlite_page *pOld;
 		/* Point to the old page */
@@ -49790,8 +51357,8 @@ static int lhMapWriteRecord(lhash_kv_engine *pEngine,pgno iLogic,pgno iReal)
 	pMap->iPtr += 8;
 	SyBigEndianPack64(&pPage->zData[pMap->iPtr],iReal);
 	pMap->iPtr += 8;
-	/* Install the bucket map */
-	rc = lhMapInstallBucket(pEngine,iLogic,iReal);
+	/* Install the bucket map (The Bloom filter and value log records are tracked by the engine) */
+	rc = (iLogic == L_HASH_BLOOM_LOGIC || iLogic == L_HASH_VLOG_LOGIC) ? UNQLITE_OK : lhMapInstallBucket(pEngine,iLogic,iReal);
 	if( rc == UNQLITE_OK ){
 		/* Total number of records */
 		pMap->nRec++;
@@ -49851,7 +51418,7 @@ static int lhPageDefragment(lhpage *pPage)
 			SyBigEndianPack32(zPtr,pCell->nKey);
 			zPtr += 4;
 			/* 8 byte data length */
-			SyBigEndianPack64(zPtr,pCell->nData);
+			SyBigEndianPack64(zPtr,L_HASH_CELL_DATA_LEN(pCell));
 			zPtr += 8;
 			/* 2 byte offset of the next cell */
 			SyBigEndianPack16(zPtr,pCell->iNext);
@@ -49910,10 +51477,10 @@ static int lhAllocateSpace(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft)
 	unsigned char *zPrev;
 	int rc;
 	if( (sxu64)pPage->nFree < nAmount ){
-		/* Don't bother looking for a free chunk */
+		/* Don't bother looking for a free chunk. This also keep nAmount in the 16-bit range */
 		return UNQLITE_FULL;
 	}
-	if( pPage->nCell < 10 && ((int)nAmount >= (pPage->pHash->iPageSize / 2)) ){
+	if( pPage->nCell < 10 && (nAmount >= (sxu64)(pPage->pHash->iPageSize / 2)) ){
 		/* Big chunk need an overflow page for its data */
 		return UNQLITE_FULL;
 	}
@@ -50000,7 +51567,7 @@ static int lhCellWriteHeader(lhcell *pCell)
 	SyBigEndianPack32(zRaw,pCell->nKey);
 	zRaw += 4;
 	/* 8 byte data length */
-	SyBigEndianPack64(zRaw,pCell->nData);
+	SyBigEndianPack64(zRaw,L_HASH_CELL_DATA_LEN(pCell));
 	zRaw += 8;
 	/* 2 byte offset of the next cell */
 	pCell->iNext = pPage->sHdr.iOfft;
@@ -50055,6 +51622,7 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	pEngine->sKeep.sStats.nOverflow++;
 	/* Acquire a writer lock */
 	rc = pEngine->pIo->xWrite(pOvfl);
 	if( rc != UNQLITE_OK ){
@@ -50083,6 +51651,7 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 			if( rc != UNQLITE_OK ){
 				return rc;
 			}
+			pEngine->sKeep.sStats.nOverflow++;
 			rc = pEngine->pIo->xWrite(pNew);
 			if( rc != UNQLITE_OK ){
 				return rc;
@@ -50105,6 +51674,28 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 		zPtr += nKeylen;
 		zRaw += nKeylen;
 	}
+	if( zRaw >= zRawEnd ){
+		/*
+		 * The key fills the page. Start the data on a new one since the
+		 * end of a 64KB page is not a valid 16-bit offset.
+		 */
+		rc = lhAcquirePage(pEngine,&pNew);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->sKeep.sStats.nOverflow++;
+		rc = pEngine->pIo->xWrite(pNew);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		/* Link */
+		SyBigEndianPack64(pOvfl->zData,pNew->iPage);
+		pEngine->pIo->xPageUnref(pOvfl);
+		SyBigEndianPack64(pNew->zData,0); /* Next overflow page on the chain */
+		pOvfl = pNew;
+		zRaw = &pNew->zData[8];
+		zRawEnd = &pNew->zData[pEngine->iPageSize];
+	}
 	rc = UNQLITE_OK;
 	va_start(ap,nKeylen);
 	pCell->iDataPage = pNew->iPage;
@@ -50137,6 +51728,7 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 					va_end(ap);
 					return rc;
 				}
+				pEngine->sKeep.sStats.nOverflow++;
 				rc = pEngine->pIo->xWrite(pNew);
 				if( rc != UNQLITE_OK ){
 					va_end(ap);
@@ -50161,6 +51753,10 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 			zRaw += nDatalen;
 		}
 	}
+	/* Remember where the data ends so that appends do not walk the chain */
+	pCell->iTailPage = pOvfl->iPage;
+	pCell->iTailOfft = (sxu32)(zRaw - pOvfl->zData);
+	pCell->iHintPage = 0;
 	/* Unref the overflow page */
 	pEngine->pIo->xPageUnref(pOvfl);
 	va_end(ap);
@@ -50183,7 +51779,8 @@ static int lhRestorePage(lhash_kv_engine *pEngine,unqlite_page *pPage)
 	/* Link to the list of free page */
 	SyBigEndianPack64(pPage->zData,pEngine->nFreeList);
 	pEngine->nFreeList = pPage->iPage;
-	SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/],pEngine->nFreeList);
+	pEngine->nFreePage++;
+	lhWriteFreeList(pEngine);
 	/* All done */
 	return UNQLITE_OK;
 }
@@ -50253,6 +51850,17 @@ static int lhRecordRemove(lhcell *pCell)
 {
 	lhash_kv_engine *pEngine = pCell->pPage->pHash;
 	int rc;
+	if( pCell->bVlog ){
+		lhash_vlog_ptr sPtr;
+		/* The log record is now dead */
+		rc = lhCellVlogPtr(pCell,&sPtr);
+		if( rc == UNQLITE_OK ){
+			rc = lhVlogRelease(pEngine,&sPtr,pCell->nKey);
+		}
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
 	if( pCell->iOvfl > 0){
 		/* Discard overflow pages */
 		unqlite_page *pOvfl;
@@ -50279,6 +51887,9 @@ static int lhRecordRemove(lhcell *pCell)
 	}
 	/* Unlink the cell */
 	rc = lhUnlinkCell(pCell);
+	if( rc == UNQLITE_OK ){
+		pEngine->sKeep.sStats.nDelete++;
+	}
 	return rc;
 }
 /*
@@ -50354,6 +51965,8 @@ static int lhRecordOverwrite(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	/* The overflow chain is rewritten */
+	pCell->iTailPage = pCell->iHintPage = 0;
 	if( pCell->iOvfl == 0 ){
 		/* Local payload, try to deal with the free space issues */
 		zPayload = &pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey];
@@ -50447,6 +52060,7 @@ static int lhRecordOverwrite(
 			if( rc != UNQLITE_OK ){
 				return rc;
 			}
+			pEngine->sKeep.sStats.nOverflow++;
 			rc = pEngine->pIo->xWrite(pNew);
 			if( rc != UNQLITE_OK ){
 				return rc;
@@ -50469,6 +52083,8 @@ static int lhRecordOverwrite(
 		zPtr += nLen;
 		zRaw += nLen;
 	}
+	pCell->iTailPage = pOvfl->iPage;
+	pCell->iTailOfft = (sxu32)(zRaw - pOvfl->zData);
 	/* Unref the last overflow page */
 	pEngine->pIo->xPageUnref(pOvfl);
 	/* Finally, update the cell header */
@@ -50548,6 +52164,16 @@ static int lhRecordAppend(
 		}
 		return UNQLITE_OK;
 	}
+	if( pCell->iTailPage > 0 ){
+		/* The end of the data is known, skip the walk */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->iTailPage,&pOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		zRaw = &pOvfl->zData[pCell->iTailOfft];
+		zRawEnd = &pOvfl->zData[pEngine->iPageSize];
+		goto append;
+	}
 	/* Point to the overflow page which hold the data */
 	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->iDataPage,&pOvfl);
 	if( rc != UNQLITE_OK ){
@@ -50589,6 +52215,7 @@ static int lhRecordAppend(
 		}
 		zRaw += nAvail;
 	}
+append:
 	/* Start the append process */
 	zPtr = (const unsigned char *)pData;
 	zEnd = &zPtr[nByte];
@@ -50608,6 +52235,7 @@ static int lhRecordAppend(
 			if( rc != UNQLITE_OK ){
 				return rc;
 			}
+			pEngine->sKeep.sStats.nOverflow++;
 			rc = pEngine->pIo->xWrite(pNew);
 			if( rc != UNQLITE_OK ){
 				return rc;
@@ -50630,6 +52258,8 @@ static int lhRecordAppend(
 		zPtr += nLen;
 		zRaw += nLen;
 	}
+	pCell->iTailPage = pOvfl->iPage;
+	pCell->iTailOfft = (sxu32)(zRaw - pOvfl->zData);
 	/* Unref the last overflow page */
 	pEngine->pIo->xPageUnref(pOvfl);
 	/* Finally, update the cell header */
@@ -50638,6 +52268,365 @@ static int lhRecordAppend(
 	/* All done */
 	return UNQLITE_OK;
 }
+/*
+ * Extract the value log threshold, zero when values are kept in the cells.
+ */
+static int lhVlogThreshold(lhash_kv_engine *pEngine,sxu64 *pThreshold)
+{
+	unqlite_page *pRoot;
+	int rc;
+	*pThreshold = 0;
+	if( pEngine->iVlog == 0 ){
+		return UNQLITE_OK;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ],pThreshold);
+	pEngine->pIo->xPageUnref(pRoot);
+	return UNQLITE_OK;
+}
+/*
+ * Append a record to the active segment of the value log. The value is made
+ * of the value of the record pSrc (if any) followed by nData bytes of pData.
+ * A new segment is started when the active one is full.
+ */
+static int lhVlogAppend(
+	lhash_kv_engine *pEngine,
+	const void *pKey,sxu32 nKey,   /* Key of the record */
+	const lhash_vlog_ptr *pSrc,    /* Copy the value of this record first, NULL otherwise */
+	const void *pData,sxu64 nData, /* Data to be appended */
+	lhash_vlog_ptr *pOut           /* OUT: The new record */
+	)
+{
+	unsigned char zHdr[L_HASH_VLOG_REC_HDR];
+	sxu64 nSegSize,nSize,nTotal,iOfft,iSrc,nCopy,nRead;
+	unsigned char *zEntry,*zBuf;
+	unqlite_file *pSrcFd = 0;
+	lhash_vlog_file *pFile;
+	unqlite_page *pRoot;
+	sxu32 nEntry,iNext,iSeg,nSrcKey;
+	int rc;
+	nTotal = nData + (pSrc ? pSrc->nData : 0);
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pRoot);
+	if( rc != UNQLITE_OK ){
+		goto done;
+	}
+	SyBigEndianUnpack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8],&nSegSize);
+	SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8],&iNext);
+	SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],&nEntry);
+	nSize = 0;
+	zEntry = 0;
+	if( nEntry > 0 ){
+		zEntry = L_HASH_VLOG_ENTRY(pRoot,nEntry - 1);
+		SyBigEndianUnpack64(&zEntry[4],&nSize);
+	}
+	if( zEntry == 0 || (nSize > 0 && nSize + L_HASH_VLOG_REC_HDR + nKey + nTotal > nSegSize
+		&& L_HASH_VLOG_ROOT_HDR + (nEntry + 1) * L_HASH_VLOG_ENTRY_SZ <= (sxu32)pEngine->iPageSize) ){
+		/* Start a new segment. When the segment table is full, the active segment keep growing */
+		zEntry = L_HASH_VLOG_ENTRY(pRoot,nEntry);
+		SyBigEndianPack32(zEntry,iNext);
+		SyBigEndianPack64(&zEntry[4],0);
+		SyBigEndianPack64(&zEntry[4+8],0);
+		SyBigEndianPack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8],iNext + 1);
+		SyBigEndianPack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],nEntry + 1);
+		nSize = 0;
+		pEngine->bVlogTx = 0;
+	}
+	SyBigEndianUnpack32(zEntry,&iSeg);
+	if( !pEngine->bVlogTx ){
+		/* Records from this point on are not committed yet */
+		pEngine->bVlogTx = 1;
+		pEngine->iVlogTxSeg = iSeg;
+		pEngine->iVlogTxOfft = nSize;
+	}
+	zBuf = lhVlogBuffer(pEngine);
+	if( zBuf == 0 ){
+		rc = UNQLITE_NOMEM;
+		goto done;
+	}
+	if( pSrc ){
+		/* Segment holding the old value, opened before the target so that pFile stay valid */
+		rc = lhVlogFile(pEngine,pSrc->iSeg,0,&pFile);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		pSrcFd = pFile->pFd;
+		rc = lhVlogReadHeader(pEngine,pSrcFd,pSrc->iOfft,&nSrcKey,&nCopy);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		if( nSrcKey != nKey || nCopy != pSrc->nData ){
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Corrupt value log record");
+			rc = UNQLITE_CORRUPT;
+			goto done;
+		}
+	}
+	rc = lhVlogFile(pEngine,iSeg,1,&pFile);
+	if( rc != UNQLITE_OK ){
+		goto done;
+	}
+	/* Record header and key */
+	SyBigEndianPack32(zHdr,L_HASH_VLOG_MAGIC);
+	SyBigEndianPack32(&zHdr[4],nKey);
+	SyBigEndianPack64(&zHdr[4+4],nTotal);
+	iOfft = nSize;
+	rc = unqliteOsWrite(pFile->pFd,zHdr,L_HASH_VLOG_REC_HDR,(unqlite_int64)iOfft);
+	if( rc == UNQLITE_OK && nKey > 0 ){
+		rc = unqliteOsWrite(pFile->pFd,pKey,(unqlite_int64)nKey,(unqlite_int64)(iOfft + L_HASH_VLOG_REC_HDR));
+	}
+	iOfft += L_HASH_VLOG_REC_HDR + nKey;
+	if( pSrc ){
+		/* Copy the old value */
+		iSrc = pSrc->iOfft + L_HASH_VLOG_REC_HDR + nKey;
+		while( rc == UNQLITE_OK && nCopy > 0 ){
+			nRead = nCopy > L_HASH_VLOG_CHUNK ? L_HASH_VLOG_CHUNK : nCopy;
+			rc = unqliteOsRead(pSrcFd,zBuf,(unqlite_int64)nRead,(unqlite_int64)iSrc);
+			if( rc == UNQLITE_OK ){
+				rc = unqliteOsWrite(pFile->pFd,zBuf,(unqlite_int64)nRead,(unqlite_int64)iOfft);
+			}
+			iSrc += nRead;
+			iOfft += nRead;
+			nCopy -= nRead;
+		}
+	}
+	if( rc == UNQLITE_OK && nData > 0 ){
+		rc = unqliteOsWrite(pFile->pFd,pData,(unqlite_int64)nData,(unqlite_int64)iOfft);
+		iOfft += nData;
+	}
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"IO error while writing the value log");
+		goto done;
+	}
+	pFile->bDirty = 1;
+	/* New size of the active segment */
+	SyBigEndianPack64(&zEntry[4],iOfft);
+	pOut->iSeg = iSeg;
+	pOut->iOfft = nSize;
+	pOut->nData = nTotal;
+done:
+	pEngine->pIo->xPageUnref(pRoot);
+	return rc;
+}
+/*
+ * Extend in place a log record written by the current transaction that is
+ * the last one of the active segment. A rollback leave nothing behind since
+ * the record lies past the committed size of the segment. *pDone is set to
+ * false when the record does not qualify.
+ */
+static int lhVlogExtend(
+	lhash_kv_engine *pEngine,
+	const lhash_vlog_ptr *pPtr,    /* Target record */
+	sxu32 nKey,                    /* Key length of the record */
+	const void *pData,sxu64 nData, /* Data to be appended */
+	lhash_vlog_ptr *pOut,          /* OUT: The extended record */
+	int *pDone
+	)
+{
+	unsigned char zLen[8];
+	sxu64 nSegSize,nSize;
+	lhash_vlog_file *pFile;
+	unsigned char *zEntry;
+	unqlite_page *pRoot;
+	sxu32 nEntry,iSeg;
+	int rc;
+	*pDone = 0;
+	if( !pEngine->bVlogTx || pPtr->iSeg != pEngine->iVlogTxSeg || pPtr->iOfft < pEngine->iVlogTxOfft ){
+		return UNQLITE_OK;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8],&nSegSize);
+	SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],&nEntry);
+	if( nEntry < 1 ){
+		goto done;
+	}
+	zEntry = L_HASH_VLOG_ENTRY(pRoot,nEntry - 1);
+	SyBigEndianUnpack32(zEntry,&iSeg);
+	SyBigEndianUnpack64(&zEntry[4],&nSize);
+	if( iSeg != pPtr->iSeg || pPtr->iOfft + L_HASH_VLOG_REC_HDR + nKey + pPtr->nData != nSize ){
+		/* Not the last record of the active segment */
+		goto done;
+	}
+	if( pPtr->iOfft > 0 && nSize + nData > nSegSize ){
+		/* Let lhVlogAppend() start a new segment */
+		goto done;
+	}
+	rc = pEngine->pIo->xWrite(pRoot);
+	if( rc != UNQLITE_OK ){
+		goto done;
+	}
+	rc = lhVlogFile(pEngine,iSeg,0,&pFile);
+	if( rc != UNQLITE_OK ){
+		goto done;
+	}
+	rc = unqliteOsWrite(pFile->pFd,pData,(unqlite_int64)nData,(unqlite_int64)nSize);
+	if( rc == UNQLITE_OK ){
+		/* New value length in the record header */
+		SyBigEndianPack64(zLen,pPtr->nData + nData);
+		rc = unqliteOsWrite(pFile->pFd,zLen,(unqlite_int64)sizeof(zLen),(unqlite_int64)(pPtr->iOfft + 4 + 4));
+	}
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"IO error while writing the value log");
+		goto done;
+	}
+	pFile->bDirty = 1;
+	SyBigEndianPack64(&zEntry[4],nSize + nData);
+	pOut->iSeg = pPtr->iSeg;
+	pOut->iOfft = pPtr->iOfft;
+	pOut->nData = pPtr->nData + nData;
+	*pDone = 1;
+done:
+	pEngine->pIo->xPageUnref(pRoot);
+	return rc;
+}
+/*
+ * Set the value log and compression flags of a cell.
+ */
+static int lhCellSetFlags(lhcell *pCell,int bVlog,int bLz)
+{
+	lhpage *pPage = pCell->pPage;
+	int rc;
+	rc = pPage->pHash->pIo->xWrite(pPage->pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pCell->bVlog = bVlog ? 1 : 0;
+	pCell->bLz = bLz ? 1 : 0;
+	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],L_HASH_CELL_DATA_LEN(pCell));
+	return UNQLITE_OK;
+}
+/*
+ * Turn the value log flag of a cell on or off.
+ */
+static int lhCellSetVlog(lhcell *pCell,int bVlog)
+{
+	return lhCellSetFlags(pCell,bVlog,pCell->bLz);
+}
+/*
+ * Overwrite the data of a cell with either a value or a value log pointer
+ * (bVlog). The log record the cell used to point to is released.
+ */
+static int lhCellReplace(lhcell *pCell,const void *pData,unqlite_int64 nByte,int bVlog)
+{
+	lhash_kv_engine *pEngine = pCell->pPage->pHash;
+	int bOld = pCell->bVlog;
+	lhash_vlog_ptr sOld;
+	int rc;
+	if( bOld ){
+		rc = lhCellVlogPtr(pCell,&sOld);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	rc = lhRecordOverwrite(pCell,pData,nByte);
+	if( rc == UNQLITE_OK ){
+		rc = lhCellSetVlog(pCell,bVlog);
+	}
+	if( rc == UNQLITE_OK && bOld ){
+		rc = lhVlogRelease(pEngine,&sOld,pCell->nKey);
+	}
+	return rc;
+}
+/*
+ * Append data to a record whose value is (or is about to be) in the value log.
+ * Unless the record can be extended in place, the whole value is written
+ * again at the end of the log.
+ */
+static int lhVlogRecordAppend(lhcell *pCell,const void *pKey,const void *pData,unqlite_int64 nByte)
+{
+	lhash_kv_engine *pEngine = pCell->pPage->pHash;
+	unsigned char zPtr[L_HASH_VLOG_PTR_SZ];
+	lhash_vlog_ptr sOld,sNew;
+	SyBlob sWorker;
+	int bDone;
+	int rc;
+	if( pCell->bVlog ){
+		rc = lhCellVlogPtr(pCell,&sOld);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = lhVlogExtend(pEngine,&sOld,pCell->nKey,pData,(sxu64)nByte,&sNew,&bDone);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( bDone ){
+			/* Same record, only its length changed */
+			lhVlogPackPtr(&sNew,zPtr);
+			rc = lhRecordOverwrite(pCell,(const void *)zPtr,L_HASH_VLOG_PTR_SZ);
+			if( rc == UNQLITE_OK ){
+				rc = lhCellSetVlog(pCell,1);
+			}
+			return rc;
+		}
+		rc = lhVlogAppend(pEngine,pKey,pCell->nKey,&sOld,pData,(sxu64)nByte,&sNew);
+	}else{
+		/* The value cross the threshold, move it to the log */
+		SyBlobInit(&sWorker,&pEngine->sAllocator);
+		rc = lhConsumeCellData(pCell,unqliteDataConsumer,&sWorker);
+		if( rc == UNQLITE_OK ){
+			rc = SyBlobAppend(&sWorker,pData,(sxu32)nByte);
+		}
+		if( rc == UNQLITE_OK ){
+			rc = lhVlogAppend(pEngine,pKey,pCell->nKey,0,SyBlobData(&sWorker),(sxu64)SyBlobLength(&sWorker),&sNew);
+		}
+		SyBlobRelease(&sWorker);
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	lhVlogPackPtr(&sNew,zPtr);
+	return lhCellReplace(pCell,(const void *)zPtr,L_HASH_VLOG_PTR_SZ,1);
+}
+/*
+ * Append data to a compressed record. The value is decompressed and
+ * stored as is from now on so that further appends are cheap.
+ */
+static int lhLzRecordAppend(lhcell *pCell,const void *pKey,const void *pData,unqlite_int64 nByte,sxu64 nThreshold)
+{
+	lhash_kv_engine *pEngine = pCell->pPage->pHash;
+	unsigned char zPtr[L_HASH_VLOG_PTR_SZ];
+	const unsigned char *zOld;
+	lhash_vlog_ptr sPtr;
+	SyBlob sWorker;
+	sxu64 nOld;
+	int rc;
+	rc = lhLzInflate(pCell,&zOld,&nOld);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBlobInit(&sWorker,&pEngine->sAllocator);
+	rc = SyBlobAppend(&sWorker,(const void *)zOld,(sxu32)nOld);
+	if( rc == SXRET_OK ){
+		rc = SyBlobAppend(&sWorker,pData,(sxu32)nByte);
+	}
+	L_HASH_LZ_DROP(pEngine,pCell);
+	if( rc != SXRET_OK ){
+		SyBlobRelease(&sWorker);
+		return UNQLITE_NOMEM;
+	}
+	if( nThreshold > 0 && (sxu64)SyBlobLength(&sWorker) >= nThreshold ){
+		rc = lhVlogAppend(pEngine,pKey,pCell->nKey,0,SyBlobData(&sWorker),(sxu64)SyBlobLength(&sWorker),&sPtr);
+		if( rc == UNQLITE_OK ){
+			lhVlogPackPtr(&sPtr,zPtr);
+			rc = lhCellReplace(pCell,(const void *)zPtr,L_HASH_VLOG_PTR_SZ,1);
+		}
+	}else{
+		rc = lhCellReplace(pCell,SyBlobData(&sWorker),(unqlite_int64)SyBlobLength(&sWorker),0);
+	}
+	SyBlobRelease(&sWorker);
+	if( rc == UNQLITE_OK ){
+		rc = lhCellSetFlags(pCell,pCell->bVlog,0);
+	}
+	return rc;
+}
 /*
  * A write privilege have been acquired on this page.
  * Mark it as an empty page (No cells).
@@ -50704,8 +52693,10 @@ static int lhStoreCell(
 	/* Check for a free block  */
 	rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ+nKeyLen+nDataLen,&nOfft);
 	if( rc != UNQLITE_OK ){
-		/* Check for a free block to hold a single cell only (without payload) */
-		rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ,&nOfft);
+		if( nKeyLen + (sxu64)nDataLen >= L_HASH_MIN_OVFL_PAYLOAD(pEngine->iPageSize) ){
+			/* Check for a free block to hold a single cell only (without payload) */
+			rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ,&nOfft);
+		}
 		if( rc != UNQLITE_OK ){
 			if( !auto_append ){
 				/* A split must be done */
@@ -50729,8 +52720,8 @@ static int lhStoreCell(
 	pCell->nKey = nKeyLen;
 	pCell->nData = (sxu64)nDataLen;
 	pCell->nHash = nHash;
-	if( nKeyLen < 262144 /* 256 KB */ ){
-		/* Keep the key in-memory for fast lookup */
+	if( iNeedOvfl && nKeyLen < 262144 /* 256 KB */ ){
+		/* Overflow key, keep it in-memory for fast lookup */
 		SyBlobAppend(&pCell->sKey,pKey,nKeyLen);
 	}
 	/* Link the cell */
@@ -50769,9 +52760,9 @@ static int lhFindSlavePage(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft,lhpage **ppS
 	/* Look for an already attached slave page */
 	for( i = 0 ; i < pMaster->iSlave ; ++i ){
 		/* Find a free chunk big enough */
-		sxu16 size = (sxu16)(L_HASH_CELL_SZ + nAmount);
+		sxu64 size = L_HASH_CELL_SZ + nAmount;
 		rc = lhAllocateSpace(pSlave,size,&iOfft);
-		if( rc != UNQLITE_OK ){
+		if( rc != UNQLITE_OK && nAmount >= L_HASH_MIN_OVFL_PAYLOAD(pEngine->iPageSize) ){
 			/* A space for cell header only */
 			size = L_HASH_CELL_SZ;
 			rc = lhAllocateSpace(pSlave,size,&iOfft);
@@ -50781,7 +52772,7 @@ static int lhFindSlavePage(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft,lhpage **ppS
 			if( pOfft ){
 				*pOfft = iOfft;
 			}else{
-				rc = lhRestoreSpace(pSlave, iOfft, size);
+				rc = lhRestoreSpace(pSlave, iOfft, (sxu16)size);
 			}
 			*ppSlave = pSlave;
 			return rc;
@@ -50826,6 +52817,7 @@ static int lhFindSlavePage(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft,lhpage **ppS
 	/* Reflect in the page header */
 	SyBigEndianPack64(&pSlave->pRaw->zData[2/*Cell offset*/+2/*Free block offset*/],pRaw->iPage);
 	pSlave->sHdr.iSlave = pRaw->iPage;
+	pEngine->sKeep.sStats.nSlave++;
 	/* All done */
 	*ppSlave = pNew;
 	return UNQLITE_OK;
@@ -50867,7 +52859,7 @@ static int lhTransferCell(lhcell *pTarget,lhpage *pPage)
 	rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ,&nOfft);
 	if( rc != UNQLITE_OK ){
 		/* Store in a slave page */
-		rc = lhFindSlavePage(pPage,L_HASH_CELL_SZ,&nOfft,&pPage);
+		rc = lhFindSlavePage(pPage,0,&nOfft,&pPage);
 		if( rc != UNQLITE_OK ){
 			return rc;
 		}
@@ -50884,7 +52876,11 @@ static int lhTransferCell(lhcell *pTarget,lhpage *pPage)
 	pCell->iOvfl  = pTarget->iOvfl;
 	pCell->iDataOfft = pTarget->iDataOfft;
 	pCell->iDataPage = pTarget->iDataPage;
+	pCell->iTailPage = pTarget->iTailPage;
+	pCell->iTailOfft = pTarget->iTailOfft;
 	pCell->nHash = pTarget->nHash;
+	pCell->bVlog = pTarget->bVlog;
+	pCell->bLz = pTarget->bLz;
 	SyBlobDup(&pTarget->sKey,&pCell->sKey);
 	/* Link the cell */
 	rc = lhInstallCell(pCell);
@@ -50896,6 +52892,75 @@ static int lhTransferCell(lhcell *pTarget,lhpage *pPage)
 	/* All done */
 	return UNQLITE_OK;
 }
+/* Forward declaration */
+static void lhash_page_release(void *pUserData);
+/*
+ * Unlink an empty slave page from the chain of its master and
+ * restore it to the free list.
+ */
+static int lhReleaseSlavePage(lhpage *pSlave)
+{
+	lhash_kv_engine *pEngine = pSlave->pHash;
+	lhpage *pMaster = pSlave->pMaster;
+	lhpage *pPrev,*pEntry;
+	unqlite_page *pRaw;
+	int rc;
+	/* Page pointing to this slave */
+	pPrev = pMaster;
+	if( pPrev->sHdr.iSlave != pSlave->pRaw->iPage ){
+		for( pPrev = pMaster->pSlave ; pPrev ; pPrev = pPrev->pNextSlave ){
+			if( pPrev->sHdr.iSlave == pSlave->pRaw->iPage ){
+				break;
+			}
+		}
+		if( pPrev == 0 ){
+			/* Can't happen */
+			return UNQLITE_CORRUPT;
+		}
+	}
+	rc = pEngine->pIo->xWrite(pPrev->pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianPack64(&pPrev->pRaw->zData[2/*Cell offset*/+2/*Free block offset*/],pSlave->sHdr.iSlave);
+	pPrev->sHdr.iSlave = pSlave->sHdr.iSlave;
+	/* Detach from the master */
+	if( pMaster->pSlave == pSlave ){
+		pMaster->pSlave = pSlave->pNextSlave;
+	}else{
+		for( pEntry = pMaster->pSlave ; pEntry ; pEntry = pEntry->pNextSlave ){
+			if( pEntry->pNextSlave == pSlave ){
+				pEntry->pNextSlave = pSlave->pNextSlave;
+				break;
+			}
+		}
+	}
+	pMaster->iSlave--;
+	pRaw = pSlave->pRaw;
+	/* Restore the page to the free list */
+	rc = lhRestorePage(pEngine,pRaw);
+	/* Discard the in-memory page */
+	lhash_page_release(pSlave);
+	return rc;
+}
+/*
+ * Release the slave pages of a bucket that no longer hold any cell.
+ */
+static int lhReleaseEmptySlaves(lhpage *pMaster)
+{
+	lhpage *pPage,*pNext;
+	int rc;
+	for( pPage = pMaster->pSlave ; pPage ; pPage = pNext ){
+		pNext = pPage->pNextSlave;
+		if( pPage->sHdr.iOfft < 1 ){
+			rc = lhReleaseSlavePage(pPage);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+		}
+	}
+	return UNQLITE_OK;
+}
 /*
  * Perform a page split.
  */
@@ -50929,26 +52994,23 @@ static int lhPageSplit(
 			}else{
 				/* Transfer the cell and its payload */
 				SyBlobReset(&sWorker);
-				if( SyBlobLength(&pCell->sKey) < 1 ){
-					/* Consume the key */
-					rc = lhConsumeCellkey(pCell,unqliteDataConsumer,&pCell->sKey,0);
-					if( rc != UNQLITE_OK ){
-						goto fail;
-					}
-				}
 				/* Consume the data (Very small data < 65k) */
 				rc = lhConsumeCellData(pCell,unqliteDataConsumer,&sWorker);
 				if( rc != UNQLITE_OK ){
 					goto fail;
 				}
-				/* Perform the transfer */
+				/* Perform the transfer, the local key is read in place */
 				rc = lhStoreCell(
 					pNew,
-					SyBlobData(&pCell->sKey),(int)SyBlobLength(&pCell->sKey),
+					lhCellKey(pCell),(int)pCell->nKey,
 					SyBlobData(&sWorker),SyBlobLength(&sWorker),
 					pCell->nHash,
 					1
 					);
+				if( rc == UNQLITE_OK && (pCell->bVlog || pCell->bLz) ){
+					/* The new cell is at the head of the list */
+					rc = lhCellSetFlags(pNew->pList,pCell->bVlog,pCell->bLz);
+				}
 			}
 			if( rc != UNQLITE_OK ){
 				goto fail;
@@ -50968,18 +53030,24 @@ fail:
 /*
  * Perform the infamous linear hash split operation.
  */
-static int lhSplit(lhpage *pTarget,int *pRetry)
+static int lhSplit(lhash_kv_engine *pEngine,pgno iTarget,int *pRetry)
 {
-	lhash_kv_engine *pEngine = pTarget->pHash;
 	lhash_bmap_rec *pRec;
 	lhpage *pOld,*pNew;
 	unqlite_page *pRaw;
 	int rc;
 	/* Get the real page number of the bucket to split */
-	pRec = lhMapFindBucket(pEngine,pEngine->split_bucket);
+	rc = lhMapLoadBucket(pEngine,pEngine->split_bucket,&pRec);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pRec == 0 ){
-		/* Can't happen */
-		return UNQLITE_CORRUPT;
+		if( !pEngine->bPresized ){
+			/* Can't happen */
+			return UNQLITE_CORRUPT;
+		}
+		/* Empty bucket of a presized table (lhPresize()), so is its image */
+		goto advance;
 	}
 	/* Load the page to be split */
 	rc = lhLoadPage(pEngine,pRec->iReal,0,&pOld,0);
@@ -51009,7 +53077,7 @@ static int lhSplit(lhpage *pTarget,int *pRetry)
 	if( rc != UNQLITE_OK ){
 		goto fail;
 	}
-	if( pTarget->pRaw->iPage == pOld->pRaw->iPage ){
+	if( iTarget == pOld->pRaw->iPage ){
 		*pRetry = 1;
 	}
 	/* Perform the split */
@@ -51017,6 +53085,12 @@ static int lhSplit(lhpage *pTarget,int *pRetry)
 	if( rc != UNQLITE_OK ){
 		goto fail;
 	}
+	/* Give back the slave pages the split emptied so the chain stays short */
+	rc = lhReleaseEmptySlaves(pOld);
+	if( rc != UNQLITE_OK ){
+		goto fail;
+	}
+advance:
 	/* Update the database header */
 	pEngine->split_bucket++;
 	/* Acquire a writer lock on the first page */
@@ -51041,6 +53115,7 @@ static int lhSplit(lhpage *pTarget,int *pRetry)
 		/* Modify only the split bucket */
 		SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/],pEngine->split_bucket);
 	}
+	pEngine->sKeep.sStats.nSplit++;
 	/* All done */
 	return UNQLITE_OK;
 fail:
@@ -51057,12 +53132,26 @@ static int lhRecordInstall(
 	  const void *pData,unqlite_int64 nDataLen /* Payload: Data */
 	  )
 {
+	lhash_kv_engine *pEngine = pPage->pHash;
 	int rc;
 	rc = lhStoreCell(pPage,pKey,nKeyLen,pData,nDataLen,nHash,0);
 	if( rc == UNQLITE_FULL ){
 		int do_retry = 0;
+		if( pEngine->bDeferSplit && pEngine->nSplitDebt < pEngine->max_split_bucket ){
+			/*
+			 * Append a slave page now and leave the split to lhMaintain().
+			 * Once the debt would double the table, split inline so that
+			 * the slave chains stay short when maintenance is neglected.
+			 */
+			rc = lhStoreCell(pPage,pKey,nKeyLen,pData,nDataLen,nHash,1);
+			if( rc == UNQLITE_OK ){
+				pEngine->nSplitDebt++;
+				pEngine->sKeep.sStats.nInsert++;
+			}
+			return rc;
+		}
 		/* Split */
-		rc = lhSplit(pPage,&do_retry);
+		rc = lhSplit(pEngine,pPage->pRaw->iPage,&do_retry);
 		if( rc == UNQLITE_OK ){
 			if( do_retry ){
 				/* Re-calculate logical bucket number */
@@ -51072,6 +53161,9 @@ static int lhRecordInstall(
 			rc = lhStoreCell(pPage,pKey,nKeyLen,pData,nDataLen,nHash,1);
 		}
 	}
+	if( rc == UNQLITE_OK ){
+		pEngine->sKeep.sStats.nInsert++;
+	}
 	return rc;
 }
 /*
@@ -51085,12 +53177,19 @@ static int lh_record_insert(
 	  )
 {
 	lhash_kv_engine *pEngine = (lhash_kv_engine *)pKv;
+	unsigned char zPtr[L_HASH_VLOG_PTR_SZ];
 	lhash_bmap_rec *pRec;
+	lhash_vlog_ptr sPtr;
 	unqlite_page *pRaw;
+	sxu64 nThreshold;
+	const void *pPacked;
+	sxu64 nPacked;
 	lhpage *pPage;
 	lhcell *pCell;
 	pgno iBucket;
 	sxu32 nHash;
+	int bVlog = 0;
+	int bLz = 0;
 	int iCnt;
 	int rc;
 
@@ -51099,6 +53198,40 @@ static int lh_record_insert(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	if( pEngine->iBloom > 0 ){
+		/* Keep the Bloom filter a superset of the stored keys */
+		rc = lhBloomProbe(pEngine,pKey,nKeyLen,1);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( !is_append ){
+		/* Compress the value if requested */
+		rc = lhLzPack(pEngine,pData,(sxu64)nDataLen,&pPacked,&nPacked);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( pPacked ){
+			pData = pPacked;
+			nDataLen = (unqlite_int64)nPacked;
+			bLz = 1;
+		}
+	}
+	rc = lhVlogThreshold(pEngine,&nThreshold);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( !is_append && nThreshold > 0 && (sxu64)nDataLen >= nThreshold ){
+		/* Large value, append it to the value log and store a pointer to it instead */
+		rc = lhVlogAppend(pEngine,pKey,nKeyLen,0,pData,(sxu64)nDataLen,&sPtr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		lhVlogPackPtr(&sPtr,zPtr);
+		pData = (const void *)zPtr;
+		nDataLen = L_HASH_VLOG_PTR_SZ;
+		bVlog = 1;
+	}
 	iCnt = 0;
 	/* Compute the hash of the key first */
 	nHash = pEngine->xHash(pKey,(sxu32)nKeyLen);
@@ -51110,7 +53243,10 @@ retry:
 		iBucket = nHash & (pEngine->max_split_bucket - 1);
 	}
 	/* Map the logical bucket number to real page number */
-	pRec = lhMapFindBucket(pEngine,iBucket);
+	rc = lhMapLoadBucket(pEngine,iBucket,&pRec);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pRec == 0 ){
 		/* Request a new page */
 		rc = lhAcquirePage(pEngine,&pRaw);
@@ -51130,7 +53266,12 @@ retry:
 		}
 		/* Store the cell */
 		rc = lhStoreCell(pPage,pKey,nKeyLen,pData,nDataLen,nHash,1);
+		if( rc == UNQLITE_OK && (bVlog || bLz) ){
+			/* The only cell of this page */
+			rc = lhCellSetFlags(pPage->pList,bVlog,bLz);
+		}
 		if( rc == UNQLITE_OK ){
+			pEngine->sKeep.sStats.nInsert++;
 			/* Install and write the logical map record */
 			rc = lhMapWriteRecord(pEngine,iBucket,pRaw->iPage);
 		}
@@ -51154,19 +53295,40 @@ retry:
 				rc = UNQLITE_OK;
 				goto retry;
 			}
+			if( rc == UNQLITE_OK && (bVlog || bLz) ){
+				/* Flag the new cell */
+				pCell = lhFindCell(pPage,pKey,(sxu32)nKeyLen,nHash);
+				rc = pCell ? lhCellSetFlags(pCell,bVlog,bLz) : UNQLITE_CORRUPT;
+			}
 		}else{
+			L_HASH_LZ_DROP(pEngine,pCell);
 			if( is_append ){
 				/* Append operation */
-				rc = lhRecordAppend(pCell,pData,nDataLen);
+				if( pCell->bLz ){
+					rc = lhLzRecordAppend(pCell,pKey,pData,nDataLen,nThreshold);
+				}else if( pCell->bVlog || (nThreshold > 0 && pCell->nData + (sxu64)nDataLen >= nThreshold) ){
+					rc = lhVlogRecordAppend(pCell,pKey,pData,nDataLen);
+				}else{
+					rc = lhRecordAppend(pCell,pData,nDataLen);
+				}
+			}else if( bVlog || pCell->bVlog ){
+				/* Overwrite old value, releasing the old log record if any */
+				rc = lhCellReplace(pCell,pData,nDataLen,bVlog);
 			}else{
 				/* Overwrite old value */
 				rc = lhRecordOverwrite(pCell,pData,nDataLen);
 			}
+			if( rc == UNQLITE_OK && !is_append && (bLz || pCell->bLz) ){
+				/* The new value may or may not be compressed */
+				rc = lhCellSetFlags(pCell,pCell->bVlog,bLz);
+			}
 		}
 		pEngine->pIo->xPageUnref(pPage->pRaw);
 	}
 	return rc;
 }
+/* Forward declaration */
+static void lhVacuumForget(lhash_kv_engine *pEngine);
 /*
  * Replace method.
  */
@@ -51177,6 +53339,7 @@ static int lhash_kv_replace(
 	  )
 {
 	int rc;
+	lhVacuumForget((lhash_kv_engine *)pKv);
 	rc = lh_record_insert(pKv,pKey,(sxu32)nKeyLen,pData,nDataLen,0);
 	return rc;
 }
@@ -51190,6 +53353,7 @@ static int lhash_kv_append(
 	  )
 {
 	int rc;
+	lhVacuumForget((lhash_kv_engine *)pKv);
 	rc = lh_record_insert(pKv,pKey,(sxu32)nKeyLen,pData,nDataLen,1);
 	return rc;
 }
@@ -51211,6 +53375,8 @@ static int lhash_write_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	/* List of free pages: Empty */
 	SyBigEndianPack64(zRaw,0);
 	zRaw += 8;
+	pEngine->nFreePage = 0;
+	SyBigEndianPack32(&pHeader->zData[L_HASH_FREE_COUNT_OFFT(pEngine->iPageSize)],1);
 	/* Current split bucket */
 	SyBigEndianPack64(zRaw,pEngine->split_bucket);
 	zRaw += 8;
@@ -51239,6 +53405,10 @@ static int lhash_kv_open(unqlite_kv_engine *pEngine,pgno dbSize)
 	lhash_kv_engine *pHash = (lhash_kv_engine *)pEngine;
 	unqlite_page *pHeader;
 	int rc;
+	/* Another process may have changed the image since the last walk */
+	lhVacuumForget(pHash);
+	/* The page size is only known once the pager has read the file header */
+	pHash->iPageSize = pEngine->pIo->xPageSize(pEngine->pIo->pHandle);
 	if( dbSize < 1 ){
 		/* A new database, create the header */
 		rc = pEngine->pIo->xNew(pEngine->pIo->pHandle,&pHeader);
@@ -51282,6 +53452,7 @@ static void lhash_page_release(void *pUserData)
 	/* Drop in-memory cells */
 	for( n = 0 ; n < pPage->nCell ; ++n ){
 		pNext = pCell->pNext;
+		L_HASH_LZ_DROP(pEngine,pCell);
 		SyBlobRelease(&pCell->sKey);
 		/* Release the cell instance */
 		SyMemBackendPoolFree(&pEngine->sAllocator,(void *)pCell);
@@ -51316,6 +53487,72 @@ static sxu32 lhash_bin_hash(const void *pSrc,sxu32 nLen)
 	}	
 	return nH;
 }
+/*
+ * Constants of the MIX64 hash function.
+ */
+#define L_HASH_MIX_SEED 0x9E3779B97F4A7C15
+#define L_HASH_MIX_K1   0x87C37B91114253D5
+#define L_HASH_MIX_K2   0x4CF5AD432745937F
+#define L_HASH_MIX_ROTL(X,N) (((X) << (N)) | ((X) >> (64 - (N))))
+/*
+ * Default hash function for new databases (MIX64).
+ * The whole key is consumed 8 bytes at a time. Words are assembled in little
+ * endian order so that the hash does not depend on the host byte order. The
+ * 64-bit state is folded to the 32-bit hash stored in the cell header.
+ */
+static sxu32 lhash_mix64_hash(const void *pSrc,sxu32 nLen)
+{
+	sxu64 nH = lhash_mix64(pSrc,nLen,L_HASH_MIX_SEED);
+	return (sxu32)(nH ^ (nH >> 32));
+}
+/*
+ * 64-bit state of the MIX64 hash for the given seed. A different seed gives
+ * an independent hash (Bloom filter).
+ */
+static sxu64 lhash_mix64(const void *pSrc,sxu32 nLen,sxu64 nSeed)
+{
+	const unsigned char *zIn = (const unsigned char *)pSrc;
+	sxu64 nH = nSeed ^ ((sxu64)nLen * L_HASH_MIX_K2);
+	sxu32 nLeft = nLen;
+	sxu64 nK;
+	while( nLeft >= 8 ){
+		nK = (sxu64)zIn[0] | ((sxu64)zIn[1] << 8) | ((sxu64)zIn[2] << 16) | ((sxu64)zIn[3] << 24) |
+			((sxu64)zIn[4] << 32) | ((sxu64)zIn[5] << 40) | ((sxu64)zIn[6] << 48) | ((sxu64)zIn[7] << 56);
+		nK *= L_HASH_MIX_K1;
+		nK = L_HASH_MIX_ROTL(nK,31);
+		nK *= L_HASH_MIX_K2;
+		nH ^= nK;
+		nH = L_HASH_MIX_ROTL(nH,27) * 5 + 0x52DCE729;
+		zIn += 8;
+		nLeft -= 8;
+	}
+	if( nLeft > 0 ){
+		/* Remaining bytes */
+		nK = 0;
+		switch(nLeft){
+		case 7: nK |= (sxu64)zIn[6] << 48; /* FALL THRU */
+		case 6: nK |= (sxu64)zIn[5] << 40; /* FALL THRU */
+		case 5: nK |= (sxu64)zIn[4] << 32; /* FALL THRU */
+		case 4: nK |= (sxu64)zIn[3] << 24; /* FALL THRU */
+		case 3: nK |= (sxu64)zIn[2] << 16; /* FALL THRU */
+		case 2: nK |= (sxu64)zIn[1] << 8;  /* FALL THRU */
+		default:
+			nK |= (sxu64)zIn[0];
+			break;
+		}
+		nK *= L_HASH_MIX_K1;
+		nK = L_HASH_MIX_ROTL(nK,31);
+		nK *= L_HASH_MIX_K2;
+		nH ^= nK;
+	}
+	/* Finalize */
+	nH ^= nH >> 33;
+	nH *= 0xFF51AFD7ED558CCD;
+	nH ^= nH >> 33;
+	nH *= 0xC4CEB9FE1A85EC53;
+	nH ^= nH >> 33;
+	return nH;
+}
 /*
  * Exported: xInit() method.
  * Initialize the Key value storage engine.
@@ -51323,24 +53560,17 @@ static sxu32 lhash_bin_hash(const void *pSrc,sxu32 nLen)
 static int lhash_kv_init(unqlite_kv_engine *pEngine,int iPageSize)
 {
 	lhash_kv_engine *pHash = (lhash_kv_engine *)pEngine;
-	int rc;
 
 	/* This structure is always zeroed, go to the initialization directly */
 	SyMemBackendInitFromParent(&pHash->sAllocator,unqliteExportMemBackend());
 	pHash->iPageSize = iPageSize;
-	/* Default hash function */
+	/* Default hash function for new databases, existing ones keep their own */
 	pHash->xHash = lhash_bin_hash;
 	/* Default comparison function */
 	pHash->xCmp = SyMemcmp;
-	/* Allocate a new record map */
-	pHash->nBuckSize = 32;
-	pHash->apMap = (lhash_bmap_rec **)SyMemBackendAlloc(&pHash->sAllocator,pHash->nBuckSize *sizeof(lhash_bmap_rec *));
-	if( pHash->apMap == 0 ){
-		rc = UNQLITE_NOMEM;
-		goto err;
-	}
-	/* Zero the table */
-	SyZero(pHash->apMap,pHash->nBuckSize * sizeof(lhash_bmap_rec *));
+	/* The bucket map is allocated as records are loaded */
+	pHash->apMap = 0;
+	pHash->nBuckSize = 0;
 	/* Linear hashing components */
 	pHash->split_bucket = 0; /* Logical not real bucket number */
 	pHash->max_split_bucket = 1;
@@ -51349,10 +53579,12 @@ static int lhash_kv_init(unqlite_kv_engine *pEngine,int iPageSize)
 	/* Install the cache unpin and reload callbacks */
 	pHash->pIo->xSetUnpin(pHash->pIo->pHandle,lhash_page_release);
 	pHash->pIo->xSetReload(pHash->pIo->pHandle,lhash_page_release);
+	/* Value log segments are synced before the pages pointing to them are written */
+	SySetInit(&pHash->aVlogFile,&pHash->sAllocator,sizeof(lhash_vlog_file));
+	pHash->pIo->xSetCommit(pHash->pIo->pHandle,lhVlogSync);
+	/* Handle settings survive a reset of the engine */
+	pHash->pIo->xSetKeep(pHash->pIo->pHandle,&pHash->sKeep,sizeof(lhash_kv_keep));
 	return UNQLITE_OK;
-err:
-	SyMemBackendRelease(&pHash->sAllocator);
-	return rc;
 }
 /*
  * Exported: xRelease() method.
@@ -51361,226 +53593,3237 @@ err:
 static void lhash_kv_release(unqlite_kv_engine *pEngine)
 {
 	lhash_kv_engine *pHash = (lhash_kv_engine *)pEngine;
+	lhash_vlog_file *aFile = (lhash_vlog_file *)SySetBasePtr(&pHash->aVlogFile);
+	sxu32 n;
+	/* Close the value log segments */
+	for( n = 0 ; n < SySetUsed(&pHash->aVlogFile) ; ++n ){
+		pHash->pIo->xCloseFile(pHash->pIo->pHandle,aFile[n].pFd);
+	}
+	pHash->pIo->xSetCommit(pHash->pIo->pHandle,0);
+	pHash->pIo->xSetKeep(pHash->pIo->pHandle,0,0);
+	lhVacuumForget(pHash);
 	/* Release the private memory backend */
 	SyMemBackendRelease(&pHash->sAllocator);
 }
 /*
- *  Exported: xConfig() method.
- *  Configure the linear hash KV store.
+ * Integrity check context.
+ */
+typedef struct lhash_check lhash_check;
+struct lhash_check
+{
+	lhash_kv_engine *pEngine; /* Engine under check */
+	pgno nPage;               /* Total number of pages in the database image */
+	Bitvec *pUsed;            /* Pages referenced so far */
+	int (*xReport)(pgno,const char *,void *); /* Report callback */
+	void *pUserData;          /* Last argument to xReport() */
+	sxu32 nErr;               /* Total number of reported problems */
+	int rc;                   /* UNQLITE_ABORT when the callback request an abort */
+	SySet aSeg;               /* Value log segments (lhash_check_seg) */
+	unsigned char *zPage;     /* Scratch buffer: Bucket, map and free pages */
+	unsigned char *zOvfl;     /* Scratch buffer: Overflow pages */
+	unsigned char *zScratch;  /* Worker thread: Scratch page of xReadShared() */
+	unsigned char *zUsed;     /* Worker thread: Pages it referenced (Bitmap), pUsed is then only read */
+	SySet aVptr;              /* Worker thread: Value log pointers left to the main thread (lhash_check_vptr) */
+};
+/*
+ * A value log pointer found by a worker thread. The segment files are
+ * opened on demand so these are checked once the workers are done.
  */
-static int lhash_kv_config(unqlite_kv_engine *pEngine,int op,va_list ap)
+typedef struct lhash_check_vptr lhash_check_vptr;
+struct lhash_check_vptr
 {
-	lhash_kv_engine *pHash = (lhash_kv_engine *)pEngine;
-	int rc = UNQLITE_OK;
-	switch(op){
-	case UNQLITE_KV_CONFIG_HASH_FUNC: {
-		/* Default hash function */
-		if( pHash->nBuckRec > 0 ){
-			/* Locked operation */
-			rc = UNQLITE_LOCKED;
-		}else{
-			ProcHash xHash = va_arg(ap,ProcHash);
-			if( xHash ){
-				pHash->xHash = xHash;
-			}
-		}
-		break;
-									  }
-	case UNQLITE_KV_CONFIG_CMP_FUNC: {
-		/* Default comparison function */
-		ProcCmp xCmp = va_arg(ap,ProcCmp);
-		if( xCmp ){
-			pHash->xCmp  = xCmp;
+	pgno iPage;  /* Page holding the cell */
+	sxu32 nKey;  /* Key length */
+	unsigned char zPtr[L_HASH_VLOG_PTR_SZ]; /* The pointer */
+};
+/*
+ * A value log segment as listed in the root page.
+ */
+typedef struct lhash_check_seg lhash_check_seg;
+struct lhash_check_seg
+{
+	sxu32 iSeg;  /* Segment number */
+	sxu64 nSize; /* Bytes in use */
+};
+/*
+ * Report a problem on the given page.
+ */
+static void lhCheckReport(lhash_check *pCheck,pgno iPage,const char *zReason)
+{
+	pCheck->nErr++;
+	if( pCheck->rc == UNQLITE_OK && pCheck->xReport ){
+		if( pCheck->xReport(iPage,zReason,pCheck->pUserData) != UNQLITE_OK ){
+			/* Callback request an operation abort */
+			pCheck->rc = UNQLITE_ABORT;
 		}
-		break;
-									 }
-	default:
-		/* Unknown OP */
-		rc = UNQLITE_UNKNOWN;
-		break;
 	}
-	return rc;
 }
 /*
- * Each public cursor is identified by an instance of this structure.
+ * Read a page into one of the scratch buffers.
  */
-typedef struct lhash_kv_cursor lhash_kv_cursor;
-struct lhash_kv_cursor
+static int lhCheckRead(lhash_check *pCheck,pgno iPage,unsigned char *zBuf)
 {
-	unqlite_kv_engine *pStore; /* Must be first */
-	/* Private fields */
-	int iState;           /* Current state of the cursor */
-	int is_first;         /* True to read the database header */
-	lhcell *pCell;        /* Current cell we are processing */
-	unqlite_page *pRaw;   /* Raw disk page */
-	lhash_bmap_rec *pRec; /* Logical to real bucket map */
-};
-/* 
- * Possible state of the cursor
+	const unqlite_kv_io *pIo = pCheck->pEngine->pIo;
+	if( pCheck->zScratch ){
+		return pIo->xReadShared(pIo->pHandle,iPage,zBuf,pCheck->zScratch);
+	}
+	return pIo->xRead(pIo->pHandle,iPage,zBuf);
+}
+/*
+ * Mark a page as referenced. Return 0 if the page number is out of range or
+ * if the page was already referenced elsewhere.
  */
-#define L_HASH_CURSOR_STATE_NEXT_PAGE 1 /* Next page in the list */
-#define L_HASH_CURSOR_STATE_CELL      2 /* Processing Cell */
-#define L_HASH_CURSOR_STATE_DONE      3 /* Cursor does not point to anything */
+static int lhCheckMarkPage(lhash_check *pCheck,pgno iPage,pgno iFrom)
+{
+	if( iPage < 2 || iPage >= pCheck->nPage ){
+		lhCheckReport(pCheck,iFrom,"page number out of range");
+		return 0;
+	}
+	if( pCheck->zUsed ){
+		/* Worker thread, the pages of the other workers are compared once they are done */
+		if( unqliteBitvecTest(pCheck->pUsed,iPage) || (pCheck->zUsed[iPage >> 3] & (1 << (iPage & 7))) ){
+			lhCheckReport(pCheck,iPage,"page referenced more than once");
+			return 0;
+		}
+		pCheck->zUsed[iPage >> 3] |= (unsigned char)(1 << (iPage & 7));
+		return 1;
+	}
+	if( unqliteBitvecTest(pCheck->pUsed,iPage) ){
+		lhCheckReport(pCheck,iPage,"page referenced more than once");
+		return 0;
+	}
+	unqliteBitvecSet(pCheck->pUsed,iPage);
+	return 1;
+}
 /*
- * Initialize the cursor.
+ * Make sure the log record a value log pointer refer to is there: its
+ * segment is listed in the root page and hold the whole record.
  */
-static void lhInitCursor(unqlite_kv_cursor *pPtr)
+static void lhCheckVlogPtr(lhash_check *pCheck,pgno iPage,const unsigned char *zPtr,sxu32 nKey)
 {
-	 lhash_kv_engine *pEngine = (lhash_kv_engine *)pPtr->pStore;
-	 lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
-	 /* Init */
-	 pCur->iState = L_HASH_CURSOR_STATE_NEXT_PAGE;
-	 pCur->pCell = 0;
-	 pCur->pRec = pEngine->pFirst;
-	 pCur->pRaw = 0;
-	 pCur->is_first = 1;
+	lhash_kv_engine *pEngine = pCheck->pEngine;
+	lhash_check_seg *aSeg = (lhash_check_seg *)SySetBasePtr(&pCheck->aSeg);
+	lhash_vlog_file *pFile;
+	unqlite_int64 iSize;
+	lhash_vlog_ptr sPtr;
+	sxu64 nData,nEnd;
+	sxu32 nRecKey,n;
+	if( pCheck->zUsed ){
+		/* Worker thread */
+		lhash_check_vptr sVptr;
+		sVptr.iPage = iPage;
+		sVptr.nKey = nKey;
+		SyMemcpy((const void *)zPtr,(void *)sVptr.zPtr,L_HASH_VLOG_PTR_SZ);
+		if( SySetPut(&pCheck->aVptr,(const void *)&sVptr) != SXRET_OK ){
+			pCheck->rc = UNQLITE_NOMEM;
+		}
+		return;
+	}
+	lhVlogUnpackPtr(zPtr,&sPtr);
+	for( n = 0 ; n < SySetUsed(&pCheck->aSeg) ; ++n ){
+		if( aSeg[n].iSeg == sPtr.iSeg ){
+			break;
+		}
+	}
+	if( n >= SySetUsed(&pCheck->aSeg) ){
+		lhCheckReport(pCheck,iPage,"value log segment not in the root page");
+		return;
+	}
+	nEnd = sPtr.iOfft + L_HASH_VLOG_REC_HDR + nKey + sPtr.nData;
+	if( nEnd > aSeg[n].nSize ){
+		lhCheckReport(pCheck,iPage,"value log pointer beyond the end of the segment");
+		return;
+	}
+	if( lhVlogFile(pEngine,sPtr.iSeg,0,&pFile) != UNQLITE_OK ){
+		lhCheckReport(pCheck,iPage,"missing value log segment file");
+		return;
+	}
+	if( unqliteOsFileSize(pFile->pFd,&iSize) != UNQLITE_OK || (sxu64)iSize < nEnd ){
+		lhCheckReport(pCheck,iPage,"value log segment file too short");
+		return;
+	}
+	if( lhVlogReadHeader(pEngine,pFile->pFd,sPtr.iOfft,&nRecKey,&nData) != UNQLITE_OK ||
+		nRecKey != nKey || nData != sPtr.nData ){
+		lhCheckReport(pCheck,iPage,"bad value log record");
+	}
 }
 /*
- * Point to the next page on the database.
+ * Walk an overflow chain and make sure it can hold nPayload bytes. When zPtr
+ * is not NULL, the data is a value log pointer and is copied there.
  */
-static int lhCursorNextPage(lhash_kv_cursor *pPtr)
+static void lhCheckOverflow(lhash_check *pCheck,pgno iCell,pgno iOvfl,sxu64 nKey,sxu64 nData,unsigned char *zPtr)
 {
-	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
-	lhash_bmap_rec *pRec;
-	lhpage *pPage;
-	int rc;
+	lhash_kv_engine *pEngine = pCheck->pEngine;
+	sxu64 nAvail = 0,nPayload = nKey + nData;
+	const unsigned char *zRaw = pCheck->zOvfl;
+	pgno iDataPage = 0,iFirst = iOvfl;
+	int bDataFound = 0;
+	sxu16 iDataOfft = 0;
+	sxu32 nPtr = 0;
 	for(;;){
-		pRec = pCur->pRec;
-		if( pRec == 0 ){
-			pCur->iState = L_HASH_CURSOR_STATE_DONE;
-			return UNQLITE_DONE;
+		if( iOvfl == 0 || pCheck->rc != UNQLITE_OK ){
+			break;
 		}
-		if( pPtr->iState == L_HASH_CURSOR_STATE_CELL && pPtr->pRaw ){
-			/* Unref this page */
-			pCur->pStore->pIo->xPageUnref(pPtr->pRaw);
-			pPtr->pRaw = 0;
+		if( !lhCheckMarkPage(pCheck,iOvfl,iCell) ){
+			return;
 		}
-		/* Advance the map cursor */
-		pCur->pRec = pRec->pPrev; /* Not a bug, reverse link */
-		/* Load the next page on the list */
-		rc = lhLoadPage((lhash_kv_engine *)pCur->pStore,pRec->iReal,0,&pPage,0);
-		if( rc != UNQLITE_OK ){
-			return rc;
+		if( lhCheckRead(pCheck,iOvfl,pCheck->zOvfl) != UNQLITE_OK ){
+			lhCheckReport(pCheck,iOvfl,"IO error while reading overflow page");
+			return;
 		}
-		if( pPage->pList ){
-			/* Reflect the change */
-			pCur->pCell = pPage->pList;
-			pCur->iState = L_HASH_CURSOR_STATE_CELL;
-			pCur->pRaw = pPage->pRaw;
-			break;
+		if( iOvfl == iFirst ){
+			/* First overflow page: Data page and its offset */
+			SyBigEndianUnpack64(&zRaw[8],&iDataPage);
+			SyBigEndianUnpack16(&zRaw[8+8],&iDataOfft);
+			if( (int)iDataOfft > pEngine->iPageSize ){
+				lhCheckReport(pCheck,iOvfl,"data offset out of range");
+			}
+			nAvail += pEngine->iPageSize - (8/* Next ovfl page*/ + 8 /* Data page */ + 2 /* Data offset*/);
+		}else{
+			nAvail += L_HASH_OVERFLOW_SIZE(pEngine->iPageSize);
+		}
+		if( iOvfl == iDataPage ){
+			bDataFound = 1;
+		}
+		if( zPtr && bDataFound && nPtr < L_HASH_VLOG_PTR_SZ ){
+			/* Value log pointer, possibly split across two pages */
+			sxu32 iStart = iOvfl == iDataPage ? iDataOfft : 8;
+			sxu32 nCopy = L_HASH_VLOG_PTR_SZ - nPtr;
+			if( (int)iStart < pEngine->iPageSize ){
+				if( iStart + nCopy > (sxu32)pEngine->iPageSize ){
+					nCopy = (sxu32)pEngine->iPageSize - iStart;
+				}
+				SyMemcpy(&zRaw[iStart],&zPtr[nPtr],nCopy);
+				nPtr += nCopy;
+			}
 		}
-		/* Empty page, discard this page and continue */
-		pPage->pHash->pIo->xPageUnref(pPage->pRaw);
+		/* Next page on the chain */
+		SyBigEndianUnpack64(zRaw,&iOvfl);
+	}
+	if( pCheck->rc != UNQLITE_OK ){
+		return;
+	}
+	if( !bDataFound && nData > 0 ){
+		lhCheckReport(pCheck,iFirst,"data page not on the overflow chain");
+	}
+	if( nAvail < nPayload ){
+		lhCheckReport(pCheck,iFirst,"overflow chain too short for the cell payload");
+	}else if( zPtr && nPtr < L_HASH_VLOG_PTR_SZ ){
+		lhCheckReport(pCheck,iFirst,"bad value log pointer");
+	}else if( zPtr ){
+		lhCheckVlogPtr(pCheck,iCell,zPtr,(sxu32)nKey);
 	}
-	return UNQLITE_OK;
 }
 /*
- * Point to the previous page on the database.
+ * Check a master page and its slave pages.
  */
-static int lhCursorPrevPage(lhash_kv_cursor *pPtr)
+static void lhCheckPage(lhash_check *pCheck,pgno iPage,pgno iBucket)
 {
-	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
-	lhash_bmap_rec *pRec;
-	lhpage *pPage;
-	int rc;
+	lhash_kv_engine *pEngine = pCheck->pEngine;
+	sxu32 nMax = (sxu32)(pEngine->iPageSize / L_HASH_CELL_SZ) + 1;
+	const unsigned char *zRaw = pCheck->zPage;
+	sxu16 iOfft,iFree,iNext;
+	pgno iSlave;
+	sxu32 n;
 	for(;;){
-		pRec = pCur->pRec;
-		if( pRec == 0 ){
-			pCur->iState = L_HASH_CURSOR_STATE_DONE;
-			return UNQLITE_DONE;
-		}
-		if( pPtr->iState == L_HASH_CURSOR_STATE_CELL && pPtr->pRaw ){
-			/* Unref this page */
-			pCur->pStore->pIo->xPageUnref(pPtr->pRaw);
-			pPtr->pRaw = 0;
+		if( lhCheckRead(pCheck,iPage,pCheck->zPage) != UNQLITE_OK ){
+			lhCheckReport(pCheck,iPage,"IO error while reading bucket page");
+			return;
 		}
-		/* Advance the map cursor */
-		pCur->pRec = pRec->pNext; /* Not a bug, reverse link */
-		/* Load the previous page on the list */
-		rc = lhLoadPage((lhash_kv_engine *)pCur->pStore,pRec->iReal,0,&pPage,0);
-		if( rc != UNQLITE_OK ){
-			return rc;
+		SyBigEndianUnpack16(zRaw,&iOfft);
+		SyBigEndianUnpack16(&zRaw[2],&iFree);
+		/* Free blocks */
+		for( n = 0 ; iFree > 0 ; ++n ){
+			sxu16 nByte;
+			if( n >= nMax || iFree < L_HASH_PAGE_HDR_SZ || (int)iFree + 4 > pEngine->iPageSize ){
+				lhCheckReport(pCheck,iPage,"corrupt free block list");
+				break;
+			}
+			SyBigEndianUnpack16(&zRaw[iFree],&iNext);
+			SyBigEndianUnpack16(&zRaw[iFree+2],&nByte);
+			if( nByte < 4 || (int)iFree + (int)nByte > pEngine->iPageSize ){
+				lhCheckReport(pCheck,iPage,"free block size out of range");
+				break;
+			}
+			iFree = iNext;
+		}
+		/* Cell chain */
+		for( n = 0 ; iOfft > 0 && pCheck->rc == UNQLITE_OK ; ++n ){
+			const unsigned char *zCell;
+			sxu32 nHash,nKey;
+			int bVlog = 0;
+			sxu64 nData;
+			pgno iOvfl;
+			if( n >= nMax ){
+				lhCheckReport(pCheck,iPage,"cell chain loop");
+				break;
+			}
+			if( iOfft < L_HASH_PAGE_HDR_SZ || (int)iOfft + L_HASH_CELL_SZ > pEngine->iPageSize ){
+				lhCheckReport(pCheck,iPage,"cell offset out of range");
+				break;
+			}
+			zCell = &zRaw[iOfft];
+			SyBigEndianUnpack32(zCell,&nHash);
+			SyBigEndianUnpack32(&zCell[4],&nKey);
+			SyBigEndianUnpack64(&zCell[4+4],&nData);
+			SyBigEndianUnpack16(&zCell[4+4+8],&iNext);
+			SyBigEndianUnpack64(&zCell[4+4+8+2],&iOvfl);
+			if( nData & L_HASH_VLOG_FLAG ){
+				/* Value log pointer */
+				nData &= ~(L_HASH_VLOG_FLAG|L_HASH_LZ_FLAG);
+				if( nData != L_HASH_VLOG_PTR_SZ || pEngine->iVlog == 0 ){
+					lhCheckReport(pCheck,iPage,"bad value log pointer");
+				}else{
+					bVlog = 1;
+				}
+			}else if( nData & L_HASH_LZ_FLAG ){
+				/* Compressed value */
+				nData &= ~L_HASH_LZ_FLAG;
+				if( nData < L_HASH_LZ_HDR ){
+					lhCheckReport(pCheck,iPage,"bad compressed value");
+				}
+			}
+			/* Make sure the cell belongs to this bucket */
+			{
+				pgno iLogic = nHash & (pEngine->nmax_split_nucket - 1);
+				if( iLogic >= pEngine->split_bucket + pEngine->max_split_bucket ){
+					iLogic = nHash & (pEngine->max_split_bucket - 1);
+				}
+				if( iLogic != iBucket ){
+					lhCheckReport(pCheck,iPage,"cell stored in the wrong bucket");
+				}
+			}
+			if( iOvfl == 0 ){
+				/* Local payload */
+				if( (sxu64)iOfft + L_HASH_CELL_SZ + nKey + nData > (sxu64)pEngine->iPageSize ){
+					lhCheckReport(pCheck,iPage,"local payload overflows the page");
+				}else if( pEngine->xHash(&zCell[L_HASH_CELL_SZ],nKey) != nHash ){
+					lhCheckReport(pCheck,iPage,"key hash mismatch");
+				}else if( bVlog ){
+					lhCheckVlogPtr(pCheck,iPage,&zCell[L_HASH_CELL_SZ + nKey],nKey);
+				}
+			}else{
+				unsigned char zPtr[L_HASH_VLOG_PTR_SZ];
+				lhCheckOverflow(pCheck,iPage,iOvfl,nKey,nData,bVlog ? zPtr : 0);
+			}
+			iOfft = iNext;
 		}
-		if( pPage->pFirst ){
-			/* Reflect the change */
-			pCur->pCell = pPage->pFirst;
-			pCur->iState = L_HASH_CURSOR_STATE_CELL;
-			pCur->pRaw = pPage->pRaw;
+		/* Slave page, marked pages are never walked twice */
+		SyBigEndianUnpack64(&zRaw[2/* Cell offset*/+2/* Free block offset*/],&iSlave);
+		if( iSlave == 0 || pCheck->rc != UNQLITE_OK || !lhCheckMarkPage(pCheck,iSlave,iPage) ){
 			break;
 		}
-		/* Discard this page and continue */
-		pPage->pHash->pIo->xPageUnref(pPage->pRaw);
+		iPage = iSlave;
 	}
-	return UNQLITE_OK;
 }
 /*
- * Is a valid cursor.
+ * Mark the directory and data pages of the Bloom filter.
  */
-static int lhCursorValid(unqlite_kv_cursor *pPtr)
+static void lhCheckBloom(lhash_check *pCheck)
 {
-	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
-	return (pCur->iState == L_HASH_CURSOR_STATE_CELL) && pCur->pCell;
+	lhash_kv_engine *pEngine = pCheck->pEngine;
+	pgno iDir = pEngine->iBloom,iNext,n;
+	for( n = 0 ; n < pEngine->nBloomPage ; ++n ){
+		lhCheckMarkPage(pCheck,pEngine->aBloomPage[n],iDir);
+	}
+	/* Directory chain, the root page is already marked */
+	if( pEngine->pIo->xRead(pEngine->pIo->pHandle,iDir,pCheck->zPage) != UNQLITE_OK ){
+		return;
+	}
+	SyBigEndianUnpack64(&pCheck->zPage[L_HASH_PAGE_HDR_SZ],&iNext);
+	for( n = 0 ; iNext > 0 && n <= pEngine->nBloomPage ; ++n ){
+		if( !lhCheckMarkPage(pCheck,iNext,iDir) ){
+			break;
+		}
+		if( pEngine->pIo->xRead(pEngine->pIo->pHandle,iNext,pCheck->zPage) != UNQLITE_OK ){
+			lhCheckReport(pCheck,iNext,"IO error while reading Bloom filter page");
+			break;
+		}
+		iDir = iNext;
+		SyBigEndianUnpack64(pCheck->zPage,&iNext);
+	}
 }
 /*
- * Point to the first record.
+ * Walk the buckets listed in aBucket[] (Master page and logical bucket pairs,
+ * the master pages are already marked).
  */
-static int lhCursorFirst(unqlite_kv_cursor *pCursor)
+static void lhCheckBucketList(lhash_check *pCheck,const pgno *aBucket,pgno nBucket)
 {
-	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
-	lhash_kv_engine *pEngine = (lhash_kv_engine *)pCursor->pStore;
-	int rc;
-	if( pCur->is_first ){
-		/* Read the database header first */
-		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
-		if( rc != UNQLITE_OK ){
-			return rc;
-		}
-		pCur->is_first = 0;
+	pgno n;
+	for( n = 0 ; n < nBucket && pCheck->rc == UNQLITE_OK ; ++n ){
+		lhCheckPage(pCheck,aBucket[2 * n],aBucket[2 * n + 1]);
 	}
-	/* Point to the first map record */
-	pCur->pRec = pEngine->pFirst;
-	/* Load the cells */
-	rc = lhCursorNextPage(pCur);
-	return rc;
 }
+#if defined(UNQLITE_ENABLE_THREADS) && defined(__UNIXES__)
+/* Maximum number of integrity check threads */
+#define L_HASH_CHECK_MAX_THREAD 64
 /*
- * Point to the last record.
+ * A problem found by a worker thread.
  */
-static int lhCursorLast(unqlite_kv_cursor *pCursor)
+typedef struct lhash_check_report lhash_check_report;
+struct lhash_check_report
 {
-	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
-	lhash_kv_engine *pEngine = (lhash_kv_engine *)pCursor->pStore;
-	int rc;
-	if( pCur->is_first ){
-		/* Read the database header first */
-		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
-		if( rc != UNQLITE_OK ){
-			return rc;
-		}
-		pCur->is_first = 0;
-	}
-	/* Point to the last map record */
-	pCur->pRec = pEngine->pList;
-	/* Load the cells */
-	rc = lhCursorPrevPage(pCur);
-	return rc;
+	pgno iPage;          /* Page number */
+	const char *zReason; /* Static reason */
+};
+/*
+ * Worker thread of a parallel integrity check.
+ */
+typedef struct lhash_check_worker lhash_check_worker;
+struct lhash_check_worker
+{
+	lhash_check sCheck;       /* Private context */
+	SyMemBackend sAllocator;  /* Private allocator of the sets below */
+	SySet aReport;            /* Problems found (lhash_check_report) */
+	const pgno *aBucket;      /* Share of the buckets */
+	pgno nBucket;             /* Number of buckets */
+	pthread_t sThread;        /* Thread handle */
+	int bThread;              /* True if the thread was created */
+};
+/*
+ * xReport() callback of the worker threads: keep the problem for the main thread.
+ */
+static int lhCheckWorkerReport(pgno iPage,const char *zReason,void *pUserData)
+{
+	lhash_check_report sReport;
+	sReport.iPage = iPage;
+	sReport.zReason = zReason;
+	return SySetPut((SySet *)pUserData,(const void *)&sReport) == SXRET_OK ? UNQLITE_OK : UNQLITE_NOMEM;
 }
 /*
- * Reset the cursor.
+ * Worker thread entry point.
  */
-static void lhCursorReset(unqlite_kv_cursor *pCursor)
+static void * lhCheckWorkerMain(void *pArg)
 {
-	lhCursorFirst(pCursor);
+	lhash_check_worker *pWorker = (lhash_check_worker *)pArg;
+	lhCheckBucketList(&pWorker->sCheck,pWorker->aBucket,pWorker->nBucket);
+	return 0;
 }
 /*
- * Point to the next record.
+ * Split the buckets into nThread contiguous shares walked by as many threads,
+ * each with its own buffers and positioned reads. Their reports are replayed
+ * in bucket order once they are done, followed by the pages referenced from
+ * more than one share. Return UNQLITE_NOTIMPLEMENTED when the pages cannot
+ * be read from several threads.
  */
-static int lhCursorNext(unqlite_kv_cursor *pCursor)
+static int lhCheckBucketsParallel(lhash_check *pCheck,const pgno *aBucket,pgno nBucket,int nThread)
 {
-	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
-	lhcell *pCell;
-	int rc;
-	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 ){
+	lhash_kv_engine *pEngine = pCheck->pEngine;
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	sxu32 nMap = (sxu32)(pCheck->nPage >> 3) + 1;
+	lhash_check_worker *aWorker,*pWorker;
+	unsigned char c,cAll,cDup;
+	sxu32 iByte,n;
+	int i,iBit,nInit,rc;
+	if( (pgno)nThread > nBucket ){
+		nThread = (int)nBucket;
+	}
+	if( nThread > L_HASH_CHECK_MAX_THREAD ){
+		nThread = L_HASH_CHECK_MAX_THREAD;
+	}
+	if( nThread < 2 || pIo->xReadShared == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	aWorker = (lhash_check_worker *)SyMemBackendAlloc(&pEngine->sAllocator,(sxu32)(nThread * sizeof(lhash_check_worker)));
+	if( aWorker == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	SyZero(aWorker,(sxu32)(nThread * sizeof(lhash_check_worker)));
+	rc = UNQLITE_OK;
+	for( nInit = 0 ; nInit < nThread ; ++nInit ){
+		i = nInit;
+		pWorker = &aWorker[i];
+		SyMemBackendInitFromParent(&pWorker->sAllocator,unqliteExportMemBackend());
+		SySetInit(&pWorker->aReport,&pWorker->sAllocator,sizeof(lhash_check_report));
+		SySetInit(&pWorker->sCheck.aVptr,&pWorker->sAllocator,sizeof(lhash_check_vptr));
+		pWorker->sCheck.pEngine = pEngine;
+		pWorker->sCheck.nPage = pCheck->nPage;
+		pWorker->sCheck.pUsed = pCheck->pUsed;
+		pWorker->sCheck.xReport = lhCheckWorkerReport;
+		pWorker->sCheck.pUserData = &pWorker->aReport;
+		pWorker->sCheck.rc = UNQLITE_OK;
+		pWorker->sCheck.zPage = (unsigned char *)SyMemBackendAlloc(&pEngine->sAllocator,(sxu32)(3 * pEngine->iPageSize));
+		pWorker->sCheck.zUsed = (unsigned char *)SyMemBackendAlloc(&pEngine->sAllocator,nMap);
+		if( pWorker->sCheck.zPage == 0 || pWorker->sCheck.zUsed == 0 ){
+			nInit++;
+			rc = UNQLITE_NOMEM;
+			goto done;
+		}
+		pWorker->sCheck.zOvfl = &pWorker->sCheck.zPage[pEngine->iPageSize];
+		pWorker->sCheck.zScratch = &pWorker->sCheck.zOvfl[pEngine->iPageSize];
+		SyZero(pWorker->sCheck.zUsed,nMap);
+		pWorker->aBucket = &aBucket[2 * (pgno)(((sxu64)nBucket * i) / nThread)];
+		pWorker->nBucket = (pgno)(((sxu64)nBucket * (i + 1)) / nThread) - (pgno)(((sxu64)nBucket * i) / nThread);
+	}
+	/* Make sure the pager and the VFS can serve several threads */
+	if( pIo->xReadShared(pIo->pHandle,1,aWorker[0].sCheck.zPage,aWorker[0].sCheck.zScratch) != UNQLITE_OK ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+		goto done;
+	}
+	for( i = 0 ; i < nThread ; ++i ){
+		aWorker[i].bThread = pthread_create(&aWorker[i].sThread,0,lhCheckWorkerMain,&aWorker[i]) == 0;
+	}
+	for( i = 0 ; i < nThread ; ++i ){
+		if( aWorker[i].bThread ){
+			pthread_join(aWorker[i].sThread,0);
+		}else{
+			/* No more threads, walk this share here */
+			lhCheckWorkerMain(&aWorker[i]);
+		}
+	}
+	/* Merge the reports in bucket order */
+	for( i = 0 ; i < nThread && pCheck->rc == UNQLITE_OK ; ++i ){
+		lhash_check_report *aReport = (lhash_check_report *)SySetBasePtr(&aWorker[i].aReport);
+		lhash_check_vptr *aVptr = (lhash_check_vptr *)SySetBasePtr(&aWorker[i].sCheck.aVptr);
+		for( n = 0 ; n < SySetUsed(&aWorker[i].aReport) ; ++n ){
+			lhCheckReport(pCheck,aReport[n].iPage,aReport[n].zReason);
+		}
+		for( n = 0 ; n < SySetUsed(&aWorker[i].sCheck.aVptr) && pCheck->rc == UNQLITE_OK ; ++n ){
+			lhCheckVlogPtr(pCheck,aVptr[n].iPage,aVptr[n].zPtr,aVptr[n].nKey);
+		}
+		if( aWorker[i].sCheck.rc != UNQLITE_OK ){
+			/* Out of memory while recording the problems */
+			rc = UNQLITE_NOMEM;
+			goto done;
+		}
+	}
+	/* Pages referenced from several shares, then mark them all for the orphan scan */
+	for( iByte = 0 ; iByte < nMap && pCheck->rc == UNQLITE_OK ; ++iByte ){
+		cAll = cDup = 0;
+		for( i = 0 ; i < nThread ; ++i ){
+			c = aWorker[i].sCheck.zUsed[iByte];
+			cDup |= (unsigned char)(cAll & c);
+			cAll |= c;
+		}
+		for( iBit = 0 ; cAll && iBit < 8 ; ++iBit ){
+			pgno iPage = ((pgno)iByte << 3) + (pgno)iBit;
+			if( (cAll & (1 << iBit)) == 0 ){
+				continue;
+			}
+			if( cDup & (1 << iBit) ){
+				lhCheckReport(pCheck,iPage,"page referenced more than once");
+			}
+			if( unqliteBitvecSet(pCheck->pUsed,iPage) != UNQLITE_OK ){
+				rc = UNQLITE_NOMEM;
+				goto done;
+			}
+		}
+	}
+done:
+	for( i = 0 ; i < nInit ; ++i ){
+		pWorker = &aWorker[i];
+		SySetRelease(&pWorker->aReport);
+		SySetRelease(&pWorker->sCheck.aVptr);
+		SyMemBackendRelease(&pWorker->sAllocator);
+		if( pWorker->sCheck.zPage ){
+			SyMemBackendFree(&pEngine->sAllocator,pWorker->sCheck.zPage);
+		}
+		if( pWorker->sCheck.zUsed ){
+			SyMemBackendFree(&pEngine->sAllocator,pWorker->sCheck.zUsed);
+		}
+	}
+	SyMemBackendFree(&pEngine->sAllocator,aWorker);
+	return rc;
+}
+#endif /* UNQLITE_ENABLE_THREADS && __UNIXES__ */
+/*
+ * Perform an integrity check of the whole linear hash image.
+ * Corrupt pages are reported via the given callback. With nThread > 1
+ * the buckets are walked by that many threads when the pager allows it.
+ */
+static int lhIntegrityCheck(
+	lhash_kv_engine *pEngine,
+	int nThread,
+	int (*xReport)(pgno,const char *,void *),
+	void *pUserData
+	)
+{
+	const unsigned char *zRaw;
+	lhash_bmap_rec *pRec;
+	lhash_check sCheck;
+	pgno iNext,iMap,iLogic,nMap,nBucket = 0;
+	pgno *aBucket = 0;
+	sxu32 nMagic,nRec,n;
+	int rc;
+	/* Acquire the first page (hash Header) so that everything gets loaded autmatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Fill-in the context */
+	SyZero(&sCheck,sizeof(lhash_check));
+	sCheck.pEngine = pEngine;
+	sCheck.nPage = pEngine->pIo->xDbSize(pEngine->pIo->pHandle);
+	sCheck.xReport = xReport;
+	sCheck.pUserData = pUserData;
+	sCheck.rc = UNQLITE_OK;
+	sCheck.pUsed = unqliteBitvecCreate(&pEngine->sAllocator,sCheck.nPage);
+	if( sCheck.pUsed == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	/* Pages are read into these buffers so that they do not fill the page cache */
+	sCheck.zPage = (unsigned char *)SyMemBackendAlloc(&pEngine->sAllocator,(sxu32)(2 * pEngine->iPageSize));
+	if( sCheck.zPage == 0 ){
+		unqliteBitvecDestroy(sCheck.pUsed);
+		return UNQLITE_NOMEM;
+	}
+	sCheck.zOvfl = &sCheck.zPage[pEngine->iPageSize];
+	SySetInit(&sCheck.aSeg,&pEngine->sAllocator,sizeof(lhash_check_seg));
+	/* Database header */
+	zRaw = pEngine->pHeader->zData;
+	SyBigEndianUnpack32(zRaw,&nMagic);
+	if( nMagic != L_HASH_MAGIC ){
+		lhCheckReport(&sCheck,1,"invalid magic number");
+	}
+	if( pEngine->max_split_bucket == 0 || (pEngine->max_split_bucket & (pEngine->max_split_bucket - 1)) != 0 ){
+		lhCheckReport(&sCheck,1,"maximum split bucket is not a power of two");
+	}
+	if( pEngine->split_bucket >= pEngine->max_split_bucket ){
+		lhCheckReport(&sCheck,1,"split bucket out of range");
+	}
+	/* Bucket map chain */
+	SyBigEndianUnpack64(&zRaw[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/],&iNext);
+	SyBigEndianUnpack32(&zRaw[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/+8/*Next map page*/],&nRec);
+	if( 44 + (sxu64)nRec * 16 > (sxu64)pEngine->iPageSize ){
+		lhCheckReport(&sCheck,1,"too many bucket map records");
+	}
+	iMap = 1;
+	for( n = 0 ; iNext > 0 && sCheck.rc == UNQLITE_OK ; ++n ){
+		if( n > sCheck.nPage || !lhCheckMarkPage(&sCheck,iNext,iMap) ){
+			break;
+		}
+		if( pEngine->pIo->xRead(pEngine->pIo->pHandle,iNext,sCheck.zPage) != UNQLITE_OK ){
+			lhCheckReport(&sCheck,iNext,"IO error while reading bucket map page");
+			break;
+		}
+		iMap = iNext;
+		SyBigEndianUnpack64(sCheck.zPage,&iNext);
+		SyBigEndianUnpack32(&sCheck.zPage[8],&nRec);
+		if( 12 + (sxu64)nRec * 16 > (sxu64)pEngine->iPageSize ){
+			lhCheckReport(&sCheck,iMap,"too many bucket map records");
+		}
+	}
+	/* Value log root, the segments are needed to check the cells */
+	if( pEngine->iVlog > 0 && sCheck.rc == UNQLITE_OK && lhCheckMarkPage(&sCheck,pEngine->iVlog,1) ){
+		if( pEngine->pIo->xRead(pEngine->pIo->pHandle,pEngine->iVlog,sCheck.zPage) != UNQLITE_OK ){
+			lhCheckReport(&sCheck,pEngine->iVlog,"IO error while reading the value log root");
+		}else{
+			SyBigEndianUnpack32(&sCheck.zPage[L_HASH_PAGE_HDR_SZ+8+8+4],&nRec);
+			if( L_HASH_VLOG_ROOT_HDR + (sxu64)nRec * L_HASH_VLOG_ENTRY_SZ > (sxu64)pEngine->iPageSize ){
+				lhCheckReport(&sCheck,pEngine->iVlog,"too many value log segments");
+				nRec = 0;
+			}
+			for( n = 0 ; n < nRec ; ++n ){
+				lhash_check_seg sSeg;
+				const unsigned char *zEntry = &sCheck.zPage[L_HASH_VLOG_ROOT_HDR + n * L_HASH_VLOG_ENTRY_SZ];
+				SyBigEndianUnpack32(zEntry,&sSeg.iSeg);
+				SyBigEndianUnpack64(&zEntry[4],&sSeg.nSize);
+				SySetPut(&sCheck.aSeg,(const void *)&sSeg);
+			}
+		}
+	}
+	/* Buckets: Master and slave pages */
+	if( lhMapLoadAll(pEngine) != UNQLITE_OK ){
+		/* Check the buckets loaded so far */
+		lhCheckReport(&sCheck,pEngine->sPageMap.iNext,"unreadable bucket map page");
+	}
+	nMap = (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK;
+	if( nThread > 1 && nMap > 0 ){
+		/* The master pages are marked first, their buckets are then walked in parallel */
+		aBucket = (pgno *)SyMemBackendAlloc(&pEngine->sAllocator,(sxu32)(2 * nMap * sizeof(pgno)));
+	}
+	for( iLogic = 0 ; iLogic < nMap && sCheck.rc == UNQLITE_OK ; ++iLogic ){
+		pRec = lhMapFindBucket(pEngine,iLogic);
+		if( pRec == 0 ){
+			continue;
+		}
+		if( pRec->iLogic >= pEngine->split_bucket + pEngine->max_split_bucket ){
+			lhCheckReport(&sCheck,pRec->iReal,"logical bucket number out of range");
+		}
+		if( lhCheckMarkPage(&sCheck,pRec->iReal,1) ){
+			if( aBucket ){
+				aBucket[2 * nBucket] = pRec->iReal;
+				aBucket[2 * nBucket + 1] = pRec->iLogic;
+				nBucket++;
+			}else{
+				lhCheckPage(&sCheck,pRec->iReal,pRec->iLogic);
+			}
+		}
+	}
+	if( aBucket ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+#if defined(UNQLITE_ENABLE_THREADS) && defined(__UNIXES__)
+		if( sCheck.rc == UNQLITE_OK ){
+			rc = lhCheckBucketsParallel(&sCheck,aBucket,nBucket,nThread);
+		}
+#endif
+		if( rc == UNQLITE_NOTIMPLEMENTED ){
+			/* Single threaded */
+			lhCheckBucketList(&sCheck,aBucket,nBucket);
+		}else if( rc != UNQLITE_OK && sCheck.rc == UNQLITE_OK ){
+			sCheck.rc = rc;
+		}
+		SyMemBackendFree(&pEngine->sAllocator,aBucket);
+	}
+	/* Bloom filter */
+	if( pEngine->iBloom > 0 && sCheck.rc == UNQLITE_OK && lhCheckMarkPage(&sCheck,pEngine->iBloom,1) ){
+		if( pEngine->aBloomPage == 0 && lhBloomLoad(pEngine) != UNQLITE_OK ){
+			lhCheckReport(&sCheck,pEngine->iBloom,"unreadable Bloom filter directory");
+		}else{
+			lhCheckBloom(&sCheck);
+		}
+	}
+	/* Free list */
+	iNext = pEngine->nFreeList;
+	iMap = 1;
+	for( n = 0 ; iNext > 0 && sCheck.rc == UNQLITE_OK ; ++n ){
+		if( n > sCheck.nPage || !lhCheckMarkPage(&sCheck,iNext,iMap) ){
+			break;
+		}
+		if( pEngine->pIo->xRead(pEngine->pIo->pHandle,iNext,sCheck.zPage) != UNQLITE_OK ){
+			lhCheckReport(&sCheck,iNext,"IO error while reading free page");
+			break;
+		}
+		iMap = iNext;
+		SyBigEndianUnpack64(sCheck.zPage,&iNext);
+	}
+	if( iNext == 0 && sCheck.rc == UNQLITE_OK && (pgno)n != pEngine->nFreePage ){
+		lhCheckReport(&sCheck,1,"free page count mismatch");
+	}
+	/* Orphan pages */
+	for( iNext = 2 ; iNext < sCheck.nPage && sCheck.rc == UNQLITE_OK ; ++iNext ){
+		if( !unqliteBitvecTest(sCheck.pUsed,iNext) ){
+			lhCheckReport(&sCheck,iNext,"page is never used");
+		}
+	}
+	unqliteBitvecDestroy(sCheck.pUsed);
+	SySetRelease(&sCheck.aSeg);
+	SyMemBackendFree(&pEngine->sAllocator,sCheck.zPage);
+	return sCheck.rc;
+}
+/*
+ * Size class of a value in the histograms of unqlite_kv_analysis.
+ */
+static int lhAnalyzeClass(sxu64 nValue)
+{
+	int iClass = 0;
+	while( nValue > 0 && iClass < UNQLITE_KV_ANALYZE_HIST - 1 ){
+		iClass++;
+		nValue >>= 1;
+	}
+	return iClass;
+}
+/*
+ * Account for the free space of a master or slave page.
+ */
+static void lhAnalyzePage(lhash_kv_engine *pEngine,lhpage *pPage,unqlite_kv_analysis *pInfo)
+{
+	int iFill;
+	pInfo->nFree += pPage->nFree;
+	iFill = (int)(((sxi64)(pEngine->iPageSize - pPage->nFree) * 10) / pEngine->iPageSize);
+	pInfo->aFill[iFill > 9 ? 9 : (iFill < 0 ? 0 : iFill)]++;
+}
+/*
+ * Count the pages of an overflow chain and their payload capacity.
+ */
+static int lhAnalyzeOverflow(lhash_kv_engine *pEngine,pgno iOvfl,unqlite_kv_analysis *pInfo)
+{
+	pgno iFirst = iOvfl;
+	unqlite_page *pRaw;
+	unqlite_int64 n;
+	int rc;
+	for( n = 0 ; iOvfl > 0 && n < pInfo->nPage ; ++n ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iOvfl,&pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pInfo->nOverflow++;
+		if( iOvfl == iFirst ){
+			pInfo->nOvflRoom += pEngine->iPageSize - (8/* Next ovfl page*/ + 8 /* Data page */ + 2 /* Data offset*/);
+		}else{
+			pInfo->nOvflRoom += L_HASH_OVERFLOW_SIZE(pEngine->iPageSize);
+		}
+		/* Next page on the chain */
+		SyBigEndianUnpack64(pRaw->zData,&iOvfl);
+		pEngine->pIo->xPageUnref(pRaw);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Walk the buckets (All of them or about nPercent of them) and report the
+ * layout of the linear hash image.
+ */
+static int lhAnalyze(lhash_kv_engine *pEngine,int nPercent,unqlite_kv_analysis *pInfo)
+{
+	lhash_bmap_rec *pRec;
+	lhpage *pPage,*pSlave;
+	pgno iLogic,nMap;
+	sxu32 nCell,nChain;
+	lhcell *pCell,*pCol;
+	int rc;
+	SyZero(pInfo,sizeof(unqlite_kv_analysis));
+	pInfo->nPage = (unqlite_int64)pEngine->pIo->xDbSize(pEngine->pIo->pHandle);
+	/* Known once the database is opened by xDbSize() */
+	pInfo->iPageSize = pEngine->iPageSize;
+	if( pInfo->nPage < 2 ){
+		/* Empty database */
+		return UNQLITE_OK;
+	}
+	/* Acquire the first page (hash Header) so that everything gets loaded autmatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pInfo->nLogic = (unqlite_int64)(pEngine->split_bucket + pEngine->max_split_bucket);
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	nMap = (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK;
+	for( iLogic = 0 ; iLogic < nMap ; ++iLogic ){
+		pRec = lhMapFindBucket(pEngine,iLogic);
+		if( pRec == 0 ){
+			continue;
+		}
+		pInfo->nReal++;
+		if( nPercent < 100 && ((((sxu32)iLogic * 0x9E3779B1) >> 16) % 100) >= (sxu32)nPercent ){
+			/* Not part of the sample, the selection is the same from one run to another */
+			continue;
+		}
+		/* The master page list cover the slave pages */
+		rc = lhLoadPage(pEngine,pRec->iReal,0,&pPage,0);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pInfo->nSampled++;
+		lhAnalyzePage(pEngine,pPage,pInfo);
+		nChain = 0;
+		for( pSlave = pPage->pSlave ; pSlave ; pSlave = pSlave->pNextSlave ){
+			lhAnalyzePage(pEngine,pSlave,pInfo);
+			nChain++;
+		}
+		pInfo->nSlave += nChain;
+		pInfo->aChain[nChain < UNQLITE_KV_ANALYZE_HIST - 1 ? nChain : UNQLITE_KV_ANALYZE_HIST - 1]++;
+		nCell = 0;
+		for( pCell = pPage->pList ; pCell ; pCell = pCell->pNext ){
+			nCell++;
+			pInfo->aKey[lhAnalyzeClass(pCell->nKey)]++;
+			pInfo->aData[lhAnalyzeClass(pCell->nData)]++;
+			if( pCell->bVlog ){
+				pInfo->nVlog++;
+			}
+			if( pCell->bLz ){
+				pInfo->nLz++;
+			}
+			/* Cells of the same hash share a collision chain */
+			for( pCol = pCell->pNextCol ; pCol ; pCol = pCol->pNextCol ){
+				if( pCol->nHash == pCell->nHash ){
+					pInfo->nHashDup++;
+					break;
+				}
+			}
+			if( pCell->iOvfl > 0 ){
+				pInfo->nOvflBytes += (unqlite_int64)(pCell->nKey + pCell->nData);
+				rc = lhAnalyzeOverflow(pEngine,pCell->iOvfl,pInfo);
+				if( rc != UNQLITE_OK ){
+					return rc;
+				}
+			}
+		}
+		pInfo->nCell += nCell;
+		pInfo->aCell[lhAnalyzeClass(nCell)]++;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Vacuum phases.
+ */
+#define L_HASH_VACUUM_DEFRAG   0 /* Defragment bucket pages and release empty slave pages */
+#define L_HASH_VACUUM_SHRINK   1 /* Merge the last bucket back into its split image */
+#define L_HASH_VACUUM_RELOCATE 2 /* Move live pages toward the start of the image and truncate */
+/*
+ * Return TRUE if the free space of a page is split across several blocks
+ * or does not extend to the end of the page.
+ */
+static int lhPageIsFragmented(lhpage *pPage)
+{
+	const unsigned char *zRaw = pPage->pRaw->zData;
+	sxu16 iNext,nByte;
+	if( pPage->sHdr.iFree < 1 || (int)pPage->sHdr.iFree + 4 > pPage->pHash->iPageSize ){
+		/* Full page */
+		return 0;
+	}
+	SyBigEndianUnpack16(&zRaw[pPage->sHdr.iFree],&iNext);
+	SyBigEndianUnpack16(&zRaw[pPage->sHdr.iFree + 2],&nByte);
+	return iNext != 0 || (int)pPage->sHdr.iFree + (int)nByte != pPage->pHash->iPageSize;
+}
+/*
+ * Return TRUE if a bucket has an empty slave page or a fragmented page.
+ * The pages are read without entering the page cache so that the buckets
+ * with nothing to do are not loaded.
+ */
+static int lhVacuumBucketNeedsWork(lhash_kv_engine *pEngine,pgno iPage)
+{
+	pgno nPage = pEngine->pIo->xDbSize(pEngine->pIo->pHandle);
+	sxu16 iOfft,iFree,iNext,nByte;
+	unsigned char *zRaw;
+	pgno n;
+	/* Temporary page of the pager, not used until the bucket is loaded */
+	zRaw = pEngine->pIo->xTmpPage(pEngine->pIo->pHandle);
+	for( n = 0 ; iPage > 0 ; ++n ){
+		if( n > nPage || pEngine->pIo->xRead(pEngine->pIo->pHandle,iPage,zRaw) != UNQLITE_OK ){
+			/* Let lhLoadPage() report the problem */
+			return 1;
+		}
+		SyBigEndianUnpack16(zRaw,&iOfft);
+		SyBigEndianUnpack16(&zRaw[2],&iFree);
+		if( n > 0 && iOfft < 1 ){
+			/* Empty slave page */
+			return 1;
+		}
+		if( iFree > 0 && (int)iFree + 4 <= pEngine->iPageSize ){
+			/* Same test as lhPageIsFragmented() */
+			SyBigEndianUnpack16(&zRaw[iFree],&iNext);
+			SyBigEndianUnpack16(&zRaw[iFree + 2],&nByte);
+			if( iNext != 0 || (int)iFree + (int)nByte != pEngine->iPageSize ){
+				return 1;
+			}
+		}
+		SyBigEndianUnpack64(&zRaw[2/*Cell offset*/+2/*Free block offset*/],&iPage);
+	}
+	return 0;
+}
+/*
+ * Defragment the master and slave pages of a single bucket.
+ */
+static int lhVacuumBucket(lhash_kv_engine *pEngine,lhash_bmap_rec *pRec)
+{
+	lhpage *pMaster,*pPage,*pNext;
+	int rc;
+	if( !lhVacuumBucketNeedsWork(pEngine,pRec->iReal) ){
+		return UNQLITE_OK;
+	}
+	rc = lhLoadPage(pEngine,pRec->iReal,0,&pMaster,0);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	for( pPage = pMaster->pSlave ; pPage ; pPage = pNext ){
+		pNext = pPage->pNextSlave;
+		if( pPage->sHdr.iOfft < 1 ){
+			/* Empty slave page */
+			rc = lhReleaseSlavePage(pPage);
+		}else if( lhPageIsFragmented(pPage) ){
+			rc = pEngine->pIo->xWrite(pPage->pRaw);
+			if( rc == UNQLITE_OK ){
+				rc = lhPageDefragment(pPage);
+			}
+		}
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+	}
+	if( rc == UNQLITE_OK && lhPageIsFragmented(pMaster) ){
+		rc = pEngine->pIo->xWrite(pMaster->pRaw);
+		if( rc == UNQLITE_OK ){
+			rc = lhPageDefragment(pMaster);
+		}
+	}
+	pEngine->pIo->xPageUnref(pMaster->pRaw);
+	return rc;
+}
+/*
+ * Locate the on-disk bucket map record of a logical bucket.
+ * The page preceding the last bucket map page is stored in *pPrevLast.
+ */
+static int lhMapLocateRecord(lhash_kv_engine *pEngine,pgno iLogic,pgno *pPage,sxu16 *pOfft,pgno *pPrevLast)
+{
+	pgno nPage = pEngine->pIo->xDbSize(pEngine->pIo->pHandle);
+	pgno iNum = pEngine->pHeader->iPage;
+	pgno iPrev = 0,iNext,iVal,nMap;
+	unqlite_page *pRaw;
+	sxu32 nRec,n;
+	sxu16 iBase;
+	int rc;
+	*pPage = 0;
+	for( nMap = 0 ;; ++nMap ){
+		if( nMap > nPage ){
+			/* Bucket map loop */
+			return UNQLITE_CORRUPT;
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNum,&pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iNum == pEngine->pHeader->iPage ){
+			iBase = 44;
+			SyBigEndianUnpack64(&pRaw->zData[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/],&iNext);
+			SyBigEndianUnpack32(&pRaw->zData[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/+8/*Next map page*/],&nRec);
+		}else{
+			iBase = 8/* Next page number */+4/* Total records in the map*/;
+			SyBigEndianUnpack64(pRaw->zData,&iNext);
+			SyBigEndianUnpack32(&pRaw->zData[8],&nRec);
+		}
+		for( n = 0 ; n < nRec && *pPage == 0 ; ++n ){
+			if( iBase + (n + 1) * 16 > (sxu32)pEngine->iPageSize ){
+				break;
+			}
+			SyBigEndianUnpack64(&pRaw->zData[iBase + n * 16],&iVal);
+			if( iVal == iLogic ){
+				*pPage = iNum;
+				*pOfft = (sxu16)(iBase + n * 16);
+			}
+		}
+		pEngine->pIo->xPageUnref(pRaw);
+		if( iNext == 0 ){
+			break;
+		}
+		iPrev = iNum;
+		iNum = iNext;
+	}
+	*pPrevLast = iPrev;
+	return *pPage ? UNQLITE_OK : UNQLITE_CORRUPT;
+}
+/*
+ * Remove a record from the in-memory bucket map.
+ */
+static void lhMapUnlinkBucket(lhash_kv_engine *pEngine,lhash_bmap_rec *pRec)
+{
+	pRec->iReal = 0;
+	pEngine->nBuckRec--;
+}
+/*
+ * Change the logical bucket number of a bucket map record.
+ */
+static int lhMapRenameBucket(lhash_kv_engine *pEngine,lhash_bmap_rec *pRec,pgno iLogic)
+{
+	unqlite_page *pRaw;
+	pgno iPage,iPrev,iReal;
+	sxu16 iOfft;
+	int rc;
+	rc = lhMapLocateRecord(pEngine,pRec->iLogic,&iPage,&iOfft,&iPrev);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPage,&pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pRaw);
+	if( rc == UNQLITE_OK ){
+		SyBigEndianPack64(&pRaw->zData[iOfft],iLogic);
+		/* Reflect the change in the map, pRec is no longer valid */
+		iReal = pRec->iReal;
+		lhMapUnlinkBucket(pEngine,pRec);
+		rc = lhMapInstallBucket(pEngine,iLogic,iReal);
+	}
+	pEngine->pIo->xPageUnref(pRaw);
+	return rc;
+}
+/*
+ * Remove a bucket map record. The hole is filled with the last record
+ * and a trailing map page that becomes empty is restored to the free list.
+ */
+static int lhMapRemoveRecord(lhash_kv_engine *pEngine,lhash_bmap_rec *pRec)
+{
+	lhash_bmap_page *pMap = &pEngine->sPageMap;
+	unqlite_page *pRaw,*pLast;
+	pgno iPage,iPrev;
+	sxu16 iOfft;
+	int rc;
+	rc = lhMapLocateRecord(pEngine,pRec->iLogic,&iPage,&iOfft,&iPrev);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pMap->nRec < 1 ){
+		/* Can't happen */
+		return UNQLITE_CORRUPT;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pMap->iNum,&pLast);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pLast);
+	if( rc != UNQLITE_OK ){
+		goto done;
+	}
+	if( iPage != pMap->iNum || iOfft != pMap->iPtr - 16 ){
+		/* Fill the hole with the last record */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPage,&pRaw);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		rc = pEngine->pIo->xWrite(pRaw);
+		if( rc == UNQLITE_OK ){
+			SyMemcpy((const void *)&pLast->zData[pMap->iPtr - 16],&pRaw->zData[iOfft],16);
+		}
+		pEngine->pIo->xPageUnref(pRaw);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+	}
+	pMap->iPtr -= 16;
+	pMap->nRec--;
+	if( pMap->iNum == pEngine->pHeader->iPage ){
+		SyBigEndianPack32(
+			&pLast->zData[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/+8/*Next map page*/],
+			pMap->nRec);
+	}else{
+		SyBigEndianPack32(&pLast->zData[8],pMap->nRec);
+		if( pMap->nRec < 1 && iPrev > 0 ){
+			unqlite_page *pPrev;
+			/* Unlink the empty map page */
+			rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPrev,&pPrev);
+			if( rc != UNQLITE_OK ){
+				goto done;
+			}
+			rc = pEngine->pIo->xWrite(pPrev);
+			if( rc == UNQLITE_OK ){
+				if( iPrev == pEngine->pHeader->iPage ){
+					SyBigEndianPack64(&pPrev->zData[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/],0);
+					SyBigEndianUnpack32(&pPrev->zData[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/+8/*Next map page*/],&pMap->nRec);
+					pMap->iPtr = (sxu16)(44 + pMap->nRec * 16);
+				}else{
+					SyBigEndianPack64(pPrev->zData,0);
+					SyBigEndianUnpack32(&pPrev->zData[8],&pMap->nRec);
+					pMap->iPtr = (sxu16)(8/* Next page number */+4/* Total records in the map*/ + pMap->nRec * 16);
+				}
+				pMap->iNum = iPrev;
+				pMap->iNext = 0;
+				rc = lhRestorePage(pEngine,pLast);
+			}
+			pEngine->pIo->xPageUnref(pPrev);
+			if( rc != UNQLITE_OK ){
+				goto done;
+			}
+		}
+	}
+	/* Drop the in-memory record */
+	lhMapUnlinkBucket(pEngine,pRec);
+done:
+	pEngine->pIo->xPageUnref(pLast);
+	return rc;
+}
+/*
+ * Move the cells of a bucket into its split image and release the bucket.
+ * Return UNQLITE_DONE if the bucket have slave pages or does not fit.
+ */
+static int lhVacuumMerge(lhash_kv_engine *pEngine,lhash_bmap_rec *pRec,lhash_bmap_rec *pBuddy)
+{
+	lhpage *pPage,*pTarget;
+	lhcell *pCell,*pNext;
+	unqlite_page *pRaw;
+	SyBlob sWorker;
+	sxu64 nNeed = 0;
+	int rc;
+	rc = lhLoadPage(pEngine,pRec->iReal,0,&pPage,0);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pRaw = pPage->pRaw;
+	if( pPage->sHdr.iSlave > 0 ){
+		/* Too many records to be merged */
+		pEngine->pIo->xPageUnref(pRaw);
+		return UNQLITE_DONE;
+	}
+	rc = lhLoadPage(pEngine,pBuddy->iReal,0,&pTarget,0);
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(pRaw);
+		return rc;
+	}
+	/* Make sure everything fit in the master page of the split image */
+	for( pCell = pPage->pList ; pCell ; pCell = pCell->pNext ){
+		nNeed += L_HASH_CELL_SZ + 4 /* Free block header */;
+		if( pCell->iOvfl == 0 ){
+			nNeed += pCell->nKey + pCell->nData;
+		}
+	}
+	if( nNeed > (sxu64)pTarget->nFree ){
+		pEngine->pIo->xPageUnref(pTarget->pRaw);
+		pEngine->pIo->xPageUnref(pRaw);
+		return UNQLITE_DONE;
+	}
+	rc = pEngine->pIo->xWrite(pTarget->pRaw);
+	if( rc != UNQLITE_OK ){
+		goto fail;
+	}
+	SyBlobInit(&sWorker,&pEngine->sAllocator);
+	for( pCell = pPage->pList ; pCell ; pCell = pNext ){
+		pNext = pCell->pNext;
+		if( pCell->iOvfl ){
+			/* Transfer the cell only, the overflow chain is kept as it is */
+			rc = lhTransferCell(pCell,pTarget);
+		}else{
+			/* Transfer the cell and its payload */
+			SyBlobReset(&sWorker);
+			rc = lhConsumeCellData(pCell,unqliteDataConsumer,&sWorker);
+			if( rc == UNQLITE_OK ){
+				rc = lhStoreCell(
+					pTarget,
+					lhCellKey(pCell),(int)pCell->nKey,
+					SyBlobData(&sWorker),SyBlobLength(&sWorker),
+					pCell->nHash,
+					0
+					);
+			}
+			if( rc == UNQLITE_OK && (pCell->bVlog || pCell->bLz) ){
+				rc = lhCellSetFlags(pTarget->pList,pCell->bVlog,pCell->bLz);
+			}
+		}
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+	}
+	SyBlobRelease(&sWorker);
+	if( rc != UNQLITE_OK ){
+		goto fail;
+	}
+	/* Release the bucket page and its map record */
+	rc = lhRestorePage(pEngine,pRaw);
+	if( rc != UNQLITE_OK ){
+		goto fail;
+	}
+	lhash_page_release(pPage);
+	rc = lhMapRemoveRecord(pEngine,pRec);
+fail:
+	pEngine->pIo->xPageUnref(pTarget->pRaw);
+	pEngine->pIo->xPageUnref(pRaw);
+	return rc;
+}
+/*
+ * Undo the last bucket split. Return UNQLITE_DONE when the bucket count
+ * cannot be reduced any further.
+ */
+static int lhVacuumShrink(lhash_kv_engine *pEngine)
+{
+	lhash_bmap_rec *pRec,*pBuddy;
+	pgno split_bucket = pEngine->split_bucket;
+	pgno max_split_bucket = pEngine->max_split_bucket;
+	int rc;
+	if( split_bucket < 1 ){
+		if( max_split_bucket < 2 ){
+			/* Single bucket */
+			return UNQLITE_DONE;
+		}
+		/* Step back to the previous generation */
+		max_split_bucket >>= 1;
+		split_bucket = max_split_bucket;
+	}
+	/* Last split bucket and its split image */
+	pRec = lhMapFindBucket(pEngine,split_bucket - 1 + max_split_bucket);
+	pBuddy = lhMapFindBucket(pEngine,split_bucket - 1);
+	if( pRec ){
+		if( pBuddy ){
+			rc = lhVacuumMerge(pEngine,pRec,pBuddy);
+		}else{
+			/* The split image was never created, take its place */
+			rc = lhMapRenameBucket(pEngine,pRec,split_bucket - 1);
+		}
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	/* Reflect the new split state */
+	rc = pEngine->pIo->xWrite(pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pEngine->split_bucket = split_bucket - 1;
+	pEngine->max_split_bucket = max_split_bucket;
+	pEngine->nmax_split_nucket = max_split_bucket << 1;
+	SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/],pEngine->split_bucket);
+	SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/+8/*Split bucket*/],pEngine->max_split_bucket);
+	return UNQLITE_OK;
+}
+/*
+ * Page relocation context. It is kept by the engine from one incremental
+ * vacuum call to the next and dropped by any other write.
+ */
+struct lhash_vacuum
+{
+	lhash_kv_engine *pEngine; /* Engine being vacuumed */
+	pgno nPage;               /* Total number of pages in the database image */
+	pgno nLive;               /* Total number of live pages (page 0 and 1 included) */
+	unsigned char *zState;    /* Page states (L_HASH_PAGE_* constants) */
+	pgno *aRef;               /* aRef[2*i]: Page pointing to page i, aRef[2*i+1]: Page using i as its data page */
+	sxu16 *aOfft;             /* Offsets of these pointers */
+	pgno *aFree;              /* Pages that are not live in ascending order */
+	pgno nFree;               /* aFree[] length */
+	pgno iHead;               /* First entry of aFree[] still on the free list */
+	pgno *aMove;              /* aMove[i - nTarget]: New location of the moved page i */
+	pgno nTarget;             /* Every live page fits below this page */
+	pgno nAbove;              /* Live pages left at or above nTarget */
+	pgno iTop;                /* Next page to examine for a move (Downward) */
+	int bLinked;              /* True once the free list follows aFree[] */
+	unsigned char *zMap;      /* Scratch buffers of the walk (Pages are not cached): Bucket map pages */
+	unsigned char *zPage;     /* Bucket and Bloom filter pages */
+	unsigned char *zOvfl;     /* Overflow and free pages */
+};
+#define L_HASH_PAGE_UNUSED 0 /* Not referenced */
+#define L_HASH_PAGE_LIVE   1 /* Map, bucket or overflow page */
+#define L_HASH_PAGE_FREE   2 /* On the free list */
+/*
+ * Mark a page as live and record the location of the pointer to it.
+ */
+static int lhVacuumMark(lhash_vacuum *pVac,pgno iPage,pgno iFrom,sxu16 iOfft)
+{
+	if( iPage < 2 || iPage >= pVac->nPage || pVac->zState[iPage] != L_HASH_PAGE_UNUSED ){
+		return UNQLITE_CORRUPT;
+	}
+	pVac->zState[iPage] = L_HASH_PAGE_LIVE;
+	pVac->aRef[iPage * 2] = iFrom;
+	pVac->aOfft[iPage * 2] = iOfft;
+	pVac->nLive++;
+	return UNQLITE_OK;
+}
+/*
+ * Walk an overflow chain.
+ */
+static int lhVacuumWalkOverflow(lhash_vacuum *pVac,pgno iFrom,sxu16 iFromOfft,pgno iOvfl)
+{
+	lhash_kv_engine *pEngine = pVac->pEngine;
+	pgno iFirst = iOvfl,iDataPage = 0;
+	int bFound = 0;
+	int rc;
+	for(;;){
+		rc = lhVacuumMark(pVac,iOvfl,iFrom,iFromOfft);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xRead(pEngine->pIo->pHandle,iOvfl,pVac->zOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iOvfl == iFirst ){
+			SyBigEndianUnpack64(&pVac->zOvfl[8/* Next ovfl page*/],&iDataPage);
+		}
+		if( iOvfl == iDataPage ){
+			bFound = 1;
+		}
+		iFrom = iOvfl;
+		iFromOfft = 0;
+		SyBigEndianUnpack64(pVac->zOvfl,&iOvfl);
+		if( iOvfl == 0 ){
+			break;
+		}
+	}
+	if( bFound ){
+		/* The first overflow page also point to the data page */
+		pVac->aRef[iDataPage * 2 + 1] = iFirst;
+		pVac->aOfft[iDataPage * 2 + 1] = 8/* Next ovfl page*/;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Walk a bucket: Master page, slave pages and overflow chains.
+ */
+static int lhVacuumWalkBucket(lhash_vacuum *pVac,pgno iFrom,sxu16 iFromOfft,pgno iPage)
+{
+	lhash_kv_engine *pEngine = pVac->pEngine;
+	sxu32 nMax = (sxu32)(pEngine->iPageSize / L_HASH_CELL_SZ) + 1;
+	const unsigned char *zRaw = pVac->zPage;
+	sxu16 iOfft,iNext;
+	pgno iOvfl,iSlave;
+	sxu32 n;
+	int rc;
+	for(;;){
+		rc = lhVacuumMark(pVac,iPage,iFrom,iFromOfft);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xRead(pEngine->pIo->pHandle,iPage,pVac->zPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack16(zRaw,&iOfft);
+		for( n = 0 ; iOfft > 0 ; ++n ){
+			if( n >= nMax || iOfft < L_HASH_PAGE_HDR_SZ || (int)iOfft + L_HASH_CELL_SZ > pEngine->iPageSize ){
+				rc = UNQLITE_CORRUPT;
+				break;
+			}
+			SyBigEndianUnpack16(&zRaw[iOfft + 4/*Hash*/+4/*Key*/+8/*Data*/],&iNext);
+			SyBigEndianUnpack64(&zRaw[iOfft + 4/*Hash*/+4/*Key*/+8/*Data*/+2/*Next cell*/],&iOvfl);
+			if( iOvfl > 0 ){
+				rc = lhVacuumWalkOverflow(pVac,iPage,(sxu16)(iOfft + 4/*Hash*/+4/*Key*/+8/*Data*/+2/*Next cell*/),iOvfl);
+				if( rc != UNQLITE_OK ){
+					break;
+				}
+			}
+			iOfft = iNext;
+		}
+		SyBigEndianUnpack64(&zRaw[2/*Cell offset*/+2/*Free block offset*/],&iSlave);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iSlave == 0 ){
+			break;
+		}
+		iFrom = iPage;
+		iFromOfft = 2/*Cell offset*/+2/*Free block offset*/;
+		iPage = iSlave;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Walk the Bloom filter: Directory pages and data pages.
+ */
+static int lhVacuumWalkBloom(lhash_vacuum *pVac,pgno iFrom,sxu16 iFromOfft,pgno iDir)
+{
+	lhash_kv_engine *pEngine = pVac->pEngine;
+	sxu16 iLink = L_HASH_PAGE_HDR_SZ,iBase = L_HASH_BLOOM_ROOT_HDR;
+	const unsigned char *zRaw = pVac->zPage;
+	sxu32 nEntry,n;
+	pgno iData;
+	int rc;
+	for(;;){
+		rc = lhVacuumMark(pVac,iDir,iFrom,iFromOfft);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xRead(pEngine->pIo->pHandle,iDir,pVac->zPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack32(&zRaw[iLink + 8],&nEntry);
+		for( n = 0 ; n < nEntry ; ++n ){
+			sxu16 iOfft = (sxu16)(iBase + n * 8);
+			if( (int)iOfft + 8 > pEngine->iPageSize ){
+				rc = UNQLITE_CORRUPT;
+				break;
+			}
+			SyBigEndianUnpack64(&zRaw[iOfft],&iData);
+			rc = lhVacuumMark(pVac,iData,iDir,iOfft);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+		}
+		iFrom = iDir;
+		iFromOfft = iLink;
+		SyBigEndianUnpack64(&zRaw[iLink],&iDir);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iDir == 0 ){
+			break;
+		}
+		iLink = 0;
+		iBase = L_HASH_BLOOM_DIR_HDR;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Collect the live pages and the free list of the image.
+ */
+static int lhVacuumWalk(lhash_vacuum *pVac)
+{
+	lhash_kv_engine *pEngine = pVac->pEngine;
+	pgno iMap = pEngine->pHeader->iPage;
+	const unsigned char *zRaw = pVac->zMap;
+	pgno iNext,iLogic,iReal;
+	sxu16 iBase,iLink;
+	sxu32 nRec,n;
+	int rc;
+	/* Page 0 and the hash header */
+	pVac->zState[0] = pVac->zState[1] = L_HASH_PAGE_LIVE;
+	pVac->nLive = 2;
+	/* Bucket map */
+	for(;;){
+		rc = pEngine->pIo->xRead(pEngine->pIo->pHandle,iMap,pVac->zMap);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iMap == pEngine->pHeader->iPage ){
+			iLink = 4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/;
+			iBase = 44;
+		}else{
+			iLink = 0;
+			iBase = 8/* Next page number */+4/* Total records in the map*/;
+		}
+		SyBigEndianUnpack64(&zRaw[iLink],&iNext);
+		SyBigEndianUnpack32(&zRaw[iLink + 8],&nRec);
+		for( n = 0 ; n < nRec ; ++n ){
+			sxu16 iOfft = (sxu16)(iBase + n * 16);
+			if( (int)iOfft + 16 > pEngine->iPageSize ){
+				rc = UNQLITE_CORRUPT;
+				break;
+			}
+			SyBigEndianUnpack64(&zRaw[iOfft],&iLogic);
+			SyBigEndianUnpack64(&zRaw[iOfft + 8],&iReal);
+			if( iLogic == L_HASH_BLOOM_LOGIC ){
+				if( iReal > 0 ){
+					rc = lhVacuumWalkBloom(pVac,iMap,(sxu16)(iOfft + 8),iReal);
+				}
+			}else{
+				/* Bucket, the value log root is walked as an empty bucket page */
+				rc = lhVacuumWalkBucket(pVac,iMap,(sxu16)(iOfft + 8),iReal);
+			}
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+		}
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iNext == 0 ){
+			break;
+		}
+		rc = lhVacuumMark(pVac,iNext,iMap,iLink);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		iMap = iNext;
+	}
+	/* Free list */
+	iNext = pEngine->nFreeList;
+	while( iNext > 0 ){
+		if( iNext < 2 || iNext >= pVac->nPage || pVac->zState[iNext] != L_HASH_PAGE_UNUSED ){
+			return UNQLITE_CORRUPT;
+		}
+		pVac->zState[iNext] = L_HASH_PAGE_FREE;
+		rc = pEngine->pIo->xRead(pEngine->pIo->pHandle,iNext,pVac->zOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(pVac->zOvfl,&iNext);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Make the free list entry iPrev (the database header when zero) point to iNext.
+ */
+static int lhVacuumLinkFree(lhash_kv_engine *pEngine,pgno iPrev,pgno iNext)
+{
+	unqlite_page *pRaw;
+	pgno iOld;
+	int rc;
+	if( iPrev == 0 ){
+		if( pEngine->nFreeList == iNext ){
+			return UNQLITE_OK;
+		}
+		rc = pEngine->pIo->xWrite(pEngine->pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->nFreeList = iNext;
+		lhWriteFreeList(pEngine);
+		return UNQLITE_OK;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPrev,&pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack64(pRaw->zData,&iOld);
+	if( iOld != iNext ){
+		rc = pEngine->pIo->xWrite(pRaw);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianPack64(pRaw->zData,iNext);
+		}
+	}
+	pEngine->pIo->xPageUnref(pRaw);
+	return rc;
+}
+/*
+ * Copy a live page into a lower free slot and redirect the pointers to it.
+ */
+static int lhVacuumMovePage(lhash_vacuum *pVac,pgno *aMove,pgno nTarget,pgno iPage,pgno iSlot)
+{
+	lhash_kv_engine *pEngine = pVac->pEngine;
+	unqlite_page *pSrc,*pDest,*pRef;
+	pgno iFrom;
+	int i,rc;
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPage,&pSrc);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Journal the original page, it is going to be truncated */
+	rc = pEngine->pIo->xWrite(pSrc);
+	if( rc == UNQLITE_OK ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iSlot,&pDest);
+		if( rc == UNQLITE_OK ){
+			rc = pEngine->pIo->xWrite(pDest);
+			if( rc == UNQLITE_OK ){
+				SyMemcpy((const void *)pSrc->zData,pDest->zData,(sxu32)pEngine->iPageSize);
+			}
+			pEngine->pIo->xPageUnref(pDest);
+		}
+	}
+	pEngine->pIo->xPageUnref(pSrc);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	for( i = 0 ; i < 2 ; ++i ){
+		iFrom = pVac->aRef[iPage * 2 + i];
+		if( iFrom == 0 ){
+			continue;
+		}
+		if( iFrom == iPage ){
+			/* First overflow page holding its own data */
+			iFrom = iSlot;
+		}else if( iFrom >= nTarget && aMove[iFrom - nTarget] > 0 ){
+			/* The referencing page was moved first */
+			iFrom = aMove[iFrom - nTarget];
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iFrom,&pRef);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pRef);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianPack64(&pRef->zData[pVac->aOfft[iPage * 2 + i]],iSlot);
+		}
+		pEngine->pIo->xPageUnref(pRef);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	aMove[iPage - nTarget] = iSlot;
+	pVac->zState[iSlot] = L_HASH_PAGE_LIVE;
+	pVac->zState[iPage] = L_HASH_PAGE_UNUSED;
+	return UNQLITE_OK;
+}
+/*
+ * Reload the engine state from the database image after its pages
+ * have been moved around.
+ */
+static int lhVacuumReload(lhash_kv_engine *pEngine)
+{
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	int iPageSize = pEngine->iPageSize;
+	ProcHash xHash = pEngine->xHash;
+	ProcCmp xCmp = pEngine->xCmp;
+	sxu32 iVacuum = pEngine->iVacuum;
+	pgno iBucket = pEngine->iVacuumBucket;
+	lhash_kv_keep sKeep = pEngine->sKeep;
+	lhash_vacuum *pVac = pEngine->pVacuum;
+	int rc;
+	/* The value log segments are closed, make the pending appends durable first */
+	rc = lhVlogSync((unqlite_kv_engine *)pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Drop the parsed pages, the page walk tracked the moves and is kept */
+	pIo->xUnpinAll(pIo->pHandle);
+	pEngine->pVacuum = 0;
+	lhash_kv_release((unqlite_kv_engine *)pEngine);
+	SyZero(pEngine,sizeof(lhash_kv_engine));
+	pEngine->pIo = pIo;
+	rc = lhash_kv_init((unqlite_kv_engine *)pEngine,iPageSize);
+	if( rc == UNQLITE_OK ){
+		pEngine->xHash = xHash;
+		pEngine->xCmp = xCmp;
+		pEngine->iVacuum = iVacuum;
+		pEngine->iVacuumBucket = iBucket;
+		pEngine->sKeep = sKeep;
+		rc = lhash_kv_open((unqlite_kv_engine *)pEngine,pIo->xDbSize(pIo->pHandle));
+	}
+	pEngine->pVacuum = pVac;
+	if( rc != UNQLITE_OK ){
+		lhVacuumForget(pEngine);
+	}
+	return rc;
+}
+/*
+ * Release the page walk of the relocation phase.
+ */
+static void lhVacuumForget(lhash_kv_engine *pEngine)
+{
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	lhash_vacuum *pVac = pEngine->pVacuum;
+	if( pVac == 0 ){
+		return;
+	}
+	if( pVac->aRef ){
+		SyMemBackendFree(pAlloc,pVac->aRef);
+	}
+	if( pVac->zMap ){
+		SyMemBackendFree(pAlloc,pVac->zMap);
+	}
+	SyMemBackendFree(pAlloc,pVac);
+	pEngine->pVacuum = 0;
+}
+/*
+ * Walk the image once for the relocation phase and collect the pages that
+ * are not live in ascending order. The walk survives the engine reloads
+ * so it is taken from the global memory backend.
+ */
+static int lhVacuumStart(lhash_kv_engine *pEngine)
+{
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	lhash_vacuum *pVac;
+	pgno iPage;
+	sxu64 nByte;
+	int rc;
+	pVac = (lhash_vacuum *)SyMemBackendAlloc(pAlloc,sizeof(lhash_vacuum));
+	if( pVac == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pVac,sizeof(lhash_vacuum));
+	pEngine->pVacuum = pVac;
+	pVac->pEngine = pEngine;
+	pVac->nPage = pEngine->pIo->xDbSize(pEngine->pIo->pHandle);
+	nByte = (sxu64)pVac->nPage * (1 + 2 * sizeof(pgno) + 2 * sizeof(sxu16) + 2 * sizeof(pgno));
+	if( nByte > 0x7FFFFFFF ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Database image too large to be vacuumed");
+		rc = UNQLITE_LIMIT;
+		goto fail;
+	}
+	pVac->aRef = (pgno *)SyMemBackendAlloc(pAlloc,(sxu32)nByte);
+	pVac->zMap = (unsigned char *)SyMemBackendAlloc(pAlloc,(sxu32)(3 * pEngine->iPageSize));
+	if( pVac->aRef == 0 || pVac->zMap == 0 ){
+		rc = UNQLITE_NOMEM;
+		goto fail;
+	}
+	SyZero(pVac->aRef,(sxu32)nByte);
+	pVac->aFree = &pVac->aRef[pVac->nPage * 2];
+	pVac->aMove = &pVac->aFree[pVac->nPage];
+	pVac->aOfft = (sxu16 *)&pVac->aMove[pVac->nPage];
+	pVac->zState = (unsigned char *)&pVac->aOfft[pVac->nPage * 2];
+	pVac->zPage = &pVac->zMap[pEngine->iPageSize];
+	pVac->zOvfl = &pVac->zPage[pEngine->iPageSize];
+	rc = lhVacuumWalk(pVac);
+	if( rc != UNQLITE_OK ){
+		goto fail;
+	}
+	/* Every live page will fit below nTarget */
+	pVac->nTarget = pVac->nLive;
+	for( iPage = 2 ; iPage < pVac->nPage ; ++iPage ){
+		if( pVac->zState[iPage] != L_HASH_PAGE_LIVE ){
+			pVac->aFree[pVac->nFree++] = iPage;
+		}else if( iPage >= pVac->nTarget ){
+			pVac->nAbove++;
+		}
+	}
+	pVac->iTop = pVac->nPage - 1;
+	return UNQLITE_OK;
+fail:
+	lhVacuumForget(pEngine);
+	return rc;
+}
+/*
+ * Move at most nStep live pages (all of them when nStep <= 0) toward
+ * the start of the image, update the free list and shrink the image.
+ * The number of pages still to be moved is stored in *pLeft.
+ * The image is walked on the first call only: the free list is then kept
+ * in ascending page order so that the slots are taken from its head and
+ * the pages past the new end are cut from its tail.
+ */
+static int lhVacuumPages(lhash_kv_engine *pEngine,int nStep,pgno *pLeft)
+{
+	lhash_vacuum *pVac;
+	pgno iPrev,iEnd,nFree,n;
+	int nMoved = 0;
+	int rc = UNQLITE_OK;
+	*pLeft = 0;
+	if( pEngine->pVacuum == 0 ){
+		if( pEngine->pIo->xDbSize(pEngine->pIo->pHandle) < 3 ){
+			/* Nothing to move */
+			return UNQLITE_OK;
+		}
+		rc = lhVacuumStart(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	pVac = pEngine->pVacuum;
+	nFree = pVac->nFree;
+	/* There are as many free slots below nTarget as live pages above it */
+	while( pVac->nAbove > 0 && (nStep <= 0 || nMoved < nStep) ){
+		while( pVac->zState[pVac->iTop] != L_HASH_PAGE_LIVE ){
+			pVac->iTop--;
+		}
+		rc = lhVacuumMovePage(pVac,pVac->aMove,pVac->nTarget,pVac->iTop,pVac->aFree[pVac->iHead]);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		pVac->iHead++;
+		pVac->nAbove--;
+		nMoved++;
+	}
+	/* New end of the image */
+	for( iEnd = pVac->nPage ; iEnd > pVac->nTarget ; --iEnd ){
+		if( pVac->zState[iEnd - 1] == L_HASH_PAGE_LIVE ){
+			break;
+		}
+	}
+	/* Journal the free pages past the new end so that a rollback restore the free list */
+	while( pVac->nFree > pVac->iHead && pVac->aFree[pVac->nFree - 1] >= iEnd ){
+		unqlite_page *pRaw;
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pVac->aFree[pVac->nFree - 1],&pRaw);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		rc = pEngine->pIo->xWrite(pRaw);
+		pEngine->pIo->xPageUnref(pRaw);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		pVac->nFree--;
+	}
+	if( !pVac->bLinked ){
+		/* Rebuild the whole free list in ascending order */
+		iPrev = 0;
+		for( n = pVac->iHead ; n < pVac->nFree ; ++n ){
+			rc = lhVacuumLinkFree(pEngine,iPrev,pVac->aFree[n]);
+			if( rc != UNQLITE_OK ){
+				goto done;
+			}
+			iPrev = pVac->aFree[n];
+		}
+		rc = lhVacuumLinkFree(pEngine,iPrev,0);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		pVac->bLinked = 1;
+	}else{
+		/* Only the ends of the list changed */
+		rc = lhVacuumLinkFree(pEngine,0,pVac->iHead < pVac->nFree ? pVac->aFree[pVac->iHead] : 0);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		if( pVac->nFree < nFree && pVac->iHead < pVac->nFree ){
+			rc = lhVacuumLinkFree(pEngine,pVac->aFree[pVac->nFree - 1],0);
+			if( rc != UNQLITE_OK ){
+				goto done;
+			}
+		}
+	}
+	if( pEngine->nFreePage != pVac->nFree - pVac->iHead ){
+		/* Reflect the new free page count */
+		rc = pEngine->pIo->xWrite(pEngine->pHeader);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		pEngine->nFreePage = pVac->nFree - pVac->iHead;
+		lhWriteFreeList(pEngine);
+	}
+	if( iEnd < pVac->nPage ){
+		/* Shrink the image, the file is truncated on commit */
+		rc = pEngine->pIo->xTruncate(pEngine->pIo->pHandle,iEnd);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		pVac->nPage = iEnd;
+		pVac->iTop = iEnd - 1;
+	}
+	*pLeft = pVac->nAbove;
+done:
+	if( rc != UNQLITE_OK ){
+		/* The walk no longer matches the image */
+		lhVacuumForget(pEngine);
+	}
+	if( nMoved > 0 ){
+		/* The parsed pages and the bucket map are stale now */
+		int rc2 = lhVacuumReload(pEngine);
+		if( rc == UNQLITE_OK ){
+			rc = rc2;
+		}
+	}
+	return rc;
+}
+/*
+ * Vacuum the linear hash image: Defragment the bucket pages, release empty
+ * slave pages, undo bucket splits while the records fit and finally move the
+ * live pages to the start of the image so that it can be truncated.
+ * Perform at most nStep units of work (the whole job when nStep <= 0) and
+ * store an estimate of the remaining work in *pRemaining (zero when done).
+ */
+static int lhVacuum(lhash_kv_engine *pEngine,int nStep,unqlite_int64 *pRemaining)
+{
+	lhash_bmap_rec *pRec;
+	pgno nLeft = 0;
+	int nDone = 0;
+	int rc;
+	if( pEngine->pIo->xReadOnly(pEngine->pIo->pHandle) ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only database");
+		return UNQLITE_READ_ONLY;
+	}
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Buckets are visited and merged through the whole map */
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( nStep <= 0 ){
+		/* Full vacuum */
+		pEngine->iVacuum = L_HASH_VACUUM_DEFRAG;
+		pEngine->iVacuumBucket = 0;
+		lhVacuumForget(pEngine);
+	}
+	if( pEngine->iVacuum == L_HASH_VACUUM_DEFRAG ){
+		while( pEngine->iVacuumBucket < pEngine->split_bucket + pEngine->max_split_bucket ){
+			if( nStep > 0 && nDone >= nStep ){
+				break;
+			}
+			pRec = lhMapFindBucket(pEngine,pEngine->iVacuumBucket);
+			if( pRec ){
+				rc = lhVacuumBucket(pEngine,pRec);
+				if( rc != UNQLITE_OK ){
+					return rc;
+				}
+				nDone++;
+			}
+			pEngine->iVacuumBucket++;
+		}
+		if( pEngine->iVacuumBucket >= pEngine->split_bucket + pEngine->max_split_bucket ){
+			pEngine->iVacuum = L_HASH_VACUUM_SHRINK;
+		}
+	}
+	if( pEngine->iVacuum == L_HASH_VACUUM_SHRINK ){
+		while( nStep <= 0 || nDone < nStep ){
+			rc = lhVacuumShrink(pEngine);
+			if( rc == UNQLITE_DONE ){
+				pEngine->iVacuum = L_HASH_VACUUM_RELOCATE;
+				break;
+			}
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			nDone++;
+		}
+	}
+	if( pEngine->iVacuum == L_HASH_VACUUM_RELOCATE && (nStep <= 0 || nDone < nStep) ){
+		rc = lhVacuumPages(pEngine,nStep > 0 ? nStep - nDone : 0,&nLeft);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( nLeft < 1 ){
+			/* All done, start over on the next call */
+			pEngine->iVacuum = L_HASH_VACUUM_DEFRAG;
+			pEngine->iVacuumBucket = 0;
+			lhVacuumForget(pEngine);
+			if( pRemaining ){
+				*pRemaining = 0;
+			}
+			return UNQLITE_OK;
+		}
+	}
+	if( pRemaining ){
+		/* Estimate the remaining work */
+		*pRemaining = (unqlite_int64)nLeft + 1;
+		if( pEngine->iVacuum == L_HASH_VACUUM_DEFRAG ){
+			*pRemaining += (unqlite_int64)(pEngine->split_bucket + pEngine->max_split_bucket - pEngine->iVacuumBucket);
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Estimate the split debt of a database image opened with deferred
+ * splits: one split for each bucket that has grown a slave page.
+ */
+static int lhCountSplitDebt(lhash_kv_engine *pEngine)
+{
+	lhash_bmap_rec *pRec;
+	unqlite_page *pRaw;
+	pgno iSlave,iLogic,nMap,nDebt = 0;
+	int rc;
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	nMap = (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK;
+	for( iLogic = 0 ; iLogic < nMap ; ++iLogic ){
+		pRec = lhMapFindBucket(pEngine,iLogic);
+		if( pRec == 0 ){
+			continue;
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pRec->iReal,&pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(&pRaw->zData[2/*iOfft*/+2/*iFree*/],&iSlave);
+		pEngine->pIo->xPageUnref(pRaw);
+		if( iSlave > 0 ){
+			nDebt++;
+		}
+	}
+	if( nDebt > pEngine->nSplitDebt ){
+		/* Keep the splits deferred since the image was loaded if larger */
+		pEngine->nSplitDebt = nDebt;
+	}
+	pEngine->bSplitDebt = 1;
+	return UNQLITE_OK;
+}
+/*
+ * Perform at most nStep deferred bucket splits (all of them when nStep <= 0).
+ * The number of splits still owed is stored in *pRemaining.
+ */
+static int lhMaintain(lhash_kv_engine *pEngine,int nStep,unqlite_int64 *pRemaining)
+{
+	int do_retry;
+	int nDone = 0;
+	int rc;
+	if( pRemaining ){
+		*pRemaining = 0;
+	}
+	if( pEngine->pIo->xDbSize(pEngine->pIo->pHandle) < 2 ){
+		/* Empty database */
+		return UNQLITE_OK;
+	}
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( !pEngine->bSplitDebt ){
+		/* Database reopened or transaction rolled back */
+		rc = lhCountSplitDebt(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( pEngine->nSplitDebt > 0 && pEngine->pIo->xReadOnly(pEngine->pIo->pHandle) ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only database");
+		return UNQLITE_READ_ONLY;
+	}
+	while( pEngine->nSplitDebt > 0 ){
+		if( nStep > 0 && nDone >= nStep ){
+			break;
+		}
+		do_retry = 0;
+		rc = lhSplit(pEngine,0,&do_retry);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->nSplitDebt--;
+		nDone++;
+	}
+	if( pRemaining ){
+		*pRemaining = (unqlite_int64)pEngine->nSplitDebt;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Size the bucket table of an empty database for nRecord records holding
+ * nPayload bytes of keys and values so that a bulk load does not go through
+ * one split per filled page. The buckets get their page on first use and
+ * an empty bucket is split without any I/O, see lhSplit().
+ */
+static int lhPresize(lhash_kv_engine *pEngine,sxu64 nRecord,sxu64 nPayload)
+{
+	sxu64 nByte,nRoom;
+	pgno nBucket,nMax;
+	int rc;
+	if( pEngine->pIo->xDbSize(pEngine->pIo->pHandle) > 2 /* Pager and hash headers */ || pEngine->nBuckRec > 0 ){
+		/* Records already stored */
+		return UNQLITE_LOCKED;
+	}
+	/* Aim at pages three quarter full */
+	nByte = nPayload + nRecord * L_HASH_CELL_SZ;
+	nRoom = (sxu64)(pEngine->iPageSize - L_HASH_PAGE_HDR_SZ);
+	nBucket = (pgno)((nByte * 4) / (nRoom * 3)) + 1;
+	if( nBucket > nRecord ){
+		/* Large values go to overflow pages */
+		nBucket = (pgno)nRecord;
+	}
+	if( nBucket <= pEngine->split_bucket + pEngine->max_split_bucket ){
+		/* Nothing to do */
+		return UNQLITE_OK;
+	}
+	for( nMax = 1 ; (nMax << 1) <= nBucket ; nMax <<= 1 );
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pEngine->split_bucket = nBucket - nMax;
+	pEngine->max_split_bucket = nMax;
+	pEngine->nmax_split_nucket = nMax << 1;
+	SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/],pEngine->split_bucket);
+	SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/+8/*Split bucket*/],pEngine->max_split_bucket);
+	/* Splits may now meet buckets that never got a page */
+	pEngine->bPresized = 1;
+	lhWriteFreeList(pEngine);
+	return UNQLITE_OK;
+}
+/*
+ * Restore the pages of the Bloom filter to the free list. The bucket map
+ * record must then be updated by lhBloomRegister().
+ */
+static int lhBloomRelease(lhash_kv_engine *pEngine)
+{
+	pgno iDir = pEngine->iBloom,n;
+	unqlite_page *pRaw;
+	sxu16 iLink;
+	int rc;
+	if( iDir == 0 ){
+		/* No filter */
+		return UNQLITE_OK;
+	}
+	if( pEngine->aBloomPage == 0 ){
+		rc = lhBloomLoad(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	/* Data pages */
+	for( n = 0 ; n < pEngine->nBloomPage ; ++n ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->aBloomPage[n],&pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = lhRestorePage(pEngine,pRaw);
+		pEngine->pIo->xPageUnref(pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	/* Directory pages */
+	iLink = L_HASH_PAGE_HDR_SZ;
+	for( n = 0 ; iDir > 0 && n <= pEngine->nBloomPage ; ++n ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iDir,&pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(&pRaw->zData[iLink],&iDir);
+		rc = lhRestorePage(pEngine,pRaw);
+		pEngine->pIo->xPageUnref(pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		iLink = 0;
+	}
+	SyMemBackendFree(&pEngine->sAllocator,pEngine->aBloomPage);
+	pEngine->aBloomPage = 0;
+	pEngine->nBloomPage = pEngine->nBloomBlock = pEngine->nBloomKey = 0;
+	pEngine->iBloom = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Point the record iLogic of the bucket map (L_HASH_BLOOM_LOGIC or
+ * L_HASH_VLOG_LOGIC) to iRoot. *pbRec is true when the record exists.
+ * A new record takes the first slot of page one after the other such
+ * records, the bucket record that was there is moved to the end of the map.
+ */
+static int lhMapRegisterRoot(lhash_kv_engine *pEngine,pgno iLogic,pgno iRoot,int *pbRec)
+{
+	unsigned char *zRaw = pEngine->pHeader->zData;
+	pgno iPage,iPrev,iMoved,iReal;
+	unqlite_page *pRaw;
+	sxu16 iOfft;
+	sxu32 nRec,iSlot;
+	int rc;
+	if( *pbRec ){
+		/* Update the existing record */
+		rc = lhMapLocateRecord(pEngine,iLogic,&iPage,&iOfft,&iPrev);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPage,&pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pRaw);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianPack64(&pRaw->zData[iOfft + 8],iRoot);
+		}
+		pEngine->pIo->xPageUnref(pRaw);
+		return rc;
+	}
+	SyBigEndianUnpack32(&zRaw[4/*magic*/+4/*hash*/+8/* Free page */+8/*current split bucket*/+8/*Maximum split bucket*/+8/*Next map page*/],&nRec);
+	iSlot = 44 + (sxu32)(pEngine->bBloomRec + pEngine->bVlogRec) * 16;
+	if( nRec <= (sxu32)(pEngine->bBloomRec + pEngine->bVlogRec) ){
+		/* No bucket record to move */
+		rc = lhMapWriteRecord(pEngine,iLogic,iRoot);
+	}else{
+		/* Take the slot and move its record to the end of the map */
+		SyBigEndianUnpack64(&zRaw[iSlot],&iMoved);
+		SyBigEndianUnpack64(&zRaw[iSlot + 8],&iReal);
+		rc = pEngine->pIo->xWrite(pEngine->pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianPack64(&zRaw[iSlot],iLogic);
+		SyBigEndianPack64(&zRaw[iSlot + 8],iRoot);
+		rc = lhMapWriteRecord(pEngine,iMoved,iReal);
+	}
+	if( rc == UNQLITE_OK ){
+		*pbRec = 1;
+	}
+	return rc;
+}
+/*
+ * Point the Bloom filter record of the bucket map to iRoot (zero for no filter).
+ */
+static int lhBloomRegister(lhash_kv_engine *pEngine,pgno iRoot)
+{
+	int rc;
+	rc = lhMapRegisterRoot(pEngine,L_HASH_BLOOM_LOGIC,iRoot,&pEngine->bBloomRec);
+	if( rc == UNQLITE_OK ){
+		pEngine->iBloom = iRoot;
+	}
+	return rc;
+}
+/*
+ * Acquire a zeroed page for the Bloom filter.
+ */
+static int lhBloomNewPage(lhash_kv_engine *pEngine,unqlite_page **ppOut)
+{
+	unqlite_page *pRaw;
+	int rc;
+	rc = lhAcquirePage(pEngine,&pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pRaw);
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(pRaw);
+		return rc;
+	}
+	SyZero(pRaw->zData,(sxu32)pEngine->iPageSize);
+	*ppOut = pRaw;
+	return UNQLITE_OK;
+}
+/*
+ * Call xKey for the key of each stored record.
+ */
+static int lhBloomWalkKeys(lhash_kv_engine *pEngine,int (*xKey)(lhash_kv_engine *,lhcell *,SyBlob *),SyBlob *pWorker)
+{
+	pgno iLogic,nMap = (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK;
+	lhash_bmap_rec *pRec;
+	lhpage *pPage;
+	lhcell *pCell;
+	int rc;
+	for( iLogic = 0 ; iLogic < nMap ; ++iLogic ){
+		pRec = lhMapFindBucket(pEngine,iLogic);
+		if( pRec == 0 ){
+			continue;
+		}
+		/* The master page list cover the slave pages */
+		rc = lhLoadPage(pEngine,pRec->iReal,0,&pPage,0);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		for( pCell = pPage->pList ; pCell ; pCell = pCell->pNext ){
+			rc = xKey(pEngine,pCell,pWorker);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * lhBloomWalkKeys() callbacks: Count the keys, then set their bits.
+ */
+static int lhBloomCountKey(lhash_kv_engine *pEngine,lhcell *pCell,SyBlob *pWorker)
+{
+	SXUNUSED(pCell);
+	SXUNUSED(pWorker);
+	pEngine->nBloomKey++;
+	return UNQLITE_OK;
+}
+static int lhBloomAddKey(lhash_kv_engine *pEngine,lhcell *pCell,SyBlob *pWorker)
+{
+	const void *pKey = lhCellKey(pCell);
+	int rc;
+	if( pKey == 0 ){
+		/* Overflow key */
+		SyBlobReset(pWorker);
+		rc = lhConsumeCellkey(pCell,unqliteDataConsumer,pWorker,0);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pKey = SyBlobData(pWorker);
+	}
+	return lhBloomProbe(pEngine,pKey,(sxu32)pCell->nKey,1);
+}
+/*
+ * Build the Bloom filter of the stored keys with nBitsPerKey bits per key,
+ * drop the filter when nBitsPerKey is zero. The number of keys indexed is
+ * stored in *pKeys.
+ */
+static int lhBloomRebuild(lhash_kv_engine *pEngine,int nBitsPerKey,unqlite_int64 *pKeys)
+{
+	pgno nPerPage = (pgno)(pEngine->iPageSize / L_HASH_BLOOM_BLOCK);
+	unqlite_page *pRoot,*pDir,*pRaw;
+	pgno nKey,nBlock,nPage,n;
+	sxu32 nBase,nEntry;
+	sxu16 iLink;
+	SyBlob sWorker;
+	int rc;
+	if( pKeys ){
+		*pKeys = 0;
+	}
+	if( pEngine->pIo->xReadOnly(pEngine->pIo->pHandle) ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only database");
+		return UNQLITE_READ_ONLY;
+	}
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Discard the previous filter */
+	rc = lhBloomRelease(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( nBitsPerKey <= 0 ){
+		return pEngine->bBloomRec ? lhBloomRegister(pEngine,0) : UNQLITE_OK;
+	}
+	/* Size the filter */
+	rc = lhBloomWalkKeys(pEngine,lhBloomCountKey,0);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	nKey = pEngine->nBloomKey;
+	nBlock = (nKey * (pgno)nBitsPerKey + L_HASH_BLOOM_BLOCK * 8 - 1) / (L_HASH_BLOOM_BLOCK * 8);
+	if( nBlock < 1 ){
+		nBlock = 1;
+	}
+	nPage = (nBlock + nPerPage - 1) / nPerPage;
+	pEngine->aBloomPage = (pgno *)SyMemBackendAlloc(&pEngine->sAllocator,(sxu32)(nPage * sizeof(pgno)));
+	if( pEngine->aBloomPage == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	/* Root page, directory and data pages */
+	rc = lhBloomNewPage(pEngine,&pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianPack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+4],nBlock);
+	SyBigEndianPack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+4+8],nKey);
+	pDir = pRoot;
+	iLink = L_HASH_PAGE_HDR_SZ;
+	nBase = L_HASH_BLOOM_ROOT_HDR;
+	nEntry = 0;
+	for( n = 0 ; n < nPage && rc == UNQLITE_OK ; ++n ){
+		if( nBase + (nEntry + 1) * 8 > (sxu32)pEngine->iPageSize ){
+			/* Chain a new directory page */
+			rc = lhBloomNewPage(pEngine,&pRaw);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			SyBigEndianPack64(&pDir->zData[iLink],pRaw->iPage);
+			SyBigEndianPack32(&pDir->zData[iLink + 8],nEntry);
+			if( pDir != pRoot ){
+				pEngine->pIo->xPageUnref(pDir);
+			}
+			pDir = pRaw;
+			iLink = 0;
+			nBase = L_HASH_BLOOM_DIR_HDR;
+			nEntry = 0;
+		}
+		rc = lhBloomNewPage(pEngine,&pRaw);
+		if( rc == UNQLITE_OK ){
+			pEngine->aBloomPage[n] = pRaw->iPage;
+			SyBigEndianPack64(&pDir->zData[nBase + nEntry * 8],pRaw->iPage);
+			nEntry++;
+			pEngine->pIo->xPageUnref(pRaw);
+		}
+	}
+	SyBigEndianPack32(&pDir->zData[iLink + 8],nEntry);
+	if( pDir != pRoot ){
+		pEngine->pIo->xPageUnref(pDir);
+	}
+	if( rc == UNQLITE_OK ){
+		pEngine->nBloomPage = nPage;
+		pEngine->nBloomBlock = nBlock;
+		rc = lhBloomRegister(pEngine,pRoot->iPage);
+	}
+	pEngine->pIo->xPageUnref(pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Index the keys */
+	SyBlobInit(&sWorker,&pEngine->sAllocator);
+	rc = lhBloomWalkKeys(pEngine,lhBloomAddKey,&sWorker);
+	SyBlobRelease(&sWorker);
+	if( rc == UNQLITE_OK && pKeys ){
+		*pKeys = (unqlite_int64)nKey;
+	}
+	return rc;
+}
+/*
+ * Configure the value log: values of at least nThreshold bytes are appended
+ * to the log (zero keep the new values in the cells) and a new segment is
+ * started once the active one reach nSegment bytes. A negative argument
+ * leaves the setting unchanged. The value log is created on first use.
+ */
+static int lhVlogConfigure(lhash_kv_engine *pEngine,unqlite_int64 nThreshold,unqlite_int64 nSegment)
+{
+	lhash_vlog_file *pFile;
+	unqlite_page *pRoot;
+	int rc;
+	if( pEngine->pIo->xReadOnly(pEngine->pIo->pHandle) ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only database");
+		return UNQLITE_READ_ONLY;
+	}
+	if( nSegment == 0 ){
+		return UNQLITE_INVALID;
+	}
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pEngine->iVlog == 0 ){
+		if( nThreshold <= 0 ){
+			/* Values stay in the cells, nothing to create */
+			return UNQLITE_OK;
+		}
+		/* Make sure the segments can be created next to the database */
+		rc = lhVlogFile(pEngine,1,1,&pFile);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = lhMapLoadAll(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		/* Empty bucket header and the first segment */
+		rc = lhBloomNewPage(pEngine,&pRoot);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianPack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8],L_HASH_VLOG_SEGMENT);
+		SyBigEndianPack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8],2);
+		SyBigEndianPack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],1);
+		SyBigEndianPack32(L_HASH_VLOG_ENTRY(pRoot,0),1);
+		rc = lhMapRegisterRoot(pEngine,L_HASH_VLOG_LOGIC,pRoot->iPage,&pEngine->bVlogRec);
+		if( rc != UNQLITE_OK ){
+			pEngine->pIo->xPageUnref(pRoot);
+			return rc;
+		}
+		pEngine->iVlog = pRoot->iPage;
+	}else{
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pRoot);
+		if( rc != UNQLITE_OK ){
+			pEngine->pIo->xPageUnref(pRoot);
+			return rc;
+		}
+	}
+	if( nThreshold >= 0 ){
+		SyBigEndianPack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ],(sxu64)nThreshold);
+	}
+	if( nSegment > 0 ){
+		SyBigEndianPack64(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8],(sxu64)nSegment);
+	}
+	pEngine->pIo->xPageUnref(pRoot);
+	return UNQLITE_OK;
+}
+/*
+ * Copy the live records of the segment iSeg (nSize bytes) to the active
+ * segment. A record is live when the cell of its key still point to it.
+ */
+static int lhVlogCollect(lhash_kv_engine *pEngine,sxu32 iSeg,sxu64 nSize)
+{
+	unsigned char zPtr[L_HASH_VLOG_PTR_SZ];
+	lhash_vlog_ptr sPtr,sNew;
+	sxu64 iOfft,nData,nRead;
+	lhash_vlog_file *pFile;
+	unsigned char *zBuf;
+	unqlite_file *pFd;
+	lhcell *pCell;
+	SyBlob sKey;
+	sxu32 nKey;
+	int rc;
+	rc = lhVlogFile(pEngine,iSeg,0,&pFile);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* The file stay open, unlike pFile which move as segments are opened */
+	pFd = pFile->pFd;
+	zBuf = lhVlogBuffer(pEngine);
+	if( zBuf == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	SyBlobInit(&sKey,&pEngine->sAllocator);
+	iOfft = 0;
+	while( iOfft < nSize ){
+		rc = lhVlogReadHeader(pEngine,pFd,iOfft,&nKey,&nData);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		if( iOfft + L_HASH_VLOG_REC_HDR + nKey + nData > nSize ){
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Corrupt value log record");
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		/* Read the key */
+		SyBlobReset(&sKey);
+		for( nRead = 0 ; nRead < nKey && rc == UNQLITE_OK ; nRead += L_HASH_VLOG_CHUNK ){
+			sxu64 nLen = nKey - nRead > L_HASH_VLOG_CHUNK ? L_HASH_VLOG_CHUNK : nKey - nRead;
+			rc = unqliteOsRead(pFd,zBuf,(unqlite_int64)nLen,(unqlite_int64)(iOfft + L_HASH_VLOG_REC_HDR + nRead));
+			if( rc == UNQLITE_OK ){
+				rc = SyBlobAppend(&sKey,(const void *)zBuf,(sxu32)nLen);
+			}
+		}
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		/* Is the record still referenced */
+		rc = lhRecordLookup(pEngine,SyBlobData(&sKey),nKey,&pCell);
+		if( rc == UNQLITE_OK && pCell->bVlog ){
+			rc = lhCellVlogPtr(pCell,&sPtr);
+			if( rc == UNQLITE_OK && sPtr.iSeg == iSeg && sPtr.iOfft == iOfft ){
+				/* Live record, move it to the active segment */
+				rc = lhVlogAppend(pEngine,SyBlobData(&sKey),nKey,&sPtr,0,0,&sNew);
+				if( rc == UNQLITE_OK ){
+					lhVlogPackPtr(&sNew,zPtr);
+					rc = lhRecordOverwrite(pCell,(const void *)zPtr,L_HASH_VLOG_PTR_SZ);
+				}
+				if( rc == UNQLITE_OK ){
+					rc = lhCellSetVlog(pCell,1);
+				}
+			}
+		}else if( rc == UNQLITE_NOTFOUND ){
+			/* Dead record */
+			rc = UNQLITE_OK;
+		}
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		iOfft += L_HASH_VLOG_REC_HDR + nKey + nData;
+	}
+	SyBlobRelease(&sKey);
+	return rc;
+}
+/*
+ * Value log garbage collection. The segments with at least nMinDead percent
+ * of dead bytes are deleted once the transaction commits, their live
+ * records are copied to the active segment first. The number of bytes
+ * reclaimed is stored in *pReclaimed.
+ */
+static int lhVlogGc(lhash_kv_engine *pEngine,int nMinDead,unqlite_int64 *pReclaimed)
+{
+	sxu64 nSize,nDead,nReclaimed = 0;
+	sxu32 nEntry,iNext,iSeg,n,i;
+	unsigned char *zEntry;
+	unqlite_page *pRoot;
+	char zSuffix[64];
+	sxu32 *aSeg;
+	SySet sSeg;
+	int rc;
+	if( pReclaimed ){
+		*pReclaimed = 0;
+	}
+	if( pEngine->pIo->xReadOnly(pEngine->pIo->pHandle) ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only database");
+		return UNQLITE_READ_ONLY;
+	}
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pEngine->iVlog == 0 ){
+		/* No value log */
+		return UNQLITE_OK;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Collect the candidates first, the copies may start new segments */
+	SySetInit(&sSeg,&pEngine->sAllocator,sizeof(sxu32));
+	SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8],&iNext);
+	SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],&nEntry);
+	for( n = 0 ; n < nEntry ; ++n ){
+		zEntry = L_HASH_VLOG_ENTRY(pRoot,n);
+		SyBigEndianUnpack32(zEntry,&iSeg);
+		SyBigEndianUnpack64(&zEntry[4],&nSize);
+		SyBigEndianUnpack64(&zEntry[4+8],&nDead);
+		if( nSize > 0 ? nDead * 100 < nSize * (sxu64)nMinDead : n + 1 >= nEntry ){
+			/* Mostly live or empty active segment */
+			continue;
+		}
+		if( n + 1 >= nEntry ){
+			/* Active segment, start a new one so that it can be collected */
+			if( L_HASH_VLOG_ROOT_HDR + (nEntry + 1) * L_HASH_VLOG_ENTRY_SZ > (sxu32)pEngine->iPageSize ){
+				continue;
+			}
+			rc = pEngine->pIo->xWrite(pRoot);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			zEntry = L_HASH_VLOG_ENTRY(pRoot,nEntry);
+			SyBigEndianPack32(zEntry,iNext);
+			SyBigEndianPack64(&zEntry[4],0);
+			SyBigEndianPack64(&zEntry[4+8],0);
+			SyBigEndianPack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8],iNext + 1);
+			SyBigEndianPack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],nEntry + 1);
+		}
+		if( SXRET_OK != SySetPut(&sSeg,(const void *)&iSeg) ){
+			rc = UNQLITE_NOMEM;
+			break;
+		}
+	}
+	pEngine->pIo->xPageUnref(pRoot);
+	aSeg = (sxu32 *)SySetBasePtr(&sSeg);
+	for( i = 0 ; i < SySetUsed(&sSeg) && rc == UNQLITE_OK ; ++i ){
+		/* Size of the candidate, it is no longer appended to */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],&nEntry);
+		nSize = 0;
+		for( n = 0 ; n < nEntry ; ++n ){
+			SyBigEndianUnpack32(L_HASH_VLOG_ENTRY(pRoot,n),&iSeg);
+			if( iSeg == aSeg[i] ){
+				SyBigEndianUnpack64(&L_HASH_VLOG_ENTRY(pRoot,n)[4],&nSize);
+				break;
+			}
+		}
+		pEngine->pIo->xPageUnref(pRoot);
+		if( n >= nEntry ){
+			continue;
+		}
+		rc = lhVlogCollect(pEngine,aSeg[i],nSize);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		/* Remove the segment from the table */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		rc = pEngine->pIo->xWrite(pRoot);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],&nEntry);
+			for( n = 0 ; n < nEntry ; ++n ){
+				SyBigEndianUnpack32(L_HASH_VLOG_ENTRY(pRoot,n),&iSeg);
+				if( iSeg == aSeg[i] ){
+					break;
+				}
+			}
+			for( ; n + 1 < nEntry ; ++n ){
+				SyMemcpy((const void *)L_HASH_VLOG_ENTRY(pRoot,n + 1),(void *)L_HASH_VLOG_ENTRY(pRoot,n),L_HASH_VLOG_ENTRY_SZ);
+			}
+			SyBigEndianPack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],nEntry - 1);
+		}
+		pEngine->pIo->xPageUnref(pRoot);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		/* The file is deleted once the transaction commits */
+		lhVlogCloseFile(pEngine,aSeg[i]);
+		lhVlogSuffix(aSeg[i],zSuffix,sizeof(zSuffix));
+		rc = pEngine->pIo->xDropFile(pEngine->pIo->pHandle,zSuffix);
+		nReclaimed += nSize;
+	}
+	SySetRelease(&sSeg);
+	if( rc == UNQLITE_OK && pReclaimed ){
+		*pReclaimed = (unqlite_int64)nReclaimed;
+	}
+	return rc;
+}
+/*
+ * Invoke xFile with the suffix and the size in use of each value log
+ * segment so that the caller (The online backup) can copy them.
+ */
+static int lhVlogList(lhash_kv_engine *pEngine,int (*xFile)(void *,const char *,unqlite_int64),void *pUserData)
+{
+	sxu32 nEntry,iSeg,n;
+	unsigned char *zEntry;
+	unqlite_page *pRoot;
+	char zSuffix[64];
+	sxu64 nSize;
+	int rc;
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pEngine->iVlog == 0 ){
+		/* No value log */
+		return UNQLITE_OK;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iVlog,&pRoot);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack32(&pRoot->zData[L_HASH_PAGE_HDR_SZ+8+8+4],&nEntry);
+	if( L_HASH_VLOG_ROOT_HDR + nEntry * L_HASH_VLOG_ENTRY_SZ > (sxu32)pEngine->iPageSize ){
+		pEngine->pIo->xPageUnref(pRoot);
+		return UNQLITE_CORRUPT;
+	}
+	for( n = 0 ; n < nEntry ; ++n ){
+		zEntry = L_HASH_VLOG_ENTRY(pRoot,n);
+		SyBigEndianUnpack32(zEntry,&iSeg);
+		SyBigEndianUnpack64(&zEntry[4],&nSize);
+		lhVlogSuffix(iSeg,zSuffix,sizeof(zSuffix));
+		rc = xFile(pUserData,zSuffix,(unqlite_int64)nSize);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+	}
+	pEngine->pIo->xPageUnref(pRoot);
+	return rc;
+}
+/*
+ * Pages handed to the pager per read ahead request while warming up the cache.
+ */
+#define L_HASH_WARMUP_BATCH 64
+/*
+ * Load the whole bucket map and the bucket pages (Every page of the
+ * database image if bAll is set) into the page cache with large reads.
+ * *pPages is set to the number of pages requested.
+ */
+static int lhWarmup(lhash_kv_engine *pEngine,int bAll,unqlite_int64 *pPages)
+{
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	pgno aPage[L_HASH_WARMUP_BATCH];
+	pgno iNum,nDbSize,nBucket;
+	sxu64 nTotal = 0;
+	lhash_bmap_rec *pRec;
+	int nPage = 0;
+	int rc;
+	if( pPages ){
+		*pPages = 0;
+	}
+	nDbSize = pIo->xDbSize(pIo->pHandle);
+	if( nDbSize < 2 ){
+		/* Empty database */
+		return UNQLITE_OK;
+	}
+	/* Acquire the first page so that the header gets loaded */
+	rc = pIo->xGet(pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pIo->xPrefetch == 0 ){
+		return UNQLITE_OK;
+	}
+	if( bAll ){
+		/* Every page, in order */
+		for( iNum = 2 ; iNum < nDbSize ; ++iNum ){
+			aPage[nPage++] = iNum;
+			if( nPage >= L_HASH_WARMUP_BATCH ){
+				pIo->xPrefetch(pIo->pHandle,aPage,nPage,1);
+				nTotal += nPage;
+				nPage = 0;
+			}
+		}
+	}
+	/* The bucket map pages */
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( !bAll ){
+		/* Primary bucket pages */
+		nBucket = (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK;
+		for( iNum = 0 ; iNum < nBucket ; ++iNum ){
+			pRec = lhMapFindBucket(pEngine,iNum);
+			if( pRec == 0 ){
+				continue;
+			}
+			aPage[nPage++] = pRec->iReal;
+			if( nPage >= L_HASH_WARMUP_BATCH ){
+				pIo->xPrefetch(pIo->pHandle,aPage,nPage,1);
+				nTotal += nPage;
+				nPage = 0;
+			}
+		}
+	}
+	if( nPage > 0 ){
+		pIo->xPrefetch(pIo->pHandle,aPage,nPage,1);
+		nTotal += nPage;
+	}
+	if( pPages ){
+		*pPages = (unqlite_int64)nTotal;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Turn deferred bucket splits on or off. The setting is stored in the
+ * database header so that it survive a reopen of the database.
+ */
+static int lhSetDeferSplit(lhash_kv_engine *pEngine,int bDefer)
+{
+	int rc;
+	if( pEngine->pIo->xReadOnly(pEngine->pIo->pHandle) ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only database");
+		return UNQLITE_READ_ONLY;
+	}
+	/* Acquire the first page (DB hash Header) so that everything gets loaded automatically */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	bDefer = bDefer ? 1 : 0;
+	if( pEngine->bDeferSplit == bDefer ){
+		return UNQLITE_OK;
+	}
+	rc = pEngine->pIo->xWrite(pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pEngine->bDeferSplit = bDefer;
+	lhWriteFreeList(pEngine);
+	return UNQLITE_OK;
+}
+/*
+ *  Exported: xConfig() method.
+ *  Configure the linear hash KV store.
+ */
+static int lhash_kv_config(unqlite_kv_engine *pEngine,int op,va_list ap)
+{
+	lhash_kv_engine *pHash = (lhash_kv_engine *)pEngine;
+	int rc = UNQLITE_OK;
+	switch(op){
+	case UNQLITE_KV_CONFIG_PRESIZE:
+	case UNQLITE_KV_CONFIG_DEFER_SPLIT:
+	case UNQLITE_KV_CONFIG_MAINTAIN:
+	case UNQLITE_KV_CONFIG_BLOOM_REBUILD:
+	case UNQLITE_KV_CONFIG_VALUE_LOG:
+	case UNQLITE_KV_CONFIG_VALUE_LOG_GC:
+		/* These write to the image, a pending page walk is stale */
+		lhVacuumForget(pHash);
+		break;
+	default:
+		break;
+	}
+	switch(op){
+	case UNQLITE_KV_CONFIG_HASH_FUNC: {
+		/* Default hash function */
+		if( pHash->nBuckRec > 0 ){
+			/* Locked operation */
+			rc = UNQLITE_LOCKED;
+		}else{
+			ProcHash xHash = va_arg(ap,ProcHash);
+			if( xHash ){
+				pHash->xHash = xHash;
+			}
+		}
+		break;
+									  }
+	case UNQLITE_KV_CONFIG_HASH_ID: {
+		/* Built-in hash function of a new database */
+		ProcHash xHash = lhBuiltinHash(va_arg(ap,int));
+		if( xHash == 0 ){
+			rc = UNQLITE_INVALID;
+		}else if( pHash->pHeader && pHash->xHash != xHash ){
+			/* The database header is already written */
+			rc = UNQLITE_LOCKED;
+		}else{
+			pHash->xHash = xHash;
+		}
+		break;
+									}
+	case UNQLITE_KV_CONFIG_CMP_FUNC: {
+		/* Default comparison function */
+		ProcCmp xCmp = va_arg(ap,ProcCmp);
+		if( xCmp ){
+			pHash->xCmp  = xCmp;
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_INTEGRITY_CHECK: {
+		/* Check the whole database image */
+		int nThread = va_arg(ap,int);
+		int (*xReport)(pgno,const char *,void *) = va_arg(ap,int (*)(pgno,const char *,void *));
+		void *pUserData = va_arg(ap,void *);
+		rc = lhIntegrityCheck(pHash,nThread,xReport,pUserData);
+		break;
+											}
+	case UNQLITE_KV_CONFIG_ANALYZE: {
+		/* Report the layout of the database image */
+		int nPercent = va_arg(ap,int);
+		unqlite_kv_analysis *pInfo = va_arg(ap,unqlite_kv_analysis *);
+		if( pInfo == 0 ){
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		rc = lhAnalyze(pHash,nPercent,pInfo);
+		break;
+									}
+	case UNQLITE_KV_CONFIG_PRESIZE: {
+		/* Size the bucket table of an empty database */
+		unqlite_int64 nRecord = va_arg(ap,unqlite_int64);
+		unqlite_int64 nPayload = va_arg(ap,unqlite_int64);
+		if( nRecord < 0 || nPayload < 0 ){
+			rc = UNQLITE_INVALID;
+			break;
+		}
+		rc = lhPresize(pHash,(sxu64)nRecord,(sxu64)nPayload);
+		break;
+									}
+	case UNQLITE_KV_CONFIG_SIDE_FILES: {
+		/* Report the value log segments */
+		int (*xFile)(void *,const char *,unqlite_int64) = va_arg(ap,int (*)(void *,const char *,unqlite_int64));
+		void *pUserData = va_arg(ap,void *);
+		if( xFile == 0 ){
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		rc = lhVlogList(pHash,xFile,pUserData);
+		break;
+									   }
+	case UNQLITE_KV_CONFIG_VACUUM: {
+		/* Compact the database image */
+		int nStep = va_arg(ap,int);
+		unqlite_int64 *pRemaining = va_arg(ap,unqlite_int64 *);
+		rc = lhVacuum(pHash,nStep,pRemaining);
+		break;
+								   }
+	case UNQLITE_KV_CONFIG_DEFER_SPLIT: {
+		/* Defer bucket splits to UNQLITE_KV_CONFIG_MAINTAIN */
+		int bDefer = va_arg(ap,int);
+		rc = lhSetDeferSplit(pHash,bDefer);
+		break;
+										}
+	case UNQLITE_KV_CONFIG_MAINTAIN: {
+		/* Perform the deferred bucket splits */
+		int nStep = va_arg(ap,int);
+		unqlite_int64 *pRemaining = va_arg(ap,unqlite_int64 *);
+		rc = lhMaintain(pHash,nStep,pRemaining);
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_BLOOM_REBUILD: {
+		/* Build (or drop) the Bloom filter of the stored keys */
+		int nBitsPerKey = va_arg(ap,int);
+		unqlite_int64 *pKeys = va_arg(ap,unqlite_int64 *);
+		rc = lhBloomRebuild(pHash,nBitsPerKey,pKeys);
+		break;
+										  }
+	case UNQLITE_KV_CONFIG_VALUE_LOG: {
+		/* Value log threshold and segment size */
+		unqlite_int64 nThreshold = va_arg(ap,unqlite_int64);
+		unqlite_int64 nSegment = va_arg(ap,unqlite_int64);
+		rc = lhVlogConfigure(pHash,nThreshold,nSegment);
+		break;
+									  }
+	case UNQLITE_KV_CONFIG_VALUE_LOG_GC: {
+		/* Reclaim the value log segments */
+		int nMinDead = va_arg(ap,int);
+		unqlite_int64 *pReclaimed = va_arg(ap,unqlite_int64 *);
+		rc = lhVlogGc(pHash,nMinDead,pReclaimed);
+		break;
+										 }
+	case UNQLITE_KV_CONFIG_COMPRESS: {
+		/* Compression of the values stored from now on */
+		int iCodec = va_arg(ap,int);
+		unqlite_int64 nMin = va_arg(ap,unqlite_int64);
+		if( (iCodec != UNQLITE_KV_COMPRESS_NONE && iCodec != UNQLITE_KV_COMPRESS_LZ) || nMin < 0 ){
+			rc = UNQLITE_INVALID;
+		}else{
+			pHash->sKeep.iLzCodec = iCodec;
+			pHash->sKeep.nLzMin = (sxu64)nMin;
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_WARMUP: {
+		/* Load the hot part of the database into the page cache */
+		int bAll = va_arg(ap,int);
+		unqlite_int64 *pPages = va_arg(ap,unqlite_int64 *);
+		rc = lhWarmup(pHash,bAll,pPages);
+		break;
+								   }
+	case UNQLITE_KV_CONFIG_STATS: {
+		/* Engine counters */
+		unqlite_kv_stats *pStats = va_arg(ap,unqlite_kv_stats *);
+		int bReset = va_arg(ap,int);
+		if( pStats ){
+			SyMemcpy((const void *)&pHash->sKeep.sStats,(void *)pStats,sizeof(unqlite_kv_stats));
+			pStats->nMemUsed = (unqlite_int64)SyMemBackendUsage(&pHash->sAllocator);
+		}
+		if( bReset ){
+			SyZero(&pHash->sKeep.sStats,sizeof(unqlite_kv_stats));
+		}
+		break;
+								  }
+	case UNQLITE_KV_CONFIG_FREE_PAGES: {
+		/* Number of pages on the free list */
+		unqlite_int64 *pCount = va_arg(ap,unqlite_int64 *);
+		int *pPageSize = va_arg(ap,int *);
+		*pCount = 0;
+		if( pPageSize ){
+			*pPageSize = pHash->iPageSize;
+		}
+		if( pHash->pIo->xDbSize(pHash->pIo->pHandle) > 1 ){
+			/* Acquire the first page so that the header gets loaded */
+			rc = pHash->pIo->xGet(pHash->pIo->pHandle,1,&pHash->pHeader);
+			if( rc == UNQLITE_OK ){
+				*pCount = (unqlite_int64)pHash->nFreePage;
+			}
+		}
+		break;
+									   }
+	default:
+		/* Unknown OP */
+		rc = UNQLITE_UNKNOWN;
+		break;
+	}
+	return rc;
+}
+/*
+ * Each public cursor is identified by an instance of this structure.
+ */
+typedef struct lhash_kv_cursor lhash_kv_cursor;
+struct lhash_kv_cursor
+{
+	unqlite_kv_engine *pStore; /* Must be first */
+	/* Private fields */
+	int iState;           /* Current state of the cursor */
+	int is_first;         /* True to read the database header */
+	lhcell *pCell;        /* Current cell we are processing */
+	unqlite_page *pRaw;   /* Raw disk page */
+	pgno iBucket;         /* Next logical bucket to visit (Previous one + 1 when moving backward) */
+	pgno iAhead;          /* First logical bucket past the pages read ahead so far */
+	sxu32 nSeq;           /* Bucket pages visited in a row by a forward scan */
+};
+/* 
+ * Possible state of the cursor
+ */
+#define L_HASH_CURSOR_STATE_NEXT_PAGE 1 /* Next page in the list */
+#define L_HASH_CURSOR_STATE_CELL      2 /* Processing Cell */
+#define L_HASH_CURSOR_STATE_DONE      3 /* Cursor does not point to anything */
+/*
+ * Forward scans read ahead L_HASH_READAHEAD bucket pages at a time once
+ * L_HASH_READAHEAD_MIN pages were visited in a row.
+ */
+#define L_HASH_READAHEAD     32
+#define L_HASH_READAHEAD_MIN 2
+/*
+ * Initialize the cursor.
+ */
+static void lhInitCursor(unqlite_kv_cursor *pPtr)
+{
+	 lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
+	 /* Init */
+	 pCur->iState = L_HASH_CURSOR_STATE_NEXT_PAGE;
+	 pCur->pCell = 0;
+	 pCur->iBucket = 0;
+	 pCur->iAhead = 0;
+	 pCur->nSeq = 0;
+	 pCur->pRaw = 0;
+	 pCur->is_first = 1;
+}
+/*
+ * Collect the real page numbers of up to L_HASH_READAHEAD buckets starting
+ * at the logical bucket *piLogic. *piLogic is advanced past the last
+ * bucket collected.
+ */
+static int lhCursorCollect(lhash_kv_engine *pEngine,pgno *piLogic,pgno *aPage)
+{
+	pgno nBucket = (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK;
+	lhash_bmap_rec *pRec;
+	pgno iLogic = *piLogic;
+	int nPage = 0;
+	while( nPage < L_HASH_READAHEAD && iLogic < nBucket ){
+		pRec = lhMapFindBucket(pEngine,iLogic++);
+		if( pRec ){
+			aPage[nPage++] = pRec->iReal;
+		}
+	}
+	*piLogic = iLogic;
+	return nPage;
+}
+/*
+ * Sequential scan: load the bucket pages starting at iLogic into the page
+ * cache with batched reads and ask the OS to read the following window in
+ * the background so that it is ready when the cursor get there.
+ */
+static void lhCursorReadAhead(lhash_kv_cursor *pCur,pgno iLogic)
+{
+	lhash_kv_engine *pEngine = (lhash_kv_engine *)pCur->pStore;
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	pgno aPage[L_HASH_READAHEAD];
+	int nPage;
+	if( pIo->xPrefetch == 0 ){
+		return;
+	}
+	/* Current window */
+	nPage = lhCursorCollect(pEngine,&iLogic,aPage);
+	if( nPage > 0 ){
+		pIo->xPrefetch(pIo->pHandle,aPage,nPage,1);
+	}
+	pCur->iAhead = iLogic;
+	/* Next window, hint only */
+	nPage = lhCursorCollect(pEngine,&iLogic,aPage);
+	if( nPage > 0 ){
+		pIo->xPrefetch(pIo->pHandle,aPage,nPage,0);
+	}
+}
+/*
+ * Point to the next page on the database.
+ */
+static int lhCursorNextPage(lhash_kv_cursor *pPtr)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
+	lhash_kv_engine *pEngine = (lhash_kv_engine *)pCur->pStore;
+	lhash_bmap_rec *pRec;
+	lhpage *pPage;
+	int rc;
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	for(;;){
+		if( pCur->iBucket >= (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK ){
+			pCur->iState = L_HASH_CURSOR_STATE_DONE;
+			return UNQLITE_DONE;
+		}
+		/* Advance the map cursor */
+		pRec = lhMapFindBucket(pEngine,pCur->iBucket++);
+		if( pRec == 0 ){
+			continue;
+		}
+		if( pPtr->iState == L_HASH_CURSOR_STATE_CELL && pPtr->pRaw ){
+			/* Unref this page */
+			pCur->pStore->pIo->xPageUnref(pPtr->pRaw);
+			pPtr->pRaw = 0;
+		}
+		if( ++pCur->nSeq >= L_HASH_READAHEAD_MIN && pCur->iBucket > pCur->iAhead ){
+			/* Sequential scan past the pages read ahead so far */
+			lhCursorReadAhead(pCur,pCur->iBucket - 1);
+		}
+		/* Load the next page on the list */
+		rc = lhLoadPage((lhash_kv_engine *)pCur->pStore,pRec->iReal,0,&pPage,0);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( pPage->pList ){
+			/* Reflect the change */
+			pCur->pCell = pPage->pList;
+			pCur->iState = L_HASH_CURSOR_STATE_CELL;
+			pCur->pRaw = pPage->pRaw;
+			break;
+		}
+		/* Empty page, discard this page and continue */
+		pPage->pHash->pIo->xPageUnref(pPage->pRaw);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Point to the previous page on the database.
+ */
+static int lhCursorPrevPage(lhash_kv_cursor *pPtr)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
+	lhash_kv_engine *pEngine = (lhash_kv_engine *)pCur->pStore;
+	lhash_bmap_rec *pRec;
+	lhpage *pPage;
+	int rc;
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	for(;;){
+		if( pCur->iBucket < 1 ){
+			pCur->iState = L_HASH_CURSOR_STATE_DONE;
+			return UNQLITE_DONE;
+		}
+		/* Advance the map cursor */
+		pRec = lhMapFindBucket(pEngine,--pCur->iBucket);
+		if( pRec == 0 ){
+			continue;
+		}
+		if( pPtr->iState == L_HASH_CURSOR_STATE_CELL && pPtr->pRaw ){
+			/* Unref this page */
+			pCur->pStore->pIo->xPageUnref(pPtr->pRaw);
+			pPtr->pRaw = 0;
+		}
+		/* Load the previous page on the list */
+		rc = lhLoadPage((lhash_kv_engine *)pCur->pStore,pRec->iReal,0,&pPage,0);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( pPage->pFirst ){
+			/* Reflect the change */
+			pCur->pCell = pPage->pFirst;
+			pCur->iState = L_HASH_CURSOR_STATE_CELL;
+			pCur->pRaw = pPage->pRaw;
+			break;
+		}
+		/* Discard this page and continue */
+		pPage->pHash->pIo->xPageUnref(pPage->pRaw);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Is a valid cursor.
+ */
+static int lhCursorValid(unqlite_kv_cursor *pPtr)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pPtr;
+	return (pCur->iState == L_HASH_CURSOR_STATE_CELL) && pCur->pCell;
+}
+/*
+ * Point to the first record.
+ */
+static int lhCursorFirst(unqlite_kv_cursor *pCursor)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	lhash_kv_engine *pEngine = (lhash_kv_engine *)pCursor->pStore;
+	int rc;
+	if( pCur->is_first ){
+		/* Read the database header first */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pCur->is_first = 0;
+	}
+	/* Point to the first logical bucket */
+	pCur->iBucket = 0;
+	pCur->iAhead = 0;
+	pCur->nSeq = 0;
+	/* Load the cells */
+	rc = lhCursorNextPage(pCur);
+	return rc;
+}
+/*
+ * Point to the last record.
+ */
+static int lhCursorLast(unqlite_kv_cursor *pCursor)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	lhash_kv_engine *pEngine = (lhash_kv_engine *)pCursor->pStore;
+	int rc;
+	if( pCur->is_first ){
+		/* Read the database header first */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pEngine->pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pCur->is_first = 0;
+	}
+	/* Point past the last logical bucket */
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pCur->iBucket = (pgno)pEngine->nBuckSize * L_HASH_MAP_CHUNK;
+	pCur->nSeq = 0;
+	/* Load the cells */
+	rc = lhCursorPrevPage(pCur);
+	return rc;
+}
+/*
+ * Reset the cursor.
+ */
+static void lhCursorReset(unqlite_kv_cursor *pCursor)
+{
+	lhCursorFirst(pCursor);
+}
+/*
+ * Point to the next record.
+ */
+static int lhCursorNext(unqlite_kv_cursor *pCursor)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	lhcell *pCell;
+	int rc;
+	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 ){
 		/* Load the cells of the next page  */
 		rc = lhCursorNextPage(pCur);
 		return rc;
@@ -51648,6 +56891,27 @@ static int lhCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
 	}
 	/* Point to the target cell */
 	pCell = pCur->pCell;
+	if( pCell->bLz ){
+		sxu64 nLen;
+		int rc;
+		/* Length of the original value */
+		rc = lhLzValueLength(pCell,&nLen);
+		if( rc == UNQLITE_OK ){
+			*pLen = (unqlite_int64)nLen;
+		}
+		return rc;
+	}
+	if( pCell->bVlog ){
+		lhash_vlog_ptr sPtr;
+		int rc;
+		/* Length of the value in the log */
+		rc = lhCellVlogPtr(pCell,&sPtr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		*pLen = (unqlite_int64)sPtr.nData;
+		return UNQLITE_OK;
+	}
 	/* Return data length */
 	*pLen = (unqlite_int64)pCell->nData;
 	return UNQLITE_OK;
@@ -51666,11 +56930,11 @@ static int lhCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,
 	}
 	/* Point to the target cell */
 	pCell = pCur->pCell;
-	if( SyBlobLength(&pCell->sKey) > 0 ){
+	if( lhCellKey(pCell) ){
 		/* Consume the key directly */
-		rc = xConsumer(SyBlobData(&pCell->sKey),SyBlobLength(&pCell->sKey),pUserData);
+		rc = xConsumer(lhCellKey(pCell),pCell->nKey,pUserData);
 	}else{
-		/* Very large key */
+		/* Overflow key */
 		rc = lhConsumeCellkey(pCell,xConsumer,pUserData,0);
 	}
 	return rc;
@@ -51689,10 +56953,50 @@ static int lhCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *
 	}
 	/* Point to the target cell */
 	pCell = pCur->pCell;
+	if( pCell->bLz ){
+		const unsigned char *zData;
+		sxu64 nData;
+		/* Consume the decompressed value */
+		rc = lhLzInflate(pCell,&zData,&nData);
+		if( rc == UNQLITE_OK ){
+			rc = xConsumer((const void *)zData,(unsigned int)nData,pUserData);
+			if( rc != UNQLITE_OK ){
+				rc = UNQLITE_ABORT;
+			}
+		}
+		return rc;
+	}
 	/* Consume the data */
-	rc = lhConsumeCellData(pCell,xConsumer,pUserData);
+	rc = lhConsumeCellValue(pCell,xConsumer,pUserData);
 	return rc;
 }
+/*
+ * Consume a range of the data.
+ */
+static int lhCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nByte,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 ){
+		/* Invalid state */
+		return UNQLITE_INVALID;
+	}
+	if( pCur->pCell->bLz ){
+		const unsigned char *zData;
+		sxu64 nData;
+		int rc;
+		/* Slice of the decompressed value */
+		rc = lhLzInflate(pCur->pCell,&zData,&nData);
+		if( rc != UNQLITE_OK || (sxu64)iOfft >= nData ){
+			return rc;
+		}
+		if( (sxu64)nByte > nData - (sxu64)iOfft ){
+			nByte = (unqlite_int64)(nData - (sxu64)iOfft);
+		}
+		rc = xConsumer((const void *)&zData[iOfft],(unsigned int)nByte,pUserData);
+		return rc != UNQLITE_OK ? UNQLITE_ABORT : UNQLITE_OK;
+	}
+	return lhConsumeCellRange(pCur->pCell,(sxu64)iOfft,(sxu64)nByte,xConsumer,pUserData);
+}
 /*
  * Find a partiuclar record.
  */
@@ -51700,6 +57004,8 @@ static int lhCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nByte,in
 {
 	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
 	int rc;
+	/* Random access, not a sequential scan */
+	pCur->nSeq = 0;
 	/* Perform a lookup */
 	rc = lhRecordLookup((lhash_kv_engine *)pCur->pStore,pKey,nByte,&pCur->pCell);
 	if( rc != UNQLITE_OK ){
@@ -51727,6 +57033,7 @@ static int lhCursorDelete(unqlite_kv_cursor *pCursor)
 	pCell = pCur->pCell;
 	/* Point to the next entry */
 	pCur->pCell = pCell->pNext;
+	lhVacuumForget(pCell->pPage->pHash);
 	/* Perform the deletion */
 	rc = lhRecordRemove(pCell);
 	return rc;
@@ -51760,7 +57067,8 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void)
 		lhCursorDataLength,         /* xDataLength */
 		lhCursorData,               /* xData */
 		lhCursorReset,              /* xReset */
-		0                           /* xRelease */                        
+		0,                          /* xRelease */
+		lhCursorDataRange           /* xDataRange */
 	};
 	return &sDiskStore;
 }
@@ -52295,6 +57603,111 @@ static int MemHashConfigure(unqlite_kv_engine *pKvEngine,int iOp,va_list ap)
 		}
 		break;
 									 }
+	case UNQLITE_KV_CONFIG_INTEGRITY_CHECK:
+		/* Nothing stored on disk, nothing to check */
+		break;
+	case UNQLITE_KV_CONFIG_ANALYZE:
+		/* No page layout to report */
+		rc = UNQLITE_NOTIMPLEMENTED;
+		break;
+	case UNQLITE_KV_CONFIG_PRESIZE:
+		/* The table grows with the records */
+		(void)va_arg(ap,unqlite_int64);
+		(void)va_arg(ap,unqlite_int64);
+		break;
+	case UNQLITE_KV_CONFIG_SIDE_FILES:
+		/* Everything lives in memory */
+		(void)va_arg(ap,int (*)(void *,const char *,unqlite_int64));
+		(void)va_arg(ap,void *);
+		break;
+	case UNQLITE_KV_CONFIG_VACUUM: {
+		/* Nothing stored on disk, nothing to compact */
+		unqlite_int64 *pRemaining;
+		(void)va_arg(ap,int);
+		pRemaining = va_arg(ap,unqlite_int64 *);
+		if( pRemaining ){
+			*pRemaining = 0;
+		}
+		break;
+								   }
+	case UNQLITE_KV_CONFIG_DEFER_SPLIT:
+		/* Buckets are never split on disk */
+		(void)va_arg(ap,int);
+		break;
+	case UNQLITE_KV_CONFIG_HASH_ID:
+		/* Nothing stored on disk, keep the default hash function */
+		(void)va_arg(ap,int);
+		break;
+	case UNQLITE_KV_CONFIG_MAINTAIN: {
+		/* Nothing deferred */
+		unqlite_int64 *pRemaining;
+		(void)va_arg(ap,int);
+		pRemaining = va_arg(ap,unqlite_int64 *);
+		if( pRemaining ){
+			*pRemaining = 0;
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_BLOOM_REBUILD: {
+		/* Lookups never touch the disk */
+		unqlite_int64 *pKeys;
+		(void)va_arg(ap,int);
+		pKeys = va_arg(ap,unqlite_int64 *);
+		if( pKeys ){
+			*pKeys = 0;
+		}
+		break;
+										  }
+	case UNQLITE_KV_CONFIG_VALUE_LOG:
+		/* Values are kept in memory */
+		(void)va_arg(ap,unqlite_int64);
+		(void)va_arg(ap,unqlite_int64);
+		break;
+	case UNQLITE_KV_CONFIG_COMPRESS:
+		/* Values are kept as is */
+		(void)va_arg(ap,int);
+		(void)va_arg(ap,unqlite_int64);
+		break;
+	case UNQLITE_KV_CONFIG_VALUE_LOG_GC: {
+		/* Nothing to reclaim */
+		unqlite_int64 *pReclaimed;
+		(void)va_arg(ap,int);
+		pReclaimed = va_arg(ap,unqlite_int64 *);
+		if( pReclaimed ){
+			*pReclaimed = 0;
+		}
+		break;
+										 }
+	case UNQLITE_KV_CONFIG_WARMUP: {
+		/* Everything is already in memory */
+		unqlite_int64 *pPages;
+		(void)va_arg(ap,int);
+		pPages = va_arg(ap,unqlite_int64 *);
+		if( pPages ){
+			*pPages = 0;
+		}
+		break;
+								   }
+	case UNQLITE_KV_CONFIG_STATS: {
+		/* No on-disk structure, only the memory usage is reported */
+		unqlite_kv_stats *pStats = va_arg(ap,unqlite_kv_stats *);
+		(void)va_arg(ap,int);
+		if( pStats ){
+			SyZero(pStats,sizeof(unqlite_kv_stats));
+			pStats->nMemUsed = (unqlite_int64)SyMemBackendUsage(&pEngine->sAlloc);
+		}
+		break;
+								  }
+	case UNQLITE_KV_CONFIG_FREE_PAGES: {
+		/* No free list */
+		unqlite_int64 *pCount = va_arg(ap,unqlite_int64 *);
+		int *pPageSize = va_arg(ap,int *);
+		*pCount = 0;
+		if( pPageSize ){
+			*pPageSize = 0;
+		}
+		break;
+									   }
 	default:
 		/* Unknown configuration option */
 		rc = UNQLITE_UNKNOWN;
@@ -52516,6 +57929,39 @@ UNQLITE_PRIVATE int unqliteOsSectorSize(unqlite_file *id)
   }
   return  UNQLITE_DEFAULT_SECTOR_SIZE;
 }
+UNQLITE_PRIVATE int unqliteOsAdvise(unqlite_file *id, unqlite_int64 iOfst, unqlite_int64 iAmt)
+{
+  if( id->pMethods->iVersion < 2 || id->pMethods->xAdvise == 0 ){
+	  /* Not supported, this is only a hint */
+	  return UNQLITE_OK;
+  }
+  return id->pMethods->xAdvise(id,iOfst,iAmt);
+}
+UNQLITE_PRIVATE int unqliteOsPunchHole(unqlite_file *id, unqlite_int64 iOfst, unqlite_int64 iAmt)
+{
+  if( id->pMethods->iVersion < 3 || id->pMethods->xPunchHole == 0 ){
+	  return UNQLITE_NOTIMPLEMENTED;
+  }
+  return id->pMethods->xPunchHole(id,iOfst,iAmt);
+}
+UNQLITE_PRIVATE int unqliteOsMmap(unqlite_file *id, unqlite_int64 iSize, void **ppMap)
+{
+  if( id->pMethods->iVersion < 4 || id->pMethods->xMmap == 0 || id->pMethods->xUnmap == 0 ){
+	  return UNQLITE_NOTIMPLEMENTED;
+  }
+  return id->pMethods->xMmap(id,iSize,ppMap);
+}
+UNQLITE_PRIVATE void unqliteOsUnmap(unqlite_file *id, void *pMap, unqlite_int64 iSize)
+{
+  id->pMethods->xUnmap(id,pMap,iSize);
+}
+UNQLITE_PRIVATE int unqliteOsReadAt(unqlite_file *id, void *pBuf, unqlite_int64 amt, unqlite_int64 offset)
+{
+  if( id->pMethods->iVersion < 5 || id->pMethods->xReadAt == 0 ){
+	  return UNQLITE_NOTIMPLEMENTED;
+  }
+  return id->pMethods->xReadAt(id,pBuf,amt,offset);
+}
 /*
 ** The next group of routines are convenience wrappers around the
 ** VFS methods.
@@ -53861,11 +59307,96 @@ static int unixSectorSize(unqlite_file *NotUsed){
   return UNQLITE_DEFAULT_SECTOR_SIZE;
 }
 /*
+** Tell the kernel that the given range of the file will be read soon
+** so that it can start reading it in the background.
+*/
+static int unixAdvise(unqlite_file *id, unqlite_int64 iOfst, unqlite_int64 iAmt){
+#if defined(POSIX_FADV_WILLNEED)
+  unixFile *pFile = (unixFile *)id;
+  if( posix_fadvise(pFile->h, (off_t)iOfst, (off_t)iAmt, POSIX_FADV_WILLNEED)!=0 ){
+    return UNQLITE_IOERR;
+  }
+  return UNQLITE_OK;
+#else
+  SXUNUSED(id);
+  SXUNUSED(iOfst);
+  SXUNUSED(iAmt);
+  return UNQLITE_OK;
+#endif
+}
+/*
+** Release the disk blocks backing the given range of the file. The range
+** reads back as zeros and the file size is unchanged. Blocks only partly
+** covered by the range are zeroed instead.
+*/
+static int unixPunchHole(unqlite_file *id, unqlite_int64 iOfst, unqlite_int64 iAmt){
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+  unixFile *pFile = (unixFile *)id;
+  if( fallocate(pFile->h, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, (off_t)iOfst, (off_t)iAmt)!=0 ){
+    return errno==EOPNOTSUPP ? UNQLITE_NOTIMPLEMENTED : UNQLITE_IOERR;
+  }
+  return UNQLITE_OK;
+#else
+  SXUNUSED(id);
+  SXUNUSED(iOfst);
+  SXUNUSED(iAmt);
+  return UNQLITE_NOTIMPLEMENTED;
+#endif
+}
+/*
+** Map the first iSize bytes of the file read-only. The view is taken from
+** the descriptor of the file so that the POSIX locks held on it survive.
+*/
+static int unixMmap(unqlite_file *id, unqlite_int64 iSize, void **ppMap){
+  unixFile *pFile = (unixFile *)id;
+  void *pMap;
+  pMap = mmap(0, (size_t)iSize, PROT_READ, MAP_SHARED, pFile->h, 0);
+  if( pMap==MAP_FAILED ){
+    return UNQLITE_IOERR;
+  }
+  *ppMap = pMap;
+  return UNQLITE_OK;
+}
+/*
+** Release a memory view obtained by unixMmap().
+*/
+static void unixUnmap(unqlite_file *id, void *pMap, unqlite_int64 iSize){
+  SXUNUSED(id);
+  munmap(pMap, (size_t)iSize);
+}
+/*
+** Read data from a file with a positioned read which leaves the file
+** offset alone, so that several threads can read the same descriptor.
+** Unlike unixRead(), lastErrno is not touched.
+*/
+static int unixReadAt(
+  unqlite_file *id, 
+  void *pBuf, 
+  unqlite_int64 amt,
+  unqlite_int64 offset
+){
+  unixFile *pFile = (unixFile *)id;
+  ssize_t got;
+#if defined(USE_PREAD64)
+  got = pread64(pFile->h, pBuf, (size_t)amt, offset);
+#else
+  got = pread(pFile->h, pBuf, (size_t)amt, (off_t)offset);
+#endif
+  if( got==(ssize_t)amt ){
+    return UNQLITE_OK;
+  }
+  if( got>=0 ){
+    /* Unread parts of the buffer must be zero-filled */
+    SyZero(&((char*)pBuf)[got],(sxu32)(amt-got));
+  }
+  return UNQLITE_IOERR;
+}
+/*
 ** This vector defines all the methods that can operate on an
 ** unqlite_file for Windows systems.
 */
 static const unqlite_io_methods unixIoMethod = {
-  1,                              /* iVersion */
+  5,                              /* iVersion */
   unixClose,                       /* xClose */
   unixRead,                        /* xRead */
   unixWrite,                       /* xWrite */
@@ -53876,6 +59407,11 @@ static const unqlite_io_methods unixIoMethod = {
   unixUnlock,                      /* xUnlock */
   unixCheckReservedLock,           /* xCheckReservedLock */
   unixSectorSize,                  /* xSectorSize */
+  unixAdvise,                      /* xAdvise */
+  unixPunchHole,                   /* xPunchHole */
+  unixMmap,                        /* xMmap */
+  unixUnmap,                       /* xUnmap */
+  unixReadAt,                      /* xReadAt */
 };
 /****************************************************************************
 **************************** unqlite_vfs methods ****************************
@@ -55493,6 +61029,23 @@ struct Page {
 #define PAGE_DONT_MAKE_HOT     0x080  /* Dont make this page Hot. In other words,
 									   * do not link it to the hot dirty list.
 									   */
+/*
+ * State of an online backup in progress (See unqlite_backup_init()).
+ * Pages are copied in ascending order. Any page below the copy cursor
+ * that is written to the database file afterwards is written to the
+ * backup file as well. Pages whose copy holds uncommitted changes are
+ * remembered so that they can be copied again from disk on rollback.
+ */
+typedef struct pager_backup pager_backup;
+struct pager_backup
+{
+  unqlite_file *pDest;           /* Destination file */
+  char *zDest;                   /* Destination path, side files are copied next to it */
+  pgno iNext;                    /* Next page to be copied */
+  Bitvec *pTouched;              /* Copied pages modified by the current transaction */
+  SySet aTouched;                /* Same pages as a list (pgno) */
+  int rc;                        /* Sticky IO error while writing to pDest */
+};
 /*
  * Each active database pager is represented by an instance of
  * the following structure.
@@ -55509,7 +61062,8 @@ struct Pager
   pgno dbSize;                   /* Number of pages in the file */
   pgno dbOrigSize;               /* dbSize before the current change */
   sxi64 dbByteSize;              /* Database size in bytes */
-  void *pMmap;                   /* Read-only Memory view (mmap) of the whole file if requested (UNQLITE_OPEN_MMAP). */
+  void *pMmap;                   /* Read-only Memory view (mmap) of the whole file if requested (UNQLITE_OPEN_MMAP). Remapped as the file grow (R/W handles) */
+  sxi64 nMmap;                   /* Size of the memory view in bytes */
   sxu32 nRec;                    /* Number of pages written to the journal */
   SyPRNGCtx sPrng;               /* PRNG Context */
   sxu32 cksumInit;               /* Quasi-random value added to every checksum */
@@ -55519,6 +61073,10 @@ struct Pager
   void *pBusyHandlerArg;         /* First arg to xBusyHandler() */
   void (*xPageUnpin)(void *);    /* Page Unpin callback */
   void (*xPageReload)(void *);   /* Page Reload callback */
+  int (*xCommit)(unqlite_kv_engine *); /* KV engine callback invoked before the dirty pages are written */
+  void *pKvKeep;                 /* KV engine fields kept when the engine is reset */
+  sxu32 nKvKeep;                 /* pKvKeep[] size in bytes */
+  SySet aDrop;                   /* Side files to be deleted once the transaction commits (char *) */
   Bitvec *pVec;                  /* Bitmap */
   Page *pHeader;                 /* Page one of the database (Unqlite header) */
   Sytm tmCreate;                 /* Database creation time */
@@ -55530,6 +61088,7 @@ struct Pager
   int is_rdonly;                 /* True for a read-only database */
   int no_jrnl;                   /* TRUE to omit journaling */
   int iPageSize;                 /* Page size in bytes (default 4K) */
+  int iNewPageSize;              /* Page size of a new database, 0 for the library default */
   int iSectorSize;               /* Size of a single sector on disk */
   unsigned char *zTmpPage;       /* Temporary page */
   Page *pFirstDirty;             /* First dirty pages */
@@ -55542,6 +61101,11 @@ struct Pager
   sxu32 nSize;                   /* apHash[] size: Must be a power of two  */
   sxu32 nPage;                   /* Total number of page loaded in memory */
   sxu32 nCacheMax;               /* Maximum page to cache*/
+  pager_backup *pBackup;         /* Online backup in progress if any */
+  unqlite_page_codec sCodec;     /* Page codec if any (xEncode != 0) */
+  unsigned char *zCodecPage;     /* Encoded page image */
+  sxu32 *aLzHash;                /* Match finder table of the built-in compressing codec */
+  unqlite_pager_stats sStats;    /* Pager counters (See UNQLITE_CONFIG_PAGER_STATS) */
 };
 /* Control flags */
 #define PAGER_CTRL_COMMIT_ERR   0x001 /* Commit error */
@@ -55664,8 +61228,8 @@ static Page * pager_alloc_page(Pager *pPager,pgno num_page)
 	if( pNew == 0 ){
 		return 0;
 	}
-	/* Zero the structure */
-	SyZero(pNew,sizeof(Page)+pPager->iPageSize);
+	/* Zero the structure, the page data is filled by the caller */
+	SyZero(pNew,sizeof(Page));
 	/* Page data */
 	pNew->zData = (unsigned char *)&pNew[1];
 	/* Fill in the structure */
@@ -55674,6 +61238,28 @@ static Page * pager_alloc_page(Pager *pPager,pgno num_page)
 	pNew->pgno = num_page;
 	return pNew;
 }
+/*
+ * Allocate a page that point directly into the read-only memory view
+ * of the database file. No page buffer is allocated and nothing is copied.
+ */
+static Page * pager_alloc_view(Pager *pPager,pgno num_page,unsigned char *zSlot)
+{
+	Page *pNew;
+	
+	pNew = (Page *)SyMemBackendPoolAlloc(pPager->pAllocator,sizeof(Page));
+	if( pNew == 0 ){
+		return 0;
+	}
+	/* Zero the structure */
+	SyZero(pNew,sizeof(Page));
+	/* Page data */
+	pNew->zData = zSlot;
+	/* Fill in the structure */
+	pNew->pPager = pPager;
+	pNew->nRef = 1;
+	pNew->pgno = num_page;
+	return pNew;
+}
 /*
  * Increment the reference count of a given page.
  */
@@ -55824,6 +61410,219 @@ static int pager_unlink_page(Pager *pPager,Page *pPage)
 	pPager->nPage--;
 	return UNQLITE_OK;
 }
+/*
+ * Release the memory view of the database file, if any.
+ */
+static void pager_mmap_drop(Pager *pPager)
+{
+	if( pPager->pMmap ){
+		unqliteOsUnmap(pPager->pfd,pPager->pMmap,pPager->nMmap);
+		pPager->pMmap = 0;
+		pPager->nMmap = 0;
+	}
+}
+/*
+ * Map (or remap) the database file after its size changed so that cache
+ * misses keep being served from the memory view. The view is taken from
+ * the locked file descriptor of the pager. Must be called with at most
+ * a SHARED lock held, never while a journal is live.
+ */
+static int pager_mmap_refresh(Pager *pPager)
+{
+	sxi64 iFileSize = 0;
+	void *pMap = 0;
+	int rc;
+	if( (pPager->iOpenFlags & UNQLITE_OPEN_MMAP) == 0 || pPager->is_mem ){
+		return UNQLITE_OK;
+	}
+	rc = unqliteOsFileSize(pPager->pfd,&iFileSize);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pPager->pMmap && iFileSize == pPager->nMmap ){
+		/* Up to date */
+		return UNQLITE_OK;
+	}
+	pager_mmap_drop(pPager);
+	if( iFileSize > 0 ){
+		rc = unqliteOsMmap(pPager->pfd,iFileSize,&pMap);
+		if( rc != UNQLITE_OK ){
+			/* Reads fall back to the regular IO path */
+			return rc;
+		}
+		pPager->pMmap = pMap;
+		pPager->nMmap = iFileSize;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Built-in compressing page codec.
+ *
+ * A compressed page is stored at the start of its page slot as follows:
+ *
+ *   4 bytes signature (aPagerLzMagic[]).
+ *   4 bytes big-endian length of the compressed stream.
+ *   4 bytes big-endian checksum (SyBinHash()) of the compressed stream.
+ *   The compressed stream (See unqliteLzCompress()).
+ *
+ * Only this extent is written to the database file, the rest of the slot
+ * is left untouched (And stay a hole on filesystems that support sparse files).
+ * A page that does not compress is stored as is.
+ */
+#define PAGER_LZ_HDR 12
+static const unsigned char aPagerLzMagic[4] = { 0xd9, 0x4c, 0x5a, 0x50 };
+/*
+ * Return TRUE if the given page image was produced by the built-in codec.
+ */
+static int pager_lz_page(const unsigned char *zData,int nPageSize)
+{
+	sxu32 nStream,iCksum;
+	if( nPageSize <= PAGER_LZ_HDR || SyMemcmp((const void *)zData,(const void *)aPagerLzMagic,sizeof(aPagerLzMagic)) != 0 ){
+		return FALSE;
+	}
+	SyBigEndianUnpack32(&zData[4],&nStream);
+	if( nStream < 1 || nStream > (sxu32)(nPageSize - PAGER_LZ_HDR) ){
+		return FALSE;
+	}
+	SyBigEndianUnpack32(&zData[8],&iCksum);
+	return iCksum == SyBinHash((const void *)&zData[PAGER_LZ_HDR],nStream);
+}
+/*
+ * xEncode() method of the built-in compressing codec.
+ */
+static int pager_lz_encode(void *pCodecArg,pgno iPage,const unsigned char *zIn,unsigned char *zOut,int nPageSize,int *pnOut)
+{
+	Pager *pPager = (Pager *)pCodecArg;
+	sxu32 nStream = 0;
+	int rc = UNQLITE_FULL;
+	SXUNUSED(iPage); /* cc warning */
+	if( pPager->aLzHash == 0 ){
+		pPager->aLzHash = (sxu32 *)SyMemBackendAlloc(pPager->pAllocator,sizeof(sxu32) << L_HASH_LZ_HASH_BITS);
+		if( pPager->aLzHash == 0 ){
+			return UNQLITE_NOMEM;
+		}
+	}
+	if( nPageSize > PAGER_LZ_HDR + 1 ){
+		rc = unqliteLzCompress(zIn,(sxu32)nPageSize,&zOut[PAGER_LZ_HDR],(sxu32)(nPageSize - PAGER_LZ_HDR - 1),pPager->aLzHash,&nStream);
+	}
+	if( rc != UNQLITE_OK ){
+		/* Incompressible page, store it as is */
+		SyMemcpy((const void *)zIn,(void *)zOut,(sxu32)nPageSize);
+		*pnOut = nPageSize;
+		return UNQLITE_OK;
+	}
+	SyMemcpy((const void *)aPagerLzMagic,(void *)zOut,sizeof(aPagerLzMagic));
+	SyBigEndianPack32(&zOut[4],nStream);
+	SyBigEndianPack32(&zOut[8],SyBinHash((const void *)&zOut[PAGER_LZ_HDR],nStream));
+	*pnOut = PAGER_LZ_HDR + (int)nStream;
+	return UNQLITE_OK;
+}
+/*
+ * xDecode() method of the built-in compressing codec.
+ */
+static int pager_lz_decode(void *pCodecArg,pgno iPage,const unsigned char *zIn,unsigned char *zOut,int nPageSize)
+{
+	sxu32 nStream;
+	SXUNUSED(pCodecArg); /* cc warning */
+	SXUNUSED(iPage);
+	if( !pager_lz_page(zIn,nPageSize) ){
+		/* Stored as is */
+		SyMemcpy((const void *)zIn,(void *)zOut,(sxu32)nPageSize);
+		return UNQLITE_OK;
+	}
+	SyBigEndianUnpack32(&zIn[4],&nStream);
+	return unqliteLzDecompress(&zIn[PAGER_LZ_HDR],nStream,zOut,(sxu32)nPageSize);
+}
+static const unqlite_page_codec sPagerLzCodec = {
+	"lz",            /* zName */
+	pager_lz_encode, /* xEncode */
+	pager_lz_decode, /* xDecode */
+	0                /* pCodecArg: The pager */
+};
+/*
+ * Encode a page image before it reach the disk. *pzOut is set to the image
+ * to write and *pnOut to the number of bytes that must reach the database file.
+ * The image is zero padded up to the page size so that it can be journalled as is.
+ * The database header (page 0) is never encoded.
+ */
+static int pager_codec_encode(Pager *pPager,pgno iPage,const unsigned char *zData,const unsigned char **pzOut,int *pnOut)
+{
+	int nOut = pPager->iPageSize;
+	int rc;
+	if( pPager->sCodec.xEncode == 0 || iPage < 1 ){
+		*pzOut = zData;
+		*pnOut = pPager->iPageSize;
+		return UNQLITE_OK;
+	}
+	rc = pPager->sCodec.xEncode(pPager->sCodec.pCodecArg,iPage,zData,pPager->zCodecPage,pPager->iPageSize,&nOut);
+	if( rc != UNQLITE_OK || nOut < 1 || nOut > pPager->iPageSize ){
+		unqliteGenErrorFormat(pPager->pDb,"Page codec '%s' failed to encode a page",pPager->sCodec.zName ? pPager->sCodec.zName : "");
+		return rc == UNQLITE_NOMEM ? UNQLITE_NOMEM : UNQLITE_IOERR;
+	}
+	if( nOut < pPager->iPageSize ){
+		SyZero(&pPager->zCodecPage[nOut],(sxu32)(pPager->iPageSize - nOut));
+	}
+	*pzOut = pPager->zCodecPage;
+	*pnOut = nOut;
+	return UNQLITE_OK;
+}
+/*
+ * Decode a page image read from the disk (or the journal) into zOut[].
+ * Pages written by the built-in compressing codec are recognized even
+ * when no codec is installed.
+ */
+static int pager_codec_decode(Pager *pPager,pgno iPage,const unsigned char *zIn,unsigned char *zOut)
+{
+	int rc;
+	if( iPage < 1 ){
+		/* Database header */
+		SyMemcpy((const void *)zIn,(void *)zOut,(sxu32)pPager->iPageSize);
+		return UNQLITE_OK;
+	}
+	if( pPager->sCodec.xDecode ){
+		rc = pPager->sCodec.xDecode(pPager->sCodec.pCodecArg,iPage,zIn,zOut,pPager->iPageSize);
+	}else{
+		rc = pager_lz_decode(0,iPage,zIn,zOut,pPager->iPageSize);
+	}
+	if( rc != UNQLITE_OK ){
+		unqliteGenError(pPager->pDb,"Page codec error, malformed page image");
+		return rc == UNQLITE_NOMEM ? UNQLITE_NOMEM : UNQLITE_CORRUPT;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Write a page image to its slot in the database file. The rest of the slot
+ * after a short (Encoded) image is punched out so that the filesystem
+ * releases the blocks it no longer needs.
+ */
+static int pager_write_image(Pager *pPager,pgno iPage,const unsigned char *zImage,int nImage)
+{
+	sxi64 iOfft = (sxi64)iPage * pPager->iPageSize;
+	int rc;
+	rc = unqliteOsWrite(pPager->pfd,zImage,nImage,iOfft);
+	if( rc == UNQLITE_OK && nImage < pPager->iPageSize ){
+		/* Without hole punching the old bytes of the slot are simply left there */
+		unqliteOsPunchHole(pPager->pfd,iOfft + nImage,pPager->iPageSize - nImage);
+	}
+	return rc;
+}
+/*
+ * Encoded pages may leave the database file shorter than the database
+ * image. Grow the file so that every page slot can be read back.
+ */
+static int pager_codec_extend(Pager *pPager)
+{
+	sxi64 iSize = 0;
+	int rc;
+	if( pPager->sCodec.xEncode == 0 ){
+		return UNQLITE_OK;
+	}
+	rc = unqliteOsFileSize(pPager->pfd,&iSize);
+	if( rc == UNQLITE_OK && iSize < (sxi64)pPager->iPageSize * pPager->dbSize ){
+		rc = unqliteOsTruncate(pPager->pfd,(sxi64)pPager->iPageSize * pPager->dbSize);
+	}
+	return rc;
+}
 /*
  * Update the content of a cached page.
  */
@@ -55835,10 +61634,30 @@ static int pager_fill_page(Pager *pPager,pgno iNum,void *pContents)
 	if( pPage == 0 ){
 		return SXERR_NOTFOUND;
 	}
-	/* Reflect the change */
-	SyMemcpy(pContents,pPage->zData,pPager->iPageSize);
-
-	return UNQLITE_OK;
+	/* Reflect the change (The journal hold encoded images) */
+	return pager_codec_decode(pPager,iNum,(const unsigned char *)pContents,pPage->zData);
+}
+/*
+ * Return a pointer to the given page inside the read-only memory view of
+ * the database file when the page can be used in place (Zero-copy), NULL
+ * otherwise (No memory view, page not yet on disk or encoded page).
+ */
+static unsigned char * pager_map_view(Pager *pPager,pgno iPage)
+{
+	unsigned char *zSlot;
+	if( (pPager->iOpenFlags & UNQLITE_OPEN_MMAP) == 0 || pPager->pMmap == 0 || !pPager->is_rdonly ){
+		/* R/W handles copy from the memory view, pages are modified in place */
+		return 0;
+	}
+	if( iPage >= pPager->dbSize || (sxi64)(iPage + 1) * pPager->iPageSize > pPager->nMmap ){
+		return 0;
+	}
+	zSlot = &((unsigned char *)pPager->pMmap)[iPage * pPager->iPageSize];
+	if( iPage > 0 && (pPager->sCodec.xDecode || pager_lz_page(zSlot,pPager->iPageSize)) ){
+		/* Must be decoded first */
+		return 0;
+	}
+	return zSlot;
 }
 /*
  * Read the content of a page from disk.
@@ -55851,12 +61670,26 @@ static int pager_get_page_contents(Pager *pPager,Page *pPage,int noContent)
 		SyZero(pPage->zData,pPager->iPageSize);
 		return UNQLITE_OK;
 	}
-	if( (pPager->iOpenFlags & UNQLITE_OPEN_MMAP) && (pPager->pMmap /* Paranoid edition */) ){
+	pPager->sStats.nRead++;
+	if( (pPager->iOpenFlags & UNQLITE_OPEN_MMAP) && pPager->pMmap /* Paranoid edition */
+		&& (sxi64)(pPage->pgno + 1) * pPager->iPageSize <= pPager->nMmap ){
 		unsigned char *zMap = (unsigned char *)pPager->pMmap;
-		pPage->zData = &zMap[pPage->pgno * pPager->iPageSize];
+		/* Plain pages are handed out as views (See pager_map_view()), decode into the page buffer */
+		rc = pager_codec_decode(pPager,pPage->pgno,&zMap[pPage->pgno * pPager->iPageSize],pPage->zData);
+	}else if( pPager->sCodec.xDecode && pPage->pgno > 0 ){
+		/* Read the encoded image */
+		rc = unqliteOsRead(pPager->pfd,pPager->zCodecPage,pPager->iPageSize,pPage->pgno * pPager->iPageSize);
+		if( rc == UNQLITE_OK ){
+			rc = pager_codec_decode(pPager,pPage->pgno,pPager->zCodecPage,pPage->zData);
+		}
 	}else{
 		/* Read content */
 		rc = unqliteOsRead(pPager->pfd,pPage->zData,pPager->iPageSize,pPage->pgno * pPager->iPageSize);
+		if( rc == UNQLITE_OK && pPage->pgno > 0 && pager_lz_page(pPage->zData,pPager->iPageSize) ){
+			/* Written by the built-in compressing codec */
+			SyMemcpy((const void *)pPage->zData,(void *)pPager->zCodecPage,(sxu32)pPager->iPageSize);
+			rc = pager_codec_decode(pPager,pPage->pgno,pPager->zCodecPage,pPage->zData);
+		}
 	}
 	return rc;
 }
@@ -56232,6 +62065,93 @@ static sxu32 pager_cksum(Pager *pPager,const unsigned char *zData)
   }
   return cksum;
 }
+/*
+ * Remember that the backup copy of the given page may hold changes made
+ * by the current write transaction.
+ */
+static void pager_backup_touch_page(Pager *pPager,pgno iPage)
+{
+	pager_backup *pBackup = pPager->pBackup;
+	if( unqliteBitvecTest(pBackup->pTouched,iPage) ){
+		/* Already recorded */
+		return;
+	}
+	if( SXRET_OK == SySetPut(&pBackup->aTouched,(const void *)&iPage) ){
+		unqliteBitvecSet(pBackup->pTouched,iPage);
+	}else{
+		/* Out of memory, restart the whole copy */
+		pBackup->iNext = 0;
+	}
+}
+/*
+ * The current transaction is over. Forget about the touched pages.
+ */
+static void pager_backup_forget_pages(Pager *pPager)
+{
+	pager_backup *pBackup = pPager->pBackup;
+	Bitvec *pTouched;
+	if( SySetUsed(&pBackup->aTouched) < 1 ){
+		return;
+	}
+	pTouched = unqliteBitvecCreate(pPager->pAllocator,pPager->dbSize);
+	if( pTouched == 0 ){
+		/* Keep the old bitmap, pages are copied again at worst */
+		return;
+	}
+	unqliteBitvecDestroy(pBackup->pTouched);
+	pBackup->pTouched = pTouched;
+	SySetReset(&pBackup->aTouched);
+}
+/*
+ * The current transaction was rolled back. Copy the touched pages again
+ * from the database file which now hold their original content.
+ */
+static void pager_backup_restore_pages(Pager *pPager)
+{
+	pager_backup *pBackup = pPager->pBackup;
+	pgno *aPage;
+	sxi64 iFileSize = 0;
+	sxu32 n;
+	int rc;
+	aPage = (pgno *)SySetBasePtr(&pBackup->aTouched);
+	rc = unqliteOsFileSize(pPager->pfd,&iFileSize);
+	for( n = 0 ; n < SySetUsed(&pBackup->aTouched) && rc == UNQLITE_OK ; ++n ){
+		if( aPage[n] >= pPager->dbSize ){
+			/* Dropped by the rollback, the backup file is truncated later */
+			continue;
+		}
+		if( (sxi64)(aPage[n] + 1) * pPager->iPageSize <= iFileSize ){
+			rc = unqliteOsRead(pPager->pfd,pPager->zTmpPage,pPager->iPageSize,aPage[n] * pPager->iPageSize);
+		}else{
+			SyZero(pPager->zTmpPage,(sxu32)pPager->iPageSize);
+		}
+		if( rc == UNQLITE_OK ){
+			rc = unqliteOsWrite(pBackup->pDest,pPager->zTmpPage,pPager->iPageSize,aPage[n] * pPager->iPageSize);
+		}
+	}
+	if( rc != UNQLITE_OK ){
+		pBackup->rc = rc;
+	}
+	pager_backup_forget_pages(pPager);
+}
+/*
+ * Mirror a page that is about to be written to the database file to the
+ * online backup file if it was already copied there. Errors are reported
+ * by the next backup step.
+ */
+static void pager_backup_mirror_page(Pager *pPager,pgno iPage,const unsigned char *zData)
+{
+	pager_backup *pBackup = pPager->pBackup;
+	int rc;
+	if( iPage >= pBackup->iNext || pBackup->rc != UNQLITE_OK ){
+		/* Nothing to do, the page will be copied later */
+		return;
+	}
+	rc = unqliteOsWrite(pBackup->pDest,zData,pPager->iPageSize,iPage * pPager->iPageSize);
+	if( rc != UNQLITE_OK ){
+		pBackup->rc = rc;
+	}
+}
 /*
 ** Read a single page from the journal file opened on file descriptor
 ** jfd. Playback this one page. Update the offset to read from.
@@ -56269,6 +62189,9 @@ static int pager_play_back_one_page(Pager *pPager,sxi64 *pOfft,unsigned char *zT
 		return UNQLITE_OK;
 	}
 	/* playback */
+	if( pPager->pBackup ){
+		pager_backup_mirror_page(pPager,iNum,zData);
+	}
 	rc = unqliteOsWrite(pPager->pfd,zData,pPager->iPageSize,iNum * pPager->iPageSize);
 	if( rc == UNQLITE_OK ){
 		/* Flush the cache */
@@ -56367,6 +62290,7 @@ end_playback:
 	if( rc == UNQLITE_OK ){
 		/* Sync the database file */
 		unqliteOsSync(pPager->pfd,UNQLITE_SYNC_FULL);
+		pPager->sStats.nSync++;
 	}
 	if( rc == UNQLITE_DONE ){
 		rc = UNQLITE_OK;
@@ -56558,6 +62482,7 @@ static int pager_journal_rollback(Pager *pPager,int check_hot)
 	}
 	/* Sync the journal file */
 	unqliteOsSync(pPager->pjfd,UNQLITE_SYNC_NORMAL);
+	pPager->sStats.nSync++;
 	/* Finally rollback the database */
 	rc = pager_playback(pPager);
 	/* Switch back to shared lock */
@@ -56723,7 +62648,7 @@ static int pager_read_db_header(Pager *pPager)
 	}else{
 		/* Set a default page and sector size */
 		pPager->iSectorSize = GetSectorSize(pPager->pfd);
-		pPager->iPageSize = unqliteGetPageSize();
+		pPager->iPageSize = pPager->iNewPageSize > 0 ? pPager->iNewPageSize : unqliteGetPageSize();
 		SyStringInitFromBuf(&pPager->sKv,pPager->pEngine->pIo->pMethods->zName,SyStrlen(pPager->pEngine->pIo->pMethods->zName));
 		pPager->dbSize = 0;
 	}
@@ -56734,6 +62659,12 @@ static int pager_read_db_header(Pager *pPager)
 		return UNQLITE_NOMEM;
 	}
 	SyZero(pPager->zTmpPage,(sxu32)pPager->iPageSize);
+	/* Encoded page image (Page codec) */
+	pPager->zCodecPage = (unsigned char *)SyMemBackendAlloc(pPager->pAllocator,(sxu32)pPager->iPageSize);
+	if( pPager->zCodecPage == 0 ){
+		unqliteGenOutofMem(pPager->pDb);
+		return UNQLITE_NOMEM;
+	}
 	return UNQLITE_OK;
 }
 /*
@@ -56748,6 +62679,7 @@ static int pager_create_header(Pager *pPager)
 	if( pHeader == 0 ){
 		return UNQLITE_NOMEM;
 	}
+	SyZero(pHeader->zData,(sxu32)pPager->iPageSize);
 	pPager->pHeader = pHeader;
 	/* Link the page */
 	pager_link_page(pPager,pHeader);
@@ -56804,22 +62736,14 @@ static int pager_shared_lock(Pager *pPager)
 				return rc;
 			}
 			if(pPager->dbSize > 0 ){
-				if( pPager->iOpenFlags & UNQLITE_OPEN_MMAP ){
-					const jx9_vfs *pVfs = jx9ExportBuiltinVfs();
-					/* Obtain a read-only memory view of the whole file */
-					if( pVfs && pVfs->xMmap ){
-						int vr;
-						vr = pVfs->xMmap(pPager->zFilename,&pPager->pMmap,&pPager->dbByteSize);
-						if( vr != JX9_OK ){
-							/* Generate a warning */
-							unqliteGenError(pPager->pDb,"Cannot obtain a read-only memory view of the target database");
-							pPager->iOpenFlags &= ~UNQLITE_OPEN_MMAP;
-						}
-					}else{
-						/* Generate a warning */
-						unqliteGenError(pPager->pDb,"Cannot obtain a read-only memory view of the target database");
-						pPager->iOpenFlags &= ~UNQLITE_OPEN_MMAP;
-					}
+				/* Obtain a read-only memory view of the whole file, the file may
+				 * have changed size since the previous one was taken.
+				 */
+				if( pager_mmap_refresh(pPager) != UNQLITE_OK ){
+					/* Generate a warning */
+					unqliteGenError(pPager->pDb,"Cannot obtain a read-only memory view of the target database");
+					pager_mmap_drop(pPager);
+					pPager->iOpenFlags &= ~UNQLITE_OPEN_MMAP;
 				}
 			}
 			/* Update the pager state */
@@ -56932,6 +62856,7 @@ static int unqliteOpenJournal(Pager *pPager)
 	pager_write_journal_header(pPager,zHeader);
 	/* Perform the disk write */
 	rc = unqliteOsWrite(pPager->pjfd,zHeader,pPager->iSectorSize,0);
+	pPager->sStats.nJournal += pPager->iSectorSize;
 	/* Offset to start writing from */
 	pPager->iJournalOfft = pPager->iSectorSize;
 	/* All done, journal will be synced later */
@@ -56986,6 +62911,7 @@ static int unqliteFinalizeJournal(Pager *pPager,int *pRetry,int close_jrnl)
 	}
 	/* Sync the journal and close it */
 	rc = unqliteOsSync(pPager->pjfd,UNQLITE_SYNC_NORMAL);
+	pPager->sStats.nSync++;
 	if( close_jrnl ){
 		/* close the journal file */
 		if( UNQLITE_OK != unqliteOsCloseFree(pPager->pAllocator,pPager->pjfd) ){
@@ -57010,9 +62936,14 @@ static int unqliteFinalizeJournal(Pager *pPager,int *pRetry,int close_jrnl)
 static int page_write(Pager *pPager,Page *pPage)
 {
 	int rc;
+	if( pPager->pBackup && pPage->pgno < pPager->pBackup->iNext ){
+		pager_backup_touch_page(pPager,pPage->pgno);
+	}
 	if( !pPager->is_mem && !pPager->no_jrnl ){
 		/* Write the page to the transaction journal */
 		if( pPage->pgno < pPager->dbOrigSize && !unqliteBitvecTest(pPager->pVec,pPage->pgno) ){
+			const unsigned char *zImage;
+			int nImage;
 			sxu32 cksum;
 			if( pPager->nRec == SXU32_HIGH ){
 				/* Journal Limit reached */
@@ -57022,16 +62953,18 @@ static int page_write(Pager *pPager,Page *pPage)
 			/* Write the page number */
 			rc = WriteInt64(pPager->pjfd,pPage->pgno,pPager->iJournalOfft);
 			if( rc != UNQLITE_OK ){ return rc; }
-			/* Write the raw page */
-			/** CODEC */
-			rc = unqliteOsWrite(pPager->pjfd,pPage->zData,pPager->iPageSize,pPager->iJournalOfft + 8);
+			/* Write the page image (Encoded by the page codec if any) */
+			rc = pager_codec_encode(pPager,pPage->pgno,pPage->zData,&zImage,&nImage);
+			if( rc != UNQLITE_OK ){ return rc; }
+			rc = unqliteOsWrite(pPager->pjfd,zImage,pPager->iPageSize,pPager->iJournalOfft + 8);
 			if( rc != UNQLITE_OK ){ return rc; }
 			/* Compute the checksum */
-			cksum = pager_cksum(pPager,pPage->zData);
+			cksum = pager_cksum(pPager,zImage);
 			rc = WriteInt32(pPager->pjfd,cksum,pPager->iJournalOfft + 8 + pPager->iPageSize);
 			if( rc != UNQLITE_OK ){ return rc; }
 			/* Update the journal offset */
 			pPager->iJournalOfft += 8 /* page num */ + pPager->iPageSize + 4 /* cksum */;
+			pPager->sStats.nJournal += 8 + pPager->iPageSize + 4;
 			pPager->nRec++;
 			/* Mark as journalled  */
 			unqliteBitvecSet(pPager->pVec,pPage->pgno);
@@ -57063,8 +62996,10 @@ static int page_write(Pager *pPager,Page *pPage)
 */
 static int pager_write_dirty_pages(Pager *pPager,Page *pDirty)
 {
+	const unsigned char *zImage;
 	int rc = UNQLITE_OK;
 	Page *pNext;
+	int nImage;
 	for(;;){
 		if( pDirty == 0 ){
 			break;
@@ -57072,7 +63007,16 @@ static int pager_write_dirty_pages(Pager *pPager,Page *pDirty)
 		/* Point to the next dirty page */
 		pNext = pDirty->pDirtyPrev; /* Not a bug: Reverse link */
 		if( (pDirty->flags & PAGE_DONT_WRITE) == 0 ){
-			rc = unqliteOsWrite(pPager->pfd,pDirty->zData,pPager->iPageSize,pDirty->pgno * pPager->iPageSize);
+			/* Encode the page if a codec is installed */
+			rc = pager_codec_encode(pPager,pDirty->pgno,pDirty->zData,&zImage,&nImage);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			if( pPager->pBackup ){
+				pager_backup_mirror_page(pPager,pDirty->pgno,zImage);
+			}
+			rc = pager_write_image(pPager,pDirty->pgno,zImage,nImage);
+			pPager->sStats.nWrite++;
 			if( rc != UNQLITE_OK ){
 				/* A rollback should be done */
 				break;
@@ -57092,6 +63036,10 @@ static int pager_write_dirty_pages(Pager *pPager,Page *pDirty)
 	pPager->pDirty = pPager->pFirstDirty = 0;
 	pPager->pHotDirty = pPager->pFirstHot = 0;
 	pPager->nHot = 0;
+	if( rc == UNQLITE_OK ){
+		/* Short page images */
+		rc = pager_codec_extend(pPager);
+	}
 	return rc;
 }
 /*
@@ -57108,8 +63056,10 @@ static int pager_write_dirty_pages(Pager *pPager,Page *pDirty)
 */
 static int pager_write_hot_dirty_pages(Pager *pPager,Page *pDirty)
 {
+	const unsigned char *zImage;
 	int rc = UNQLITE_OK;
 	Page *pNext;
+	int nImage;
 	for(;;){
 		if( pDirty == 0 ){
 			break;
@@ -57117,7 +63067,16 @@ static int pager_write_hot_dirty_pages(Pager *pPager,Page *pDirty)
 		/* Point to the next page */
 		pNext = pDirty->pPrevHot; /* Not a bug: Reverse link */
 		if( (pDirty->flags & PAGE_DONT_WRITE) == 0 ){
-			rc = unqliteOsWrite(pPager->pfd,pDirty->zData,pPager->iPageSize,pDirty->pgno * pPager->iPageSize);
+			/* Encode the page if a codec is installed */
+			rc = pager_codec_encode(pPager,pDirty->pgno,pDirty->zData,&zImage,&nImage);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			if( pPager->pBackup ){
+				pager_backup_mirror_page(pPager,pDirty->pgno,zImage);
+			}
+			rc = pager_write_image(pPager,pDirty->pgno,zImage,nImage);
+			pPager->sStats.nWrite++;
 			if( rc != UNQLITE_OK ){
 				break;
 			}
@@ -57142,8 +63101,27 @@ static int pager_write_hot_dirty_pages(Pager *pPager,Page *pDirty)
 		/* Next hot page */
 		pDirty = pNext;
 	}
+	if( rc == UNQLITE_OK ){
+		/* Short page images */
+		rc = pager_codec_extend(pPager);
+	}
 	return rc;
 }
+/*
+ * Delete (bDelete) or forget the side files released by the transaction.
+ */
+static void pager_drop_files(Pager *pPager,int bDelete)
+{
+	char **azPath = (char **)SySetBasePtr(&pPager->aDrop);
+	sxu32 n;
+	for( n = 0 ; n < SySetUsed(&pPager->aDrop) ; ++n ){
+		if( bDelete ){
+			unqliteOsDelete(pPager->pVfs,azPath[n],0);
+		}
+		SyMemBackendFree(pPager->pAllocator,azPath[n]);
+	}
+	SySetReset(&pPager->aDrop);
+}
 /*
  * Commit a transaction: Phase one.
  */
@@ -57165,6 +63143,13 @@ static int pager_commit_phase1(Pager *pPager)
 		unqliteGenError(pPager->pDb,"Read-Only database");
 		return UNQLITE_READ_ONLY;
 	}
+	if( pPager->xCommit ){
+		/* Let the KV engine make its side files durable before the pages referencing them */
+		rc = pPager->xCommit(pPager->pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
 	/* Finalize the journal file */
 	rc = unqliteFinalizeJournal(pPager,&get_excl,1);
 	if( rc != UNQLITE_OK ){
@@ -57183,6 +63168,7 @@ static int pager_commit_phase1(Pager *pPager)
 	if( pPager->iFlags & PAGER_CTRL_DIRTY_COMMIT ){
 		/* Sync the database first if a dirty commit have been applied */
 		unqliteOsSync(pPager->pfd,UNQLITE_SYNC_NORMAL);
+		pPager->sStats.nSync++;
 	}
 	/* Write the dirty pages */
 	rc = pager_write_dirty_pages(pPager,pDirty);
@@ -57204,16 +63190,23 @@ static int pager_commit_phase1(Pager *pPager)
 			}
 			pager_unlink_page(pPager, p);
 			pager_release_page(pPager, p);
+			pPager->sStats.nEvict++;
 		}
 	}
 	/* If the file on disk is not the same size as the database image,
      * then use unqliteOsTruncate to grow or shrink the file here.
      */
 	if( pPager->dbSize != pPager->dbOrigSize ){
+		if( pPager->dbSize < pPager->dbOrigSize ){
+			/* Do not keep a view past the end of the file, it is taken again in phase two */
+			pager_mmap_drop(pPager);
+		}
 		unqliteOsTruncate(pPager->pfd,pPager->iPageSize * pPager->dbSize);
 	}
 	/* Sync the database file */
 	unqliteOsSync(pPager->pfd,UNQLITE_SYNC_FULL);
+	pPager->sStats.nSync++;
+	pPager->sStats.nCommit++;
 	/* Remove stale flags */
 	pPager->iJournalOfft = 0;
 	pPager->nRec = 0;
@@ -57233,13 +63226,24 @@ static int pager_commit_phase2(Pager *pPager)
 				/* Finally, unlink the journal file */
 				unqliteOsDelete(pPager->pVfs,pPager->zJournal,1);
 			}
+			/* Side files released by the transaction */
+			pager_drop_files(pPager,1);
+			pPager->iFlags &= ~PAGER_CTRL_DIRTY_COMMIT;
 			/* Downgrade to shared lock */
 			pager_unlock_db(pPager,SHARED_LOCK);
 			pPager->iState = PAGER_READER;
+			/* Follow the new file size */
+			if( pager_mmap_refresh(pPager) != UNQLITE_OK ){
+				pager_mmap_drop(pPager);
+			}
 			if( pPager->pVec ){
 				unqliteBitvecDestroy(pPager->pVec);
 				pPager->pVec = 0;
 			}
+			if( pPager->pBackup ){
+				/* Changes are now durable */
+				pager_backup_forget_pages(pPager);
+			}
 		}
 	}
 	return UNQLITE_OK;
@@ -57348,6 +63352,7 @@ static int pager_reset_state(Pager *pPager,int bResetKvEngine)
 		pPtr->flags &= ~(PAGE_DIRTY|PAGE_DONT_WRITE|PAGE_NEED_SYNC|PAGE_IN_JOURNAL|PAGE_HOT_DIRTY);
 		/* Release the page */
 		pager_release_page(pPager,pPtr);
+		pPager->sStats.nEvict++;
 		/* Point to the next page */
 		pPtr = pNext;
 	}
@@ -57364,12 +63369,32 @@ static int pager_reset_state(Pager *pPager,int bResetKvEngine)
 		unqliteBitvecDestroy(pPager->pVec);
 		pPager->pVec = 0;
 	}
+	if( pPager->pBackup ){
+		/* Undo the uncommitted changes that reached the backup file */
+		pager_backup_restore_pages(pPager);
+	}
+	/* Side files released by the transaction are kept */
+	pager_drop_files(pPager,0);
 	/* Switch back to shared lock */
 	pager_unlock_db(pPager,SHARED_LOCK);
 	pPager->iState = PAGER_READER;
+	/* The rollback may have truncated the file */
+	if( pager_mmap_refresh(pPager) != UNQLITE_OK ){
+		pager_mmap_drop(pPager);
+	}
 	if( bResetKvEngine ){
+		unsigned char *zKeep = 0;
+		sxu32 nKeep = pPager->nKvKeep;
 		/* Reset the underlying KV engine */
 		pIo = pEngine->pIo;
+		if( pPager->pKvKeep && nKeep > 0 ){
+			/* Save the handle settings of the engine */
+			zKeep = (unsigned char *)SyMemBackendAlloc(pPager->pAllocator,nKeep);
+			if( zKeep == 0 ){
+				return UNQLITE_NOMEM;
+			}
+			SyMemcpy(pPager->pKvKeep,(void *)zKeep,nKeep);
+		}
 		if( pIo->pMethods->xRelease ){
 			/* Call the release callback */
 			pIo->pMethods->xRelease(pEngine);
@@ -57382,9 +63407,19 @@ static int pager_reset_state(Pager *pPager,int bResetKvEngine)
 			/* Call the init method */
 			rc = pIo->pMethods->xInit(pEngine,pPager->iPageSize);
 			if( rc != UNQLITE_OK ){
+				if( zKeep ){
+					SyMemBackendFree(pPager->pAllocator,zKeep);
+				}
 				return rc;
 			}
 		}
+		if( zKeep ){
+			/* Restore them */
+			if( pPager->pKvKeep && pPager->nKvKeep == nKeep ){
+				SyMemcpy((const void *)zKeep,pPager->pKvKeep,nKeep);
+			}
+			SyMemBackendFree(pPager->pAllocator,zKeep);
+		}
 		if( pIo->pMethods->xOpen ){
 			/* Call the xOpen method */
 			rc = pIo->pMethods->xOpen(pEngine,pPager->dbSize);
@@ -57436,6 +63471,7 @@ UNQLITE_PRIVATE int unqlitePagerRollback(Pager *pPager,int bResetKvEngine)
 			if( pPager->pjfd ){
 				/* Sync the journal file */
 				unqliteOsSync(pPager->pjfd,UNQLITE_SYNC_NORMAL);
+				pPager->sStats.nSync++;
 			}
 			unqliteOsCloseFree(pPager->pAllocator,pPager->pjfd);
 			pPager->pjfd = 0;
@@ -57549,21 +63585,34 @@ static int unqlitePagerAcquire(
 		return pPage ? UNQLITE_OK : UNQLITE_NOTFOUND;
 	}
 	if( pPage == 0 ){
-		/* Allocate a new page */
-		pPage = pager_alloc_page(pPager,pgno);
-		if( pPage == 0 ){
-			unqliteGenOutofMem(pPager->pDb);
-			return UNQLITE_NOMEM;
-		}
-		/* Read page contents */
-		rc = pager_get_page_contents(pPager,pPage,noContent);
-		if( rc != UNQLITE_OK ){
-			SyMemBackendPoolFree(pPager->pAllocator,pPage);
-			return rc;
+		unsigned char *zSlot = noContent ? 0 : pager_map_view(pPager,pgno);
+		pPager->sStats.nMiss++;
+		if( zSlot ){
+			/* Page view into the read-only memory map */
+			pPage = pager_alloc_view(pPager,pgno,zSlot);
+			if( pPage == 0 ){
+				unqliteGenOutofMem(pPager->pDb);
+				return UNQLITE_NOMEM;
+			}
+			pPager->sStats.nRead++;
+		}else{
+			/* Allocate a new page */
+			pPage = pager_alloc_page(pPager,pgno);
+			if( pPage == 0 ){
+				unqliteGenOutofMem(pPager->pDb);
+				return UNQLITE_NOMEM;
+			}
+			/* Read page contents */
+			rc = pager_get_page_contents(pPager,pPage,noContent);
+			if( rc != UNQLITE_OK ){
+				SyMemBackendPoolFree(pPager->pAllocator,pPage);
+				return rc;
+			}
 		}
 		/* Link the page */
 		pager_link_page(pPager,pPage);
 	}else{
+		pPager->sStats.nHit++;
 		if( ppPage ){
 			page_ref(pPage);
 		}
@@ -57574,6 +63623,128 @@ static int unqlitePagerAcquire(
 	}
 	return UNQLITE_OK;
 }
+/*
+ * Maximum number of pages a single read ahead request may cover.
+ */
+#define PAGER_PREFETCH_MAX 64
+/*
+ * Requested pages at most this many pages apart are read as a single
+ * run. The pages in between (Usually slave or overflow pages of the
+ * requested ones) are cached as well.
+ */
+#define PAGER_PREFETCH_GAP 4
+/*
+ * Read ahead requests stop installing pages once the page cache holds
+ * this many bytes (Or the limit set by unqlitePagerSetCachesize()), the
+ * remaining runs are only announced to the OS.
+ */
+#define PAGER_PREFETCH_CACHE_MAX (64 << 20)
+/*
+ * Read ahead the given pages. Pages already cached or past the end of
+ * the database image are ignored, the remaining ones are sorted and
+ * grouped into runs of nearby pages.
+ * Each run is first announced to the OS (See unqliteOsAdvise()) and,
+ * if bLoad is set, read with a single call and installed in the page
+ * cache so that the next unqlitePagerAcquire() is a cache hit.
+ * This is only a hint, errors are ignored here and are reported by
+ * the real read of the page.
+ */
+static int unqlitePagerPrefetch(Pager *pPager,const pgno *aPage,int nPage,int bLoad)
+{
+	pgno aRun[PAGER_PREFETCH_MAX];
+	unsigned char *zBuf = 0;
+	int nRun,i,j,k,rc;
+	sxu32 nCacheMax;
+	pgno iNum;
+	if( pPager->is_mem || nPage < 1 ){
+		return UNQLITE_OK;
+	}
+	if( (pPager->iOpenFlags & UNQLITE_OPEN_MMAP) && pPager->pMmap ){
+		/* Pages are served from the memory view, only warm up the OS cache */
+		bLoad = 0;
+	}
+	rc = pager_shared_lock(pPager);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	nCacheMax = pPager->nCacheMax;
+	if( nCacheMax == SXU32_HIGH && pPager->iPageSize > 0 ){
+		nCacheMax = (sxu32)(PAGER_PREFETCH_CACHE_MAX / pPager->iPageSize);
+	}
+	if( pPager->nPage >= nCacheMax ){
+		/* Cache full, only warm up the OS cache */
+		bLoad = 0;
+	}
+	/* Collect the uncached pages */
+	nRun = 0;
+	for( i = 0 ; i < nPage && nRun < PAGER_PREFETCH_MAX ; ++i ){
+		iNum = aPage[i];
+		if( iNum < 1 || iNum >= pPager->dbSize || pager_fetch_page(pPager,iNum) ){
+			continue;
+		}
+		/* Insertion sort, duplicates are dropped */
+		for( j = nRun ; j > 0 && aRun[j - 1] > iNum ; --j );
+		if( j > 0 && aRun[j - 1] == iNum ){
+			continue;
+		}
+		for( k = nRun ; k > j ; --k ){
+			aRun[k] = aRun[k - 1];
+		}
+		aRun[j] = iNum;
+		nRun++;
+	}
+	if( nRun < 1 ){
+		return UNQLITE_OK;
+	}
+	if( bLoad ){
+		/* Large enough for the longest possible run */
+		zBuf = (unsigned char *)SyMemBackendAlloc(pPager->pAllocator,
+			(sxu32)((nRun + (nRun - 1) * (PAGER_PREFETCH_GAP - 1)) * pPager->iPageSize));
+		if( zBuf == 0 ){
+			/* Advise only */
+			bLoad = 0;
+		}
+	}
+	for( i = 0 ; i < nRun ; i = j ){
+		sxi64 iOfft = (sxi64)aRun[i] * pPager->iPageSize;
+		sxi64 nByte;
+		/* Extend the run */
+		for( j = i + 1 ; j < nRun && aRun[j] - aRun[j - 1] <= PAGER_PREFETCH_GAP ; ++j );
+		nByte = (sxi64)(aRun[j - 1] - aRun[i] + 1) * pPager->iPageSize;
+		unqliteOsAdvise(pPager->pfd,iOfft,nByte);
+		if( !bLoad ){
+			continue;
+		}
+		/* One read for the whole run */
+		if( unqliteOsRead(pPager->pfd,zBuf,nByte,iOfft) != UNQLITE_OK ){
+			continue;
+		}
+		for( iNum = aRun[i] ; iNum <= aRun[j - 1] && pPager->nPage < nCacheMax ; ++iNum ){
+			Page *pNew;
+			if( pager_fetch_page(pPager,iNum) ){
+				/* Cached page in the gap, possibly dirty */
+				continue;
+			}
+			pNew = pager_alloc_page(pPager,iNum);
+			if( pNew == 0 ){
+				break;
+			}
+			if( pager_codec_decode(pPager,iNum,&zBuf[(iNum - aRun[i]) * pPager->iPageSize],pNew->zData) != UNQLITE_OK ){
+				SyMemBackendPoolFree(pPager->pAllocator,pNew);
+				continue;
+			}
+			/* Cached but not referenced */
+			pNew->nRef = 0;
+			pager_link_page(pPager,pNew);
+			pPager->sStats.nRead++;
+			pPager->sStats.nPrefetch++;
+		}
+	}
+	if( zBuf ){
+		SyMemBackendFree(pPager->pAllocator,zBuf);
+	}
+	return UNQLITE_OK;
+}
 /*
  * Return true if we are dealing with an in-memory database.
  */
@@ -57711,7 +63882,7 @@ UNQLITE_PRIVATE int unqlitePagerRegisterKvEngine(Pager *pPager,unqlite_kv_method
 	pEngine->pIo = pIo;
 	/* Invoke the init callback if avaialble */
 	if( pMethods->xInit ){
-		rc = pMethods->xInit(pEngine,unqliteGetPageSize());
+		rc = pMethods->xInit(pEngine,pPager->iPageSize > 0 ? pPager->iPageSize : unqliteGetPageSize());
 		if( rc != UNQLITE_OK ){
 			unqliteGenErrorFormat(pDb,
 				"xInit() method of the underlying KV engine '%z' failed",&pPager->sKv);
@@ -57819,6 +63990,7 @@ UNQLITE_PRIVATE int unqlitePagerOpen(
 	pPager->is_rdonly = rd_only;
 	pPager->iOpenFlags = iFlags;
 	pPager->pVfs = pVfs;
+	SySetInit(&pPager->aDrop,pPager->pAllocator,sizeof(char *));
 	SyRandomnessInit(&pPager->sPrng,0,0);
 	SyRandomness(&pPager->sPrng,(void *)&pPager->cksumInit,sizeof(sxu32));
 	/* Unlimited cache size */
@@ -57881,19 +64053,138 @@ UNQLITE_PRIVATE int unqlitePagerSetCachesize(Pager *pPager,int mxPage)
 	pPager->nCacheMax = mxPage;
 	return UNQLITE_OK;
 }
+/*
+ * Set the page size of a new database. The database file must not have
+ * been accessed yet and the setting is ignored when the file exists.
+ */
+UNQLITE_PRIVATE int unqlitePagerSetPageSize(Pager *pPager,int iPageSize)
+{
+	if( iPageSize < UNQLITE_MIN_PAGE_SIZE || iPageSize > UNQLITE_MAX_PAGE_SIZE || (iPageSize & (iPageSize - 1)) ){
+		/* Must be a power of two */
+		return UNQLITE_INVALID;
+	}
+	if( pPager->iState != PAGER_OPEN ){
+		/* Page size already chosen */
+		return UNQLITE_LOCKED;
+	}
+	pPager->iNewPageSize = iPageSize;
+	return UNQLITE_OK;
+}
+/*
+ * Select the KV storage engine of a new database. Same rules as
+ * unqlitePagerSetPageSize(): an existing file keeps its own engine.
+ */
+UNQLITE_PRIVATE int unqlitePagerSetKvEngine(Pager *pPager,const char *zName)
+{
+	unqlite_kv_methods *pMethods;
+	pMethods = unqliteFindKVStore(zName,SyStrlen(zName));
+	if( pMethods == 0 ){
+		unqliteGenErrorFormat(pPager->pDb,"No such Key/Value storage engine '%s'",zName);
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	if( pMethods->xOpen == 0 ){
+		/* In-memory engine, nothing would reach the disk */
+		unqliteGenErrorFormat(pPager->pDb,"Key/Value storage engine '%s' cannot back a database file",zName);
+		return UNQLITE_INVALID;
+	}
+	if( pPager->iState != PAGER_OPEN ){
+		return UNQLITE_LOCKED;
+	}
+	return unqlitePagerRegisterKvEngine(pPager,pMethods);
+}
+/*
+ * Install or remove (pCodec == NULL) a page codec.
+ */
+UNQLITE_PRIVATE int unqlitePagerSetCodec(Pager *pPager,const unqlite_page_codec *pCodec)
+{
+	if( pCodec == 0 ){
+		SyZero(&pPager->sCodec,sizeof(unqlite_page_codec));
+		return UNQLITE_OK;
+	}
+	if( pCodec->xEncode == 0 || pCodec->xDecode == 0 ){
+		return UNQLITE_INVALID;
+	}
+	if( pPager->is_mem ){
+		/* Pages never reach the disk */
+		return UNQLITE_OK;
+	}
+	SyMemcpy((const void *)pCodec,(void *)&pPager->sCodec,sizeof(unqlite_page_codec));
+	if( pCodec == &sPagerLzCodec ){
+		pPager->sCodec.pCodecArg = pPager;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Enable or disable the built-in compressing page codec.
+ */
+UNQLITE_PRIVATE int unqlitePagerSetCompress(Pager *pPager,int bEnable)
+{
+	return unqlitePagerSetCodec(pPager,bEnable ? &sPagerLzCodec : 0);
+}
+/*
+ * Invoke the given callback for each page held in the page cache.
+ */
+UNQLITE_PRIVATE int unqlitePagerCachePages(Pager *pPager,int (*xPage)(pgno,void *),void *pUserData)
+{
+	Page *pPage;
+	if( xPage == 0 ){
+		return UNQLITE_INVALID;
+	}
+	for( pPage = pPager->pAll ; pPage ; pPage = pPage->pNext ){
+		if( xPage(pPage->pgno,pUserData) != UNQLITE_OK ){
+			/* User abort */
+			return UNQLITE_ABORT;
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Load the given pages into the page cache. Sorted page numbers are
+ * read with a few large reads (See unqlitePagerPrefetch()).
+ */
+UNQLITE_PRIVATE int unqlitePagerCacheLoad(Pager *pPager,const pgno *aPage,int nPage)
+{
+	int rc = UNQLITE_OK;
+	int n;
+	while( nPage > 0 ){
+		n = nPage > PAGER_PREFETCH_MAX ? PAGER_PREFETCH_MAX : nPage;
+		rc = unqlitePagerPrefetch(pPager,aPage,n,1);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		aPage += n;
+		nPage -= n;
+	}
+	return rc;
+}
+/*
+ * Copy the pager counters to pStats and optionally reset them.
+ */
+UNQLITE_PRIVATE int unqlitePagerStats(Pager *pPager,unqlite_pager_stats *pStats,int bReset)
+{
+	if( pStats ){
+		SyMemcpy((const void *)&pPager->sStats,(void *)pStats,sizeof(unqlite_pager_stats));
+		pStats->nCached = (unqlite_int64)pPager->nPage;
+	}
+	if( bReset ){
+		SyZero(&pPager->sStats,sizeof(unqlite_pager_stats));
+	}
+	return UNQLITE_OK;
+}
 /*
  * Shutdown the page cache. Free all memory and close the database file.
  */
 UNQLITE_PRIVATE int unqlitePagerClose(Pager *pPager)
 {
+	if( pPager->pBackup ){
+		/* Abandon the online backup in progress */
+		unqlitePagerBackupFinish(pPager);
+	}
 	/* Release the KV engine */
 	pager_release_kv_engine(pPager);
-	if( pPager->iOpenFlags & UNQLITE_OPEN_MMAP ){
-		const jx9_vfs *pVfs = jx9ExportBuiltinVfs();
-		if( pVfs && pVfs->xUnmap && pPager->pMmap ){
-			pVfs->xUnmap(pPager->pMmap,pPager->dbByteSize);
-		}
-	}
+	pager_drop_files(pPager,0);
+	SySetRelease(&pPager->aDrop);
+	pager_mmap_drop(pPager);
 	if( !pPager->is_mem && pPager->iState >= PAGER_OPEN ){
 		/* Release all lock on this database handle. The issue is
 		 * discussed at https://github.com/symisc/unqlite/issues/74.
@@ -57931,6 +64222,305 @@ UNQLITE_PRIVATE sxu32 unqlitePagerRandomNum(Pager *pPager)
 	SyRandomness(&pPager->sPrng,(void *)&iNum,sizeof(iNum));
 	return iNum;
 }
+/*
+ * Build the path of a side file: zBase (The database path or the backup
+ * path) followed by zSuffix.
+ */
+static char * pager_side_path(Pager *pPager,const char *zBase,const char *zSuffix)
+{
+	sxu32 nLen = SyStrlen(zBase);
+	sxu32 nSuffix = SyStrlen(zSuffix);
+	char *zPath;
+	zPath = (char *)SyMemBackendAlloc(pPager->pAllocator,nLen + nSuffix + sizeof(char));
+	if( zPath == 0 ){
+		return 0;
+	}
+	SyMemcpy(zBase,zPath,nLen);
+	SyMemcpy(zSuffix,&zPath[nLen],nSuffix);
+	zPath[nLen + nSuffix] = 0;
+	return zPath;
+}
+/*
+ * Release the online backup state.
+ */
+static void pager_backup_release(Pager *pPager)
+{
+	pager_backup *pBackup = pPager->pBackup;
+	if( pBackup->pDest ){
+		unqliteOsCloseFree(pPager->pAllocator,pBackup->pDest);
+	}
+	if( pBackup->zDest ){
+		SyMemBackendFree(pPager->pAllocator,pBackup->zDest);
+	}
+	if( pBackup->pTouched ){
+		unqliteBitvecDestroy(pBackup->pTouched);
+	}
+	SySetRelease(&pBackup->aTouched);
+	SyMemBackendFree(pPager->pAllocator,pBackup);
+	pPager->pBackup = 0;
+}
+/*
+ * Start an online backup of the database image to the given file.
+ * Any previous content of the destination file is discarded.
+ */
+UNQLITE_PRIVATE int unqlitePagerBackupInit(Pager *pPager,const char *zDest)
+{
+	pager_backup *pBackup;
+	char *zJournal;
+	sxu32 nLen;
+	int rc;
+	if( pPager->is_mem ){
+		unqliteGenError(pPager->pDb,"Online backup is not supported for in-memory databases");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	if( pPager->pBackup ){
+		unqliteGenError(pPager->pDb,"Another online backup is in progress");
+		return UNQLITE_LOCKED;
+	}
+	nLen = SyStrlen(zDest);
+	if( nLen == SyStrlen(pPager->zFilename) && SyStrncmp(zDest,pPager->zFilename,nLen) == 0 ){
+		unqliteGenError(pPager->pDb,"Cannot backup a database onto itself");
+		return UNQLITE_INVALID;
+	}
+	/* Obtain a shared lock on the database first */
+	rc = pager_shared_lock(pPager);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pBackup = (pager_backup *)SyMemBackendAlloc(pPager->pAllocator,sizeof(pager_backup));
+	if( pBackup == 0 ){
+		unqliteGenOutofMem(pPager->pDb);
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pBackup,sizeof(pager_backup));
+	SySetInit(&pBackup->aTouched,pPager->pAllocator,sizeof(pgno));
+	pPager->pBackup = pBackup;
+	pBackup->pTouched = unqliteBitvecCreate(pPager->pAllocator,pPager->dbSize);
+	pBackup->zDest = SyMemBackendStrDup(pPager->pAllocator,zDest,nLen);
+	if( pBackup->pTouched == 0 || pBackup->zDest == 0 ){
+		pager_backup_release(pPager);
+		unqliteGenOutofMem(pPager->pDb);
+		return UNQLITE_NOMEM;
+	}
+	/* A stale journal next to the destination would be played back on open */
+	zJournal = (char *)SyMemBackendAlloc(pPager->pAllocator,nLen + sizeof(UNQLITE_JOURNAL_FILE_SUFFIX));
+	if( zJournal ){
+		SyMemcpy(zDest,zJournal,nLen);
+		SyMemcpy(UNQLITE_JOURNAL_FILE_SUFFIX,&zJournal[nLen],sizeof(UNQLITE_JOURNAL_FILE_SUFFIX));
+		unqliteOsDelete(pPager->pVfs,zJournal,0);
+		SyMemBackendFree(pPager->pAllocator,zJournal);
+	}
+	rc = unqliteOsOpen(pPager->pVfs,pPager->pAllocator,zDest,&pBackup->pDest,UNQLITE_OPEN_CREATE|UNQLITE_OPEN_READWRITE);
+	if( rc != UNQLITE_OK ){
+		pBackup->pDest = 0;
+		pager_backup_release(pPager);
+		unqliteGenErrorFormat(pPager->pDb,"IO error while opening backup file: %s",zDest);
+		return rc;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Number of pages of the last committed database image.
+ */
+static pgno pager_backup_size(Pager *pPager)
+{
+	if( pPager->iState >= PAGER_WRITER_LOCKED ){
+		/* Pages appended by the open transaction are not committed yet */
+		return pPager->dbOrigSize;
+	}
+	return pPager->dbSize;
+}
+/*
+ * Copy a single page to the backup file. The backup holds the committed
+ * images, which are found on disk: the pages of the open transaction stay
+ * in the cache until commit. Pages written early by a dirty commit are
+ * remembered so that a rollback copies them again.
+ */
+static int pager_backup_copy_page(Pager *pPager,pgno iPage,sxi64 iFileSize)
+{
+	int rc;
+	if( (pPager->iFlags & PAGER_CTRL_DIRTY_COMMIT) && pPager->pVec
+		&& unqliteBitvecTest(pPager->pVec,iPage) ){
+		/* The disk may hold an uncommitted image */
+		pager_backup_touch_page(pPager,iPage);
+	}
+	if( (sxi64)(iPage + 1) * pPager->iPageSize <= iFileSize ){
+		rc = unqliteOsRead(pPager->pfd,pPager->zTmpPage,pPager->iPageSize,iPage * pPager->iPageSize);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}else{
+		/* Page not yet on disk */
+		SyZero(pPager->zTmpPage,(sxu32)pPager->iPageSize);
+	}
+	rc = unqliteOsWrite(pPager->pBackup->pDest,pPager->zTmpPage,pPager->iPageSize,iPage * pPager->iPageSize);
+	return rc;
+}
+/*
+ * Copy the first nSize bytes of the side file zSuffix (A value log segment)
+ * next to the backup file. Invoked by the KV engine for each of its side
+ * files once the database image is copied.
+ */
+static int pager_backup_side_file(void *pUserData,const char *zSuffix,unqlite_int64 nSize)
+{
+	Pager *pPager = (Pager *)pUserData;
+	unqlite_file *pSrc = 0,*pDst = 0;
+	char *zSrc,*zDst;
+	sxi64 iOfft;
+	int nChunk;
+	int rc;
+	zSrc = pager_side_path(pPager,pPager->zFilename,zSuffix);
+	zDst = pager_side_path(pPager,pPager->pBackup->zDest,zSuffix);
+	if( zSrc == 0 || zDst == 0 ){
+		rc = UNQLITE_NOMEM;
+		goto done;
+	}
+	rc = unqliteOsOpen(pPager->pVfs,pPager->pAllocator,zSrc,&pSrc,UNQLITE_OPEN_READONLY);
+	if( rc != UNQLITE_OK ){
+		pSrc = 0;
+		goto done;
+	}
+	rc = unqliteOsOpen(pPager->pVfs,pPager->pAllocator,zDst,&pDst,UNQLITE_OPEN_CREATE|UNQLITE_OPEN_READWRITE);
+	if( rc != UNQLITE_OK ){
+		pDst = 0;
+		goto done;
+	}
+	for( iOfft = 0 ; iOfft < nSize ; iOfft += nChunk ){
+		nChunk = pPager->iPageSize;
+		if( nSize - iOfft < nChunk ){
+			nChunk = (int)(nSize - iOfft);
+		}
+		rc = unqliteOsRead(pSrc,pPager->zTmpPage,nChunk,iOfft);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+		rc = unqliteOsWrite(pDst,pPager->zTmpPage,nChunk,iOfft);
+		if( rc != UNQLITE_OK ){
+			goto done;
+		}
+	}
+	rc = unqliteOsTruncate(pDst,nSize);
+	if( rc == UNQLITE_OK ){
+		rc = unqliteOsSync(pDst,UNQLITE_SYNC_FULL);
+	}
+done:
+	if( rc != UNQLITE_OK ){
+		unqliteGenErrorFormat(pPager->pDb,"IO error while copying %s to the backup",zSuffix);
+	}
+	if( pSrc ){
+		unqliteOsCloseFree(pPager->pAllocator,pSrc);
+	}
+	if( pDst ){
+		unqliteOsCloseFree(pPager->pAllocator,pDst);
+	}
+	if( zSrc ){
+		SyMemBackendFree(pPager->pAllocator,zSrc);
+	}
+	if( zDst ){
+		SyMemBackendFree(pPager->pAllocator,zDst);
+	}
+	return rc;
+}
+/*
+ * Copy the side files of the underlying KV engine next to the backup file.
+ * Engines without side files do not implement UNQLITE_KV_CONFIG_SIDE_FILES.
+ */
+static int pager_backup_side_files(Pager *pPager,...)
+{
+	unqlite_kv_engine *pEngine = pPager->pEngine;
+	va_list ap;
+	int rc;
+	if( pEngine == 0 || pEngine->pIo->pMethods->xConfig == 0 ){
+		return UNQLITE_OK;
+	}
+	va_start(ap,pPager);
+	rc = pEngine->pIo->pMethods->xConfig(pEngine,UNQLITE_KV_CONFIG_SIDE_FILES,ap);
+	va_end(ap);
+	if( rc == UNQLITE_UNKNOWN || rc == UNQLITE_NOTIMPLEMENTED ){
+		rc = UNQLITE_OK;
+	}
+	return rc;
+}
+/*
+ * Perform one step of the online backup: copy up to nPage pages (all remaining
+ * pages if nPage <= 0). Return UNQLITE_DONE when the backup file is a complete image of the
+ * database, UNQLITE_OK if more steps are needed, any other code on failure.
+ */
+UNQLITE_PRIVATE int unqlitePagerBackupStep(Pager *pPager,int nPage,pgno *pRemaining,pgno *pTotal)
+{
+	pager_backup *pBackup = pPager->pBackup;
+	sxi64 iFileSize = 0;
+	pgno nSize;
+	int nCopy = 0;
+	int rc;
+	if( pBackup == 0 ){
+		unqliteGenError(pPager->pDb,"No online backup in progress");
+		return UNQLITE_INVALID;
+	}
+	if( pBackup->rc != UNQLITE_OK ){
+		unqliteGenError(pPager->pDb,"IO error while writing to the backup file");
+		return pBackup->rc;
+	}
+	rc = pager_shared_lock(pPager);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	nSize = pager_backup_size(pPager);
+	if( nSize > 0 ){
+		rc = unqliteOsFileSize(pPager->pfd,&iFileSize);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	/* Copy the next pages */
+	while( pBackup->iNext < nSize && (nPage <= 0 || nCopy < nPage) ){
+		rc = pager_backup_copy_page(pPager,pBackup->iNext,iFileSize);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pBackup->iNext++;
+		nCopy++;
+	}
+	if( pTotal ){
+		*pTotal = nSize;
+	}
+	if( pBackup->iNext < nSize ){
+		if( pRemaining ){
+			*pRemaining = nSize - pBackup->iNext;
+		}
+		return UNQLITE_OK;
+	}
+	if( pRemaining ){
+		*pRemaining = 0;
+	}
+	if( pPager->iState >= PAGER_WRITER_LOCKED && (pPager->iFlags & PAGER_CTRL_DIRTY_COMMIT) ){
+		/* The backup may hold pages the open transaction spilled to disk */
+		unqliteGenError(pPager->pDb,
+			"The open transaction wrote to the database file, commit or rollback before finishing the backup");
+		return UNQLITE_BUSY;
+	}
+	/* Reflect the size of the database image and make it durable */
+	rc = unqliteOsTruncate(pBackup->pDest,(sxi64)pPager->iPageSize * nSize);
+	if( rc == UNQLITE_OK ){
+		rc = unqliteOsSync(pBackup->pDest,UNQLITE_SYNC_FULL);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Value log segments referenced by the image */
+		rc = pager_backup_side_files(pPager,pager_backup_side_file,(void *)pPager);
+	}
+	return rc == UNQLITE_OK ? UNQLITE_DONE : rc;
+}
+/*
+ * Terminate the online backup and close the destination file.
+ */
+UNQLITE_PRIVATE int unqlitePagerBackupFinish(Pager *pPager)
+{
+	if( pPager->pBackup == 0 ){
+		return UNQLITE_OK;
+	}
+	pager_backup_release(pPager);
+	return UNQLITE_OK;
+}
 /* Exported KV IO Methods */
 /* 
  * Refer to [unqlitePagerAcquire()]
@@ -58113,6 +64703,219 @@ static void unqliteKvIoErr(unqlite_kv_handle pHandle,const char *zErr)
 	Pager *pPager = (Pager *)pHandle;
 	unqliteGenError(pPager->pDb,zErr);
 }
+/*
+ * Total number of pages in the database image (page 0 included).
+ */
+static pgno unqliteKvIoDbSize(unqlite_kv_handle pHandle)
+{
+	Pager *pPager = (Pager *)pHandle;
+	/* Acquire a reader-lock first so that pPager->dbSize get initialized */
+	pager_shared_lock(pPager);
+	return pPager->dbSize;
+}
+/*
+ * Shrink the database image to nPage pages (page 0 included).
+ * The file is truncated when the transaction commits.
+ */
+static int unqliteKvIoTruncate(unqlite_kv_handle pHandle,pgno nPage)
+{
+	Pager *pPager = (Pager *)pHandle;
+	if( pPager->iState < PAGER_WRITER_LOCKED ){
+		/* A write transaction must be active */
+		return UNQLITE_LOCKED;
+	}
+	if( nPage > 1 && nPage < pPager->dbSize ){
+		pPager->dbSize = nPage;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Invoke the unpin callback on every cached page so that the
+ * underlying storage engine can drop its parsed copies.
+ */
+static void unqliteKvIoUnpinAll(unqlite_kv_handle pHandle)
+{
+	Pager *pPager = (Pager *)pHandle;
+	Page *pPage;
+	for( pPage = pPager->pAll ; pPage ; pPage = pPage->pNext ){
+		if( pPage->pUserData ){
+			if( pPager->xPageUnpin ){
+				pPager->xPageUnpin(pPage->pUserData);
+			}
+			pPage->pUserData = 0;
+		}
+	}
+}
+/*
+ * Open a side file of the database.
+ * Refer to the declaration of the [Pager] structure
+ */
+static int unqliteKvIoOpenFile(unqlite_kv_handle pHandle,const char *zSuffix,int bCreate,unqlite_file **ppOut)
+{
+	Pager *pPager = (Pager *)pHandle;
+	unsigned int iFlags;
+	char *zPath;
+	int rc;
+	*ppOut = 0;
+	if( pPager->is_mem || pPager->zFilename == 0 ){
+		/* No backing file */
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	zPath = pager_side_path(pPager,pPager->zFilename,zSuffix);
+	if( zPath == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	if( pPager->is_rdonly ){
+		iFlags = UNQLITE_OPEN_READONLY;
+	}else{
+		iFlags = UNQLITE_OPEN_READWRITE;
+		if( bCreate ){
+			iFlags |= UNQLITE_OPEN_CREATE;
+		}
+	}
+	rc = unqliteOsOpen(pPager->pVfs,pPager->pAllocator,zPath,ppOut,iFlags);
+	SyMemBackendFree(pPager->pAllocator,zPath);
+	return rc;
+}
+/*
+ * Close a side file opened by unqliteKvIoOpenFile().
+ */
+static void unqliteKvIoCloseFile(unqlite_kv_handle pHandle,unqlite_file *pFile)
+{
+	Pager *pPager = (Pager *)pHandle;
+	unqliteOsCloseFree(pPager->pAllocator,pFile);
+}
+/*
+ * Schedule the deletion of a side file. The file is deleted once the
+ * current transaction commits and kept if it rolls back.
+ */
+static int unqliteKvIoDropFile(unqlite_kv_handle pHandle,const char *zSuffix)
+{
+	Pager *pPager = (Pager *)pHandle;
+	char *zPath;
+	int rc;
+	if( pPager->is_mem || pPager->zFilename == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	zPath = pager_side_path(pPager,pPager->zFilename,zSuffix);
+	if( zPath == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	rc = SySetPut(&pPager->aDrop,(const void *)&zPath);
+	if( rc != SXRET_OK ){
+		SyMemBackendFree(pPager->pAllocator,zPath);
+		return UNQLITE_NOMEM;
+	}
+	return UNQLITE_OK;
+}
+/* 
+ * Set the commit callback.
+ * Refer to the declaration of the [Pager] structure
+ */
+static void unqliteKvIoSetCommit(unqlite_kv_handle pHandle,int (*xCommit)(unqlite_kv_engine *))
+{
+	Pager *pPager = (Pager *)pHandle;
+	pPager->xCommit = xCommit;
+}
+/*
+ * Set the engine fields kept when the engine is reset.
+ * Refer to the declaration of the [Pager] structure
+ */
+static void unqliteKvIoSetKeep(unqlite_kv_handle pHandle,void *pKeep,unsigned int nByte)
+{
+	Pager *pPager = (Pager *)pHandle;
+	pPager->pKvKeep = pKeep;
+	pPager->nKvKeep = (sxu32)nByte;
+}
+/*
+ * Refer to [unqlitePagerPrefetch()]
+ */
+static int unqliteKvIoPrefetch(unqlite_kv_handle pHandle,const pgno *aPage,int nPage,int bLoad)
+{
+	return unqlitePagerPrefetch((Pager *)pHandle,aPage,nPage,bLoad);
+}
+/*
+ * Copy the content of a page into zBuf[] (A full page). A cached page,
+ * possibly dirty, is copied. Any other page is read from the database file
+ * and decoded without entering the page cache, so that a scan of the whole
+ * image (Integrity check, vacuum) does not keep every page in memory.
+ */
+static int unqliteKvIoReadPage(unqlite_kv_handle pHandle,pgno iNum,unsigned char *zBuf)
+{
+	Pager *pPager = (Pager *)pHandle;
+	Page *pPage;
+	int rc;
+	rc = pager_shared_lock(pPager);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pPage = pager_fetch_page(pPager,iNum);
+	if( pPage ){
+		SyMemcpy((const void *)pPage->zData,(void *)zBuf,(sxu32)pPager->iPageSize);
+		return UNQLITE_OK;
+	}
+	if( pPager->is_mem || iNum >= pPager->dbSize ){
+		/* Page not yet on disk */
+		SyZero(zBuf,(sxu32)pPager->iPageSize);
+		return UNQLITE_OK;
+	}
+	pPager->sStats.nRead++;
+	if( pPager->sCodec.xDecode && iNum > 0 ){
+		/* Read the encoded image */
+		rc = unqliteOsRead(pPager->pfd,pPager->zCodecPage,pPager->iPageSize,iNum * pPager->iPageSize);
+		if( rc == UNQLITE_OK ){
+			rc = pager_codec_decode(pPager,iNum,pPager->zCodecPage,zBuf);
+		}
+	}else{
+		rc = unqliteOsRead(pPager->pfd,zBuf,pPager->iPageSize,iNum * pPager->iPageSize);
+		if( rc == UNQLITE_OK && iNum > 0 && pager_lz_page(zBuf,pPager->iPageSize) ){
+			/* Written by the built-in compressing codec */
+			SyMemcpy((const void *)zBuf,(void *)pPager->zCodecPage,(sxu32)pPager->iPageSize);
+			rc = pager_codec_decode(pPager,iNum,pPager->zCodecPage,zBuf);
+		}
+	}
+	return rc;
+}
+/*
+ * Same as unqliteKvIoReadPage() but safe to call from several threads while
+ * the handle is idle: the cache is only looked up, the file is read with
+ * positioned reads and zScratch[] (A full page) replaces the codec buffer.
+ * A custom codec may keep state from one page to the next, so this is
+ * refused when one is installed, as it is when the VFS cannot read from
+ * several threads.
+ */
+static int unqliteKvIoReadPageShared(unqlite_kv_handle pHandle,pgno iNum,unsigned char *zBuf,unsigned char *zScratch)
+{
+	Pager *pPager = (Pager *)pHandle;
+	Page *pPage;
+	int rc;
+	if( (pPager->sCodec.xDecode && pPager->sCodec.xDecode != pager_lz_decode) ||
+		pPager->pfd == 0 || pPager->pfd->pMethods->iVersion < 5 || pPager->pfd->pMethods->xReadAt == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	pPage = pager_fetch_page(pPager,iNum);
+	if( pPage ){
+		SyMemcpy((const void *)pPage->zData,(void *)zBuf,(sxu32)pPager->iPageSize);
+		return UNQLITE_OK;
+	}
+	if( pPager->is_mem || iNum >= pPager->dbSize ){
+		/* Page not yet on disk */
+		SyZero(zBuf,(sxu32)pPager->iPageSize);
+		return UNQLITE_OK;
+	}
+	rc = unqliteOsReadAt(pPager->pfd,zScratch,pPager->iPageSize,iNum * pPager->iPageSize);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( iNum < 1 ){
+		/* Database header */
+		SyMemcpy((const void *)zScratch,(void *)zBuf,(sxu32)pPager->iPageSize);
+		return UNQLITE_OK;
+	}
+	/* Pages that were not compressed are copied as is */
+	rc = pager_lz_decode(0,iNum,zScratch,zBuf,pPager->iPageSize);
+	return rc == UNQLITE_OK ? UNQLITE_OK : UNQLITE_CORRUPT;
+}
 /*
  * Init an instance of the [unqlite_kv_io] structure.
  */
@@ -58142,6 +64945,18 @@ static int pager_kv_io_init(Pager *pPager,unqlite_kv_methods *pMethods,unqlite_k
 	pIo->xSetReload = unqliteKvIoPageReload;
 
 	pIo->xErr = unqliteKvIoErr;
+	pIo->xDbSize = unqliteKvIoDbSize;
+	pIo->xTruncate = unqliteKvIoTruncate;
+	pIo->xUnpinAll = unqliteKvIoUnpinAll;
+
+	pIo->xOpenFile = unqliteKvIoOpenFile;
+	pIo->xCloseFile = unqliteKvIoCloseFile;
+	pIo->xDropFile = unqliteKvIoDropFile;
+	pIo->xSetCommit = unqliteKvIoSetCommit;
+	pIo->xPrefetch = unqliteKvIoPrefetch;
+	pIo->xRead = unqliteKvIoReadPage;
+	pIo->xReadShared = unqliteKvIoReadPageShared;
+	pIo->xSetKeep = unqliteKvIoSetKeep;
 
 	return UNQLITE_OK;
 }
@@ -393,6 +393,13 @@ typedef sxi64 unqlite_int64;
 #define UNQLITE_CONFIG_KV_ENGINE           4  /* ONE ARGUMENT: const char *zKvName */
 #define UNQLITE_CONFIG_DISABLE_AUTO_COMMIT 5  /* NO ARGUMENTS */
 #define UNQLITE_CONFIG_GET_KV_NAME         6  /* ONE ARGUMENT: const char **pzPtr */
+#define UNQLITE_CONFIG_PAGE_CODEC          7  /* ONE ARGUMENT: const unqlite_page_codec *pCodec */
+#define UNQLITE_CONFIG_PAGE_COMPRESS       8  /* ONE ARGUMENT: int bEnable */
+#define UNQLITE_CONFIG_CACHE_PAGES         9  /* TWO ARGUMENTS: int (*xPage)(pgno iPage,void *pUserData), void *pUserData */
+#define UNQLITE_CONFIG_CACHE_LOAD         10  /* TWO ARGUMENTS: const pgno *aPage, int nPage */
+#define UNQLITE_CONFIG_PAGER_STATS        11  /* TWO ARGUMENTS: unqlite_pager_stats *pStats, int bReset */
+#define UNQLITE_CONFIG_MEM_USED           12  /* ONE ARGUMENT: unqlite_int64 *pBytes */
+#define UNQLITE_CONFIG_PAGE_SIZE          13  /* ONE ARGUMENT: int iPageSize */
 /*
  * UnQLite/Jx9 Virtual Machine Configuration Commands.
  *
@@ -438,6 +445,35 @@ typedef sxi64 unqlite_int64;
  */
 #define UNQLITE_KV_CONFIG_HASH_FUNC  1 /* ONE ARGUMENT: unsigned int (*xHash)(const void *,unsigned int) */
 #define UNQLITE_KV_CONFIG_CMP_FUNC   2 /* ONE ARGUMENT: int (*xCmp)(const void *,const void *,unsigned int) */
+#define UNQLITE_KV_CONFIG_INTEGRITY_CHECK 3 /* THREE ARGUMENTS: int nThread, int (*xReport)(pgno iPage,const char *zReason,void *pUserData), void *pUserData */
+#define UNQLITE_KV_CONFIG_VACUUM          4 /* TWO ARGUMENTS: int nStep, unqlite_int64 *pRemaining */
+#define UNQLITE_KV_CONFIG_FREE_PAGES      5 /* TWO ARGUMENTS: unqlite_int64 *pCount, int *pPageSize */
+#define UNQLITE_KV_CONFIG_DEFER_SPLIT     6 /* ONE ARGUMENT: int bDefer */
+#define UNQLITE_KV_CONFIG_MAINTAIN        7 /* TWO ARGUMENTS: int nStep, unqlite_int64 *pRemaining */
+#define UNQLITE_KV_CONFIG_HASH_ID         8 /* ONE ARGUMENT: int iHashId (UNQLITE_KV_HASH_*) */
+#define UNQLITE_KV_CONFIG_BLOOM_REBUILD   9 /* TWO ARGUMENTS: int nBitsPerKey, unqlite_int64 *pKeys */
+#define UNQLITE_KV_CONFIG_VALUE_LOG      10 /* TWO ARGUMENTS: unqlite_int64 nThreshold, unqlite_int64 nSegmentSize */
+#define UNQLITE_KV_CONFIG_VALUE_LOG_GC   11 /* TWO ARGUMENTS: int nMinDeadPercent, unqlite_int64 *pReclaimed */
+#define UNQLITE_KV_CONFIG_COMPRESS      12 /* TWO ARGUMENTS: int iCodec (UNQLITE_KV_COMPRESS_*), unqlite_int64 nMinSize */
+#define UNQLITE_KV_CONFIG_WARMUP        13 /* TWO ARGUMENTS: int bAll, unqlite_int64 *pPages */
+#define UNQLITE_KV_CONFIG_STATS         14 /* TWO ARGUMENTS: unqlite_kv_stats *pStats, int bReset */
+#define UNQLITE_KV_CONFIG_ANALYZE       15 /* TWO ARGUMENTS: int nPercent, unqlite_kv_analysis *pInfo */
+#define UNQLITE_KV_CONFIG_PRESIZE       16 /* TWO ARGUMENTS: unqlite_int64 nRecord, unqlite_int64 nPayload */
+#define UNQLITE_KV_CONFIG_SIDE_FILES    17 /* TWO ARGUMENTS: int (*xFile)(void *,const char *zSuffix,unqlite_int64 nSize), void *pUserData */
+/*
+ * Built-in hash functions of the linear hash engine. The function a database
+ * was created with is recorded in its header and is used from then on.
+ * UNQLITE_KV_CONFIG_HASH_ID select the one used for a new database.
+ * Stock UnQLite only knows DJB and rejects a database created with MIX64.
+ */
+#define UNQLITE_KV_HASH_DJB   1 /* Byte-at-a-time DJB over the first 2KB of the key (Default) */
+#define UNQLITE_KV_HASH_MIX64 2 /* Word-at-a-time 64-bit mix over the whole key (Opt-in) */
+/*
+ * Value compression codecs (UNQLITE_KV_CONFIG_COMPRESS). The setting only
+ * affect the values stored afterward, compressed values are always readable.
+ */
+#define UNQLITE_KV_COMPRESS_NONE 0 /* Store the values as is (Default) */
+#define UNQLITE_KV_COMPRESS_LZ   1 /* Built-in LZ77 codec */
 /*
  * Global Library Configuration Commands.
  *
@@ -563,9 +599,26 @@ struct unqlite_file {
  * the file. The sector size is the minimum write that can be performed without
  * disturbing other bytes in the file.
  *
+ * The xAdvise() method (Version 2) tells the OS that the given range of the file
+ * is about to be read so that it can be brought into the OS cache ahead of time.
+ * It is only a hint, may be NULL and its return value is ignored.
+ *
+ * The xPunchHole() method (Version 3) releases the disk blocks backing the given
+ * range of the file, which then reads back as zeros. The file size is unchanged.
+ * It may be NULL and is used to free the unused tail of compressed page slots.
+ *
+ * The xMmap() method (Version 4) returns a read-only memory view of the first
+ * iSize bytes of the file and xUnmap() releases it. The view is obtained from
+ * the open file so that the locks held on it are kept. Both may be NULL, the
+ * pages are then read with xRead().
+ *
+ * The xReadAt() method (Version 5) reads like xRead() but may be called from
+ * several threads at once on the same file, the file offset is not used. It
+ * may be NULL, the integrity check then reads the pages from a single thread.
+ *
  */
 struct unqlite_io_methods {
-  int iVersion;                 /* Structure version number (currently 1) */
+  int iVersion;                 /* Structure version number (currently 5) */
   int (*xClose)(unqlite_file*);
   int (*xRead)(unqlite_file*, void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
   int (*xWrite)(unqlite_file*, const void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
@@ -576,6 +629,15 @@ struct unqlite_io_methods {
   int (*xUnlock)(unqlite_file*, int);
   int (*xCheckReservedLock)(unqlite_file*, int *pResOut);
   int (*xSectorSize)(unqlite_file*);
+  /* Methods above are valid for version 1 */
+  int (*xAdvise)(unqlite_file*, unqlite_int64 iOfst, unqlite_int64 iAmt); /* Read ahead hint (May be NULL) */
+  /* Methods above are valid for version 2 */
+  int (*xPunchHole)(unqlite_file*, unqlite_int64 iOfst, unqlite_int64 iAmt); /* Release the disk blocks of a range (May be NULL) */
+  /* Methods above are valid for version 3 */
+  int (*xMmap)(unqlite_file*, unqlite_int64 iSize, void **ppMap); /* Read-only memory view of the file (May be NULL) */
+  void (*xUnmap)(unqlite_file*, void *pMap, unqlite_int64 iSize); /* Release a memory view (May be NULL) */
+  /* Methods above are valid for version 4 */
+  int (*xReadAt)(unqlite_file*, void*, unqlite_int64 iAmt, unqlite_int64 iOfst); /* Thread safe xRead() (May be NULL) */
 };
 /*
  * CAPIREF: OS Interface Object
@@ -664,6 +726,107 @@ struct unqlite_page
   void *pUserData;            /* Extra content */
   pgno iPage;                 /* Page number for this page */
 };
+/*
+ * Page codec.
+ *
+ * An instance of the following structure can be installed on a database handle via
+ * [unqlite_config()] using the UNQLITE_CONFIG_PAGE_CODEC verb (The structure is copied,
+ * a NULL pointer remove the codec). Every page image the pager write to the database
+ * or journal file, except the database header (page 0), is passed through xEncode()
+ * and every page image read back is passed through xDecode().
+ * xEncode() store at most nPageSize bytes in zOut[] and set *pnOut to the number of
+ * bytes that must reach the disk. Only these bytes are written to the database file,
+ * the rest of the page slot is left as is.
+ * xDecode() is given the whole page slot and must rebuild exactly nPageSize bytes in zOut[].
+ * Pages read before the codec was installed (The storage engine header is read by
+ * [unqlite_open()]) or written without it are handed to xDecode() as well, so a codec
+ * must recognize its own images and copy any other page as is.
+ * Both methods must return UNQLITE_OK on success, any other return value is reported
+ * as an IO error.
+ * The built-in compressing codec is installed by the UNQLITE_CONFIG_PAGE_COMPRESS verb.
+ * Its pages are recognized on read whether the codec is installed or not.
+ */
+typedef struct unqlite_page_codec unqlite_page_codec;
+struct unqlite_page_codec
+{
+	const char *zName; /* Codec name */
+	int (*xEncode)(void *pCodecArg,pgno iPage,const unsigned char *zIn,unsigned char *zOut,int nPageSize,int *pnOut);
+	int (*xDecode)(void *pCodecArg,pgno iPage,const unsigned char *zIn,unsigned char *zOut,int nPageSize);
+	void *pCodecArg;   /* First argument to xEncode() and xDecode() */
+};
+/*
+ * Pager statistics.
+ *
+ * Filled by [unqlite_config()] using the UNQLITE_CONFIG_PAGER_STATS verb. The counters
+ * are plain increments on the handle and are zeroed when bReset is set, nCached
+ * reports the current state and is never reset. Taking a snapshot is cheap, the
+ * memory held by the handle is reported by UNQLITE_CONFIG_MEM_USED instead.
+ */
+typedef struct unqlite_pager_stats unqlite_pager_stats;
+struct unqlite_pager_stats
+{
+	unqlite_int64 nHit;       /* Page requests served by the page cache */
+	unqlite_int64 nMiss;      /* Page requests that had to load the page */
+	unqlite_int64 nEvict;     /* Pages dropped from the page cache */
+	unqlite_int64 nRead;      /* Pages read from the database file (Read ahead included) */
+	unqlite_int64 nPrefetch;  /* Pages loaded by read ahead */
+	unqlite_int64 nWrite;     /* Pages written to the database file */
+	unqlite_int64 nJournal;   /* Bytes written to the rollback journal */
+	unqlite_int64 nSync;      /* Sync requests on the database and journal files */
+	unqlite_int64 nCommit;    /* Transactions committed to the database file */
+	unqlite_int64 nCached;    /* Pages currently in the page cache */
+};
+/*
+ * Key/Value storage engine statistics.
+ *
+ * Filled by [unqlite_kv_config()] using the UNQLITE_KV_CONFIG_STATS verb. Counters are
+ * zeroed when bReset is set, nMemUsed is never reset. Engines that do not keep a
+ * counter leave it to zero.
+ */
+typedef struct unqlite_kv_stats unqlite_kv_stats;
+struct unqlite_kv_stats
+{
+	unqlite_int64 nSplit;     /* Bucket splits */
+	unqlite_int64 nSlave;     /* Slave (Overflowing bucket) pages created */
+	unqlite_int64 nOverflow;  /* Overflow pages created for large keys and values */
+	unqlite_int64 nInsert;    /* Cells (Records) created */
+	unqlite_int64 nDelete;    /* Cells (Records) removed */
+	unqlite_int64 nMemUsed;   /* Bytes currently held by the engine memory backend */
+};
+/*
+ * Layout of a Key/Value storage engine database.
+ *
+ * Filled by [unqlite_kv_config()] using the UNQLITE_KV_CONFIG_ANALYZE verb. Only a
+ * sample of the buckets may be walked (nSampled out of nReal), the counters then
+ * cover that sample only. Histograms use power of two classes: entry 0 counts
+ * the zero values and entry i (i > 0) the values in [2^(i-1), 2^i), except
+ * aChain[] which is indexed by the exact slave chain length (The last entry
+ * counts the longer chains) and aFill[] which is indexed by tenth of page used.
+ */
+#define UNQLITE_KV_ANALYZE_HIST 32
+typedef struct unqlite_kv_analysis unqlite_kv_analysis;
+struct unqlite_kv_analysis
+{
+	int iPageSize;            /* Database page size */
+	unqlite_int64 nPage;      /* Total number of pages in the database */
+	unqlite_int64 nLogic;     /* Logical buckets */
+	unqlite_int64 nReal;      /* Buckets with a master page */
+	unqlite_int64 nSampled;   /* Buckets walked */
+	unqlite_int64 nSlave;     /* Slave pages of the walked buckets */
+	unqlite_int64 nOverflow;  /* Overflow pages of the walked buckets */
+	unqlite_int64 nOvflBytes; /* Payload bytes stored on those overflow pages */
+	unqlite_int64 nOvflRoom;  /* Payload capacity of those overflow pages */
+	unqlite_int64 nCell;      /* Cells (Records) of the walked buckets */
+	unqlite_int64 nVlog;      /* Cells whose value is stored in the value log */
+	unqlite_int64 nLz;        /* Cells whose value is compressed */
+	unqlite_int64 nHashDup;   /* Cells whose hash value is shared with an earlier cell */
+	unqlite_int64 nFree;      /* Free bytes on the master and slave pages walked */
+	unqlite_int64 aCell[UNQLITE_KV_ANALYZE_HIST];  /* Buckets by number of cells */
+	unqlite_int64 aChain[UNQLITE_KV_ANALYZE_HIST]; /* Buckets by slave chain length */
+	unqlite_int64 aKey[UNQLITE_KV_ANALYZE_HIST];   /* Keys by size in bytes */
+	unqlite_int64 aData[UNQLITE_KV_ANALYZE_HIST];  /* Values by stored size in bytes */
+	unqlite_int64 aFill[10];  /* Master and slave pages by fill factor */
+};
 /*
  * UnQLite handle to the underlying Key/Value Storage Engine (See below).
  */
@@ -697,6 +860,18 @@ struct unqlite_kv_io
 	void (*xSetUnpin)(unqlite_kv_handle,void (*xPageUnpin)(void *)); 
 	void (*xSetReload)(unqlite_kv_handle,void (*xPageReload)(void *));
 	void (*xErr)(unqlite_kv_handle,const char *);
+	pgno (*xDbSize)(unqlite_kv_handle);
+	int (*xTruncate)(unqlite_kv_handle,pgno);
+	void (*xUnpinAll)(unqlite_kv_handle);
+	/* Side files: the database path followed by a suffix */
+	int (*xOpenFile)(unqlite_kv_handle,const char *zSuffix,int bCreate,unqlite_file **);
+	void (*xCloseFile)(unqlite_kv_handle,unqlite_file *);
+	int (*xDropFile)(unqlite_kv_handle,const char *zSuffix); /* Deleted once the transaction commits */
+	void (*xSetCommit)(unqlite_kv_handle,int (*xCommit)(unqlite_kv_engine *)); /* Called before the dirty pages are written */
+	int (*xPrefetch)(unqlite_kv_handle,const pgno *aPage,int nPage,int bLoad); /* Read ahead hint, bLoad to pull the pages into the cache */
+	int (*xRead)(unqlite_kv_handle,pgno,unsigned char *zBuf); /* Copy of a page, uncached pages do not enter the cache */
+	int (*xReadShared)(unqlite_kv_handle,pgno,unsigned char *zBuf,unsigned char *zScratch); /* xRead() for several threads while the handle is idle */
+	void (*xSetKeep)(unqlite_kv_handle,void *pKeep,unsigned int nByte); /* Engine fields kept when the pager resets the engine */
 };
 /*
  * Key/Value Storage Engine Cursor Object
@@ -779,6 +954,7 @@ struct unqlite_kv_methods
   int (*xData)(unqlite_kv_cursor *,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
   void (*xReset)(unqlite_kv_cursor *);
   void (*xCursorRelease)(unqlite_kv_cursor *);
+  int (*xDataRange)(unqlite_kv_cursor *,unqlite_int64 iOfft,unqlite_int64 nByte,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData); /* Optional */
 };
 /*
  * UnQLite journal file suffix.
@@ -786,6 +962,12 @@ struct unqlite_kv_methods
 #ifndef UNQLITE_JOURNAL_FILE_SUFFIX
 #define UNQLITE_JOURNAL_FILE_SUFFIX "_unqlite_journal"
 #endif
+/*
+ * Value log segment file suffix (Followed by the segment number).
+ */
+#ifndef UNQLITE_VLOG_FILE_SUFFIX
+#define UNQLITE_VLOG_FILE_SUFFIX "_unqlite_vlog"
+#endif
 /*
  * Call Context - Error Message Severity Level.
  *
@@ -841,6 +1023,7 @@ UNQLITE_APIEXPORT int unqlite_kv_cursor_prev_entry(unqlite_kv_cursor *pCursor);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_key(unqlite_kv_cursor *pCursor,void *pBuf,int *pnByte);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_key_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_data(unqlite_kv_cursor *pCursor,void *pBuf,unqlite_int64 *pnData);
+UNQLITE_APIEXPORT int unqlite_kv_cursor_data_read(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,void *pBuf,unqlite_int64 *pnData);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_data_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_delete_entry(unqlite_kv_cursor *pCursor);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_reset(unqlite_kv_cursor *pCursor);
@@ -856,6 +1039,11 @@ UNQLITE_APIEXPORT int unqlite_util_release_mmaped_file(void *pMap,unqlite_int64
 UNQLITE_APIEXPORT int unqlite_util_random_string(unqlite *pDb,char *zBuf,unsigned int buf_size);
 UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb);
 
+/* Online backup interfaces */
+UNQLITE_APIEXPORT int unqlite_backup_init(unqlite *pDb,const char *zDest);
+UNQLITE_APIEXPORT int unqlite_backup_step(unqlite *pDb,int nPage,unqlite_int64 *pRemaining,unqlite_int64 *pTotal);
+UNQLITE_APIEXPORT int unqlite_backup_finish(unqlite *pDb);
+
 /* In-process extending interfaces */
 UNQLITE_APIEXPORT int unqlite_create_function(unqlite_vm *pVm,const char *zName,int (*xFunc)(unqlite_context *,int,unqlite_value **),void *pUserData);
 UNQLITE_APIEXPORT int unqlite_delete_function(unqlite_vm *pVm, const char *zName);